@@ -0,0 +1,188 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file analyser.h
+ * Streaming analysis: decode each frame and reduce it to one scalar per
+ * frame metric (see frame_metric.h), without retaining the frame.
+ *-----------------------------------------------------------------------*/
+
+#include "lumin/decoder.h"
+#include "lumin/frame_metric.h"
+#include "lumin/metrics.h"
+#include "lumin/permutation.h"
+#include "lumin/pipeline.h"
+#include "lumin/series.h"
+
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace lumin
+{
+
+/**------------------------------------------------------------------------
+ * Error introduced by subsampling, estimated by also computing the
+ * metric from every pixel of the region on one frame in CHECK_INTERVAL.
+ * Frames between checks are never compared, so these are sampled
+ * estimates, not bounds: a frame with a larger error can go unseen.
+ *-----------------------------------------------------------------------*/
+class SamplingError
+{
+public:
+    static const size_t CHECK_INTERVAL = 64;
+
+    /**------------------------------------------------------------------------
+     * Record a checked frame. Safe to call from several threads.
+     *-----------------------------------------------------------------------*/
+    void add(double sampled, double full);
+
+    size_t get_frames_checked() const;
+
+    /**------------------------------------------------------------------------
+     * Largest and mean absolute error over the checked frames only.
+     *-----------------------------------------------------------------------*/
+    double get_observed_max_error() const;
+    double get_observed_mean_error() const;
+
+    /**------------------------------------------------------------------------
+     * Checked frames whose sampled value has a different order key under
+     * `options` than the full value, i.e. lands in another bucket at the
+     * chosen precision.
+     *-----------------------------------------------------------------------*/
+    size_t get_bucket_changes(const OrderOptions &options) const;
+
+private:
+    mutable std::mutex mutex;
+    std::vector<std::pair<double, double>> checks;
+};
+
+class AnalysisOptions
+{
+public:
+    /**------------------------------------------------------------------------
+     * Duration to crop to, in seconds, or 0 to analyse the whole stream.
+     *-----------------------------------------------------------------------*/
+    double duration = 0.0;
+
+    /**------------------------------------------------------------------------
+     * Name of the frame metric that analyse() returns the series of.
+     *-----------------------------------------------------------------------*/
+    std::string metric = "luma";
+
+    /**------------------------------------------------------------------------
+     * Further metrics to compute in the same decode pass and store in
+     * the luminance index beside `metric`, so that ordering by any of
+     * them later reads the index rather than decoding again. Metrics
+     * already in the index are kept whenever it is rewritten. Not
+     * computed by a proxy analysis.
+     *-----------------------------------------------------------------------*/
+    std::vector<std::string> extra_metrics;
+
+    /**------------------------------------------------------------------------
+     * The pixels each frame is reduced from: a region of interest, and a
+     * subsampling step within it. Other than the whole frame, every
+     * pixel, the luminance index is neither read nor written.
+     *-----------------------------------------------------------------------*/
+    FrameSampling sampling;
+
+    /**------------------------------------------------------------------------
+     * If set and `sampling` subsamples, filled with an estimate of the
+     * error this introduces in options.metric.
+     *-----------------------------------------------------------------------*/
+    SamplingError *sampling_error = nullptr;
+
+    /**------------------------------------------------------------------------
+     * Number of worker threads, or 0 for one per hardware thread. With
+     * more than one, the stream is split at keyframes into segments that
+     * are decoded and reduced concurrently. With 0, a stream decoded in
+     * hardware is decoded in one piece.
+     *-----------------------------------------------------------------------*/
+    int threads = 0;
+
+    /**------------------------------------------------------------------------
+     * Path of a luminance index (see sidecar.h), or empty to disable.
+     * If the index is valid for the source and holds every metric
+     * needed, analysis is skipped; otherwise the index is rewritten
+     * after analysis. Failure to write the index is not an error.
+     *-----------------------------------------------------------------------*/
+    std::string index_path;
+
+    /**------------------------------------------------------------------------
+     * Path of a packet index file (see sidecar.h), or empty to disable.
+     * Splitting the stream into segments and proxy refinement read the
+     * source's packet index from it, or write it there after a scan.
+     *-----------------------------------------------------------------------*/
+    std::string packet_index_path;
+
+    /**------------------------------------------------------------------------
+     * Identity of the source, if the caller already has it, which must
+     * outlive the call. Otherwise it is computed at most once, when a
+     * cache needs checking.
+     *-----------------------------------------------------------------------*/
+    const SourceKey *source_key = nullptr;
+
+    /**------------------------------------------------------------------------
+     * Analyse a proxy decode (see VideoDecoder) for a quick preview. A
+     * valid index is still used, but proxy results are never written to
+     * it.
+     *-----------------------------------------------------------------------*/
+    bool proxy = false;
+
+    /**------------------------------------------------------------------------
+     * In proxy mode, frames whose rough brightness is within
+     * `refine_margin` of a rounding boundary at this many decimal places
+     * are analysed again with a full decode, so that they are ordered
+     * into the same bucket as a full analysis. 0 disables refinement.
+     *-----------------------------------------------------------------------*/
+    int refine_decimal_places = 0;
+
+    /**------------------------------------------------------------------------
+     * Bound on the error of a proxy brightness value. Averaging is
+     * barely affected by reduced resolution, so this can be small.
+     *-----------------------------------------------------------------------*/
+    double refine_margin = 0.002;
+
+    /**------------------------------------------------------------------------
+     * Decode with a hardware decoder, falling back to software for
+     * streams it can't decode. With NVDEC, if built with the CUDA
+     * backend and luma of every pixel is the only metric, luma is reduced
+     * on the GPU, so that only one scalar per frame reaches the host.
+     * Other surfaces are mapped into host memory where the platform
+     * allows (VAAPI, VideoToolbox), so that metrics read their planes in
+     * place, and copied to it otherwise.
+     *-----------------------------------------------------------------------*/
+    HardwareDecode hardware = HARDWARE_DECODE_NONE;
+
+    /**------------------------------------------------------------------------
+     * If set, analysis is timed as the "analyse" phase, followed by
+     * "refine" for proxy refinement, and counts frames decoded, bytes
+     * read and seeks as it goes.
+     *-----------------------------------------------------------------------*/
+    Metrics *metrics = nullptr;
+
+    /**------------------------------------------------------------------------
+     * Path of a raw frame store (see frame_store.h), or empty to disable.
+     * If there isn't a complete store for the source, analysis decodes
+     * (even if the luminance index is valid) and writes one, so that
+     * later renders can read frames by index. Incompatible with `proxy`
+     * and an explicit `hardware` decoder; with HARDWARE_DECODE_AUTO, the
+     * store is written from a software decode.
+     *-----------------------------------------------------------------------*/
+    std::string frame_store_path;
+};
+
+/**------------------------------------------------------------------------
+ * Analyse the file at `path`, returning the value of options.metric for
+ * each frame, in [0..1].
+ *
+ * @param stages If given, timing of each pipeline stage is appended:
+ *               decode and reduce for a single stream, or one per
+ *               segment in parallel. Nothing is appended if the
+ *               luminance index was used.
+ *-----------------------------------------------------------------------*/
+LuminanceSeries analyse(const std::string &path,
+                        const AnalysisOptions &options = AnalysisOptions(),
+                        std::vector<StageStats> *stages = nullptr);
+
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file audio.h
+ * Decoded PCM audio, and reordering it by an edit decision list.
+ *-----------------------------------------------------------------------*/
+
+#include "lumin/edl.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace lumin
+{
+
+/**------------------------------------------------------------------------
+ * Interleaved 32-bit float PCM, read by position.
+ *-----------------------------------------------------------------------*/
+class AudioSource
+{
+public:
+    virtual ~AudioSource();
+
+    virtual int get_sample_rate() const = 0;
+    virtual int get_channels() const = 0;
+
+    /**------------------------------------------------------------------------
+     * Number of sample frames (samples per channel).
+     *-----------------------------------------------------------------------*/
+    virtual size_t get_sample_count() const = 0;
+
+    /**------------------------------------------------------------------------
+     * Copy sample frames [position, position + count), which must lie
+     * within the source, to `output`.
+     *-----------------------------------------------------------------------*/
+    virtual void read(size_t position, size_t count, float *output) const = 0;
+
+    bool empty() const;
+
+    /**------------------------------------------------------------------------
+     * Index of the first sample frame of video frame `frame`, at frame
+     * rate `frame_rate`. Exact for non-integer rates such as 30000/1001.
+     *-----------------------------------------------------------------------*/
+    size_t get_sample_position(int64_t frame, Rational frame_rate) const;
+};
+
+/**------------------------------------------------------------------------
+ * PCM held in memory.
+ *-----------------------------------------------------------------------*/
+class AudioBuffer : public AudioSource
+{
+public:
+    AudioBuffer();
+    AudioBuffer(int sample_rate, int channels, std::vector<float> samples = {});
+
+    int get_sample_rate() const override;
+    int get_channels() const override;
+    size_t get_sample_count() const override;
+    void read(size_t position, size_t count, float *output) const override;
+
+    const std::vector<float> &get_samples() const;
+    std::vector<float> &get_samples();
+
+private:
+    int sample_rate;
+    int channels;
+    std::vector<float> samples;
+};
+
+/**------------------------------------------------------------------------
+ * PCM in an unlinked temporary file, appended to in order and then read
+ * back by position, for soundtracks too long to hold in memory.
+ *-----------------------------------------------------------------------*/
+class AudioFile : public AudioSource
+{
+public:
+    /**------------------------------------------------------------------------
+     * Create the file in `directory` ($TMPDIR, or /tmp, if empty).
+     * Throws io_exception if it can't be created.
+     *-----------------------------------------------------------------------*/
+    AudioFile(int sample_rate, int channels, const std::string &directory = "");
+    ~AudioFile();
+
+    AudioFile(const AudioFile &) = delete;
+    AudioFile &operator=(const AudioFile &) = delete;
+
+    int get_sample_rate() const override;
+    int get_channels() const override;
+    size_t get_sample_count() const override;
+    void read(size_t position, size_t count, float *output) const override;
+
+    /**------------------------------------------------------------------------
+     * Append `count` interleaved sample frames. Throws io_exception if
+     * the file can't be written.
+     *-----------------------------------------------------------------------*/
+    void append(const float *samples, size_t count);
+
+private:
+    int sample_rate;
+    int channels;
+    int fd;
+    size_t sample_count;
+};
+
+/**------------------------------------------------------------------------
+ * `source` reordered by `edl`, with the audio under each run copied in
+ * one block so that it stays in sync with the reordered video. Samples
+ * are produced as they are read, so neither soundtrack need be held in
+ * memory; reads are cheapest in destination order.
+ *-----------------------------------------------------------------------*/
+class RemappedAudio : public AudioSource
+{
+public:
+    /**------------------------------------------------------------------------
+     * @param source    Must outlive this, as must `edl`.
+     * @param crossfade Seconds over which to fade from the audio that
+     *                  followed the previous run into each new run, to
+     *                  avoid clicks at cuts. 0 for hard cuts.
+     *-----------------------------------------------------------------------*/
+    RemappedAudio(const AudioSource &source, const EditDecisionList &edl, double crossfade = 0.0);
+
+    int get_sample_rate() const override;
+    int get_channels() const override;
+    size_t get_sample_count() const override;
+    void read(size_t position, size_t count, float *output) const override;
+
+private:
+    /**------------------------------------------------------------------------
+     * Source start and length in sample frames of run `index`.
+     *-----------------------------------------------------------------------*/
+    void get_run_samples(size_t index, size_t &source_start, size_t &length) const;
+
+    const AudioSource &source;
+    const EditDecisionList &edl;
+    size_t sample_count;
+    size_t fade_count;
+};
+
+/**------------------------------------------------------------------------
+ * Reorder `source` by `edl` into memory (see RemappedAudio).
+ *-----------------------------------------------------------------------*/
+AudioBuffer remap_audio(const AudioSource &source, const EditDecisionList &edl, double crossfade = 0.0);
+
+}
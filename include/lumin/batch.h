@@ -0,0 +1,83 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file batch.h
+ * Render many outputs in one process: each distinct input is analysed
+ * once, and every job ordering it shares that luminance series. Renders
+ * are then spread across a pool of worker threads.
+ *-----------------------------------------------------------------------*/
+
+#include "lumin/analyser.h"
+#include "lumin/metrics.h"
+#include "lumin/permutation.h"
+#include "lumin/renderer.h"
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace lumin
+{
+
+class BatchJob
+{
+public:
+    std::string input;
+    std::string output;
+    AnalysisOptions analysis;
+    OrderOptions order;
+    RenderOptions render;
+};
+
+class BatchResult
+{
+public:
+    bool succeeded = false;
+
+    /**------------------------------------------------------------------------
+     * Why the job failed, if it did.
+     *-----------------------------------------------------------------------*/
+    std::string error;
+
+    RenderStats stats;
+    size_t runs = 0;
+    double seconds = 0.0;
+};
+
+class BatchOptions
+{
+public:
+    /**------------------------------------------------------------------------
+     * Renders to run at once, or 0 for a quarter of the hardware threads,
+     * since each render decodes and encodes on several threads itself.
+     * Encoders are limited to their share of the hardware threads unless
+     * a job sets its own "threads" codec option.
+     *-----------------------------------------------------------------------*/
+    int workers = 0;
+
+    /**------------------------------------------------------------------------
+     * Called as each job finishes, with its index in the batch. Calls
+     * are serialised, but may come from any worker.
+     *-----------------------------------------------------------------------*/
+    std::function<void(size_t job, const BatchResult &result)> completed;
+
+    /**------------------------------------------------------------------------
+     * If set, timed as an "analyse" phase with inputs as progress, then
+     * a "render" phase with jobs as progress. Jobs' own metrics are
+     * ignored, as concurrent renders can't share phases.
+     *-----------------------------------------------------------------------*/
+    Metrics *metrics = nullptr;
+};
+
+/**------------------------------------------------------------------------
+ * Run every job, returning one result each, in job order. A job that
+ * fails doesn't stop the others. Jobs share an analysis if they have the
+ * same input and analysis options that give the same values; it then
+ * computes every extra metric and writes the frame store any of them
+ * asks for. Jobs naming different frame stores are analysed apart.
+ *-----------------------------------------------------------------------*/
+std::vector<BatchResult> render_batch(const std::vector<BatchJob> &jobs,
+                                      const BatchOptions &options = BatchOptions());
+
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file chunks.h
+ * Chunked rendering: the output is cut into fixed runs of destination
+ * frames, each rendered and encoded on its own by a pool of workers, or
+ * by other machines sharing the chunk directory. Each chunk starts a new
+ * GOP. A marker written beside each finished chunk records what it was
+ * rendered from, so an interrupted render resumes from the chunks
+ * already complete. Once every chunk is complete, they are joined into
+ * the output by stream copy, with the soundtrack encoded across the
+ * whole output in the same pass.
+ *
+ * Layout of the chunk directory:
+ *   chunk-000000.ext       chunk 0, in the output's container
+ *   chunk-000000.done      its completion marker
+ *   ...
+ *-----------------------------------------------------------------------*/
+
+#include "lumin/edl.h"
+#include "lumin/renderer.h"
+
+#include <string>
+
+namespace lumin
+{
+
+/**------------------------------------------------------------------------
+ * Render `edl` in chunks of options.chunk_frames destination frames,
+ * rounded up to a multiple of the encoder's GOP size if it has a fixed
+ * one ("g"). Encodes this shard's incomplete chunks, then joins every
+ * chunk into `output` if all are complete and no other shard has begun
+ * to, removing the chunk directory.
+ * render() calls this when options.chunk_frames is set.
+ *-----------------------------------------------------------------------*/
+RenderStats render_chunked(const std::string &input,
+                           const std::string &output,
+                           const EditDecisionList &edl,
+                           const RenderOptions &options);
+
+}
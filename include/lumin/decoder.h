@@ -0,0 +1,254 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file decoder.h
+ * Thin wrapper around libavformat/libavcodec for sequential decode of
+ * the best video stream in a file, in software or with a hardware
+ * decoder.
+ *-----------------------------------------------------------------------*/
+
+#include "lumin/audio.h"
+#include "lumin/metrics.h"
+#include "lumin/packet_index.h"
+#include "lumin/rational.h"
+#include "lumin/sidecar.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+extern "C"
+{
+struct AVFormatContext;
+struct AVIOContext;
+struct AVCodecContext;
+struct AVPacket;
+struct AVFrame;
+struct SwsContext;
+}
+
+namespace lumin
+{
+
+class ReadAheadFile;
+class ReadAheadCursor;
+
+/**------------------------------------------------------------------------
+ * Hardware decoders. A stream that the chosen decoder can't decode,
+ * because its device can't be opened or doesn't support the codec or
+ * profile, is decoded in software instead.
+ *-----------------------------------------------------------------------*/
+enum HardwareDecode
+{
+    HARDWARE_DECODE_NONE,
+
+    /**------------------------------------------------------------------------
+     * The first of the platform's decoders that opens and supports the
+     * codec: VideoToolbox on macOS, otherwise NVDEC then VAAPI.
+     *-----------------------------------------------------------------------*/
+    HARDWARE_DECODE_AUTO,
+
+    HARDWARE_DECODE_CUDA,
+    HARDWARE_DECODE_VAAPI,
+    HARDWARE_DECODE_VIDEOTOOLBOX
+};
+
+/**------------------------------------------------------------------------
+ * Name of a hardware decoder, as on the command line: "none", "auto",
+ * "cuda", "vaapi" or "videotoolbox".
+ *-----------------------------------------------------------------------*/
+const char *get_hardware_decode_name(HardwareDecode hardware);
+
+class DecoderOptions
+{
+public:
+    /**------------------------------------------------------------------------
+     * Decoder threads, or 0 to let libavcodec decide.
+     *-----------------------------------------------------------------------*/
+    int threads = 0;
+
+    /**------------------------------------------------------------------------
+     * Decode a rough approximation, quickly: at the lowest resolution the
+     * decoder supports (lowres: MPEG-2, MJPEG and other DCT codecs),
+     * without the loop filter, and with non-compliant speedups allowed.
+     *-----------------------------------------------------------------------*/
+    bool proxy = false;
+
+    /**------------------------------------------------------------------------
+     * Decode with a hardware decoder, leaving frames in device memory as
+     * hardware surfaces (e.g. AV_PIX_FMT_CUDA). For NVDEC, the device's
+     * primary CUDA context is used, so CUDA runtime kernels can read
+     * the surfaces directly.
+     *-----------------------------------------------------------------------*/
+    HardwareDecode hardware = HARDWARE_DECODE_NONE;
+
+    /**------------------------------------------------------------------------
+     * Copy hardware frames back to host memory before returning them, in
+     * the format given by get_pixel_format(), so that callers only ever
+     * see software frames.
+     *-----------------------------------------------------------------------*/
+    bool download = false;
+
+    /**------------------------------------------------------------------------
+     * Surfaces to allocate beyond the decoder's own needs, for callers
+     * that hold references to decoded hardware frames.
+     *-----------------------------------------------------------------------*/
+    int extra_hw_frames = 0;
+
+    /**------------------------------------------------------------------------
+     * If set, read the file through this read-ahead cache, which must be
+     * of the same path and outlive the decoder, rather than through
+     * libavformat's own I/O. Several decoders may share one.
+     *-----------------------------------------------------------------------*/
+    ReadAheadFile *read_ahead = nullptr;
+
+    /**------------------------------------------------------------------------
+     * If set, counts the frames decoded, bytes demuxed, seeks made and
+     * corrupt packets skipped.
+     *-----------------------------------------------------------------------*/
+    Metrics *metrics = nullptr;
+};
+
+class VideoDecoder
+{
+public:
+    /**------------------------------------------------------------------------
+     * Open `path` and prepare a decoder for its best video stream.
+     * Throws io_exception or decode_exception on failure.
+     *-----------------------------------------------------------------------*/
+    VideoDecoder(const std::string &path, const DecoderOptions &options = DecoderOptions());
+    ~VideoDecoder();
+
+    VideoDecoder(const VideoDecoder &) = delete;
+    VideoDecoder &operator=(const VideoDecoder &) = delete;
+
+    /**------------------------------------------------------------------------
+     * Decode the next frame, in presentation order.
+     * Returns nullptr at end of stream. The frame is owned by the decoder
+     * and remains valid until the next call.
+     *-----------------------------------------------------------------------*/
+    AVFrame *read_frame();
+
+    /**------------------------------------------------------------------------
+     * Seek to the last keyframe at or before `pts`, in stream time base
+     * units. Frames before `pts` will still be returned by read_frame().
+     *-----------------------------------------------------------------------*/
+    void seek(int64_t pts);
+
+    /**------------------------------------------------------------------------
+     * Presentation timestamp of a frame returned by read_frame(), in
+     * stream time base units.
+     *-----------------------------------------------------------------------*/
+    int64_t get_timestamp(const AVFrame *frame) const;
+
+    Rational get_time_base() const;
+
+    /**------------------------------------------------------------------------
+     * Nominal frame rate of the stream, in frames/sec, exactly as the
+     * container gives it (e.g. 30000/1001).
+     *-----------------------------------------------------------------------*/
+    Rational get_frame_rate() const;
+
+    /**------------------------------------------------------------------------
+     * Duration of the stream in seconds, or 0 if unknown.
+     *-----------------------------------------------------------------------*/
+    double get_duration() const;
+
+    /**------------------------------------------------------------------------
+     * Dimensions of decoded frames, which are reduced in proxy mode.
+     *-----------------------------------------------------------------------*/
+    int get_width() const;
+    int get_height() const;
+
+    /**------------------------------------------------------------------------
+     * AVPixelFormat of decoded frames, or of their contents for hardware
+     * frames. Downloaded hardware frames are always in the stream's own
+     * software format.
+     *-----------------------------------------------------------------------*/
+    int get_pixel_format() const;
+
+    /**------------------------------------------------------------------------
+     * Hardware decoder in use, or HARDWARE_DECODE_NONE in software. Until
+     * the first frame is decoded, this is the decoder whose device was
+     * opened, which may yet find it can't decode the stream's profile.
+     *-----------------------------------------------------------------------*/
+    HardwareDecode get_hardware() const;
+
+    /**------------------------------------------------------------------------
+     * Change DecoderOptions::extra_hw_frames, for callers that size it by
+     * the frame dimensions. Surfaces are allocated at the first decode, so
+     * this throws invalid_argument_exception once a frame has been read.
+     *-----------------------------------------------------------------------*/
+    void set_extra_hw_frames(int count);
+
+private:
+    bool receive_frame();
+    AVFrame *download_frame();
+    void close_input();
+
+    AVFormatContext *format_context;
+
+    /**------------------------------------------------------------------------
+     * For `read_ahead`: the custom I/O context and its position.
+     *-----------------------------------------------------------------------*/
+    AVIOContext *io_context;
+    std::unique_ptr<ReadAheadCursor> cursor;
+
+    AVCodecContext *codec_context;
+    AVPacket *packet;
+    AVFrame *frame;
+    int stream_index;
+
+    /**------------------------------------------------------------------------
+     * Whether `packet` is still to be sent, the decoder having had no
+     * room for it until its output was received.
+     *-----------------------------------------------------------------------*/
+    bool packet_pending;
+    bool flushing;
+    bool finished;
+    Metrics *metrics;
+    HardwareDecode hardware;
+
+    /**------------------------------------------------------------------------
+     * Surface format of the hardware decoder, reset to AV_PIX_FMT_NONE if
+     * the stream falls back to software.
+     *-----------------------------------------------------------------------*/
+    int hardware_format;
+
+    /**------------------------------------------------------------------------
+     * For `download`: the stream's software format, the download of the
+     * last frame, and its conversion if the device couldn't download to
+     * that format directly.
+     *-----------------------------------------------------------------------*/
+    bool download;
+    int software_format;
+    bool convert_download;
+    AVFrame *downloaded;
+    AVFrame *converted;
+    SwsContext *sws_context;
+};
+
+/**------------------------------------------------------------------------
+ * Scan the packets of the best video stream in `path` without decoding.
+ *-----------------------------------------------------------------------*/
+PacketIndex index_packets(const std::string &path);
+
+/**------------------------------------------------------------------------
+ * The packet index of `path`, read from the packet index file at
+ * `cache_path` (see sidecar.h) if it was built from the file as it is
+ * now. Otherwise the file is indexed by index_packets() and the result
+ * written to `cache_path`; failure to write it is not an error. With no
+ * `cache_path`, the same as index_packets(). `key` identifies the file
+ * if the caller already has it; otherwise it is computed here.
+ *-----------------------------------------------------------------------*/
+PacketIndex load_packet_index(const std::string &path, const std::string &cache_path, const SourceKey *key = nullptr);
+
+/**------------------------------------------------------------------------
+ * Decode the whole of the best audio stream in `path` to interleaved
+ * float PCM, at its own sample rate and channel count, in a temporary
+ * file in `directory` (see AudioFile). Returns nullptr if there is no
+ * audio stream.
+ *-----------------------------------------------------------------------*/
+std::unique_ptr<AudioFile> decode_audio(const std::string &path, const std::string &directory = "");
+
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file edl.h
+ * Edit decision list: the reorder permutation collapsed into maximal
+ * runs of consecutive source frames. Renderers decode sequentially
+ * within a run and only seek at run boundaries.
+ *-----------------------------------------------------------------------*/
+
+#include "lumin/permutation.h"
+#include "lumin/rational.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace lumin
+{
+
+/**------------------------------------------------------------------------
+ * Source frames [source_start, source_start + length) are shown at
+ * destination frames [dest_start, dest_start + length).
+ *-----------------------------------------------------------------------*/
+class EditRun
+{
+public:
+    uint32_t source_start;
+    uint32_t length;
+    uint32_t dest_start;
+
+    uint32_t get_source_end() const
+    {
+        return source_start + length;
+    }
+
+    uint32_t get_dest_end() const
+    {
+        return dest_start + length;
+    }
+};
+
+class EditDecisionList
+{
+public:
+    EditDecisionList();
+
+    /**------------------------------------------------------------------------
+     * @param runs Runs in destination order, contiguous from frame 0.
+     *-----------------------------------------------------------------------*/
+    EditDecisionList(Rational frame_rate, std::vector<EditRun> runs);
+
+    /**------------------------------------------------------------------------
+     * Collapse `permutation` into maximal runs of consecutive frames.
+     *-----------------------------------------------------------------------*/
+    static EditDecisionList from_permutation(const Permutation &permutation);
+
+    /**------------------------------------------------------------------------
+     * Expand back to a per-frame permutation.
+     *-----------------------------------------------------------------------*/
+    Permutation to_permutation() const;
+
+    Rational get_frame_rate() const;
+
+    /**------------------------------------------------------------------------
+     * Total number of destination frames.
+     *-----------------------------------------------------------------------*/
+    size_t get_frame_count() const;
+
+    /**------------------------------------------------------------------------
+     * Number of runs, which is the number of seeks needed to render.
+     *-----------------------------------------------------------------------*/
+    size_t size() const;
+
+    const std::vector<EditRun> &get_runs() const;
+
+    /**------------------------------------------------------------------------
+     * Index of the run containing destination frame `dest_frame`.
+     *-----------------------------------------------------------------------*/
+    size_t find_run(size_t dest_frame) const;
+
+    /**------------------------------------------------------------------------
+     * One past the highest source frame shown.
+     *-----------------------------------------------------------------------*/
+    size_t get_source_end() const;
+
+    /**------------------------------------------------------------------------
+     * The EDL of destination frames [dest_start, dest_end), renumbered
+     * from destination frame 0, with runs cut at the bounds.
+     *-----------------------------------------------------------------------*/
+    EditDecisionList slice(size_t dest_start, size_t dest_end) const;
+
+private:
+    Rational frame_rate;
+    std::vector<EditRun> runs;
+    size_t frame_count;
+};
+
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file encoder.h
+ * Encodes and muxes a video stream, and optionally a soundtrack, with
+ * libavcodec/libavformat.
+ *-----------------------------------------------------------------------*/
+
+#include "lumin/audio.h"
+#include "lumin/metrics.h"
+#include "lumin/rational.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+struct AVFormatContext;
+struct AVCodecContext;
+struct AVCodecParameters;
+struct AVStream;
+struct AVPacket;
+struct AVFrame;
+struct AVBufferRef;
+struct SwsContext;
+}
+
+namespace lumin
+{
+
+class EncoderOptions
+{
+public:
+    /**------------------------------------------------------------------------
+     * libavcodec encoder name.
+     *-----------------------------------------------------------------------*/
+    std::string codec = "libx264";
+
+    /**------------------------------------------------------------------------
+     * Target bit rate in bits/sec, or 0 to leave rate control to
+     * `codec_options` (e.g. crf).
+     *-----------------------------------------------------------------------*/
+    int64_t bit_rate = 0;
+
+    /**------------------------------------------------------------------------
+     * Private options passed to the encoder, e.g. { "preset", "fast" }.
+     *-----------------------------------------------------------------------*/
+    std::map<std::string, std::string> codec_options = { { "crf", "18" } };
+
+    /**------------------------------------------------------------------------
+     * libavcodec encoder name for the soundtrack, if there is one.
+     *-----------------------------------------------------------------------*/
+    std::string audio_codec = "aac";
+
+    int64_t audio_bit_rate = 192000;
+
+    /**------------------------------------------------------------------------
+     * If set, counts the frames encoded and bytes muxed.
+     *-----------------------------------------------------------------------*/
+    Metrics *metrics = nullptr;
+};
+
+class VideoEncoder
+{
+public:
+    /**------------------------------------------------------------------------
+     * Create `path` (container chosen by extension) with one video stream,
+     * and an audio stream if `audio` is given and not empty.
+     *
+     * @param pixel_format AVPixelFormat of the frames that will be written.
+     *                     If the encoder doesn't accept it, frames are
+     *                     converted to the encoder's preferred format.
+     * @param audio        Soundtrack, which is read in order and
+     *                     interleaved with the video as frames are
+     *                     written. Must outlive the encoder.
+     * @param hw_frames_context
+     *                     If set, frames are hardware surfaces from this
+     *                     frames context (pixel_format AV_PIX_FMT_CUDA,
+     *                     say), passed to the encoder without download.
+     *                     The encoder must accept that format.
+     *-----------------------------------------------------------------------*/
+    VideoEncoder(const std::string &path,
+                 int width,
+                 int height,
+                 int pixel_format,
+                 Rational frame_rate,
+                 const EncoderOptions &options = EncoderOptions(),
+                 const AudioSource *audio = nullptr,
+                 AVBufferRef *hw_frames_context = nullptr);
+
+    /**------------------------------------------------------------------------
+     * Create `path` with a video stream of already-compressed packets,
+     * described by `parameters`, which are copied in by write_packet()
+     * rather than encoded. The soundtrack is encoded as usual.
+     *-----------------------------------------------------------------------*/
+    VideoEncoder(const std::string &path,
+                 const AVCodecParameters *parameters,
+                 Rational frame_rate,
+                 const EncoderOptions &options = EncoderOptions(),
+                 const AudioSource *audio = nullptr);
+    ~VideoEncoder();
+
+    VideoEncoder(const VideoEncoder &) = delete;
+    VideoEncoder &operator=(const VideoEncoder &) = delete;
+
+    /**------------------------------------------------------------------------
+     * Encode `frame` as the next output frame. Timestamps are assigned
+     * sequentially; the frame's own pts is ignored. If `frame` is
+     * reference-counted and in the encoder's pixel format, the encoder
+     * takes a reference to its buffers rather than a copy.
+     *-----------------------------------------------------------------------*/
+    void write_frame(const AVFrame *frame);
+
+    /**------------------------------------------------------------------------
+     * Copy `packet`, with timestamps in `time_base`, as the next output
+     * frame, for an encoder created from codec parameters. The packet is
+     * consumed. Packets must be in decode order.
+     *-----------------------------------------------------------------------*/
+    void write_packet(AVPacket *packet, Rational time_base);
+
+    /**------------------------------------------------------------------------
+     * Flush the encoder and write the container trailer.
+     *-----------------------------------------------------------------------*/
+    void finish();
+
+    /**------------------------------------------------------------------------
+     * Number of frames written so far.
+     *-----------------------------------------------------------------------*/
+    int64_t get_frame_count() const;
+
+private:
+    void open(const std::string &path, const EncoderOptions &options);
+    void open_audio(const EncoderOptions &options);
+    void write_audio(size_t sample_end);
+    void encode(AVCodecContext *context, AVStream *stream, const AVFrame *frame);
+    void close();
+
+    AVFormatContext *format_context;
+    AVCodecContext *codec_context;
+    AVStream *stream;
+    AVPacket *packet;
+    AVFrame *converted;
+    AVFrame *stamped;
+    SwsContext *sws_context;
+    int input_format;
+    Rational frame_rate;
+    int64_t next_pts;
+    bool finished;
+    Metrics *metrics;
+
+    const AudioSource *audio;
+    AVCodecContext *audio_codec_context;
+    AVStream *audio_stream;
+    AVFrame *audio_frame;
+    std::vector<float> audio_samples;
+    size_t audio_position;
+};
+
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file exceptions.h
+ * Exceptions thrown by the lumin engine.
+ *-----------------------------------------------------------------------*/
+
+#include <stdexcept>
+#include <string>
+
+namespace lumin
+{
+
+/**------------------------------------------------------------------------
+ * A media file could not be opened, probed or read.
+ *-----------------------------------------------------------------------*/
+class io_exception : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+/**------------------------------------------------------------------------
+ * The decoder failed, or the stream is in a format we cannot reduce.
+ *-----------------------------------------------------------------------*/
+class decode_exception : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+/**------------------------------------------------------------------------
+ * An argument passed to the engine was out of range or inconsistent.
+ *-----------------------------------------------------------------------*/
+class invalid_argument_exception : public std::invalid_argument
+{
+public:
+    using std::invalid_argument::invalid_argument;
+};
+
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file frame_cache.h
+ * LRU cache of decoded source frames within a byte budget, backed by a
+ * FramePool so that steady-state caching does no allocation.
+ *-----------------------------------------------------------------------*/
+
+#include "lumin/frame_pool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+
+extern "C"
+{
+struct AVFrame;
+}
+
+namespace lumin
+{
+
+class CacheStats
+{
+public:
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t insertions = 0;
+    uint64_t evictions = 0;
+
+    double get_hit_rate() const
+    {
+        return hits + misses ? (double) hits / (hits + misses) : 0.0;
+    }
+};
+
+class FrameCache
+{
+public:
+    /**------------------------------------------------------------------------
+     * Cache as many frames of the given size and format as fit in
+     * `byte_budget`, and at least one.
+     *-----------------------------------------------------------------------*/
+    FrameCache(size_t byte_budget, int width, int height, int pixel_format);
+
+    /**------------------------------------------------------------------------
+     * Look up source frame `frame_index`, marking it most recently used.
+     * Returns nullptr on a miss. The frame is valid until the next insert().
+     *-----------------------------------------------------------------------*/
+    const AVFrame *get(uint32_t frame_index);
+
+    /**------------------------------------------------------------------------
+     * Copy `frame` into the cache as `frame_index`, evicting the least
+     * recently used frame if the cache is full. Returns the cached copy.
+     *-----------------------------------------------------------------------*/
+    const AVFrame *insert(uint32_t frame_index, const AVFrame *frame);
+
+    bool contains(uint32_t frame_index) const;
+
+    /**------------------------------------------------------------------------
+     * Maximum number of frames held.
+     *-----------------------------------------------------------------------*/
+    size_t get_capacity() const;
+
+    size_t size() const;
+
+    CacheStats get_stats() const;
+
+    /**------------------------------------------------------------------------
+     * Copy the timing and colour properties of `src` to `dst`, without
+     * allocating.
+     *-----------------------------------------------------------------------*/
+    static void copy_props(AVFrame *dst, const AVFrame *src);
+
+private:
+    class Entry
+    {
+    public:
+        AVFrame *frame;
+        std::list<uint32_t>::iterator position;
+    };
+
+    FramePool pool;
+    std::list<uint32_t> recency;
+    std::unordered_map<uint32_t, Entry> entries;
+    CacheStats stats;
+};
+
+}
@@ -0,0 +1,233 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file frame_metric.h
+ * Frame metrics: the per-frame scalars that frames can be ordered by.
+ * Metrics are registered by name, and analysis computes any number of
+ * them in a single decode pass. Each decoded frame is wrapped in a
+ * MetricFrame, which converts it to the planes the metrics read (luma,
+ * RGB24) at most once, however many metrics read them. A FrameSampling
+ * limits the planes to a region of interest, and to a subsample of its
+ * pixels, so that the rest of the frame is never read or converted.
+ *
+ * Built-in metrics, each in [0..1]:
+ *   luma        Mean of the Y plane, normalised for the colour range
+ *   rgb         Mean over RGB24 channels, as np.mean(frame) / 255.0
+ *   rec709      Mean of Rec.709-weighted R'G'B' (perceptual luma)
+ *   contrast    Standard deviation of luma, doubled
+ *   saturation  Mean HSV saturation
+ *   hue         Hue of the mean colour, as a fraction of the colour
+ *               wheel from red, or 0 for grey frames
+ *-----------------------------------------------------------------------*/
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+struct AVFrame;
+}
+
+namespace lumin
+{
+
+class ConvertedFrame;
+
+/**------------------------------------------------------------------------
+ * The pixels of each frame that metrics see.
+ *-----------------------------------------------------------------------*/
+class FrameSampling
+{
+public:
+    /**------------------------------------------------------------------------
+     * Region of interest, as fractions of the frame's width and height,
+     * e.g. 0, 0.125, 1, 0.75 to skip 2.39:1 letterboxing in a 16:9 frame.
+     *-----------------------------------------------------------------------*/
+    double left = 0.0;
+    double top = 0.0;
+    double width = 1.0;
+    double height = 1.0;
+
+    /**------------------------------------------------------------------------
+     * Read every `step`-th pixel of every `step`-th row of the region:
+     * 1 in step² pixels.
+     *-----------------------------------------------------------------------*/
+    int step = 1;
+
+    bool is_whole_frame() const;
+
+    /**------------------------------------------------------------------------
+     * True for the whole frame with every pixel read.
+     *-----------------------------------------------------------------------*/
+    bool is_default() const;
+
+    /**------------------------------------------------------------------------
+     * Throws invalid_argument_exception if the region isn't a non-empty
+     * part of the frame or the step isn't positive.
+     *-----------------------------------------------------------------------*/
+    void validate() const;
+};
+
+/**------------------------------------------------------------------------
+ * The sampled pixels of an 8-bit image plane, valid until the
+ * MetricFrame it came from moves to the next frame.
+ *-----------------------------------------------------------------------*/
+class FramePlane
+{
+public:
+    const uint8_t *data = nullptr;
+
+    /**------------------------------------------------------------------------
+     * Bytes from one sampled row to the next.
+     *-----------------------------------------------------------------------*/
+    ptrdiff_t stride = 0;
+
+    /**------------------------------------------------------------------------
+     * Bytes from one sampled pixel to the next within a row, which is
+     * `bytes_per_pixel` unless the plane is subsampled in place.
+     *-----------------------------------------------------------------------*/
+    ptrdiff_t pixel_stride = 1;
+
+    /**------------------------------------------------------------------------
+     * Sampled pixels per row, and rows; each pixel is `bytes_per_pixel`
+     * bytes.
+     *-----------------------------------------------------------------------*/
+    size_t width = 0;
+    size_t height = 0;
+    int bytes_per_pixel = 1;
+
+    /**------------------------------------------------------------------------
+     * For luma, whether black is 0 and white 255, rather than the
+     * limited range 16..235.
+     *-----------------------------------------------------------------------*/
+    bool full_range = true;
+};
+
+/**------------------------------------------------------------------------
+ * A decoded frame as seen by metrics, with its derived planes made on
+ * first use and shared by every metric computed on it.
+ *-----------------------------------------------------------------------*/
+class MetricFrame
+{
+public:
+    explicit MetricFrame(const FrameSampling &sampling = FrameSampling());
+    ~MetricFrame();
+
+    MetricFrame(const MetricFrame &) = delete;
+    MetricFrame &operator=(const MetricFrame &) = delete;
+
+    /**------------------------------------------------------------------------
+     * Move to `frame`, a software frame, discarding the previous frame's
+     * planes. The frame must outlive its use.
+     *-----------------------------------------------------------------------*/
+    void set_frame(const AVFrame *frame);
+
+    const AVFrame *get_frame() const;
+
+    /**------------------------------------------------------------------------
+     * The frame's own Y plane, for 8-bit YUV and greyscale formats, or a
+     * GRAY8 conversion of it otherwise. Either way, only the sampled
+     * region is read.
+     *-----------------------------------------------------------------------*/
+    const FramePlane &get_luma();
+
+    /**------------------------------------------------------------------------
+     * The frame converted to packed RGB24, as moviepy's ffmpeg reader
+     * does. A subsampled frame is converted at the reduced size with
+     * point sampling.
+     *-----------------------------------------------------------------------*/
+    const FramePlane &get_rgb();
+
+    /**------------------------------------------------------------------------
+     * Sums of the R, G and B channels of get_rgb().
+     *-----------------------------------------------------------------------*/
+    const std::array<uint64_t, 3> &get_rgb_sums();
+
+private:
+    FrameSampling sampling;
+    const AVFrame *frame;
+    AVFrame *cropped;
+    std::unique_ptr<ConvertedFrame> gray;
+    std::unique_ptr<ConvertedFrame> rgb;
+    FramePlane luma_plane;
+    FramePlane rgb_plane;
+    std::array<uint64_t, 3> rgb_sums;
+    bool has_luma;
+    bool has_rgb;
+    bool has_rgb_sums;
+};
+
+/**------------------------------------------------------------------------
+ * Reduces a frame to one scalar. Metrics may keep state between frames,
+ * such as scratch buffers, so each analysis thread creates its own.
+ *-----------------------------------------------------------------------*/
+class FrameMetric
+{
+public:
+    virtual ~FrameMetric() {}
+
+    /**------------------------------------------------------------------------
+     * Value of the metric for `frame`, unrounded, in [0..1].
+     *-----------------------------------------------------------------------*/
+    virtual double compute(MetricFrame &frame) = 0;
+};
+
+typedef std::function<std::unique_ptr<FrameMetric>()> FrameMetricFactory;
+
+/**------------------------------------------------------------------------
+ * Register a metric under `name`, which must be 1 to 31 lowercase
+ * letters, digits or underscores. Throws invalid_argument_exception if
+ * the name is invalid or already registered.
+ *-----------------------------------------------------------------------*/
+void register_frame_metric(const std::string &name, FrameMetricFactory factory);
+
+/**------------------------------------------------------------------------
+ * Create an instance of the metric registered as `name`. Throws
+ * invalid_argument_exception if there is none.
+ *-----------------------------------------------------------------------*/
+std::unique_ptr<FrameMetric> create_frame_metric(const std::string &name);
+
+bool has_frame_metric(const std::string &name);
+
+/**------------------------------------------------------------------------
+ * Names of every registered metric, in sorted order.
+ *-----------------------------------------------------------------------*/
+std::vector<std::string> get_frame_metric_names();
+
+/**------------------------------------------------------------------------
+ * Brightness in [0..1] of a mean 8-bit luma level.
+ *-----------------------------------------------------------------------*/
+double normalise_luma(double mean, bool full_range);
+
+/**------------------------------------------------------------------------
+ * Several metrics computed together on each frame, sharing its planes.
+ *-----------------------------------------------------------------------*/
+class FrameMetricSet
+{
+public:
+    /**------------------------------------------------------------------------
+     * Create one instance of each metric in `names`, computed over the
+     * pixels chosen by `sampling`. Throws invalid_argument_exception if
+     * any is unknown.
+     *-----------------------------------------------------------------------*/
+    explicit FrameMetricSet(const std::vector<std::string> &names, const FrameSampling &sampling = FrameSampling());
+
+    size_t size() const;
+
+    /**------------------------------------------------------------------------
+     * Compute every metric for `frame`, a software frame, into
+     * values[0..size()).
+     *-----------------------------------------------------------------------*/
+    void compute(const AVFrame *frame, double *values);
+
+private:
+    std::vector<std::unique_ptr<FrameMetric>> metrics;
+    MetricFrame frame;
+};
+
+}
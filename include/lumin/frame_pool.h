@@ -0,0 +1,57 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file frame_pool.h
+ * A fixed pool of preallocated, 64-byte aligned video frames of a single
+ * size and format, so that holding decoded frames does not allocate.
+ *-----------------------------------------------------------------------*/
+
+#include <cstddef>
+#include <vector>
+
+extern "C"
+{
+struct AVFrame;
+}
+
+namespace lumin
+{
+
+class FramePool
+{
+public:
+    /**------------------------------------------------------------------------
+     * Allocate `capacity` frames of the given size and AVPixelFormat.
+     *-----------------------------------------------------------------------*/
+    FramePool(int width, int height, int pixel_format, size_t capacity);
+    ~FramePool();
+
+    FramePool(const FramePool &) = delete;
+    FramePool &operator=(const FramePool &) = delete;
+
+    /**------------------------------------------------------------------------
+     * Take a writable frame from the pool, or nullptr if all are in use.
+     * If a previous user's frame is still referenced elsewhere (e.g. by
+     * an encoder), its buffer is replaced rather than overwritten.
+     *-----------------------------------------------------------------------*/
+    AVFrame *acquire();
+
+    /**------------------------------------------------------------------------
+     * Return a frame obtained from acquire().
+     *-----------------------------------------------------------------------*/
+    void release(AVFrame *frame);
+
+    size_t get_capacity() const;
+    size_t get_available() const;
+
+    /**------------------------------------------------------------------------
+     * Bytes of image data held by each frame.
+     *-----------------------------------------------------------------------*/
+    static size_t get_frame_bytes(int width, int height, int pixel_format);
+
+private:
+    std::vector<AVFrame *> frames;
+    std::vector<AVFrame *> available;
+};
+
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file frame_reader.h
+ * Random access to decoded source frames by index, through a FrameCache.
+ * Every frame decoded on the way to a request is cached, so requests for
+ * neighbouring frames in the same GOP don't decode it again.
+ *-----------------------------------------------------------------------*/
+
+#include "lumin/decoder.h"
+#include "lumin/frame_cache.h"
+#include "lumin/packet_index.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace lumin
+{
+
+class FrameReader
+{
+public:
+    /**------------------------------------------------------------------------
+     * @param index Packet index of `path`, which must outlive the reader.
+     * @param cache_budget Bytes of decoded frames to cache.
+     *-----------------------------------------------------------------------*/
+    FrameReader(const std::string &path,
+                const PacketIndex &index,
+                size_t cache_budget,
+                const DecoderOptions &decoder_options = DecoderOptions());
+
+    /**------------------------------------------------------------------------
+     * Source frame `frame_index`, or nullptr if it could not be decoded.
+     * Valid until the next call.
+     *-----------------------------------------------------------------------*/
+    const AVFrame *read(uint32_t frame_index);
+
+    CacheStats get_cache_stats() const;
+    size_t get_cache_capacity() const;
+    size_t get_seek_count() const;
+    size_t get_decode_count() const;
+
+    VideoDecoder &get_decoder();
+
+private:
+    VideoDecoder decoder;
+    const PacketIndex &index;
+    std::unique_ptr<FrameCache> cache;
+
+    /*------------------------------------------------------------------------
+     * Index of the next frame the decoder will produce.
+     *-----------------------------------------------------------------------*/
+    size_t position;
+    size_t seeks;
+    size_t decoded;
+};
+
+}
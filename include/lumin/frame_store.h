@@ -0,0 +1,153 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file frame_store.h
+ * Raw frame store: every decoded frame of a source, uncompressed, in a
+ * memory-mappable file with one fixed-size slot per frame. Written
+ * during analysis, it lets later renders of the same source read frames
+ * by index from the page cache instead of seeking and decoding.
+ *
+ * Layout (native byte order):
+ *   FrameStoreHeader, followed by the source path (path_length bytes)
+ *   padding to data_offset, a multiple of 4096
+ *   slot_bytes per frame, frame_count slots, each a multiple of 4096,
+ *     holding the planes at plane_offset with 64-byte aligned linesize
+ *   uint8_t present[frame_count], 0 where a frame failed to decode
+ *-----------------------------------------------------------------------*/
+
+#include "lumin/sidecar.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+struct AVFrame;
+}
+
+namespace lumin
+{
+
+struct FrameStoreHeader
+{
+    char magic[8];
+    uint32_t version;
+    int32_t pixel_format;
+    int32_t width;
+    int32_t height;
+    int32_t linesize[4];
+    uint64_t plane_offset[4];
+    uint64_t slot_bytes;
+    uint64_t data_offset;
+    uint64_t frame_count;
+    uint64_t present_offset;
+    uint32_t path_length;
+    uint32_t flags;
+    uint64_t source_size;
+    int64_t source_mtime_ns;
+    uint64_t content_hash;
+};
+
+class FrameStore
+{
+public:
+    static const uint32_t VERSION = 1;
+
+    /**------------------------------------------------------------------------
+     * The store covers the whole source, rather than a cropped prefix.
+     *-----------------------------------------------------------------------*/
+    static const uint32_t FLAG_COMPLETE = 1 << 0;
+
+    ~FrameStore();
+
+    FrameStore(const FrameStore &) = delete;
+    FrameStore &operator=(const FrameStore &) = delete;
+
+    /**------------------------------------------------------------------------
+     * Map the store at `path`. Returns nullptr if the file does not exist
+     * or is not a valid store, including one whose slot layout isn't the
+     * one its pixel format and size call for.
+     *-----------------------------------------------------------------------*/
+    static std::unique_ptr<FrameStore> open(const std::string &path);
+
+    /**------------------------------------------------------------------------
+     * Default store path for a source: alongside it, with a .lumraw
+     * suffix.
+     *-----------------------------------------------------------------------*/
+    static std::string get_default_path(const std::string &source_path);
+
+    /**------------------------------------------------------------------------
+     * True if the store was written from `key`.
+     *-----------------------------------------------------------------------*/
+    bool matches(const SourceKey &key) const;
+
+    /**------------------------------------------------------------------------
+     * Frame `frame_index`, referencing the mapped slot without a copy, or
+     * nullptr if it wasn't decoded. Valid until the next call; references
+     * taken to it (by an encoder, say) must not outlive the store.
+     *-----------------------------------------------------------------------*/
+    const AVFrame *read(size_t frame_index);
+
+    uint32_t get_flags() const;
+    size_t get_frame_count() const;
+    int get_width() const;
+    int get_height() const;
+    int get_pixel_format() const;
+
+private:
+    FrameStore(void *mapping, size_t mapping_size);
+
+    void *mapping;
+    size_t mapping_size;
+    const FrameStoreHeader *header;
+    AVFrame *frame;
+};
+
+/**------------------------------------------------------------------------
+ * Writes a FrameStore. Frames may be written from several threads at
+ * once, in any order. The file is written to a temporary path and
+ * renamed into place by finish(), so readers never see a partial store;
+ * if finish() isn't called, the temporary file is removed.
+ *-----------------------------------------------------------------------*/
+class FrameStoreWriter
+{
+public:
+    FrameStoreWriter(const std::string &path, const SourceKey &key);
+    ~FrameStoreWriter();
+
+    FrameStoreWriter(const FrameStoreWriter &) = delete;
+    FrameStoreWriter &operator=(const FrameStoreWriter &) = delete;
+
+    /**------------------------------------------------------------------------
+     * Store `frame` as frame `frame_index`. The slot layout is taken from
+     * the first frame written; frames of another size or format, or in
+     * hardware memory, throw invalid_argument_exception.
+     *-----------------------------------------------------------------------*/
+    void write(size_t frame_index, const AVFrame *frame);
+
+    /**------------------------------------------------------------------------
+     * Complete the store with `frame_count` slots. Unwritten slots are
+     * marked as missing.
+     *-----------------------------------------------------------------------*/
+    void finish(size_t frame_count, uint32_t flags);
+
+private:
+    void set_layout(const AVFrame *frame);
+
+    std::string path;
+    std::string temp_path;
+    SourceKey key;
+    int fd;
+    bool finished;
+
+    std::mutex mutex;
+    bool has_layout;
+    FrameStoreHeader header;
+    std::vector<uint8_t> present;
+};
+
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file kernels.h
+ * Reduction kernels for 8-bit image planes. Each entry point dispatches
+ * at runtime to the widest implementation the CPU supports.
+ *-----------------------------------------------------------------------*/
+
+#include <cstddef>
+#include <cstdint>
+
+namespace lumin
+{
+
+enum KernelType
+{
+    KERNEL_SCALAR,
+    KERNEL_AVX2,
+    KERNEL_NEON
+};
+
+/**------------------------------------------------------------------------
+ * Returns the kernel type selected for this CPU.
+ *-----------------------------------------------------------------------*/
+KernelType get_kernel_type();
+
+/**------------------------------------------------------------------------
+ * Returns a human-readable name for `type`.
+ *-----------------------------------------------------------------------*/
+const char *get_kernel_name(KernelType type);
+
+/**------------------------------------------------------------------------
+ * Force a particular kernel, e.g. KERNEL_SCALAR for comparison.
+ * Throws invalid_argument_exception if it is not supported on this CPU.
+ *-----------------------------------------------------------------------*/
+void set_kernel_type(KernelType type);
+
+/**------------------------------------------------------------------------
+ * Sum `count` contiguous bytes.
+ *-----------------------------------------------------------------------*/
+uint64_t sum_u8(const uint8_t *data, size_t count);
+
+/**------------------------------------------------------------------------
+ * Sum the first `width` bytes of each of `height` rows, `stride` bytes
+ * apart. Padding at the end of each row is not read.
+ *-----------------------------------------------------------------------*/
+uint64_t sum_plane_u8(const uint8_t *data, ptrdiff_t stride, size_t width, size_t height);
+
+uint64_t sum_u8_scalar(const uint8_t *data, size_t count);
+#if defined(__x86_64__)
+uint64_t sum_u8_avx2(const uint8_t *data, size_t count);
+#endif
+#if defined(__aarch64__)
+uint64_t sum_u8_neon(const uint8_t *data, size_t count);
+#endif
+
+}
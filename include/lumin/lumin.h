@@ -0,0 +1,41 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file lumin.h
+ * Umbrella header for the lumin engine.
+ *-----------------------------------------------------------------------*/
+
+#include "lumin/audio.h"
+#include "lumin/edl.h"
+#include "lumin/exceptions.h"
+#include "lumin/kernels.h"
+#include "lumin/metrics.h"
+#include "lumin/packet_index.h"
+#include "lumin/permutation.h"
+#include "lumin/pipeline.h"
+#include "lumin/rational.h"
+#include "lumin/read_ahead.h"
+#include "lumin/reorder.h"
+#include "lumin/scheduler.h"
+#include "lumin/series.h"
+#include "lumin/sidecar.h"
+#include "lumin/sort.h"
+
+#ifdef LUMIN_HAVE_LIBAV
+#include "lumin/analyser.h"
+#include "lumin/batch.h"
+#include "lumin/chunks.h"
+#include "lumin/decoder.h"
+#include "lumin/encoder.h"
+#include "lumin/frame_cache.h"
+#include "lumin/frame_metric.h"
+#include "lumin/frame_pool.h"
+#include "lumin/frame_reader.h"
+#include "lumin/frame_store.h"
+#include "lumin/remux.h"
+#include "lumin/renderer.h"
+
+#ifdef LUMIN_HAVE_SDL
+#include "lumin/player.h"
+#endif
+#endif
@@ -0,0 +1,190 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file metrics.h
+ * Live counters for a job (frames decoded and written, seeks, cache
+ * hits, bytes read and written, queue depths), grouped into timed
+ * phases, and a reporter that prints them as JSON lines while the job
+ * runs and as a summary when it ends.
+ *-----------------------------------------------------------------------*/
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace lumin
+{
+
+class PhaseStats
+{
+public:
+    std::string name;
+    double seconds = 0.0;
+
+    /**------------------------------------------------------------------------
+     * Units of progress made: frames analysed, ordered or rendered.
+     *-----------------------------------------------------------------------*/
+    uint64_t items = 0;
+
+    double get_rate() const
+    {
+        return this->seconds > 0.0 ? this->items / this->seconds : 0.0;
+    }
+};
+
+/**------------------------------------------------------------------------
+ * Counters are atomic and can be updated from any thread. Phases are
+ * begun and ended by the thread driving the job.
+ *-----------------------------------------------------------------------*/
+class Metrics
+{
+public:
+    Metrics();
+
+    Metrics(const Metrics &) = delete;
+    Metrics &operator=(const Metrics &) = delete;
+
+    /**------------------------------------------------------------------------
+     * End the current phase, if any, and begin `name`.
+     *
+     * @param total Expected items in this phase, for the progress fraction
+     *              and ETA, or 0 if unknown.
+     *-----------------------------------------------------------------------*/
+    void begin_phase(const std::string &name, uint64_t total = 0);
+    void end_phase();
+
+    /**------------------------------------------------------------------------
+     * Set the expected items of the current phase, once it is known.
+     *-----------------------------------------------------------------------*/
+    void set_phase_total(uint64_t total);
+
+    void add_progress(uint64_t count = 1);
+    void add_frames_decoded(uint64_t count = 1);
+    void add_frames_written(uint64_t count = 1);
+    void add_seeks(uint64_t count = 1);
+    void add_cache_hits(uint64_t count);
+    void add_cache_misses(uint64_t count);
+    void add_bytes_read(uint64_t count);
+    void add_bytes_written(uint64_t count);
+
+    /**------------------------------------------------------------------------
+     * Packets the decoder rejected as corrupt and skipped.
+     *-----------------------------------------------------------------------*/
+    void add_corrupt_packets(uint64_t count = 1);
+
+    /**------------------------------------------------------------------------
+     * Sample `depth` in each progress report, as the depth of queue
+     * `name`, until remove_queue(). See QueueGauge.
+     *-----------------------------------------------------------------------*/
+    void add_queue(const std::string &name, std::function<size_t()> depth);
+    void remove_queue(const std::string &name);
+
+    std::vector<PhaseStats> get_phases() const;
+
+    /**------------------------------------------------------------------------
+     * One JSON object, without a trailing newline: "progress" with the
+     * current phase, counters and queue depths, or "summary" with every
+     * phase and the totals.
+     *-----------------------------------------------------------------------*/
+    std::string get_progress_json() const;
+    std::string get_summary_json() const;
+
+private:
+    std::string get_counters_json() const;
+
+    using Clock = std::chrono::steady_clock;
+
+    Clock::time_point start_time;
+
+    mutable std::mutex mutex;
+    std::vector<PhaseStats> phases;
+    std::string phase;
+    Clock::time_point phase_start_time;
+    uint64_t phase_total;
+    std::map<std::string, std::function<size_t()>> queues;
+
+    std::atomic<uint64_t> phase_progress;
+    std::atomic<int64_t> last_progress_ns;
+    std::atomic<uint64_t> frames_decoded;
+    std::atomic<uint64_t> frames_written;
+    std::atomic<uint64_t> seeks;
+    std::atomic<uint64_t> cache_hits;
+    std::atomic<uint64_t> cache_misses;
+    std::atomic<uint64_t> bytes_read;
+    std::atomic<uint64_t> bytes_written;
+    std::atomic<uint64_t> corrupt_packets;
+};
+
+/**------------------------------------------------------------------------
+ * Registers a queue depth with `metrics` (which may be null) for the
+ * lifetime of the gauge. Declare it after the queue, so that it is
+ * removed before the queue is destroyed.
+ *-----------------------------------------------------------------------*/
+class QueueGauge
+{
+public:
+    QueueGauge(Metrics *metrics, const std::string &name, std::function<size_t()> depth)
+        : metrics(metrics), name(name)
+    {
+        if (this->metrics)
+        {
+            this->metrics->add_queue(name, depth);
+        }
+    }
+
+    ~QueueGauge()
+    {
+        if (this->metrics)
+        {
+            this->metrics->remove_queue(this->name);
+        }
+    }
+
+    QueueGauge(const QueueGauge &) = delete;
+    QueueGauge &operator=(const QueueGauge &) = delete;
+
+private:
+    Metrics *metrics;
+    std::string name;
+};
+
+/**------------------------------------------------------------------------
+ * Writes a progress line for `metrics` to `output` every `interval`
+ * seconds on a background thread, and the summary line on finish().
+ *-----------------------------------------------------------------------*/
+class ProgressReporter
+{
+public:
+    ProgressReporter(const Metrics &metrics, FILE *output, double interval);
+    ~ProgressReporter();
+
+    ProgressReporter(const ProgressReporter &) = delete;
+    ProgressReporter &operator=(const ProgressReporter &) = delete;
+
+    /**------------------------------------------------------------------------
+     * Stop reporting and write the summary. Called by the destructor if
+     * not called before.
+     *-----------------------------------------------------------------------*/
+    void finish();
+
+private:
+    void stop();
+
+    const Metrics &metrics;
+    FILE *output;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping;
+    bool finished;
+    std::thread thread;
+};
+
+}
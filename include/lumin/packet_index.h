@@ -0,0 +1,179 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file packet_index.h
+ * An index of the compressed packets of a video stream, built by a
+ * demux-only scan. Maps presentation order to packets and keyframes.
+ *-----------------------------------------------------------------------*/
+
+#include "lumin/rational.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace lumin
+{
+
+/**------------------------------------------------------------------------
+ * A half-open range of frame indices, [start, end).
+ *-----------------------------------------------------------------------*/
+class FrameRange
+{
+public:
+    size_t start;
+    size_t end;
+
+    size_t size() const
+    {
+        return end - start;
+    }
+};
+
+/**------------------------------------------------------------------------
+ * A half-open range of byte offsets in a file, [start, end).
+ *-----------------------------------------------------------------------*/
+class ByteRange
+{
+public:
+    int64_t start;
+    int64_t end;
+
+    int64_t size() const
+    {
+        return end - start;
+    }
+};
+
+class PacketIndexEntry
+{
+public:
+    int64_t pts;
+    int64_t dts;
+    int64_t pos;
+    int32_t size;
+    bool keyframe;
+};
+
+/**------------------------------------------------------------------------
+ * The packets of a stream, in decode order, wherever they are held: in
+ * memory, or in a mapped packet index file (see PacketIndexFile).
+ *-----------------------------------------------------------------------*/
+class PacketTable
+{
+public:
+    virtual ~PacketTable();
+
+    virtual size_t size() const = 0;
+    virtual PacketIndexEntry get(size_t position) const = 0;
+};
+
+/**------------------------------------------------------------------------
+ * The presentation-order tables are built on first use, so that loading
+ * an index costs nothing until it is queried. Copies share the packets
+ * and tables, and may be used from any number of threads.
+ *-----------------------------------------------------------------------*/
+class PacketIndex
+{
+public:
+    PacketIndex();
+
+    /**------------------------------------------------------------------------
+     * @param entries Packets of the stream, in decode order.
+     * @param time_base Time base of the stream's timestamps.
+     * @param frame_rate Nominal frame rate of the stream.
+     *-----------------------------------------------------------------------*/
+    PacketIndex(std::vector<PacketIndexEntry> entries, Rational time_base, Rational frame_rate);
+    PacketIndex(std::shared_ptr<const PacketTable> packets, Rational time_base, Rational frame_rate);
+
+    /**------------------------------------------------------------------------
+     * Number of frames in the stream.
+     *-----------------------------------------------------------------------*/
+    size_t get_frame_count() const;
+
+    Rational get_time_base() const;
+    Rational get_frame_rate() const;
+
+    /**------------------------------------------------------------------------
+     * True if every packet has a timestamp, so frames can be located by
+     * presentation order. Without it, the stream can only be decoded
+     * sequentially.
+     *-----------------------------------------------------------------------*/
+    bool has_timestamps() const;
+
+    /**------------------------------------------------------------------------
+     * True if, as well, no two packets share a timestamp. Broken muxes
+     * can repeat one; frames with the same timestamp are then ordered by
+     * decode position, but can't be told apart by get_frame_index(), so
+     * their packets can't be copied by frame.
+     *-----------------------------------------------------------------------*/
+    bool has_unique_timestamps() const;
+
+    /**------------------------------------------------------------------------
+     * Presentation timestamp of frame `index`, in stream time base units.
+     *-----------------------------------------------------------------------*/
+    int64_t get_frame_pts(size_t index) const;
+
+    /**------------------------------------------------------------------------
+     * Index of the frame with presentation timestamp `pts`, or of the
+     * first frame after it. Returns get_frame_count() if `pts` is past
+     * the end of the stream.
+     *-----------------------------------------------------------------------*/
+    size_t get_frame_index(int64_t pts) const;
+
+    /**------------------------------------------------------------------------
+     * Indices of the keyframes, in presentation order.
+     *-----------------------------------------------------------------------*/
+    const std::vector<size_t> &get_keyframes() const;
+
+    /**------------------------------------------------------------------------
+     * Split frames [0, frame_count) into at most `segment_count` ranges
+     * of roughly equal length, each starting at a keyframe.
+     *-----------------------------------------------------------------------*/
+    std::vector<FrameRange> split(size_t segment_count, size_t frame_count) const;
+
+    /**------------------------------------------------------------------------
+     * Packet `position` in decode order, of get_frame_count().
+     *-----------------------------------------------------------------------*/
+    PacketIndexEntry get_entry(size_t position) const;
+
+    /**------------------------------------------------------------------------
+     * Bytes of the file spanned by the packets needed to decode frames
+     * [start, end) from the keyframe at or before `start`: the packets
+     * from that keyframe's to the last of the range's in decode order.
+     * Packets of other streams interleaved with them are included. Empty
+     * if the range is, or if packets have no timestamps or positions.
+     *-----------------------------------------------------------------------*/
+    ByteRange get_byte_range(size_t start, size_t end) const;
+
+private:
+    class Tables
+    {
+    public:
+        std::once_flag built;
+        std::vector<int64_t> presentation_pts;
+
+        /**------------------------------------------------------------------------
+         * Decode-order entry of each frame, in presentation order.
+         *-----------------------------------------------------------------------*/
+        std::vector<size_t> presentation_entries;
+        std::vector<size_t> keyframes;
+        bool timestamps = false;
+        bool unique_timestamps = false;
+    };
+
+    /**------------------------------------------------------------------------
+     * The tables, built by the first caller.
+     *-----------------------------------------------------------------------*/
+    const Tables &get_tables() const;
+    void build_tables() const;
+
+    std::shared_ptr<const PacketTable> packets;
+    std::shared_ptr<Tables> tables;
+    Rational time_base;
+    Rational frame_rate;
+};
+
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file permutation.h
+ * The reorder map: a dense array giving, for each destination frame, the
+ * source frame to show in its place.
+ *-----------------------------------------------------------------------*/
+
+#include "lumin/metrics.h"
+#include "lumin/rational.h"
+#include "lumin/series.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace lumin
+{
+
+class OrderOptions
+{
+public:
+    /**------------------------------------------------------------------------
+     * Luminosity precision, in decimal places, or 0 to disable rounding.
+     *-----------------------------------------------------------------------*/
+    int decimal_places = 2;
+
+    /**------------------------------------------------------------------------
+     * Sort by descending brightness. Source order is kept within each
+     * brightness value in both directions.
+     *-----------------------------------------------------------------------*/
+    bool reverse = false;
+
+    /**------------------------------------------------------------------------
+     * Keep runs of consecutive source frames together, so that the order
+     * has fewer, longer runs, each costing a renderer one seek. A frame
+     * joins the run before it while that run is shorter than
+     * `min_run_length`, or if its key is within `run_tolerance` of the
+     * key of the run's first frame, in units of 10^-decimal_places. Each
+     * run is then placed as a unit, by its mean brightness, rounded.
+     *-----------------------------------------------------------------------*/
+    size_t min_run_length = 1;
+    int run_tolerance = 0;
+
+    /**------------------------------------------------------------------------
+     * Change in brightness between consecutive source frames taken as a
+     * cut between shots, which no run spans, or 0 for no shot detection.
+     *-----------------------------------------------------------------------*/
+    double shot_threshold = 0.0;
+
+    /**------------------------------------------------------------------------
+     * Bytes of sort records to hold in memory, or 0 for no limit. Beyond
+     * this, sorted runs are spilled to `spill_directory` and merged.
+     *-----------------------------------------------------------------------*/
+    size_t memory_budget = 0;
+
+    std::string spill_directory;
+
+    /**------------------------------------------------------------------------
+     * If set, order() is timed as the "order" phase.
+     *-----------------------------------------------------------------------*/
+    Metrics *metrics = nullptr;
+
+    /**------------------------------------------------------------------------
+     * True if any run constraint is set, so that frames aren't ordered
+     * individually.
+     *-----------------------------------------------------------------------*/
+    bool constrains_runs() const;
+};
+
+/**------------------------------------------------------------------------
+ * Integer sort key of a brightness value under a set of OrderOptions:
+ * round(value, places) as a count of 10^-places, negated if reversed.
+ *-----------------------------------------------------------------------*/
+class OrderKey
+{
+public:
+    OrderKey(const OrderOptions &options);
+
+    int64_t operator()(double value) const
+    {
+        int64_t key = (int64_t) std::round(value * this->scale);
+        return this->reverse ? -key : key;
+    }
+
+private:
+    double scale;
+    bool reverse;
+};
+
+class Permutation
+{
+public:
+    Permutation();
+
+    /**------------------------------------------------------------------------
+     * @param frame_rate Frame rate of source and destination.
+     * @param source_frames For each destination frame, its source frame.
+     *                      Must be a permutation of [0, size).
+     *-----------------------------------------------------------------------*/
+    Permutation(Rational frame_rate, std::vector<uint32_t> source_frames);
+
+    size_t size() const;
+
+    Rational get_frame_rate() const;
+
+    /**------------------------------------------------------------------------
+     * Source frame shown at destination frame `dest_frame`.
+     *-----------------------------------------------------------------------*/
+    uint32_t get_source_frame(size_t dest_frame) const
+    {
+        return this->source_frames[dest_frame];
+    }
+
+    /**------------------------------------------------------------------------
+     * Index of the frame containing time `t`, in seconds, clamped to the
+     * last frame. t is quantised to microseconds once; the rest of the
+     * conversion is exact integer arithmetic on the rational frame rate.
+     *-----------------------------------------------------------------------*/
+    size_t get_frame_index(double t) const;
+
+    /**------------------------------------------------------------------------
+     * Map destination time `t` to the corresponding source time,
+     * preserving its offset within the frame.
+     *-----------------------------------------------------------------------*/
+    double remap(double t) const;
+
+    /**------------------------------------------------------------------------
+     * The whole permutation, indexed by destination frame.
+     *-----------------------------------------------------------------------*/
+    const std::vector<uint32_t> &get_source_frames() const;
+
+    /**------------------------------------------------------------------------
+     * The inverse permutation: for each source frame, its destination.
+     *-----------------------------------------------------------------------*/
+    std::vector<uint32_t> get_inverse() const;
+
+private:
+    Rational frame_rate;
+    std::vector<uint32_t> source_frames;
+};
+
+/**------------------------------------------------------------------------
+ * Order the frames of `series` by brightness rounded to
+ * `options.decimal_places`, breaking ties by source position: the same
+ * order as reorder.py's sort. With run constraints, the runs they keep
+ * together are ordered the same way, by their mean brightness.
+ *-----------------------------------------------------------------------*/
+Permutation order(const LuminanceSeries &series, const OrderOptions &options = OrderOptions());
+
+}
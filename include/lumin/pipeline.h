@@ -0,0 +1,273 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file pipeline.h
+ * Building blocks for staged pipelines: bounded single-producer,
+ * single-consumer ring buffers between stages, each stage on its own
+ * thread, with per-stage timing to find the bottleneck.
+ *-----------------------------------------------------------------------*/
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace lumin
+{
+
+class StageStats
+{
+public:
+    std::string name;
+    double wall_seconds = 0.0;
+
+    /**------------------------------------------------------------------------
+     * Time spent waiting for the upstream stage (input queue empty).
+     *-----------------------------------------------------------------------*/
+    double input_wait_seconds = 0.0;
+
+    /**------------------------------------------------------------------------
+     * Time spent blocked by the downstream stage (output queue full).
+     *-----------------------------------------------------------------------*/
+    double output_wait_seconds = 0.0;
+
+    uint64_t items = 0;
+
+    /**------------------------------------------------------------------------
+     * Fraction of wall time spent working rather than waiting. The
+     * bottleneck is the stage with the highest utilisation.
+     *-----------------------------------------------------------------------*/
+    double get_utilisation() const;
+};
+
+/**------------------------------------------------------------------------
+ * Timing for one pipeline stage. Wait times are accumulated by the
+ * queues the stage pushes to and pops from; items by the stage itself.
+ *-----------------------------------------------------------------------*/
+class Stage
+{
+public:
+    Stage(const std::string &name);
+
+    void start();
+    void stop();
+
+    void add_items(uint64_t count);
+    void add_input_wait(std::chrono::nanoseconds duration);
+    void add_output_wait(std::chrono::nanoseconds duration);
+
+    StageStats get_stats() const;
+
+private:
+    std::string name;
+    std::chrono::steady_clock::time_point start_time;
+    std::chrono::steady_clock::time_point stop_time;
+    std::atomic<int64_t> input_wait_ns;
+    std::atomic<int64_t> output_wait_ns;
+    std::atomic<uint64_t> items;
+};
+
+/**------------------------------------------------------------------------
+ * Spins, then yields, then sleeps: cheap when the other side is about
+ * to catch up, without burning a core when it isn't.
+ *-----------------------------------------------------------------------*/
+class Backoff
+{
+public:
+    void wait()
+    {
+        if (this->count < 64)
+        {
+            this->count++;
+        }
+        else if (this->count < 128)
+        {
+            this->count++;
+            std::this_thread::yield();
+        }
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+
+private:
+    int count = 0;
+};
+
+/**------------------------------------------------------------------------
+ * Bounded lock-free ring buffer for exactly one producer thread and one
+ * consumer thread. push() blocks while the buffer is full, which is the
+ * backpressure between stages; pop() blocks while it is empty.
+ *
+ * Either side may close() the queue: the producer when it has finished,
+ * the consumer to cancel. After close(), push() fails and pop() returns
+ * the remaining values and then fails.
+ *-----------------------------------------------------------------------*/
+template <typename T>
+class SpscQueue
+{
+public:
+    /**------------------------------------------------------------------------
+     * @param capacity Rounded up to a power of two.
+     *-----------------------------------------------------------------------*/
+    SpscQueue(size_t capacity)
+        : head(0), tail(0), closed(false)
+    {
+        size_t size = 1;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        this->slots.resize(size);
+        this->mask = size - 1;
+    }
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    bool try_push(T &value)
+    {
+        size_t tail = this->tail.load(std::memory_order_relaxed);
+        if (tail - this->head.load(std::memory_order_acquire) > this->mask)
+        {
+            return false;
+        }
+        this->slots[tail & this->mask] = std::move(value);
+        this->tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T &value)
+    {
+        size_t head = this->head.load(std::memory_order_relaxed);
+        if (head == this->tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        value = std::move(this->slots[head & this->mask]);
+        this->head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**------------------------------------------------------------------------
+     * Returns false, leaving `value` untouched, if the queue is closed.
+     *-----------------------------------------------------------------------*/
+    bool push(T &value, Stage *producer = nullptr)
+    {
+        if (this->is_closed())
+        {
+            return false;
+        }
+        if (this->try_push(value))
+        {
+            return true;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        Backoff backoff;
+        bool pushed = false;
+        while (!this->is_closed() && !(pushed = this->try_push(value)))
+        {
+            backoff.wait();
+        }
+        if (producer)
+        {
+            producer->add_output_wait(std::chrono::steady_clock::now() - start);
+        }
+        return pushed;
+    }
+
+    bool pop(T &value, Stage *consumer = nullptr)
+    {
+        if (this->try_pop(value))
+        {
+            return true;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        Backoff backoff;
+        bool popped = false;
+        while (!(popped = this->try_pop(value)))
+        {
+            if (this->is_closed())
+            {
+                /*------------------------------------------------------------------------
+                 * The producer may have pushed just before closing.
+                 *-----------------------------------------------------------------------*/
+                popped = this->try_pop(value);
+                break;
+            }
+            backoff.wait();
+        }
+        if (consumer)
+        {
+            consumer->add_input_wait(std::chrono::steady_clock::now() - start);
+        }
+        return popped;
+    }
+
+    void close()
+    {
+        this->closed.store(true, std::memory_order_release);
+    }
+
+    bool is_closed() const
+    {
+        return this->closed.load(std::memory_order_acquire);
+    }
+
+    /**------------------------------------------------------------------------
+     * Number of values queued: exact from either end, approximate from
+     * any other thread.
+     *-----------------------------------------------------------------------*/
+    size_t size() const
+    {
+        return this->tail.load(std::memory_order_acquire) - this->head.load(std::memory_order_acquire);
+    }
+
+    size_t get_capacity() const
+    {
+        return this->mask + 1;
+    }
+
+private:
+    std::vector<T> slots;
+    size_t mask;
+
+    /*------------------------------------------------------------------------
+     * Head and tail on separate cache lines, so producer and consumer
+     * don't contend on one line.
+     *-----------------------------------------------------------------------*/
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+    alignas(64) std::atomic<bool> closed;
+};
+
+/**------------------------------------------------------------------------
+ * Runs `body` as a pipeline stage on its own thread, timing it with
+ * `stage`, then runs `finally` (typically closing the output queue) even
+ * if `body` throws. join() rethrows any exception from `body`.
+ *-----------------------------------------------------------------------*/
+class StageThread
+{
+public:
+    StageThread(Stage &stage, std::function<void()> body, std::function<void()> finally);
+    ~StageThread();
+
+    StageThread(const StageThread &) = delete;
+    StageThread &operator=(const StageThread &) = delete;
+
+    void join();
+
+private:
+    std::thread thread;
+    std::exception_ptr error;
+};
+
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file player.h
+ * Live playback: show the source on screen in EDL order, with no encode
+ * step. A background stage reads upcoming frames in destination order,
+ * from a raw frame store if there is one and through a FrameReader
+ * otherwise, while the display loop uploads each frame to one of two
+ * streaming textures and presents it on vsync.
+ *-----------------------------------------------------------------------*/
+
+#include "lumin/decoder.h"
+#include "lumin/edl.h"
+#include "lumin/metrics.h"
+#include "lumin/pipeline.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace lumin
+{
+
+/**------------------------------------------------------------------------
+ * Distribution of frame times, in 0.1 ms buckets up to 100 ms; longer
+ * times all fall in the last bucket.
+ *-----------------------------------------------------------------------*/
+class FrameTimeHistogram
+{
+public:
+    static constexpr double BUCKET_SECONDS = 0.0001;
+    static constexpr size_t BUCKET_COUNT = 1000;
+
+    FrameTimeHistogram();
+
+    void add(double seconds);
+
+    uint64_t get_count() const;
+    double get_mean() const;
+    double get_max() const;
+
+    /**------------------------------------------------------------------------
+     * Frame time that `fraction` of frames took no longer than, to the
+     * bucket's upper edge.
+     *-----------------------------------------------------------------------*/
+    double get_percentile(double fraction) const;
+
+    /**------------------------------------------------------------------------
+     * Number of frames that took longer than `seconds`.
+     *-----------------------------------------------------------------------*/
+    uint64_t get_count_over(double seconds) const;
+
+    const std::vector<uint64_t> &get_buckets() const;
+
+private:
+    std::vector<uint64_t> buckets;
+    uint64_t count;
+    double total;
+    double max;
+};
+
+class PlaybackOptions
+{
+public:
+    /**------------------------------------------------------------------------
+     * Bytes of decoded frames to cache when reading through a
+     * FrameReader.
+     *-----------------------------------------------------------------------*/
+    size_t cache_budget = (size_t) 512 << 20;
+
+    /**------------------------------------------------------------------------
+     * Frames read ahead of the one on screen. Each one read ahead
+     * absorbs a slow seek or GOP at the cost of one decoded frame of
+     * memory (12 MB at 4K).
+     *-----------------------------------------------------------------------*/
+    size_t prefetch_frames = 32;
+
+    /**------------------------------------------------------------------------
+     * Path of a raw frame store written by analysis (see frame_store.h),
+     * read instead of decoding if it is valid for the source and covers
+     * the EDL. Otherwise it is ignored.
+     *-----------------------------------------------------------------------*/
+    std::string frame_store_path;
+
+    /**------------------------------------------------------------------------
+     * Path of a packet index file (see sidecar.h) caching the source's
+     * packet index, or empty to index the source every time it is needed.
+     *-----------------------------------------------------------------------*/
+    std::string packet_index_path;
+
+    /**------------------------------------------------------------------------
+     * Identity of the source, if the caller already has it, which must
+     * outlive the call. Otherwise it is computed at most once, when a
+     * cache needs checking.
+     *-----------------------------------------------------------------------*/
+    const SourceKey *source_key = nullptr;
+
+    /**------------------------------------------------------------------------
+     * Hardware decoder to read frames with, falling back to software for
+     * streams it can't decode. Frames are downloaded to host memory for
+     * the frame cache and texture upload.
+     *-----------------------------------------------------------------------*/
+    HardwareDecode hardware = HARDWARE_DECODE_NONE;
+
+    /**------------------------------------------------------------------------
+     * Start again from the first destination frame at the end of the
+     * EDL, rather than stopping.
+     *-----------------------------------------------------------------------*/
+    bool loop = true;
+
+    /**------------------------------------------------------------------------
+     * Seconds to play for, or 0 to play until the window is closed (or,
+     * without `loop`, the EDL ends).
+     *-----------------------------------------------------------------------*/
+    double duration = 0.0;
+
+    bool fullscreen = false;
+
+    /**------------------------------------------------------------------------
+     * If set, playback is timed as a "play" phase with frames shown as
+     * progress, and the decoder and prefetch queue report into it.
+     *-----------------------------------------------------------------------*/
+    Metrics *metrics = nullptr;
+};
+
+class PlaybackStats
+{
+public:
+    size_t frames_shown = 0;
+
+    /**------------------------------------------------------------------------
+     * Frames that weren't ready by the vsync they were due at, so that
+     * the previous frame stayed on screen for longer.
+     *-----------------------------------------------------------------------*/
+    size_t frames_late = 0;
+
+    size_t loops = 0;
+    size_t seeks = 0;
+    size_t frames_decoded = 0;
+    bool frame_store_used = false;
+
+    /**------------------------------------------------------------------------
+     * Refresh rate of the display the window opened on, in Hz, or 0 if
+     * unknown.
+     *-----------------------------------------------------------------------*/
+    int refresh_rate = 0;
+
+    /**------------------------------------------------------------------------
+     * Time between presenting one frame and presenting the next. At the
+     * source rate, every frame time is one frame period.
+     *-----------------------------------------------------------------------*/
+    FrameTimeHistogram frame_times;
+
+    /**------------------------------------------------------------------------
+     * Timing of the read stage (on its own thread) and the display loop
+     * (on the calling thread), which spends most of its time on vsync.
+     *-----------------------------------------------------------------------*/
+    std::vector<StageStats> stages;
+};
+
+/**------------------------------------------------------------------------
+ * Play the video stream of `input` reordered by `edl` in a window, at
+ * the EDL's frame rate, until it is closed, Escape or Q is pressed, or
+ * playback ends. Must be called from the main thread. The soundtrack
+ * isn't played.
+ *-----------------------------------------------------------------------*/
+PlaybackStats play(const std::string &input,
+                   const EditDecisionList &edl,
+                   const PlaybackOptions &options = PlaybackOptions());
+
+}
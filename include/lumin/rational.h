@@ -0,0 +1,83 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file rational.h
+ * Exact rational numbers, for time bases and frame rates.
+ *-----------------------------------------------------------------------*/
+
+#include <cstdint>
+
+namespace lumin
+{
+
+class Rational
+{
+public:
+    Rational()
+        : num(0), den(1)
+    {
+    }
+
+    Rational(int64_t num, int64_t den)
+        : num(num), den(den)
+    {
+    }
+
+    /**------------------------------------------------------------------------
+     * Closest rational to `value` with a denominator no greater than
+     * `max_den`, by continued fractions.
+     *-----------------------------------------------------------------------*/
+    static Rational from_double(double value, int64_t max_den = 1001000);
+
+    double to_double() const
+    {
+        return den ? (double) num / den : 0.0;
+    }
+
+    bool is_valid() const
+    {
+        return num > 0 && den > 0;
+    }
+
+    bool operator==(const Rational &other) const
+    {
+        return num == other.num && den == other.den;
+    }
+
+    bool operator!=(const Rational &other) const
+    {
+        return !(*this == other);
+    }
+
+    int64_t num;
+    int64_t den;
+};
+
+inline Rational Rational::from_double(double value, int64_t max_den)
+{
+    int64_t p0 = 0, q0 = 1, p1 = 1, q1 = 0;
+    double x = value;
+    for (int iteration = 0; iteration < 64; iteration++)
+    {
+        int64_t a = (int64_t) x;
+        int64_t q2 = q0 + a * q1;
+        if (q2 > max_den)
+        {
+            break;
+        }
+        int64_t p2 = p0 + a * p1;
+        p0 = p1;
+        q0 = q1;
+        p1 = p2;
+        q1 = q2;
+        double fraction = x - (double) a;
+        if (fraction < 1e-9)
+        {
+            break;
+        }
+        x = 1.0 / fraction;
+    }
+    return q1 ? Rational(p1, q1) : Rational((int64_t) value, 1);
+}
+
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file read_ahead.h
+ * Read-ahead file I/O for sources on network mounts, where each read is
+ * a round trip and libavformat's small sequential reads leave the link
+ * idle while frames decode. The file is read in large blocks at
+ * block-aligned offsets by a pool of threads, both just ahead of the
+ * reader and over byte ranges the caller knows it will need next, such
+ * as the packets of the next EDL runs (see PacketIndex::get_byte_range()).
+ *-----------------------------------------------------------------------*/
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace lumin
+{
+
+class ReadAheadOptions
+{
+public:
+    /**------------------------------------------------------------------------
+     * Bytes per read. Every read starts at a multiple of this.
+     *-----------------------------------------------------------------------*/
+    size_t block_size = (size_t) 4 << 20;
+
+    /**------------------------------------------------------------------------
+     * Bytes of blocks to hold, whether read or still being read. At most
+     * half of it is used for blocks prefetched but not yet read.
+     *-----------------------------------------------------------------------*/
+    size_t budget = (size_t) 256 << 20;
+
+    /**------------------------------------------------------------------------
+     * Reads to have in flight at once.
+     *-----------------------------------------------------------------------*/
+    int threads = 4;
+
+    /**------------------------------------------------------------------------
+     * Blocks to read ahead of the block last read.
+     *-----------------------------------------------------------------------*/
+    size_t sequential_blocks = 2;
+};
+
+class ReadAheadStats
+{
+public:
+    uint64_t reads = 0;
+
+    /**------------------------------------------------------------------------
+     * Reads that had to wait for their block to arrive from the file,
+     * and the total time spent waiting.
+     *-----------------------------------------------------------------------*/
+    uint64_t waits = 0;
+    double wait_seconds = 0.0;
+
+    uint64_t blocks_read = 0;
+    uint64_t bytes_read = 0;
+
+    /**------------------------------------------------------------------------
+     * Blocks dropped to stay within the budget.
+     *-----------------------------------------------------------------------*/
+    uint64_t evictions = 0;
+};
+
+/**------------------------------------------------------------------------
+ * A file read through a cache of large blocks. Thread safe: any number
+ * of readers may share one, each keeping its own position.
+ *-----------------------------------------------------------------------*/
+class ReadAheadFile
+{
+public:
+    /**------------------------------------------------------------------------
+     * Open `path` for reading. Throws io_exception on failure, or
+     * invalid_argument_exception if the block size or thread count is 0.
+     *-----------------------------------------------------------------------*/
+    explicit ReadAheadFile(const std::string &path, const ReadAheadOptions &options = ReadAheadOptions());
+    ~ReadAheadFile();
+
+    ReadAheadFile(const ReadAheadFile &) = delete;
+    ReadAheadFile &operator=(const ReadAheadFile &) = delete;
+
+    const std::string &get_path() const;
+    int64_t get_size() const;
+
+    /**------------------------------------------------------------------------
+     * Copy up to `size` bytes at `offset` into `buffer`, waiting for them
+     * to be read if need be, and read ahead of them. Returns the bytes
+     * copied, which is less than `size` only at the end of the file.
+     * Throws io_exception if the file can't be read.
+     *-----------------------------------------------------------------------*/
+    size_t read(int64_t offset, uint8_t *buffer, size_t size);
+
+    /**------------------------------------------------------------------------
+     * Read bytes [start, end) in the background, behind any ranges
+     * already queued. Returns false if only some of the range could be
+     * queued within the budget, in which case the caller should ask for
+     * it again once more has been read.
+     *-----------------------------------------------------------------------*/
+    bool prefetch(int64_t start, int64_t end);
+
+    ReadAheadStats get_stats() const;
+
+private:
+    enum BlockState
+    {
+        BLOCK_QUEUED,
+        BLOCK_READING,
+        BLOCK_READY,
+        BLOCK_FAILED
+    };
+
+    class Block
+    {
+    public:
+        BlockState state = BLOCK_QUEUED;
+        std::vector<uint8_t> data;
+        int error = 0;
+
+        /**------------------------------------------------------------------------
+         * Prefetched blocks count against the prefetch half of the budget
+         * until they are first read.
+         *-----------------------------------------------------------------------*/
+        bool prefetched = false;
+
+        /**------------------------------------------------------------------------
+         * Position in the LRU list, once ready.
+         *-----------------------------------------------------------------------*/
+        std::list<int64_t>::iterator lru_position;
+    };
+
+    /**------------------------------------------------------------------------
+     * Queue block `index`, ahead of other queued blocks if `urgent`.
+     * Returns false if it isn't already held and there's no room for it.
+     * Must be called with the mutex held.
+     *-----------------------------------------------------------------------*/
+    bool enqueue(int64_t index, bool urgent, bool prefetched);
+
+    /**------------------------------------------------------------------------
+     * Drop least recently used blocks until there's room for another.
+     *-----------------------------------------------------------------------*/
+    void evict();
+
+    /**------------------------------------------------------------------------
+     * Read block `index`, which must be held, releasing `lock` meanwhile.
+     *-----------------------------------------------------------------------*/
+    void read_block(int64_t index, std::unique_lock<std::mutex> &lock);
+    void run_worker();
+
+    std::string path;
+    ReadAheadOptions options;
+    int fd;
+    int64_t size;
+    int64_t block_count;
+    size_t capacity;
+
+    mutable std::mutex mutex;
+    std::condition_variable queue_changed;
+    std::condition_variable block_changed;
+    std::unordered_map<int64_t, Block> blocks;
+    std::deque<int64_t> queue;
+    std::list<int64_t> lru;
+    std::vector<std::vector<uint8_t>> spare_buffers;
+    size_t prefetched_count;
+    bool stopping;
+    ReadAheadStats stats;
+    std::vector<std::thread> workers;
+};
+
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file remux.h
+ * Stream-copy rendering: reorder compressed packets without decoding,
+ * for EDLs whose runs are all whole GOPs. Intra-only sources (ProRes,
+ * DNxHR, MJPEG, all-I H.264) qualify for any EDL.
+ *-----------------------------------------------------------------------*/
+
+#include "lumin/edl.h"
+#include "lumin/metrics.h"
+#include "lumin/packet_index.h"
+
+#include <cstddef>
+#include <string>
+
+namespace lumin
+{
+
+class RemuxStats
+{
+public:
+    size_t runs = 0;
+    size_t packets_written = 0;
+    size_t seeks = 0;
+};
+
+/**------------------------------------------------------------------------
+ * True if every run of `edl` starts on a keyframe and ends on a
+ * keyframe or the end of the stream, its packets contain exactly its
+ * frames (no references across the boundary, as in open GOPs), and its
+ * decode timestamps can be made to follow the previous run's without
+ * moving it onto the next destination frame. Otherwise returns false
+ * and sets `reason`, if given.
+ *-----------------------------------------------------------------------*/
+bool can_remux(const PacketIndex &index, const EditDecisionList &edl, std::string *reason = nullptr);
+
+/**------------------------------------------------------------------------
+ * Write the video stream of `input` to `output`, reordered by `edl`,
+ * by copying compressed packets. Throws invalid_argument_exception if
+ * can_remux() is false.
+ *
+ * @param metrics If set, counts packets copied as progress, with their
+ *                bytes read and written, and seeks.
+ *-----------------------------------------------------------------------*/
+RemuxStats remux(const std::string &input,
+                 const std::string &output,
+                 const PacketIndex &index,
+                 const EditDecisionList &edl,
+                 Metrics *metrics = nullptr);
+
+}
@@ -0,0 +1,239 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file renderer.h
+ * Native render path: decode the source according to a render schedule
+ * and encode frames in destination order, with the soundtrack reordered
+ * to match.
+ *-----------------------------------------------------------------------*/
+
+#include "lumin/decoder.h"
+#include "lumin/edl.h"
+#include "lumin/encoder.h"
+#include "lumin/frame_cache.h"
+#include "lumin/packet_index.h"
+#include "lumin/pipeline.h"
+#include "lumin/read_ahead.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace lumin
+{
+
+enum RenderMode
+{
+    /**------------------------------------------------------------------------
+     * Decode in source order according to a RenderSchedule.
+     *-----------------------------------------------------------------------*/
+    RENDER_SCHEDULED,
+
+    /**------------------------------------------------------------------------
+     * Request frames in destination order through an LRU FrameCache.
+     * Uses less memory than a schedule, at the cost of more seeks.
+     *-----------------------------------------------------------------------*/
+    RENDER_CACHED
+};
+
+class RenderOptions
+{
+public:
+    RenderMode mode = RENDER_SCHEDULED;
+
+    /**------------------------------------------------------------------------
+     * Bytes of decoded frames to hold in memory at once. Determines how
+     * many destination frames each render pass covers, and so how many
+     * passes over the source are needed.
+     *-----------------------------------------------------------------------*/
+    size_t memory_budget = (size_t) 2 << 30;
+
+    /**------------------------------------------------------------------------
+     * If set, and the whole output doesn't fit in `memory_budget`, decode
+     * the source in a single forward pass and spill decoded frames to a
+     * temporary file in this directory, rather than making several passes.
+     * The decoded soundtrack is kept here too ($TMPDIR if unset).
+     *-----------------------------------------------------------------------*/
+    std::string spill_directory;
+
+    /**------------------------------------------------------------------------
+     * Hold references to the decoder's frame buffers and pass them
+     * straight to the encoder. Disable to copy frames into a preallocated
+     * pool instead, for decoders with a small fixed pool of surfaces.
+     *-----------------------------------------------------------------------*/
+    bool zero_copy = true;
+
+    /**------------------------------------------------------------------------
+     * Bytes of decoded frames to cache in RENDER_CACHED mode.
+     *-----------------------------------------------------------------------*/
+    size_t cache_budget = (size_t) 512 << 20;
+
+    /**------------------------------------------------------------------------
+     * Copy compressed packets in EDL order without decoding, if every run
+     * is made of whole closed GOPs (see can_remux()). Falls back to
+     * decoding and re-encoding otherwise.
+     *-----------------------------------------------------------------------*/
+    bool stream_copy = false;
+
+    /**------------------------------------------------------------------------
+     * Reorder and encode the source's soundtrack along with the video.
+     * Not supported when stream copying.
+     *-----------------------------------------------------------------------*/
+    bool audio = true;
+
+    /**------------------------------------------------------------------------
+     * Seconds of crossfade between audio runs (see remap_audio()).
+     *-----------------------------------------------------------------------*/
+    double crossfade = 0.0;
+
+    /**------------------------------------------------------------------------
+     * Decode with NVDEC and pass the GPU surfaces straight to the encoder,
+     * which must accept CUDA frames (e.g. h264_nvenc). Frames are held
+     * by reference, so `memory_budget` is GPU memory, and
+     * `spill_directory` and `zero_copy` are ignored. Scheduled mode only.
+     *-----------------------------------------------------------------------*/
+    bool cuda = false;
+
+    /**------------------------------------------------------------------------
+     * Otherwise, decode with this hardware decoder, falling back to
+     * software for streams it can't decode. Frames are downloaded to host
+     * memory as they are decoded, so they are held and encoded exactly
+     * as software frames are.
+     *-----------------------------------------------------------------------*/
+    HardwareDecode hardware = HARDWARE_DECODE_NONE;
+
+    EncoderOptions encoder;
+
+    /**------------------------------------------------------------------------
+     * If set, rendering is timed as "index", "audio" and "render" phases,
+     * with frames written as progress, and the decoder, encoder, frame
+     * cache and encode queue report into it. Overrides encoder.metrics.
+     *-----------------------------------------------------------------------*/
+    Metrics *metrics = nullptr;
+
+    /**------------------------------------------------------------------------
+     * Path of a raw frame store written by analysis (see frame_store.h).
+     * If it is valid for the source and covers the EDL, frames are read
+     * from it by index, with no seeking or decoding, in either mode.
+     * Otherwise it is ignored. Not used with `cuda`.
+     *-----------------------------------------------------------------------*/
+    std::string frame_store_path;
+
+    /**------------------------------------------------------------------------
+     * If set, render the output in chunks of this many destination
+     * frames, each encoded separately into `chunk_directory` and then
+     * joined by stream copy (see chunks.h). A render that is interrupted
+     * resumes from the chunks already complete. 0 renders in one piece.
+     *-----------------------------------------------------------------------*/
+    size_t chunk_frames = 0;
+
+    /**------------------------------------------------------------------------
+     * Where chunks and their completion markers are kept until joined
+     * (default: the output path with a .chunks suffix).
+     *-----------------------------------------------------------------------*/
+    std::string chunk_directory;
+
+    /**------------------------------------------------------------------------
+     * Chunks to encode at once, or 0 for a quarter of the hardware threads.
+     *-----------------------------------------------------------------------*/
+    int chunk_workers = 0;
+
+    /**------------------------------------------------------------------------
+     * Encode only the chunks whose index modulo `chunk_shard_count` is
+     * `chunk_shard`, so that machines sharing `chunk_directory` can split
+     * a render between them. The first to find every chunk complete
+     * joins them, holding a marker in the chunk directory so that no
+     * other shard joins at the same time.
+     *-----------------------------------------------------------------------*/
+    size_t chunk_shard = 0;
+    size_t chunk_shard_count = 1;
+
+    /**------------------------------------------------------------------------
+     * Packet index of the source, if the caller already has one, which
+     * must outlive the render. Otherwise the source is indexed as needed.
+     *-----------------------------------------------------------------------*/
+    const PacketIndex *packet_index = nullptr;
+
+    /**------------------------------------------------------------------------
+     * Otherwise, path of a packet index file (see sidecar.h) caching it,
+     * or empty to index the source every time.
+     *-----------------------------------------------------------------------*/
+    std::string packet_index_path;
+
+    /**------------------------------------------------------------------------
+     * Identity of the source, if the caller already has it, which must
+     * outlive the call. Otherwise it is computed at most once, when a
+     * cache needs checking.
+     *-----------------------------------------------------------------------*/
+    const SourceKey *source_key = nullptr;
+
+    /**------------------------------------------------------------------------
+     * If set, read the source through a ReadAheadFile holding this many
+     * bytes, which fetches the packets of the next spans of the schedule
+     * (or runs of the EDL, in RENDER_CACHED mode) while the current one
+     * decodes. For sources on network mounts; 0 reads through
+     * libavformat directly. Chunked renders share it between workers.
+     *-----------------------------------------------------------------------*/
+    size_t read_ahead = 0;
+
+    /**------------------------------------------------------------------------
+     * Read-ahead file of the source to read through, if the caller
+     * already has one, in place of `read_ahead`. It must outlive the
+     * render, and its stats are left to the caller.
+     *-----------------------------------------------------------------------*/
+    ReadAheadFile *read_ahead_file = nullptr;
+};
+
+class RenderStats
+{
+public:
+    size_t passes = 0;
+    size_t seeks = 0;
+    size_t frames_decoded = 0;
+    size_t frames_written = 0;
+    CacheStats cache;
+
+    /**------------------------------------------------------------------------
+     * True if the output was stream copied, in which case frames_written
+     * counts packets and nothing was decoded.
+     *-----------------------------------------------------------------------*/
+    bool stream_copied = false;
+
+    /**------------------------------------------------------------------------
+     * Frames were read from the frame store rather than decoded.
+     *-----------------------------------------------------------------------*/
+    bool frame_store_used = false;
+
+    /**------------------------------------------------------------------------
+     * For chunked renders: the number of chunks, how many were encoded
+     * by this call rather than found complete, whether the output was
+     * joined, and whether it was left to another shard already joining
+     * it. Other counts cover only the chunks encoded.
+     *-----------------------------------------------------------------------*/
+    size_t chunks = 0;
+    size_t chunks_rendered = 0;
+    bool chunks_joined = false;
+    bool chunks_joined_elsewhere = false;
+
+    /**------------------------------------------------------------------------
+     * Reads through the read-ahead cache, if `read_ahead` was set.
+     *-----------------------------------------------------------------------*/
+    ReadAheadStats read_ahead;
+
+    /**------------------------------------------------------------------------
+     * Timing of the decode stage (on the calling thread) and the encode
+     * stage (on its own thread). The busier one is the bottleneck.
+     *-----------------------------------------------------------------------*/
+    std::vector<StageStats> stages;
+};
+
+/**------------------------------------------------------------------------
+ * Render the video stream and soundtrack of `input` reordered by `edl`
+ * to `output`.
+ *-----------------------------------------------------------------------*/
+RenderStats render(const std::string &input,
+                   const std::string &output,
+                   const EditDecisionList &edl,
+                   const RenderOptions &options = RenderOptions());
+
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file reorder.h
+ * Incremental re-ordering: derive the permutation for new OrderOptions
+ * from one already computed, touching only the brightness buckets that
+ * change, and report which output runs differ.
+ *-----------------------------------------------------------------------*/
+
+#include "lumin/edl.h"
+#include "lumin/packet_index.h"
+#include "lumin/permutation.h"
+#include "lumin/series.h"
+
+#include <cstddef>
+#include <vector>
+
+namespace lumin
+{
+
+class ReorderResult
+{
+public:
+    Permutation permutation;
+    EditDecisionList edl;
+
+    /**------------------------------------------------------------------------
+     * Indices into `edl` of the runs that are not in the previous EDL,
+     * and so must be re-rendered.
+     *-----------------------------------------------------------------------*/
+    std::vector<size_t> changed_runs;
+
+    /**------------------------------------------------------------------------
+     * Destination frame ranges covered by `changed_runs`, coalesced.
+     * Output outside these ranges is identical to the previous render.
+     *-----------------------------------------------------------------------*/
+    std::vector<FrameRange> changed_ranges;
+
+    size_t get_changed_frame_count() const;
+};
+
+/**------------------------------------------------------------------------
+ * Re-order `series` with `options`, given `previous`, the result of
+ * order(series, previous_options). The result is identical to
+ * order(series, options).
+ *
+ * The previous permutation is split into its buckets of equal
+ * brightness. Flipping `reverse` reverses the bucket order. A
+ * precision change re-sorts each bucket by its new keys, and merges
+ * it with its neighbours only where their new keys overlap: buckets
+ * whose frames all still share a key are left as they are. If either
+ * options constrain runs, the order is made from scratch, and only the
+ * runs are compared.
+ *
+ * Throws invalid_argument_exception if `previous` is not ordered by
+ * `previous_options`.
+ *-----------------------------------------------------------------------*/
+ReorderResult reorder(const LuminanceSeries &series,
+                      const Permutation &previous,
+                      const OrderOptions &previous_options,
+                      const OrderOptions &options);
+
+}
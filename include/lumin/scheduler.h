@@ -0,0 +1,101 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file scheduler.h
+ * Render scheduling: turns an EDL into passes that each decode the
+ * source in one forward sweep, so that frames are emitted in
+ * destination order without seeking back and forth for every run.
+ *-----------------------------------------------------------------------*/
+
+#include "lumin/edl.h"
+#include "lumin/packet_index.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace lumin
+{
+
+/**------------------------------------------------------------------------
+ * Source frames [start, end), all of which are needed by the pass.
+ * If `seek` is set, the decoder seeks to the keyframe before `start`;
+ * otherwise it decodes through from wherever the previous span ended.
+ *-----------------------------------------------------------------------*/
+class DecodeSpan
+{
+public:
+    uint32_t start;
+    uint32_t end;
+    bool seek;
+};
+
+/**------------------------------------------------------------------------
+ * A window of destination frames whose source frames are decoded, held
+ * and then emitted together. Spans are in ascending source order.
+ *-----------------------------------------------------------------------*/
+class RenderPass
+{
+public:
+    FrameRange dest_range;
+    std::vector<DecodeSpan> spans;
+};
+
+class RenderSchedule
+{
+public:
+    std::vector<RenderPass> passes;
+
+    /**------------------------------------------------------------------------
+     * Number of seeks the schedule performs.
+     *-----------------------------------------------------------------------*/
+    size_t get_seek_count() const;
+
+    /**------------------------------------------------------------------------
+     * Estimated number of frames decoded, including frames decoded only
+     * to reach a span from the preceding keyframe or previous span.
+     *-----------------------------------------------------------------------*/
+    size_t get_decode_count() const;
+
+    /**------------------------------------------------------------------------
+     * Estimated decode cost of each span, parallel to `passes`.
+     *-----------------------------------------------------------------------*/
+    std::vector<std::vector<size_t>> decode_costs;
+};
+
+/**------------------------------------------------------------------------
+ * Plan the render of `edl` holding at most `frames_per_pass` decoded
+ * frames at a time. `keyframes` are the source's keyframe indices in
+ * presentation order (see PacketIndex); decoding through to the next
+ * span is preferred over seeking whenever the seek would not land past
+ * the current decode position.
+ *-----------------------------------------------------------------------*/
+RenderSchedule schedule_render(const EditDecisionList &edl,
+                               const std::vector<size_t> &keyframes,
+                               size_t frames_per_pass);
+
+/**------------------------------------------------------------------------
+ * Keeps the output timeline intact when frames fail to decode. Each
+ * missing destination frame is replaced by the last good frame before
+ * it, whichever pass that was in, or at the start of the output, where
+ * there is none, by the first good frame after it.
+ *-----------------------------------------------------------------------*/
+class GapFiller
+{
+public:
+    GapFiller();
+
+    /**------------------------------------------------------------------------
+     * Account for the next destination frame, which decoded if `present`,
+     * and return how many times to write the last good frame, which is
+     * this one if present: 1 to fill a gap, or more for a first good
+     * frame that covers the gap before it. 0 until a frame has decoded.
+     *-----------------------------------------------------------------------*/
+    size_t next(bool present);
+
+private:
+    bool started;
+    size_t missing;
+};
+
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file series.h
+ * The per-frame series of a frame metric produced by the analysis pass.
+ *-----------------------------------------------------------------------*/
+
+#include "lumin/rational.h"
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace lumin
+{
+
+class LuminanceSeries
+{
+public:
+    LuminanceSeries();
+    LuminanceSeries(Rational frame_rate, std::vector<double> values = {});
+
+    /**------------------------------------------------------------------------
+     * Frame rate used to convert frame indices to offsets, in frames/sec:
+     * the stream's own rate, e.g. 30000/1001, unrounded.
+     *-----------------------------------------------------------------------*/
+    Rational get_frame_rate() const;
+
+    /**------------------------------------------------------------------------
+     * Number of frames in the series.
+     *-----------------------------------------------------------------------*/
+    size_t size() const;
+
+    /**------------------------------------------------------------------------
+     * Offset of frame `index`, in seconds.
+     *-----------------------------------------------------------------------*/
+    double get_offset(size_t index) const;
+
+    /**------------------------------------------------------------------------
+     * Value of frame `index`, unrounded, in [0..1].
+     *-----------------------------------------------------------------------*/
+    double get_value(size_t index) const;
+
+    /**------------------------------------------------------------------------
+     * Returns the series as a list of (offset_seconds, value) pairs,
+     * as built by the analysis stage of reorder.py.
+     *-----------------------------------------------------------------------*/
+    std::vector<std::pair<double, double>> get_pairs() const;
+
+    void append(double value);
+
+    const std::vector<double> &get_values() const;
+
+private:
+    Rational frame_rate;
+    std::vector<double> values;
+};
+
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file sidecar.h
+ * Persistent luminance index: the raw, unrounded series of one or more
+ * frame metrics (see frame_metric.h) of a source file, stored in a
+ * compact memory-mappable binary file so that re-ordering with different
+ * parameters, or by a different metric, does not repeat the analysis.
+ *
+ * Layout (native byte order):
+ *   SidecarHeader, followed by the source path (path_length bytes)
+ *   char names[column_count][32], each metric name NUL-padded
+ *   padding to data_offset, a multiple of 4096
+ *   double values[column_count][frame_count]
+ *
+ * Alongside it, a packet index file caches the source's PacketIndex, so
+ * that it is demuxed only once rather than every time frames are
+ * located:
+ *   PacketIndexHeader, followed by the source path (path_length bytes)
+ *   padding to data_offset, a multiple of 4096
+ *   PacketIndexRecord records[entry_count], in decode order
+ *-----------------------------------------------------------------------*/
+
+#include "lumin/packet_index.h"
+#include "lumin/series.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace lumin
+{
+
+/**------------------------------------------------------------------------
+ * Identifies a particular version of a source file. The content hash is
+ * taken over sampled blocks from the start, middle and end of the file,
+ * so that computing it does not read the whole file.
+ *-----------------------------------------------------------------------*/
+class SourceKey
+{
+public:
+    /**------------------------------------------------------------------------
+     * Stat and hash the file at `path`. Throws io_exception on failure.
+     *-----------------------------------------------------------------------*/
+    static SourceKey from_file(const std::string &path);
+
+    bool operator==(const SourceKey &other) const;
+    bool operator!=(const SourceKey &other) const;
+
+    std::string path;
+    uint64_t size = 0;
+    int64_t mtime_ns = 0;
+    uint64_t content_hash = 0;
+};
+
+struct SidecarHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t data_offset;
+    uint64_t frame_count;
+    int64_t frame_rate_num;
+    int64_t frame_rate_den;
+    uint32_t column_count;
+    uint32_t path_length;
+    uint64_t source_size;
+    int64_t source_mtime_ns;
+    uint64_t content_hash;
+};
+
+class LuminanceIndex
+{
+public:
+    static const uint32_t VERSION = 3;
+    static const size_t COLUMN_NAME_SIZE = 32;
+
+    /**------------------------------------------------------------------------
+     * The series covers the whole source, rather than a cropped prefix.
+     *-----------------------------------------------------------------------*/
+    static const uint32_t FLAG_COMPLETE = 1 << 0;
+
+    ~LuminanceIndex();
+
+    LuminanceIndex(const LuminanceIndex &) = delete;
+    LuminanceIndex &operator=(const LuminanceIndex &) = delete;
+
+    /**------------------------------------------------------------------------
+     * Map the index file at `path`. Returns nullptr if the file does not
+     * exist or is not a valid index.
+     *-----------------------------------------------------------------------*/
+    static std::unique_ptr<LuminanceIndex> open(const std::string &path);
+
+    /**------------------------------------------------------------------------
+     * Write `columns`, the series of the metrics in `names`, as an index
+     * for the source identified by `key`. The series must have the same
+     * frame rate and length. The file is written to a temporary path and
+     * renamed into place, so readers never see a partial index.
+     *-----------------------------------------------------------------------*/
+    static void write(const std::string &path,
+                      const SourceKey &key,
+                      const std::vector<std::string> &names,
+                      const std::vector<LuminanceSeries> &columns,
+                      uint32_t flags);
+
+    /**------------------------------------------------------------------------
+     * Default index path for a source: alongside it, with a .lumin suffix.
+     *-----------------------------------------------------------------------*/
+    static std::string get_default_path(const std::string &source_path);
+
+    /**------------------------------------------------------------------------
+     * True if the index was built from `key`.
+     *-----------------------------------------------------------------------*/
+    bool matches(const SourceKey &key) const;
+
+    SourceKey get_source_key() const;
+    uint32_t get_flags() const;
+    Rational get_frame_rate() const;
+    size_t get_frame_count() const;
+
+    size_t get_column_count() const;
+    std::string get_column_name(size_t column) const;
+
+    /**------------------------------------------------------------------------
+     * Index of the column holding metric `name`, or -1 if there is none.
+     *-----------------------------------------------------------------------*/
+    int find_column(const std::string &name) const;
+
+    /**------------------------------------------------------------------------
+     * The mapped values of `column`, valid for the lifetime of the index.
+     *-----------------------------------------------------------------------*/
+    const double *get_values(size_t column) const;
+
+    /**------------------------------------------------------------------------
+     * Copy the first `frame_count` values (default: all) of `column` into
+     * a series.
+     *-----------------------------------------------------------------------*/
+    LuminanceSeries to_series(size_t column, size_t frame_count = SIZE_MAX) const;
+
+private:
+    LuminanceIndex(void *mapping, size_t mapping_size);
+
+    void *mapping;
+    size_t mapping_size;
+    const SidecarHeader *header;
+};
+
+struct PacketIndexHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t data_offset;
+    uint64_t entry_count;
+    int64_t time_base_num;
+    int64_t time_base_den;
+    int64_t frame_rate_num;
+    int64_t frame_rate_den;
+    uint32_t path_length;
+    uint32_t reserved;
+    uint64_t source_size;
+    int64_t source_mtime_ns;
+    uint64_t content_hash;
+};
+
+/**------------------------------------------------------------------------
+ * A PacketIndexEntry as stored, without padding.
+ *-----------------------------------------------------------------------*/
+struct PacketIndexRecord
+{
+    int64_t pts;
+    int64_t dts;
+    int64_t pos;
+    int32_t size;
+    uint32_t flags;
+};
+
+class PacketIndexFile
+{
+public:
+    static const uint32_t VERSION = 1;
+    static const uint32_t RECORD_KEYFRAME = 1 << 0;
+
+    /**------------------------------------------------------------------------
+     * Read the packet index file at `path` into `index`. Returns false,
+     * leaving `index` as it was, if the file does not exist, is not a
+     * valid packet index, or was not built from `key`. The records are
+     * read in place from the mapped file, which stays mapped while
+     * `index` or a copy of it is alive.
+     *-----------------------------------------------------------------------*/
+    static bool read(const std::string &path, const SourceKey &key, PacketIndex &index);
+
+    /**------------------------------------------------------------------------
+     * Write `index` as the packet index of the source identified by
+     * `key`, replacing the file atomically as LuminanceIndex::write()
+     * does. Throws io_exception on failure.
+     *-----------------------------------------------------------------------*/
+    static void write(const std::string &path, const SourceKey &key, const PacketIndex &index);
+
+    /**------------------------------------------------------------------------
+     * Default packet index path for a luminance index: alongside it, with
+     * a .packets suffix.
+     *-----------------------------------------------------------------------*/
+    static std::string get_default_path(const std::string &index_path);
+};
+
+}
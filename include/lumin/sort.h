@@ -0,0 +1,82 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file sort.h
+ * Stable sort of (key, frame) records, for ordering very long inputs.
+ * Records are held as a struct of arrays and sorted by LSD radix sort on
+ * the key. Past a memory budget, sorted runs are spilled to temporary
+ * files and merged.
+ *-----------------------------------------------------------------------*/
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace lumin
+{
+
+/**------------------------------------------------------------------------
+ * Map a signed key to an unsigned one with the same order.
+ *-----------------------------------------------------------------------*/
+inline uint64_t encode_sort_key(int64_t key)
+{
+    return (uint64_t) key ^ ((uint64_t) 1 << 63);
+}
+
+/**------------------------------------------------------------------------
+ * Sort `frames` by `keys`, in place and stably. Passes over bytes in
+ * which every key is the same are skipped, so keys quantised to a few
+ * decimal places take one or two passes.
+ *-----------------------------------------------------------------------*/
+void radix_sort(std::vector<uint64_t> &keys, std::vector<uint32_t> &frames);
+
+class KeySorter
+{
+public:
+    /**------------------------------------------------------------------------
+     * @param memory_budget   Bytes of records (and radix sort scratch) to
+     *                        hold in memory, or 0 for no limit.
+     * @param spill_directory Directory for sorted runs beyond the budget
+     *                        (default: $TMPDIR, or /tmp).
+     *-----------------------------------------------------------------------*/
+    KeySorter(size_t memory_budget = 0, const std::string &spill_directory = "");
+    ~KeySorter();
+
+    KeySorter(const KeySorter &) = delete;
+    KeySorter &operator=(const KeySorter &) = delete;
+
+    /**------------------------------------------------------------------------
+     * Add a record. Frames must be added in increasing order, which is
+     * what makes the sort stable across spilled runs.
+     *-----------------------------------------------------------------------*/
+    void add(uint64_t key, uint32_t frame);
+
+    /**------------------------------------------------------------------------
+     * Sort all records added so far, returning their frames in key order.
+     *-----------------------------------------------------------------------*/
+    std::vector<uint32_t> finish();
+
+    /**------------------------------------------------------------------------
+     * Number of sorted runs spilled to disk.
+     *-----------------------------------------------------------------------*/
+    size_t get_spill_count() const;
+
+    /**------------------------------------------------------------------------
+     * Bytes per record while sorting: key, frame and radix scratch.
+     *-----------------------------------------------------------------------*/
+    static const size_t RECORD_BYTES = 2 * (sizeof(uint64_t) + sizeof(uint32_t));
+
+private:
+    void spill();
+
+    size_t capacity;
+    std::string spill_directory;
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> frames;
+    std::vector<int> spill_fds;
+    std::vector<size_t> spill_sizes;
+    size_t count;
+};
+
+}
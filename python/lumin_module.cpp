@@ -0,0 +1,363 @@
+/*------------------------------------------------------------------------
+ * lumin: Python bindings for the lumin engine, so that many jobs can run
+ * in one process, without starting lumin-order or probing the source
+ * for each.
+ *
+ *   import lumin
+ *
+ *   series = lumin.analyse("input.mp4", lumin.AnalysisOptions())
+ *   series.values                # float64 numpy view of the series
+ *
+ *   options = lumin.OrderOptions()
+ *   options.decimal_places = 1
+ *   permutation = lumin.order(series, options)
+ *   permutation.source_frames    # uint32 numpy view of the permutation
+ *
+ *   edl = lumin.EditDecisionList.from_permutation(permutation)
+ *   index = lumin.index_packets("input.mp4")
+ *   lumin.render("input.mp4", "out.mp4", edl, lumin.RenderOptions(), index)
+ *
+ * Arrays returned by properties are read-only views into the object
+ * they came from, which they keep alive. Frame rates are Fractions.
+ * Analysis, ordering and rendering release the GIL, so jobs can run on
+ * several Python threads at once.
+ *-----------------------------------------------------------------------*/
+
+#include "lumin/lumin.h"
+
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace py = pybind11;
+
+/*------------------------------------------------------------------------
+ * A read-only view of `rows` x `columns` items at `data`, kept alive by
+ * `owner`, the Python object that holds them. Rows are `row_stride`
+ * bytes apart.
+ *-----------------------------------------------------------------------*/
+template <typename T>
+static py::array_t<T> make_view(const T *data, size_t rows, size_t columns, size_t row_stride, py::handle owner)
+{
+    std::vector<py::ssize_t> shape = { (py::ssize_t) rows };
+    std::vector<py::ssize_t> strides = { (py::ssize_t) row_stride };
+    if (columns > 1)
+    {
+        shape.push_back((py::ssize_t) columns);
+        strides.push_back((py::ssize_t) sizeof(T));
+    }
+    py::array_t<T> view(shape, strides, data, owner);
+    view.attr("flags").attr("writeable") = false;
+    return view;
+}
+
+template <typename T>
+static py::array_t<T> make_view(const std::vector<T> &values, py::handle owner)
+{
+    return make_view(values.data(), values.size(), 1, sizeof(T), owner);
+}
+
+/*------------------------------------------------------------------------
+ * A writable array that owns `values`.
+ *-----------------------------------------------------------------------*/
+template <typename T>
+static py::array_t<T> make_array(std::vector<T> values)
+{
+    std::vector<T> *owned = new std::vector<T>(std::move(values));
+    py::capsule owner(owned, [](void *pointer) { delete (std::vector<T> *) pointer; });
+    return py::array_t<T>({ (py::ssize_t) owned->size() }, { (py::ssize_t) sizeof(T) }, owned->data(), owner);
+}
+
+static py::object to_fraction(lumin::Rational rate)
+{
+    return py::module_::import("fractions").attr("Fraction")(rate.num, rate.den);
+}
+
+/*------------------------------------------------------------------------
+ * Accepts a Fraction, an int, or anything else with a numerator and
+ * denominator.
+ *-----------------------------------------------------------------------*/
+static lumin::Rational from_fraction(py::handle rate)
+{
+    return lumin::Rational(rate.attr("numerator").cast<int64_t>(), rate.attr("denominator").cast<int64_t>());
+}
+
+PYBIND11_MODULE(lumin, module)
+{
+    module.doc() = "Reorder video frames by brightness";
+
+    /*------------------------------------------------------------------------
+     * Engine exceptions, as the nearest Python ones.
+     *-----------------------------------------------------------------------*/
+    py::register_exception<lumin::io_exception>(module, "IOException", PyExc_IOError);
+    py::register_exception<lumin::decode_exception>(module, "DecodeException", PyExc_RuntimeError);
+    py::register_exception<lumin::invalid_argument_exception>(module, "InvalidArgumentException",
+                                                              PyExc_ValueError);
+
+    py::enum_<lumin::HardwareDecode>(module, "HardwareDecode")
+        .value("NONE", lumin::HARDWARE_DECODE_NONE)
+        .value("AUTO", lumin::HARDWARE_DECODE_AUTO)
+        .value("CUDA", lumin::HARDWARE_DECODE_CUDA)
+        .value("VAAPI", lumin::HARDWARE_DECODE_VAAPI)
+        .value("VIDEOTOOLBOX", lumin::HARDWARE_DECODE_VIDEOTOOLBOX);
+
+    py::enum_<lumin::RenderMode>(module, "RenderMode")
+        .value("SCHEDULED", lumin::RENDER_SCHEDULED)
+        .value("CACHED", lumin::RENDER_CACHED);
+
+    /*------------------------------------------------------------------------
+     * Series, permutations and EDLs
+     *-----------------------------------------------------------------------*/
+    py::class_<lumin::LuminanceSeries>(module, "LuminanceSeries")
+        .def(py::init([](py::handle frame_rate, std::vector<double> values) {
+                 return lumin::LuminanceSeries(from_fraction(frame_rate), std::move(values));
+             }),
+             py::arg("frame_rate"), py::arg("values"))
+        .def("__len__", &lumin::LuminanceSeries::size)
+        .def_property_readonly("frame_rate",
+                               [](const lumin::LuminanceSeries &series) {
+                                   return to_fraction(series.get_frame_rate());
+                               })
+        .def_property_readonly("values",
+                               [](py::object self) {
+                                   return make_view(self.cast<const lumin::LuminanceSeries &>().get_values(), self);
+                               })
+        .def("get_offset", &lumin::LuminanceSeries::get_offset, py::arg("index"));
+
+    py::class_<lumin::Permutation>(module, "Permutation")
+        .def(py::init([](py::handle frame_rate, std::vector<uint32_t> source_frames) {
+                 return lumin::Permutation(from_fraction(frame_rate), std::move(source_frames));
+             }),
+             py::arg("frame_rate"), py::arg("source_frames"))
+        .def("__len__", &lumin::Permutation::size)
+        .def_property_readonly("frame_rate",
+                               [](const lumin::Permutation &permutation) {
+                                   return to_fraction(permutation.get_frame_rate());
+                               })
+        .def_property_readonly("source_frames",
+                               [](py::object self) {
+                                   return make_view(self.cast<const lumin::Permutation &>().get_source_frames(),
+                                                    self);
+                               })
+        .def("get_inverse",
+             [](const lumin::Permutation &permutation) { return make_array(permutation.get_inverse()); })
+        .def("remap", &lumin::Permutation::remap, py::arg("t"));
+
+    py::class_<lumin::EditDecisionList>(module, "EditDecisionList")
+        .def_static("from_permutation", &lumin::EditDecisionList::from_permutation, py::arg("permutation"))
+        .def("to_permutation", &lumin::EditDecisionList::to_permutation)
+        .def("__len__", &lumin::EditDecisionList::size)
+        .def_property_readonly("frame_rate",
+                               [](const lumin::EditDecisionList &edl) { return to_fraction(edl.get_frame_rate()); })
+        .def_property_readonly("frame_count", &lumin::EditDecisionList::get_frame_count)
+
+        /*------------------------------------------------------------------------
+         * One (source_start, length, dest_start) row per run.
+         *-----------------------------------------------------------------------*/
+        .def_property_readonly("runs",
+                               [](py::object self) {
+                                   const std::vector<lumin::EditRun> &runs =
+                                       self.cast<const lumin::EditDecisionList &>().get_runs();
+                                   return make_view((const uint32_t *) runs.data(), runs.size(), 3,
+                                                    sizeof(lumin::EditRun), self);
+                               })
+        .def("slice", &lumin::EditDecisionList::slice, py::arg("dest_start"), py::arg("dest_end"));
+
+    /*------------------------------------------------------------------------
+     * A packet index can be shared by every render of the same source, so
+     * that it is only probed once.
+     *-----------------------------------------------------------------------*/
+    py::class_<lumin::PacketIndex>(module, "PacketIndex")
+        .def_property_readonly("frame_count", &lumin::PacketIndex::get_frame_count)
+        .def_property_readonly("frame_rate",
+                               [](const lumin::PacketIndex &index) { return to_fraction(index.get_frame_rate()); })
+        .def_property_readonly("keyframes",
+                               [](py::object self) {
+                                   return make_view(self.cast<const lumin::PacketIndex &>().get_keyframes(), self);
+                               })
+        .def("has_timestamps", &lumin::PacketIndex::has_timestamps)
+        .def("has_unique_timestamps", &lumin::PacketIndex::has_unique_timestamps);
+
+    module.def("index_packets", &lumin::index_packets, py::arg("path"), py::call_guard<py::gil_scoped_release>());
+    module.def(
+        "load_packet_index",
+        [](const std::string &path, const std::string &cache_path) {
+            return lumin::load_packet_index(path, cache_path);
+        },
+        py::arg("path"), py::arg("cache_path"), py::call_guard<py::gil_scoped_release>());
+
+    /*------------------------------------------------------------------------
+     * Options
+     *-----------------------------------------------------------------------*/
+    py::class_<lumin::FrameSampling>(module, "FrameSampling")
+        .def(py::init<>())
+        .def_readwrite("left", &lumin::FrameSampling::left)
+        .def_readwrite("top", &lumin::FrameSampling::top)
+        .def_readwrite("width", &lumin::FrameSampling::width)
+        .def_readwrite("height", &lumin::FrameSampling::height)
+        .def_readwrite("step", &lumin::FrameSampling::step);
+
+    py::class_<lumin::AnalysisOptions>(module, "AnalysisOptions")
+        .def(py::init<>())
+        .def_readwrite("duration", &lumin::AnalysisOptions::duration)
+        .def_readwrite("metric", &lumin::AnalysisOptions::metric)
+        .def_readwrite("extra_metrics", &lumin::AnalysisOptions::extra_metrics)
+        .def_readwrite("sampling", &lumin::AnalysisOptions::sampling)
+        .def_readwrite("threads", &lumin::AnalysisOptions::threads)
+        .def_readwrite("index_path", &lumin::AnalysisOptions::index_path)
+        .def_readwrite("packet_index_path", &lumin::AnalysisOptions::packet_index_path)
+        .def_readwrite("proxy", &lumin::AnalysisOptions::proxy)
+        .def_readwrite("refine_decimal_places", &lumin::AnalysisOptions::refine_decimal_places)
+        .def_readwrite("refine_margin", &lumin::AnalysisOptions::refine_margin)
+        .def_readwrite("hardware", &lumin::AnalysisOptions::hardware)
+        .def_readwrite("frame_store_path", &lumin::AnalysisOptions::frame_store_path);
+
+    py::class_<lumin::OrderOptions>(module, "OrderOptions")
+        .def(py::init<>())
+        .def_readwrite("decimal_places", &lumin::OrderOptions::decimal_places)
+        .def_readwrite("reverse", &lumin::OrderOptions::reverse)
+        .def_readwrite("min_run_length", &lumin::OrderOptions::min_run_length)
+        .def_readwrite("run_tolerance", &lumin::OrderOptions::run_tolerance)
+        .def_readwrite("shot_threshold", &lumin::OrderOptions::shot_threshold)
+        .def_readwrite("memory_budget", &lumin::OrderOptions::memory_budget)
+        .def_readwrite("spill_directory", &lumin::OrderOptions::spill_directory);
+
+    py::class_<lumin::EncoderOptions>(module, "EncoderOptions")
+        .def(py::init<>())
+        .def_readwrite("codec", &lumin::EncoderOptions::codec)
+        .def_readwrite("bit_rate", &lumin::EncoderOptions::bit_rate)
+        .def_readwrite("codec_options", &lumin::EncoderOptions::codec_options)
+        .def_readwrite("audio_codec", &lumin::EncoderOptions::audio_codec)
+        .def_readwrite("audio_bit_rate", &lumin::EncoderOptions::audio_bit_rate);
+
+    py::class_<lumin::RenderOptions>(module, "RenderOptions")
+        .def(py::init<>())
+        .def_readwrite("mode", &lumin::RenderOptions::mode)
+        .def_readwrite("memory_budget", &lumin::RenderOptions::memory_budget)
+        .def_readwrite("spill_directory", &lumin::RenderOptions::spill_directory)
+        .def_readwrite("zero_copy", &lumin::RenderOptions::zero_copy)
+        .def_readwrite("cache_budget", &lumin::RenderOptions::cache_budget)
+        .def_readwrite("stream_copy", &lumin::RenderOptions::stream_copy)
+        .def_readwrite("audio", &lumin::RenderOptions::audio)
+        .def_readwrite("crossfade", &lumin::RenderOptions::crossfade)
+        .def_readwrite("cuda", &lumin::RenderOptions::cuda)
+        .def_readwrite("hardware", &lumin::RenderOptions::hardware)
+        .def_readwrite("encoder", &lumin::RenderOptions::encoder)
+        .def_readwrite("frame_store_path", &lumin::RenderOptions::frame_store_path)
+        .def_readwrite("packet_index_path", &lumin::RenderOptions::packet_index_path)
+        .def_readwrite("chunk_frames", &lumin::RenderOptions::chunk_frames)
+        .def_readwrite("chunk_directory", &lumin::RenderOptions::chunk_directory)
+        .def_readwrite("chunk_workers", &lumin::RenderOptions::chunk_workers)
+        .def_readwrite("chunk_shard", &lumin::RenderOptions::chunk_shard)
+        .def_readwrite("chunk_shard_count", &lumin::RenderOptions::chunk_shard_count)
+        .def_readwrite("read_ahead", &lumin::RenderOptions::read_ahead);
+
+    /*------------------------------------------------------------------------
+     * Results
+     *-----------------------------------------------------------------------*/
+    py::class_<lumin::StageStats>(module, "StageStats")
+        .def_readonly("name", &lumin::StageStats::name)
+        .def_readonly("wall_seconds", &lumin::StageStats::wall_seconds)
+        .def_readonly("input_wait_seconds", &lumin::StageStats::input_wait_seconds)
+        .def_readonly("output_wait_seconds", &lumin::StageStats::output_wait_seconds)
+        .def_readonly("items", &lumin::StageStats::items);
+
+    py::class_<lumin::CacheStats>(module, "CacheStats")
+        .def_readonly("hits", &lumin::CacheStats::hits)
+        .def_readonly("misses", &lumin::CacheStats::misses)
+        .def_readonly("insertions", &lumin::CacheStats::insertions)
+        .def_readonly("evictions", &lumin::CacheStats::evictions)
+        .def("get_hit_rate", &lumin::CacheStats::get_hit_rate);
+
+    py::class_<lumin::ReadAheadStats>(module, "ReadAheadStats")
+        .def_readonly("reads", &lumin::ReadAheadStats::reads)
+        .def_readonly("waits", &lumin::ReadAheadStats::waits)
+        .def_readonly("wait_seconds", &lumin::ReadAheadStats::wait_seconds)
+        .def_readonly("blocks_read", &lumin::ReadAheadStats::blocks_read)
+        .def_readonly("bytes_read", &lumin::ReadAheadStats::bytes_read)
+        .def_readonly("evictions", &lumin::ReadAheadStats::evictions);
+
+    py::class_<lumin::RenderStats>(module, "RenderStats")
+        .def_readonly("passes", &lumin::RenderStats::passes)
+        .def_readonly("seeks", &lumin::RenderStats::seeks)
+        .def_readonly("frames_decoded", &lumin::RenderStats::frames_decoded)
+        .def_readonly("frames_written", &lumin::RenderStats::frames_written)
+        .def_readonly("cache", &lumin::RenderStats::cache)
+        .def_readonly("stream_copied", &lumin::RenderStats::stream_copied)
+        .def_readonly("frame_store_used", &lumin::RenderStats::frame_store_used)
+        .def_readonly("chunks", &lumin::RenderStats::chunks)
+        .def_readonly("chunks_rendered", &lumin::RenderStats::chunks_rendered)
+        .def_readonly("chunks_joined", &lumin::RenderStats::chunks_joined)
+        .def_readonly("chunks_joined_elsewhere", &lumin::RenderStats::chunks_joined_elsewhere)
+        .def_readonly("read_ahead", &lumin::RenderStats::read_ahead)
+        .def_readonly("stages", &lumin::RenderStats::stages);
+
+    py::class_<lumin::ReorderResult>(module, "ReorderResult")
+        .def_readonly("permutation", &lumin::ReorderResult::permutation)
+        .def_readonly("edl", &lumin::ReorderResult::edl)
+        .def_readonly("changed_runs", &lumin::ReorderResult::changed_runs)
+        .def("get_changed_frame_count", &lumin::ReorderResult::get_changed_frame_count);
+
+    /*------------------------------------------------------------------------
+     * The engine
+     *-----------------------------------------------------------------------*/
+    module.def("get_frame_metric_names", &lumin::get_frame_metric_names);
+
+    module.def(
+        "analyse",
+        [](const std::string &path, const lumin::AnalysisOptions &options) { return lumin::analyse(path, options); },
+        py::arg("path"), py::arg("options") = lumin::AnalysisOptions(), py::call_guard<py::gil_scoped_release>());
+
+    module.def("order", &lumin::order, py::arg("series"), py::arg("options") = lumin::OrderOptions(),
+               py::call_guard<py::gil_scoped_release>());
+
+    module.def("reorder", &lumin::reorder, py::arg("series"), py::arg("previous"), py::arg("previous_options"),
+               py::arg("options"), py::call_guard<py::gil_scoped_release>());
+
+    /*------------------------------------------------------------------------
+     * Given `packet_index`, the source isn't indexed again.
+     *-----------------------------------------------------------------------*/
+    module.def(
+        "render",
+        [](const std::string &input, const std::string &output, const lumin::EditDecisionList &edl,
+           lumin::RenderOptions options, const lumin::PacketIndex *packet_index) {
+            options.packet_index = packet_index;
+            return lumin::render(input, output, edl, options);
+        },
+        py::arg("input"), py::arg("output"), py::arg("edl"), py::arg("options") = lumin::RenderOptions(),
+        py::arg("packet_index") = nullptr, py::call_guard<py::gil_scoped_release>());
+
+#ifdef LUMIN_HAVE_SDL
+    py::class_<lumin::PlaybackOptions>(module, "PlaybackOptions")
+        .def(py::init<>())
+        .def_readwrite("cache_budget", &lumin::PlaybackOptions::cache_budget)
+        .def_readwrite("prefetch_frames", &lumin::PlaybackOptions::prefetch_frames)
+        .def_readwrite("frame_store_path", &lumin::PlaybackOptions::frame_store_path)
+        .def_readwrite("packet_index_path", &lumin::PlaybackOptions::packet_index_path)
+        .def_readwrite("hardware", &lumin::PlaybackOptions::hardware)
+        .def_readwrite("loop", &lumin::PlaybackOptions::loop)
+        .def_readwrite("duration", &lumin::PlaybackOptions::duration)
+        .def_readwrite("fullscreen", &lumin::PlaybackOptions::fullscreen);
+
+    py::class_<lumin::PlaybackStats>(module, "PlaybackStats")
+        .def_readonly("frames_shown", &lumin::PlaybackStats::frames_shown)
+        .def_readonly("frames_late", &lumin::PlaybackStats::frames_late)
+        .def_readonly("loops", &lumin::PlaybackStats::loops)
+        .def_readonly("seeks", &lumin::PlaybackStats::seeks)
+        .def_readonly("frames_decoded", &lumin::PlaybackStats::frames_decoded)
+        .def_readonly("frame_store_used", &lumin::PlaybackStats::frame_store_used)
+        .def_readonly("refresh_rate", &lumin::PlaybackStats::refresh_rate)
+        .def_readonly("stages", &lumin::PlaybackStats::stages);
+
+    /*------------------------------------------------------------------------
+     * Must be called from the main thread.
+     *-----------------------------------------------------------------------*/
+    module.def("play", &lumin::play, py::arg("input"), py::arg("edl"), py::arg("options") = lumin::PlaybackOptions(),
+               py::call_guard<py::gil_scoped_release>());
+#endif
+}
@@ -17,12 +17,38 @@
 # <http://www.erase.net/> 
 #------------------------------------------------------------------------
 
-from moviepy.editor import VideoFileClip
 import numpy as np
 
 import argparse
-import math
+from fractions import Fraction
+import os
+import subprocess
 import sys
+from distutils.spawn import find_executable
+
+#------------------------------------------------------------------------
+# Locate the native lumin-order engine: $LUMIN_ORDER, then $PATH, then
+# a local CMake build directory.
+#------------------------------------------------------------------------
+def find_engine():
+    if os.environ.get("LUMIN_ORDER"):
+        return os.environ["LUMIN_ORDER"]
+    path = find_executable("lumin-order")
+    if path is None:
+        local = os.path.join(os.path.dirname(os.path.abspath(__file__)), "build", "lumin-order")
+        if os.path.exists(local):
+            path = local
+    return path
+
+#------------------------------------------------------------------------
+# moviepy only reports the frame rate to two decimal places. Recover
+# the NTSC rates (24000/1001, 30000/1001, ...) that it has truncated.
+#------------------------------------------------------------------------
+def get_exact_frame_rate(fps):
+    ntsc = Fraction(int(round(fps * 1.001)) * 1000, 1001)
+    if abs(float(ntsc) - fps) < 0.01 and abs(round(fps) - fps) > 0.001:
+        return ntsc
+    return Fraction(fps).limit_denominator(1001)
 
 #------------------------------------------------------------------------
 # Parse command-line arguments.
@@ -36,64 +62,211 @@ parser.add_argument('-R', dest='reverse', help='Reverse order',
     action='store_true', default=False)
 parser.add_argument('-r', dest='round', metavar='decimal_places',
     type=int, help='Luminosity precision, in decimal places, or 0 to disable rounding', default=2)
+parser.add_argument('-L', dest='min_run', metavar='frames', type=int, default=1,
+    help='Keep runs of at least this many consecutive source frames together')
+parser.add_argument('-T', dest='tolerance', metavar='buckets', type=int, default=0,
+    help='Also keep a frame with the run before it if its rounded luminosity is within this many steps')
+parser.add_argument('-E', dest='shot_threshold', metavar='threshold', type=float, default=0,
+    help='Never keep frames together across a change in luminosity of at least this much')
 parser.add_argument('-l', dest='length', metavar='duration_seconds',
     type=float, help='Duration to crop to')
+parser.add_argument('-m', dest='mode', choices=['luma', 'rgb', 'rec709', 'contrast', 'saturation', 'hue'],
+    help='Frame metric to order by (default luma): mean luma, read from the Y plane by the native engine '
+         'or computed from RGB with Rec.601 weights by moviepy; mean of RGB; or (native engine only) '
+         'Rec.709 luma, luma standard deviation, HSV saturation or hue', default='luma')
+parser.add_argument('-a', dest='extra_metrics', metavar='metric,...', type=str,
+    help='Further metrics for the native engine to keep in its index, so that ordering by them later needs no decode')
+parser.add_argument('-e', dest='engine', choices=['auto', 'native', 'moviepy'],
+    help='Analysis and render engine', default='auto')
+parser.add_argument('-q', dest='proxy', action='store_true', default=False,
+    help='Quick preview: analyse a reduced-resolution decode (native engine only)')
+parser.add_argument('-x', dest='crossfade', metavar='crossfade_ms',
+    type=float, help='Audio crossfade at each cut, in milliseconds', default=0)
+parser.add_argument('-p', dest='progress', metavar='seconds', type=float,
+    help='Print JSON progress lines from the native engine every N seconds')
 
 args = parser.parse_args()
 if args.round == 0:
     args.round = 12
 
-clip = VideoFileClip(args.input)
+engine = find_engine() if args.engine != 'moviepy' else None
+if args.engine == 'native' and engine is None:
+    print "Native engine requested but lumin-order was not found"
+    sys.exit(1)
+if engine is None and args.mode not in ('luma', 'rgb'):
+    print "Ordering by %s needs the native engine, which was not found" % args.mode
+    sys.exit(1)
 
+#------------------------------------------------------------------------
+# With the native engine, analysis, ordering and the render, soundtrack
+# included, all run in lumin-order, which renders by a decode schedule
+# rather than a seek per run and reuses the saved index. moviepy is only
+# imported without it.
+#------------------------------------------------------------------------
+if engine is not None:
+    command = [ engine ] if args.progress is None else [ engine, "-p", str(args.progress) ]
+    command += [ "render", "-m", args.mode, "-r", str(args.round), "-L", str(args.min_run),
+                 "-T", str(args.tolerance), "-E", str(args.shot_threshold), "-x", str(args.crossfade) ]
+    if args.reverse:
+        command += [ "-R" ]
+    if args.length is not None:
+        command += [ "-l", str(args.length) ]
+    if args.extra_metrics:
+        command += [ "-a", args.extra_metrics ]
+    if args.proxy:
+        command += [ "-q" ]
+    sys.exit(subprocess.call(command + [ "-o", args.output, args.input ]))
+
+from moviepy.editor import VideoFileClip, concatenate_videoclips
+clip = VideoFileClip(args.input)
 if args.length is not None:
     clip = clip.set_duration(args.length)
-
-print "Read clip, duration = %.1fs, FPS = %.1f" % (clip.duration, clip.fps)
+print "Read clip, duration = %.1fs, FPS = %.3f" % (clip.duration, clip.fps)
 
 #------------------------------------------------------------------------
-# Non-integer frame rates (e.g. 29.97) cause problems when retrieving
-# offsets. Round to an integer.
+# Frames are addressed by integer index throughout, and converted to
+# times using the exact frame rate, so that 29.97fps sources are neither
+# retimed nor have frames dropped or repeated on output. The reader is
+# given the same rate, so that each subclip time maps back to exactly
+# the frame it was computed from.
 #------------------------------------------------------------------------
-clip.fps = round(clip.fps)
+frame_rate = get_exact_frame_rate(clip.fps)
+clip.fps = clip.reader.fps = float(frame_rate)
 
 #------------------------------------------------------------------------
-# Transform brightnesses into a list of (offset_seconds, brightness) 
+# Measure the brightness of each frame, into a flat array. There is no
+# Y plane to read here, so luma is weighted from the mean of each RGB
+# channel, as full-range Rec.601 Y would be.
 #------------------------------------------------------------------------
+REC601_WEIGHTS = np.array([ 0.299, 0.587, 0.114 ])
+
 print "Analysing brightness ...."
-brightnesses = [ (index / clip.fps, round(np.mean(frame) / 255.0, args.round)) for index, frame in enumerate(clip.iter_frames()) ]
+if args.mode == 'luma':
+    measure = lambda frame: np.dot(frame.reshape(-1, 3).mean(axis=0), REC601_WEIGHTS) / 255.0
+else:
+    measure = lambda frame: np.mean(frame) / 255.0
+values = np.fromiter((measure(frame) for frame in clip.iter_frames()), dtype=np.float64)
+
+#------------------------------------------------------------------------
+# Quantise each brightness to an integer count of 10^-r, rounding half
+# away from zero as round() does, and sort ascending. The sort is stable,
+# so source order is kept within each brightness value. This yields the
+# dense permutation: for each destination frame, the index of the
+# source frame to show there.
+#------------------------------------------------------------------------
+scale = 10.0 ** args.round
+quantise = lambda values: (np.sign(values) * np.floor(np.abs(values) * scale + 0.5)).astype(np.int64)
+keys = quantise(values)
 
 #------------------------------------------------------------------------
-# Sort ascending
+# Optionally keep runs of consecutive source frames together, trading
+# strict order for fewer, longer runs, as lumin-order's -L, -T and -E
+# do: a frame joins the run before it while that run is shorter than
+# -L frames, or if its key is within -T of the key of the run's first
+# frame, but never across a shot cut, a change of at least -E between
+# consecutive frames. Each run is then sorted by its mean brightness.
 #------------------------------------------------------------------------
-brightnesses = sorted(brightnesses, key = lambda x: ((-1 if args.reverse else 1) * x[1], x[0]))
+def split_runs(values, keys):
+    starts = []
+    for frame in xrange(len(values)):
+        if starts:
+            cut = args.shot_threshold > 0 and abs(values[frame] - values[frame - 1]) >= args.shot_threshold
+            joins = frame - starts[-1] < args.min_run or abs(keys[frame] - keys[starts[-1]]) <= args.tolerance
+            if joins and not cut:
+                continue
+        starts.append(frame)
+    return np.array(starts, dtype=np.int64)
+
+if len(values) and (args.min_run > 1 or args.tolerance > 0 or args.shot_threshold > 0):
+    starts = split_runs(values, keys)
+    lengths = np.diff(np.concatenate((starts, [ len(values) ])))
+    run_keys = quantise(np.add.reduceat(values, starts) / lengths)
+    runs = np.argsort(-run_keys if args.reverse else run_keys, kind='mergesort')
+    permutation = np.concatenate([ np.arange(starts[run], starts[run] + lengths[run]) for run in runs ]).astype(np.uint32)
+    del starts, lengths, run_keys, runs
+else:
+    permutation = np.argsort(-keys if args.reverse else keys, kind='mergesort').astype(np.uint32)
+del keys
+print "Found %d frames" % len(permutation)
 
 #------------------------------------------------------------------------
-# Transform into pairs of (origin_offset, destination_offset)
+# Collapse the permutation into an edit decision list of maximal runs of
+# consecutive source frames: (source_start, length, dest_start).
 #------------------------------------------------------------------------
-brightnesses = dict([ ("%.2f" % (index / clip.fps), value[0]) for index, value in enumerate(brightnesses) ])
-print "Found %f frames" % (clip.fps * clip.duration)
+breaks = np.flatnonzero(np.diff(permutation.astype(np.int64)) != 1) + 1
+dest_starts = np.concatenate(([ 0 ], breaks)).astype(np.int64)
+lengths = np.diff(np.concatenate((dest_starts, [ len(permutation) ])))
+edl = zip(permutation[dest_starts], lengths, dest_starts)
+print "Compacted to %d runs, mean length %.1f frames" % (len(edl), len(permutation) / float(max(1, len(edl))))
 
 #------------------------------------------------------------------------
-# Filter function.
-# Need two cases, for video (scalar offsets) and audio (arrays).
+# Reorder the soundtrack, copying the audio under each run in one block.
+# With a crossfade, the start of each run is faded in over the audio that
+# followed the previous run, to avoid clicks at cuts. Samples are read
+# from the source as moviepy asks for each block of output, so neither
+# soundtrack is ever held in memory whole.
 #------------------------------------------------------------------------
-def remap_time(t):
-    try:
-        t0 = t[0]
-        t1 = brightnesses["%.2f" % t0]
-        t += (t1 - t0)
-    except:
-        try:
-            t0 = t
-            t1 = brightnesses["%.2f" % t0]
-            t += (t1 - t0)
-        except Exception, e:
-            print "Exception when reordering: %s" % e
-            sys.exit(1)
-    return t
+AUDIO_BUFFER_SIZE = 1 << 20
+
+def remap_audio(audio, edl, crossfade_ms):
+    from moviepy.audio.AudioClip import AudioClip
+    rate = int(audio.fps)
+    sample = lambda frame: int(frame) * rate * frame_rate.denominator // frame_rate.numerator
+    source_count = int(audio.duration * rate)
+    dest_count = sample(len(permutation))
+    fade_count = int(round(crossfade_ms * rate / 1000.0))
+
+    source_starts = np.array([ sample(source_start) for source_start, length, dest_start in edl ], dtype=np.int64)
+    dest_starts = np.array([ sample(dest_start) for source_start, length, dest_start in edl ], dtype=np.int64)
+    fade_starts = np.zeros(len(edl), dtype=np.int64)
+    fades = np.zeros(len(edl), dtype=np.int64)
+    previous_end = None
+    for run, (source_start, length, dest_start) in enumerate(edl):
+        start = source_starts[run]
+        count = min(sample(dest_start + length), dest_count) - dest_starts[run]
+        if fade_count > 0 and previous_end is not None and start != previous_end and previous_end < source_count:
+            fade_starts[run] = previous_end
+            fades[run] = min(fade_count, count, source_count - previous_end)
+        previous_end = start + count
+
+    #------------------------------------------------------------------------
+    # Consecutive source samples, with silence past the end of the source.
+    #------------------------------------------------------------------------
+    def read(positions):
+        output = np.zeros((len(positions), audio.nchannels), dtype=np.float32)
+        available = positions < source_count
+        if available.any():
+            frames = audio.get_frame(positions[available] / float(rate))
+            output[available] = np.reshape(frames, (int(available.sum()), audio.nchannels))
+        return output
+
+    def make_frame(t):
+        positions = np.rint(np.atleast_1d(t) * rate).astype(np.int64)
+        runs = np.searchsorted(dest_starts, positions, side='right') - 1
+        output = np.zeros((len(positions), audio.nchannels), dtype=np.float32)
+        for run in np.unique(runs):
+            selected = np.flatnonzero(runs == run)
+            offsets = positions[selected] - dest_starts[run]
+            output[selected] = read(source_starts[run] + offsets)
+            fading = offsets < fades[run]
+            if fading.any():
+                gain = ((offsets[fading] + 1) / (fades[run] + 1.0))[:, np.newaxis]
+                faded = selected[fading]
+                output[faded] = output[faded] * gain + read(fade_starts[run] + offsets[fading]) * (1 - gain)
+        return output if np.ndim(t) else output[0]
+
+    return AudioClip(make_frame, duration=dest_count / float(rate), fps=rate)
 
 #------------------------------------------------------------------------
-# Process the clip.
+# Process the clip. Video is rendered from the EDL, so that frames are
+# read sequentially within each run and the reader only seeks between
+# runs.
 #------------------------------------------------------------------------
-clip_sorted = clip.fl_time(remap_time, apply_to=['mask', 'audio'], keep_duration=True)
-clip_sorted.write_videofile(args.output, fps = clip.fps, write_logfile = True, audio_bufsize = int(44100.0 / clip.fps))
+video = clip.without_audio()
+frame_time = lambda frame: float(int(frame) / frame_rate)
+clip_sorted = concatenate_videoclips([ video.subclip(frame_time(source_start), frame_time(source_start + length))
+                                       for source_start, length, dest_start in edl ])
+if clip.audio is not None:
+    print "Reordering audio ...."
+    clip_sorted = clip_sorted.set_audio(remap_audio(clip.audio, edl, args.crossfade))
+clip_sorted.write_videofile(args.output, fps = clip.fps, write_logfile = True, audio_bufsize = AUDIO_BUFFER_SIZE)
@@ -0,0 +1,830 @@
+#include "lumin/analyser.h"
+#include "lumin/decoder.h"
+#include "lumin/exceptions.h"
+#include "lumin/frame_metric.h"
+#include "lumin/frame_store.h"
+#include "lumin/sidecar.h"
+#include "frame_queue.h"
+#include "libav.h"
+
+#ifdef LUMIN_HAVE_CUDA
+#include "cuda_kernels.h"
+#endif
+
+extern "C"
+{
+#include <libavutil/frame.h>
+#include <libavutil/hwcontext.h>
+}
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <exception>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace lumin
+{
+
+/**------------------------------------------------------------------------
+ * Reduces a decoded frame to the value of each metric being analysed.
+ *-----------------------------------------------------------------------*/
+class FrameReducer
+{
+public:
+    virtual ~FrameReducer() {}
+    virtual void reduce(const AVFrame *frame, double *values) = 0;
+};
+
+/**------------------------------------------------------------------------
+ * Computes every metric in one pass over each frame, sharing any colour
+ * conversion between metrics. Given `sampling_error`, every
+ * CHECK_INTERVAL-th frame of a subsampled analysis is also reduced from
+ * every pixel of the region, to estimate the first metric's error.
+ *-----------------------------------------------------------------------*/
+class MetricReducer : public FrameReducer
+{
+public:
+    MetricReducer(const std::vector<std::string> &names, const FrameSampling &sampling, SamplingError *sampling_error)
+        : metrics(names, sampling), sampling_error(sampling.step > 1 ? sampling_error : nullptr), frame_count(0)
+    {
+        if (this->sampling_error)
+        {
+            FrameSampling full_sampling = sampling;
+            full_sampling.step = 1;
+            this->full_metrics = std::make_unique<FrameMetricSet>(std::vector<std::string>{ names[0] }, full_sampling);
+        }
+    }
+
+    void reduce(const AVFrame *frame, double *values) override
+    {
+        this->metrics.compute(frame, values);
+        if (this->sampling_error && this->frame_count++ % SamplingError::CHECK_INTERVAL == 0)
+        {
+            double full;
+            this->full_metrics->compute(frame, &full);
+            this->sampling_error->add(values[0], full);
+        }
+    }
+
+private:
+    FrameMetricSet metrics;
+    SamplingError *sampling_error;
+    std::unique_ptr<FrameMetricSet> full_metrics;
+    size_t frame_count;
+};
+
+/**------------------------------------------------------------------------
+ * Reduces frames decoded to hardware surfaces. If luma of every pixel is
+ * the only metric and the CUDA backend is built, CUDA surfaces' Y plane
+ * is summed on the device and only the sum is copied back. Otherwise
+ * surfaces are mapped into host memory, so that `reducer` reads their
+ * planes in place, or downloaded if the device can't map them.
+ *-----------------------------------------------------------------------*/
+class HardwareFrameReducer : public FrameReducer
+{
+public:
+    HardwareFrameReducer(std::unique_ptr<FrameReducer> reducer,
+                         const std::vector<std::string> &names,
+                         const FrameSampling &sampling)
+        : reducer(std::move(reducer)), luma_only(names.size() == 1 && names[0] == "luma" && sampling.is_default()),
+          can_map(true), host_frame(av_frame_alloc())
+    {
+    }
+
+    ~HardwareFrameReducer()
+    {
+        av_frame_free(&this->host_frame);
+    }
+
+    void reduce(const AVFrame *frame, double *values) override
+    {
+        if (!frame->hw_frames_ctx)
+        {
+            this->reducer->reduce(frame, values);
+            return;
+        }
+
+#ifdef LUMIN_HAVE_CUDA
+        AVPixelFormat sw_format = ((AVHWFramesContext *) frame->hw_frames_ctx->data)->sw_format;
+        if (this->luma_only && frame->format == AV_PIX_FMT_CUDA && has_8bit_luma_plane(sw_format))
+        {
+            uint64_t sum = sum_device_plane_u8(frame->data[0], frame->linesize[0], frame->width, frame->height);
+            double mean = (double) sum / ((double) frame->width * frame->height);
+            values[0] = normalise_luma(mean, frame->color_range == AVCOL_RANGE_JPEG);
+            return;
+        }
+#endif
+
+        int rv = AVERROR(ENOSYS);
+        if (this->can_map)
+        {
+            rv = av_hwframe_map(this->host_frame, frame, AV_HWFRAME_MAP_READ);
+            if (rv < 0)
+            {
+                this->can_map = false;
+                av_frame_unref(this->host_frame);
+            }
+        }
+        if (rv < 0)
+        {
+            rv = av_hwframe_transfer_data(this->host_frame, frame, 0);
+        }
+        if (rv < 0)
+        {
+            av_frame_unref(this->host_frame);
+            throw decode_exception("Couldn't download hardware frame: " + av_error_string(rv));
+        }
+        this->host_frame->color_range = frame->color_range;
+
+        /*------------------------------------------------------------------------
+         * A mapping holds one of the decoder's few surfaces, so release
+         * it as soon as the frame is reduced.
+         *-----------------------------------------------------------------------*/
+        try
+        {
+            this->reducer->reduce(this->host_frame, values);
+        }
+        catch (...)
+        {
+            av_frame_unref(this->host_frame);
+            throw;
+        }
+        av_frame_unref(this->host_frame);
+    }
+
+private:
+    std::unique_ptr<FrameReducer> reducer;
+    bool luma_only;
+    bool can_map;
+    AVFrame *host_frame;
+};
+
+static std::unique_ptr<FrameReducer> create_reducer(const std::vector<std::string> &names,
+                                                    const AnalysisOptions &options,
+                                                    SamplingError *sampling_error = nullptr)
+{
+    std::unique_ptr<FrameReducer> reducer = std::make_unique<MetricReducer>(names, options.sampling, sampling_error);
+    if (options.hardware != HARDWARE_DECODE_NONE)
+    {
+        return std::make_unique<HardwareFrameReducer>(std::move(reducer), names, options.sampling);
+    }
+    return reducer;
+}
+
+static DecoderOptions get_decoder_options(const AnalysisOptions &options, int threads)
+{
+    DecoderOptions decoder_options;
+    decoder_options.threads = threads;
+    decoder_options.proxy = options.proxy;
+    decoder_options.hardware = options.hardware;
+    decoder_options.metrics = options.metrics;
+    return decoder_options;
+}
+
+/*------------------------------------------------------------------------
+ * moviepy's iter_frames() yields frames at t = index / fps for all
+ * t < duration, so stop at the first frame beyond the crop point.
+ *-----------------------------------------------------------------------*/
+static double get_frame_limit(Rational frame_rate, const AnalysisOptions &options)
+{
+    return options.duration > 0.0 ? options.duration * frame_rate.num / frame_rate.den : INFINITY;
+}
+
+/*------------------------------------------------------------------------
+ * Decoder for analyse_sequential(), with a hardware surface for every
+ * frame the queue can hold.
+ *-----------------------------------------------------------------------*/
+static std::unique_ptr<VideoDecoder> open_sequential_decoder(const std::string &path, const AnalysisOptions &options)
+{
+    DecoderOptions decoder_options = get_decoder_options(options, 0);
+    decoder_options.extra_hw_frames = (int) FRAME_QUEUE_DEPTH;
+    return std::make_unique<VideoDecoder>(path, decoder_options);
+}
+
+/*------------------------------------------------------------------------
+ * Two-stage pipeline: demux and decode on one thread, reduction on the
+ * calling thread. Returns one series per metric in `names`.
+ *-----------------------------------------------------------------------*/
+static std::vector<LuminanceSeries> analyse_sequential(VideoDecoder &decoder,
+                                                       const AnalysisOptions &options,
+                                                       const std::vector<std::string> &names,
+                                                       FrameStoreWriter *store,
+                                                       std::vector<StageStats> *stages)
+{
+    const Rational frame_rate = decoder.get_frame_rate();
+    const double frame_limit = get_frame_limit(frame_rate, options);
+
+    std::vector<LuminanceSeries> columns(names.size(), LuminanceSeries(frame_rate));
+    std::vector<double> values(names.size());
+    std::unique_ptr<FrameReducer> reducer = create_reducer(names, options, options.sampling_error);
+    if (options.metrics)
+    {
+        double duration = decoder.get_duration();
+        if (duration > 0.0)
+        {
+            const double frames = std::min(duration * frame_rate.to_double(), frame_limit);
+            options.metrics->set_phase_total((uint64_t) std::ceil(frames));
+        }
+    }
+
+    FrameQueue frames;
+    QueueGauge frames_gauge(options.metrics, "decode", [&]() { return frames.size(); });
+    Stage decode_stage("decode");
+    Stage reduce_stage("reduce");
+    StageThread decode_thread(
+        decode_stage,
+        [&]() {
+            for (size_t count = 0; count < frame_limit; count++)
+            {
+                AVFrame *frame = decoder.read_frame();
+                if (!frame || !frames.push_reference(frame, &decode_stage))
+                {
+                    break;
+                }
+                decode_stage.add_items(1);
+            }
+        },
+        [&]() { frames.close(); });
+
+    reduce_stage.start();
+    AVFrame *frame = nullptr;
+    try
+    {
+        while (frames.pop(frame, &reduce_stage))
+        {
+            reducer->reduce(frame, values.data());
+            if (store)
+            {
+                store->write(columns[0].size(), frame);
+            }
+            av_frame_free(&frame);
+            for (size_t column = 0; column < columns.size(); column++)
+            {
+                columns[column].append(values[column]);
+            }
+            reduce_stage.add_items(1);
+            if (options.metrics)
+            {
+                options.metrics->add_progress();
+            }
+        }
+    }
+    catch (...)
+    {
+        av_frame_free(&frame);
+        frames.close();
+        decode_thread.join();
+        throw;
+    }
+    reduce_stage.stop();
+    decode_thread.join();
+
+    if (stages)
+    {
+        stages->push_back(decode_stage.get_stats());
+        stages->push_back(reduce_stage.get_stats());
+    }
+    return columns;
+}
+
+/*------------------------------------------------------------------------
+ * Decode and reduce frames [range.start, range.end) into `values`, one
+ * vector per metric in `names`. Decoding starts at the keyframe opening
+ * the segment and continues past range.end until the decoder emits a
+ * later frame, so that reordered frames at the end of the segment are
+ * still produced.
+ *-----------------------------------------------------------------------*/
+static void analyse_segment(const std::string &path,
+                            const PacketIndex &index,
+                            FrameRange range,
+                            const AnalysisOptions &options,
+                            const std::vector<std::string> &names,
+                            int decoder_threads,
+                            FrameStoreWriter *store,
+                            std::vector<std::vector<double>> &values)
+{
+    VideoDecoder decoder(path, get_decoder_options(options, decoder_threads));
+    std::unique_ptr<FrameReducer> reducer = create_reducer(names, options, options.sampling_error);
+    std::vector<double> frame_values(names.size());
+
+    if (range.start > 0)
+    {
+        decoder.seek(index.get_frame_pts(range.start));
+    }
+
+    while (AVFrame *frame = decoder.read_frame())
+    {
+        int64_t timestamp = decoder.get_timestamp(frame);
+        if (timestamp == AV_NOPTS_VALUE)
+        {
+            continue;
+        }
+
+        size_t frame_index = index.get_frame_index(timestamp);
+        if (frame_index < range.start)
+        {
+            continue;
+        }
+        if (frame_index >= range.end)
+        {
+            break;
+        }
+        reducer->reduce(frame, frame_values.data());
+        for (size_t column = 0; column < names.size(); column++)
+        {
+            values[column][frame_index] = frame_values[column];
+        }
+        if (store)
+        {
+            store->write(frame_index, frame);
+        }
+        if (options.metrics)
+        {
+            options.metrics->add_progress();
+        }
+    }
+}
+
+/*------------------------------------------------------------------------
+ * A packet that failed to decode leaves a gap: hold the previous frame's
+ * value over it, as a sequential decode would have shown.
+ *-----------------------------------------------------------------------*/
+static void fill_gaps(std::vector<double> &values)
+{
+    double last = std::numeric_limits<double>::quiet_NaN();
+    for (size_t frame_index = 0; frame_index < values.size(); frame_index++)
+    {
+        if (std::isnan(values[frame_index]))
+        {
+            values[frame_index] = last;
+        }
+        last = values[frame_index];
+    }
+    auto first = std::find_if(values.begin(), values.end(), [](double value) { return !std::isnan(value); });
+    std::fill(values.begin(), first, first == values.end() ? 0.0 : *first);
+}
+
+static std::vector<LuminanceSeries> analyse_parallel(const std::string &path,
+                                                     const AnalysisOptions &options,
+                                                     const std::vector<std::string> &names,
+                                                     const PacketIndex &index,
+                                                     const std::vector<FrameRange> &segments,
+                                                     Rational frame_rate,
+                                                     FrameStoreWriter *store,
+                                                     std::vector<StageStats> *stages)
+{
+    const size_t frame_count = segments.back().end;
+    std::vector<std::vector<double>> values(names.size(),
+                                            std::vector<double>(frame_count, std::numeric_limits<double>::quiet_NaN()));
+
+    const int hardware_threads = std::max(1, (int) std::thread::hardware_concurrency());
+    const int decoder_threads = std::max(1, hardware_threads / (int) segments.size());
+
+    /*------------------------------------------------------------------------
+     * Segments are independent stages, with no queues between them; their
+     * wall times show how evenly the work was split.
+     *-----------------------------------------------------------------------*/
+    std::vector<std::unique_ptr<Stage>> segment_stages;
+    std::vector<std::unique_ptr<StageThread>> workers;
+    for (size_t segment = 0; segment < segments.size(); segment++)
+    {
+        segment_stages.push_back(std::make_unique<Stage>("segment " + std::to_string(segment)));
+        Stage &stage = *segment_stages.back();
+        workers.push_back(std::make_unique<StageThread>(
+            stage,
+            [&, segment]() {
+                analyse_segment(path, index, segments[segment], options, names, decoder_threads, store, values);
+                stage.add_items(segments[segment].size());
+            },
+            []() {}));
+    }
+
+    for (std::unique_ptr<StageThread> &worker : workers)
+    {
+        worker->join();
+    }
+    if (stages)
+    {
+        for (const std::unique_ptr<Stage> &stage : segment_stages)
+        {
+            stages->push_back(stage->get_stats());
+        }
+    }
+
+    std::vector<LuminanceSeries> columns;
+    for (std::vector<double> &column : values)
+    {
+        fill_gaps(column);
+        columns.emplace_back(frame_rate, std::move(column));
+    }
+    return columns;
+}
+
+static std::vector<LuminanceSeries> analyse_decoded(const std::string &path,
+                                                    const AnalysisOptions &options,
+                                                    const std::vector<std::string> &names,
+                                                    FrameStoreWriter *store,
+                                                    std::vector<StageStats> *stages)
+{
+    /*------------------------------------------------------------------------
+     * A hardware decoder is one device however many threads feed it, so
+     * unless told otherwise, a stream it can decode isn't split into
+     * segments. Streams that fall back to software are split as usual.
+     *-----------------------------------------------------------------------*/
+    if (options.hardware != HARDWARE_DECODE_NONE && options.threads <= 0)
+    {
+        std::unique_ptr<VideoDecoder> decoder = open_sequential_decoder(path, options);
+        if (decoder->get_hardware() != HARDWARE_DECODE_NONE)
+        {
+            return analyse_sequential(*decoder, options, names, store, stages);
+        }
+    }
+
+    int threads = options.threads > 0 ? options.threads : (int) std::thread::hardware_concurrency();
+    if (threads <= 1)
+    {
+        return analyse_sequential(*open_sequential_decoder(path, options), options, names, store, stages);
+    }
+
+    PacketIndex index = load_packet_index(path, options.packet_index_path, options.source_key);
+    if (!index.get_frame_rate().is_valid())
+    {
+        throw decode_exception("Stream has no usable frame rate");
+    }
+
+    const Rational frame_rate = index.get_frame_rate();
+    double frame_limit = std::ceil(get_frame_limit(frame_rate, options));
+    size_t frame_count = std::isinf(frame_limit) ? index.get_frame_count() : (size_t) frame_limit;
+
+    if (options.metrics)
+    {
+        options.metrics->set_phase_total(frame_count);
+    }
+    std::vector<FrameRange> segments = index.split(threads, frame_count);
+    if (segments.size() <= 1)
+    {
+        return analyse_sequential(*open_sequential_decoder(path, options), options, names, store, stages);
+    }
+
+    return analyse_parallel(path, options, names, index, segments, frame_rate, store, stages);
+}
+
+/*------------------------------------------------------------------------
+ * Frames whose brightness is within the refinement margin of a rounding
+ * boundary, (k + 0.5) / 10^places.
+ *-----------------------------------------------------------------------*/
+static std::vector<size_t> get_refine_frames(const std::vector<double> &values, const AnalysisOptions &options)
+{
+    const double scale = std::pow(10.0, options.refine_decimal_places);
+    std::vector<size_t> frames;
+    for (size_t frame_index = 0; frame_index < values.size(); frame_index++)
+    {
+        double scaled = values[frame_index] * scale;
+        double distance = std::fabs(scaled - std::floor(scaled) - 0.5) / scale;
+        if (distance < options.refine_margin)
+        {
+            frames.push_back(frame_index);
+        }
+    }
+    return frames;
+}
+
+/*------------------------------------------------------------------------
+ * Replace the values of `frames`, in ascending order, with those from a
+ * full decode. Decodes forward from frame to frame, seeking only when
+ * the next keyframe is nearer than the next frame.
+ *-----------------------------------------------------------------------*/
+static void refine_frames(const std::string &path,
+                          const PacketIndex &index,
+                          const std::vector<size_t> &frames,
+                          const AnalysisOptions &options,
+                          std::vector<double> &values)
+{
+    DecoderOptions decoder_options = get_decoder_options(options, options.threads > 0 ? options.threads : 0);
+    decoder_options.proxy = false;
+    VideoDecoder decoder(path, decoder_options);
+    std::unique_ptr<FrameReducer> reducer = create_reducer({ options.metric }, options);
+    const std::vector<size_t> &keyframes = index.get_keyframes();
+
+    size_t position = 0;
+    for (size_t target : frames)
+    {
+        auto next_keyframe = std::upper_bound(keyframes.begin(), keyframes.end(), target);
+        size_t keyframe = next_keyframe == keyframes.begin() ? 0 : *(next_keyframe - 1);
+        if (target < position || keyframe > position)
+        {
+            decoder.seek(index.get_frame_pts(target));
+            position = keyframe;
+        }
+
+        while (AVFrame *frame = decoder.read_frame())
+        {
+            int64_t timestamp = decoder.get_timestamp(frame);
+            if (timestamp == AV_NOPTS_VALUE)
+            {
+                continue;
+            }
+            size_t frame_index = index.get_frame_index(timestamp);
+            position = frame_index + 1;
+            if (frame_index == target)
+            {
+                reducer->reduce(frame, &values[target]);
+                if (options.metrics)
+                {
+                    options.metrics->add_progress();
+                }
+            }
+            if (frame_index >= target)
+            {
+                break;
+            }
+        }
+    }
+}
+
+/*------------------------------------------------------------------------
+ * Analyse the metrics in `names`, the first of which is options.metric.
+ * A proxy analysis only computes options.metric.
+ *-----------------------------------------------------------------------*/
+static std::vector<LuminanceSeries> analyse_source(const std::string &path,
+                                                   const AnalysisOptions &options,
+                                                   const std::vector<std::string> &names,
+                                                   FrameStoreWriter *store,
+                                                   std::vector<StageStats> *stages)
+{
+    std::vector<LuminanceSeries> columns = analyse_decoded(path, options, names, store, stages);
+    if (!options.proxy || options.refine_decimal_places <= 0)
+    {
+        return columns;
+    }
+
+    /*------------------------------------------------------------------------
+     * If most frames need refining (at high precision, say), or frames
+     * can't be located by timestamp, a full analysis is cheaper.
+     *-----------------------------------------------------------------------*/
+    AnalysisOptions full_options = options;
+    full_options.proxy = false;
+
+    std::vector<double> values = columns[0].get_values();
+    std::vector<size_t> frames = get_refine_frames(values, options);
+    if (frames.empty())
+    {
+        return columns;
+    }
+    bool full = frames.size() * 2 > values.size();
+    PacketIndex index;
+    if (!full)
+    {
+        index = load_packet_index(path, options.packet_index_path, options.source_key);
+        full = !index.has_timestamps() || index.get_frame_count() < values.size();
+    }
+    if (full)
+    {
+        if (options.metrics)
+        {
+            options.metrics->begin_phase("analyse");
+        }
+        return analyse_decoded(path, full_options, names, store, stages);
+    }
+
+    if (options.metrics)
+    {
+        options.metrics->begin_phase("refine", frames.size());
+    }
+    refine_frames(path, index, frames, options, values);
+    return { LuminanceSeries(columns[0].get_frame_rate(), std::move(values)) };
+}
+
+static LuminanceSeries get_indexed_series(const LuminanceIndex &index,
+                                          int column,
+                                          size_t frame_count,
+                                          const AnalysisOptions &options)
+{
+    LuminanceSeries series = index.to_series((size_t) column, frame_count);
+    if (options.metrics)
+    {
+        options.metrics->add_progress(series.size());
+    }
+    return series;
+}
+
+/*------------------------------------------------------------------------
+ * A cropped analysis that ran out of frames still covers the source.
+ *-----------------------------------------------------------------------*/
+static bool is_complete(const LuminanceSeries &series, const AnalysisOptions &options)
+{
+    return options.duration <= 0.0 || series.size() < std::ceil(get_frame_limit(series.get_frame_rate(), options));
+}
+
+static void add_metric_name(std::vector<std::string> &names, const std::string &name)
+{
+    if (std::find(names.begin(), names.end(), name) == names.end())
+    {
+        names.push_back(name);
+    }
+}
+
+/*------------------------------------------------------------------------
+ * The metrics to analyse: options.metric first, then any extra metrics.
+ *-----------------------------------------------------------------------*/
+static std::vector<std::string> get_metric_names(const AnalysisOptions &options)
+{
+    options.sampling.validate();
+    std::vector<std::string> names = { options.metric };
+    if (!options.proxy)
+    {
+        for (const std::string &name : options.extra_metrics)
+        {
+            add_metric_name(names, name);
+        }
+    }
+    for (const std::string &name : names)
+    {
+        if (!has_frame_metric(name))
+        {
+            throw invalid_argument_exception("Unknown frame metric: " + name);
+        }
+    }
+    return names;
+}
+
+static LuminanceSeries analyse_indexed(const std::string &path,
+                                       const AnalysisOptions &options,
+                                       std::vector<StageStats> *stages)
+{
+    std::vector<std::string> names = get_metric_names(options);
+    const bool use_index = !options.index_path.empty() && options.sampling.is_default();
+    if (!use_index && options.frame_store_path.empty())
+    {
+        return analyse_source(path, options, names, nullptr, stages)[0];
+    }
+
+    const SourceKey &key = *options.source_key;
+
+    /*------------------------------------------------------------------------
+     * A frame store is only written by a full decode, so it has to be
+     * made before the luminance index can let analysis be skipped.
+     *-----------------------------------------------------------------------*/
+    std::unique_ptr<FrameStoreWriter> store;
+    if (!options.frame_store_path.empty())
+    {
+        if (options.proxy || (options.hardware != HARDWARE_DECODE_NONE && options.hardware != HARDWARE_DECODE_AUTO))
+        {
+            throw invalid_argument_exception("A frame store needs a full software decode");
+        }
+        std::unique_ptr<FrameStore> existing = FrameStore::open(options.frame_store_path);
+        if (!existing || !existing->matches(key) || !(existing->get_flags() & FrameStore::FLAG_COMPLETE))
+        {
+            store = std::make_unique<FrameStoreWriter>(options.frame_store_path, key);
+        }
+    }
+
+    std::unique_ptr<LuminanceIndex> index;
+    if (use_index)
+    {
+        index = LuminanceIndex::open(options.index_path);
+    }
+    if (index && index->matches(key))
+    {
+        bool usable = !store && std::all_of(names.begin(), names.end(), [&](const std::string &name) {
+            return index->find_column(name) >= 0;
+        });
+        bool complete = index->get_flags() & LuminanceIndex::FLAG_COMPLETE;
+        int column = index->find_column(options.metric);
+        if (usable && options.duration > 0.0)
+        {
+            double frame_limit = std::ceil(get_frame_limit(index->get_frame_rate(), options));
+            if (complete || frame_limit <= index->get_frame_count())
+            {
+                return get_indexed_series(*index, column, (size_t) frame_limit, options);
+            }
+        }
+        else if (usable && complete)
+        {
+            return get_indexed_series(*index, column, index->get_frame_count(), options);
+        }
+
+        /*------------------------------------------------------------------------
+         * The source is being decoded anyway, so recompute the metrics
+         * already in the index too, rather than losing them when it is
+         * rewritten.
+         *-----------------------------------------------------------------------*/
+        if (!options.proxy)
+        {
+            for (size_t existing = 0; existing < index->get_column_count(); existing++)
+            {
+                std::string name = index->get_column_name(existing);
+                if (has_frame_metric(name))
+                {
+                    add_metric_name(names, name);
+                }
+            }
+        }
+    }
+    index.reset();
+
+    AnalysisOptions source_options = options;
+    if (store)
+    {
+        source_options.hardware = HARDWARE_DECODE_NONE;
+    }
+    std::vector<LuminanceSeries> columns = analyse_source(path, source_options, names, store.get(), stages);
+    if (store)
+    {
+        store->finish(columns[0].size(), is_complete(columns[0], options) ? FrameStore::FLAG_COMPLETE : 0);
+    }
+    if (options.proxy || !use_index)
+    {
+        return columns[0];
+    }
+
+    uint32_t flags = is_complete(columns[0], options) ? LuminanceIndex::FLAG_COMPLETE : 0;
+
+    try
+    {
+        LuminanceIndex::write(options.index_path, key, names, columns, flags);
+    }
+    catch (const io_exception &)
+    {
+        /*------------------------------------------------------------------------
+         * The index is only an optimisation; sources on read-only media
+         * are analysed every time.
+         *-----------------------------------------------------------------------*/
+    }
+
+    return columns[0];
+}
+
+void SamplingError::add(double sampled, double full)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->checks.emplace_back(sampled, full);
+}
+
+size_t SamplingError::get_frames_checked() const
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->checks.size();
+}
+
+double SamplingError::get_observed_max_error() const
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    double max = 0.0;
+    for (const std::pair<double, double> &check : this->checks)
+    {
+        max = std::max(max, std::fabs(check.first - check.second));
+    }
+    return max;
+}
+
+double SamplingError::get_observed_mean_error() const
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    double total = 0.0;
+    for (const std::pair<double, double> &check : this->checks)
+    {
+        total += std::fabs(check.first - check.second);
+    }
+    return this->checks.empty() ? 0.0 : total / this->checks.size();
+}
+
+size_t SamplingError::get_bucket_changes(const OrderOptions &options) const
+{
+    const OrderKey get_key(options);
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return (size_t) std::count_if(this->checks.begin(), this->checks.end(),
+                                  [&](const std::pair<double, double> &check) {
+                                      return get_key(check.first) != get_key(check.second);
+                                  });
+}
+
+LuminanceSeries analyse(const std::string &path, const AnalysisOptions &options, std::vector<StageStats> *stages)
+{
+    /*------------------------------------------------------------------------
+     * Identify the source once for every cache analysis checks.
+     *-----------------------------------------------------------------------*/
+    SourceKey key;
+    AnalysisOptions keyed_options = options;
+    if (!options.source_key &&
+        (!options.index_path.empty() || !options.frame_store_path.empty() || !options.packet_index_path.empty()))
+    {
+        key = SourceKey::from_file(path);
+        keyed_options.source_key = &key;
+    }
+
+    if (!options.metrics)
+    {
+        return analyse_indexed(path, keyed_options, stages);
+    }
+    options.metrics->begin_phase(options.proxy ? "proxy" : "analyse");
+    LuminanceSeries series = analyse_indexed(path, keyed_options, stages);
+    options.metrics->end_phase();
+    return series;
+}
+
+}
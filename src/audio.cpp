@@ -0,0 +1,290 @@
+#include "lumin/audio.h"
+#include "lumin/exceptions.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+namespace lumin
+{
+
+AudioSource::~AudioSource()
+{
+}
+
+bool AudioSource::empty() const
+{
+    return this->get_sample_count() == 0;
+}
+
+size_t AudioSource::get_sample_position(int64_t frame, Rational frame_rate) const
+{
+    return (size_t) (frame * this->get_sample_rate() * frame_rate.den / frame_rate.num);
+}
+
+AudioBuffer::AudioBuffer()
+    : sample_rate(0), channels(0)
+{
+}
+
+AudioBuffer::AudioBuffer(int sample_rate, int channels, std::vector<float> samples)
+    : sample_rate(sample_rate), channels(channels), samples(std::move(samples))
+{
+    if (sample_rate <= 0 || channels <= 0)
+    {
+        throw invalid_argument_exception("Sample rate and channel count must be positive");
+    }
+    if (this->samples.size() % channels != 0)
+    {
+        throw invalid_argument_exception("Sample count is not a multiple of the channel count");
+    }
+}
+
+int AudioBuffer::get_sample_rate() const
+{
+    return this->sample_rate;
+}
+
+int AudioBuffer::get_channels() const
+{
+    return this->channels;
+}
+
+size_t AudioBuffer::get_sample_count() const
+{
+    return this->channels ? this->samples.size() / this->channels : 0;
+}
+
+void AudioBuffer::read(size_t position, size_t count, float *output) const
+{
+    memcpy(output, this->samples.data() + position * this->channels, count * this->channels * sizeof(float));
+}
+
+const std::vector<float> &AudioBuffer::get_samples() const
+{
+    return this->samples;
+}
+
+std::vector<float> &AudioBuffer::get_samples()
+{
+    return this->samples;
+}
+
+AudioFile::AudioFile(int sample_rate, int channels, const std::string &directory)
+    : sample_rate(sample_rate), channels(channels), fd(-1), sample_count(0)
+{
+    if (sample_rate <= 0 || channels <= 0)
+    {
+        throw invalid_argument_exception("Sample rate and channel count must be positive");
+    }
+
+    std::string spill_directory = directory;
+    if (spill_directory.empty())
+    {
+        const char *tmpdir = getenv("TMPDIR");
+        spill_directory = tmpdir && *tmpdir ? tmpdir : "/tmp";
+    }
+    std::string path_template = spill_directory + "/lumin-audio-XXXXXX";
+    std::vector<char> path(path_template.begin(), path_template.end());
+    path.push_back('\0');
+    this->fd = mkstemp(path.data());
+    if (this->fd < 0)
+    {
+        throw io_exception("Couldn't create audio file in " + spill_directory + ": " + strerror(errno));
+    }
+    unlink(path.data());
+}
+
+AudioFile::~AudioFile()
+{
+    close(this->fd);
+}
+
+int AudioFile::get_sample_rate() const
+{
+    return this->sample_rate;
+}
+
+int AudioFile::get_channels() const
+{
+    return this->channels;
+}
+
+size_t AudioFile::get_sample_count() const
+{
+    return this->sample_count;
+}
+
+void AudioFile::read(size_t position, size_t count, float *output) const
+{
+    const size_t frame_bytes = this->channels * sizeof(float);
+    uint8_t *buffer = (uint8_t *) output;
+    size_t filled = 0;
+    while (filled < count * frame_bytes)
+    {
+        ssize_t rv = pread(this->fd, buffer + filled, count * frame_bytes - filled,
+                           (off_t) (position * frame_bytes + filled));
+        if (rv < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (rv <= 0)
+        {
+            throw io_exception(std::string("Couldn't read audio file: ") + (rv < 0 ? strerror(errno) : "truncated"));
+        }
+        filled += (size_t) rv;
+    }
+}
+
+void AudioFile::append(const float *samples, size_t count)
+{
+    const size_t frame_bytes = this->channels * sizeof(float);
+    const uint8_t *buffer = (const uint8_t *) samples;
+    size_t written = 0;
+    while (written < count * frame_bytes)
+    {
+        ssize_t rv = pwrite(this->fd, buffer + written, count * frame_bytes - written,
+                            (off_t) (this->sample_count * frame_bytes + written));
+        if (rv < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (rv < 0)
+        {
+            throw io_exception(std::string("Couldn't write audio file: ") + strerror(errno));
+        }
+        written += (size_t) rv;
+    }
+    this->sample_count += count;
+}
+
+RemappedAudio::RemappedAudio(const AudioSource &source, const EditDecisionList &edl, double crossfade)
+    : source(source), edl(edl),
+      sample_count(source.empty() ? 0 : source.get_sample_position(edl.get_frame_count(), edl.get_frame_rate())),
+      fade_count((size_t) std::lround(std::max(0.0, crossfade) * source.get_sample_rate()))
+{
+}
+
+int RemappedAudio::get_sample_rate() const
+{
+    return this->source.get_sample_rate();
+}
+
+int RemappedAudio::get_channels() const
+{
+    return this->source.get_channels();
+}
+
+size_t RemappedAudio::get_sample_count() const
+{
+    return this->sample_count;
+}
+
+void RemappedAudio::get_run_samples(size_t index, size_t &source_start, size_t &length) const
+{
+    /*------------------------------------------------------------------------
+     * Source and destination sample positions are rounded separately,
+     * so take the length from the destination to keep it gapless.
+     *-----------------------------------------------------------------------*/
+    const EditRun &run = this->edl.get_runs()[index];
+    const Rational frame_rate = this->edl.get_frame_rate();
+    const size_t dest_start = this->get_sample_position(run.dest_start, frame_rate);
+    const size_t dest_end = std::min(this->get_sample_position(run.get_dest_end(), frame_rate), this->sample_count);
+    source_start = this->get_sample_position(run.source_start, frame_rate);
+    length = dest_end - dest_start;
+}
+
+void RemappedAudio::read(size_t position, size_t count, float *output) const
+{
+    const std::vector<EditRun> &runs = this->edl.get_runs();
+    const Rational frame_rate = this->edl.get_frame_rate();
+    const size_t channels = this->get_channels();
+    const size_t source_count = this->source.get_sample_count();
+    const size_t end = position + count;
+    std::fill(output, output + count * channels, 0.0f);
+
+    size_t index = std::partition_point(runs.begin(), runs.end(),
+                                        [&](const EditRun &run) {
+                                            return this->get_sample_position(run.get_dest_end(), frame_rate) <=
+                                                   position;
+                                        }) -
+                   runs.begin();
+    std::vector<float> tail;
+    for (; index < runs.size(); index++)
+    {
+        const size_t dest_start = this->get_sample_position(runs[index].dest_start, frame_rate);
+        if (dest_start >= end)
+        {
+            break;
+        }
+        size_t source_start = 0;
+        size_t length = 0;
+        this->get_run_samples(index, source_start, length);
+        size_t available = source_start < source_count ? std::min(length, source_count - source_start) : 0;
+
+        /*------------------------------------------------------------------------
+         * Copy the part of the run's audio that overlaps the request.
+         *-----------------------------------------------------------------------*/
+        size_t first = std::max(position, dest_start);
+        size_t last = std::min(end, dest_start + available);
+        if (first < last)
+        {
+            this->source.read(source_start + (first - dest_start), last - first,
+                              output + (first - position) * channels);
+        }
+
+        /*------------------------------------------------------------------------
+         * Mix in the continuation of the previous run, fading out, unless
+         * this run is that continuation.
+         *-----------------------------------------------------------------------*/
+        if (index == 0 || this->fade_count == 0)
+        {
+            continue;
+        }
+        size_t previous_start = 0;
+        size_t previous_length = 0;
+        this->get_run_samples(index - 1, previous_start, previous_length);
+        const size_t previous_end = previous_start + previous_length;
+        if (source_start == previous_end || previous_end >= source_count)
+        {
+            continue;
+        }
+        size_t fade = std::min({ this->fade_count, length, source_count - previous_end });
+        last = std::min(end, dest_start + fade);
+        if (first >= last)
+        {
+            continue;
+        }
+        tail.resize((last - first) * channels);
+        this->source.read(previous_end + (first - dest_start), last - first, tail.data());
+        float *head = output + (first - position) * channels;
+        for (size_t sample = first; sample < last; sample++)
+        {
+            float gain = (float) (sample - dest_start + 1) / (float) (fade + 1);
+            for (size_t channel = 0; channel < channels; channel++)
+            {
+                size_t offset = (sample - first) * channels + channel;
+                head[offset] = head[offset] * gain + tail[offset] * (1.0f - gain);
+            }
+        }
+    }
+}
+
+AudioBuffer remap_audio(const AudioSource &source, const EditDecisionList &edl, double crossfade)
+{
+    RemappedAudio remapped(source, edl, crossfade);
+    if (remapped.empty())
+    {
+        return AudioBuffer();
+    }
+    std::vector<float> samples(remapped.get_sample_count() * remapped.get_channels());
+    remapped.read(0, remapped.get_sample_count(), samples.data());
+    return AudioBuffer(remapped.get_sample_rate(), remapped.get_channels(), std::move(samples));
+}
+
+}
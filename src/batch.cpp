@@ -0,0 +1,221 @@
+#include "lumin/batch.h"
+#include "lumin/edl.h"
+#include "lumin/exceptions.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace lumin
+{
+
+/*------------------------------------------------------------------------
+ * Jobs with equal keys get identical series from analyse(). Threads and
+ * the index path don't change the values, so aren't part of the key,
+ * nor are the side effects merged by merge_analysis().
+ *-----------------------------------------------------------------------*/
+static std::string get_analysis_key(const BatchJob &job)
+{
+    const AnalysisOptions &options = job.analysis;
+    const FrameSampling &sampling = options.sampling;
+    char buffer[384];
+    snprintf(buffer, sizeof(buffer), "%s %.17g %d %d %.17g %d %.17g %.17g %.17g %.17g %d",
+             options.metric.c_str(), options.duration, options.proxy,
+             options.proxy ? options.refine_decimal_places : 0, options.proxy ? options.refine_margin : 0.0,
+             (int) options.hardware, sampling.left, sampling.top, sampling.width, sampling.height, sampling.step);
+    return job.input + '\n' + buffer;
+}
+
+/*------------------------------------------------------------------------
+ * Whether a job's analysis can be shared with `shared`: one analysis
+ * writes at most one frame store.
+ *-----------------------------------------------------------------------*/
+static bool can_share_analysis(const AnalysisOptions &shared, const AnalysisOptions &options)
+{
+    return options.frame_store_path.empty() || shared.frame_store_path.empty() ||
+           options.frame_store_path == shared.frame_store_path;
+}
+
+/*------------------------------------------------------------------------
+ * Fold into a shared analysis the side effects another job asks for, so
+ * that its extra metrics and frame store aren't dropped.
+ *-----------------------------------------------------------------------*/
+static void merge_analysis(AnalysisOptions &shared, const AnalysisOptions &options)
+{
+    if (shared.frame_store_path.empty())
+    {
+        shared.frame_store_path = options.frame_store_path;
+    }
+    for (const std::string &name : options.extra_metrics)
+    {
+        if (std::find(shared.extra_metrics.begin(), shared.extra_metrics.end(), name) == shared.extra_metrics.end())
+        {
+            shared.extra_metrics.push_back(name);
+        }
+    }
+}
+
+class BatchAnalysis
+{
+public:
+    std::unique_ptr<LuminanceSeries> series;
+    std::string error;
+};
+
+std::vector<BatchResult> render_batch(const std::vector<BatchJob> &jobs, const BatchOptions &options)
+{
+    std::vector<BatchResult> results(jobs.size());
+
+    /*------------------------------------------------------------------------
+     * Analyse each distinct input once. Analysis already uses every
+     * hardware thread, so inputs are analysed one at a time.
+     *-----------------------------------------------------------------------*/
+    std::multimap<std::string, size_t> analysis_indices;
+    std::vector<size_t> job_analyses(jobs.size());
+    std::vector<const std::string *> analysis_inputs;
+    std::vector<AnalysisOptions> analysis_options;
+    for (size_t job = 0; job < jobs.size(); job++)
+    {
+        const std::string key = get_analysis_key(jobs[job]);
+        size_t analysis = analysis_options.size();
+        auto range = analysis_indices.equal_range(key);
+        for (auto it = range.first; it != range.second; it++)
+        {
+            if (can_share_analysis(analysis_options[it->second], jobs[job].analysis))
+            {
+                analysis = it->second;
+                break;
+            }
+        }
+        if (analysis == analysis_options.size())
+        {
+            analysis_indices.emplace(key, analysis);
+            analysis_inputs.push_back(&jobs[job].input);
+            analysis_options.push_back(jobs[job].analysis);
+        }
+        else
+        {
+            merge_analysis(analysis_options[analysis], jobs[job].analysis);
+        }
+        job_analyses[job] = analysis;
+    }
+
+    if (options.metrics)
+    {
+        options.metrics->begin_phase("analyse", analysis_options.size());
+    }
+    /*------------------------------------------------------------------------
+     * Each input is identified once, for its analyses and renders alike.
+     *-----------------------------------------------------------------------*/
+    std::map<std::string, SourceKey> source_keys;
+    std::vector<BatchAnalysis> analyses(analysis_options.size());
+    for (size_t index = 0; index < analysis_options.size(); index++)
+    {
+        analysis_options[index].metrics = nullptr;
+        try
+        {
+            const std::string &input = *analysis_inputs[index];
+            auto key = source_keys.find(input);
+            if (key == source_keys.end())
+            {
+                key = source_keys.emplace(input, SourceKey::from_file(input)).first;
+            }
+            analysis_options[index].source_key = &key->second;
+            analyses[index].series = std::make_unique<LuminanceSeries>(analyse(input, analysis_options[index]));
+        }
+        catch (const std::exception &e)
+        {
+            analyses[index].error = e.what();
+        }
+        if (options.metrics)
+        {
+            options.metrics->add_progress();
+        }
+    }
+
+    /*------------------------------------------------------------------------
+     * Workers take the next job in order, so inputs are rendered in
+     * roughly the order given.
+     *-----------------------------------------------------------------------*/
+    const int hardware_threads = std::max(1, (int) std::thread::hardware_concurrency());
+    int workers = options.workers > 0 ? options.workers : std::max(1, hardware_threads / 4);
+    workers = std::max(1, std::min(workers, (int) jobs.size()));
+    const std::string encoder_threads = std::to_string(std::max(1, hardware_threads / workers));
+
+    if (options.metrics)
+    {
+        options.metrics->begin_phase("render", jobs.size());
+    }
+    std::atomic<size_t> next(0);
+    std::mutex completed_mutex;
+    auto work = [&]() {
+        size_t job;
+        while ((job = next.fetch_add(1)) < jobs.size())
+        {
+            BatchResult &result = results[job];
+            const BatchAnalysis &analysis = analyses[job_analyses[job]];
+            auto start = std::chrono::steady_clock::now();
+            try
+            {
+                if (!analysis.series)
+                {
+                    throw decode_exception(analysis.error);
+                }
+                OrderOptions order_options = jobs[job].order;
+                order_options.metrics = nullptr;
+                EditDecisionList edl = EditDecisionList::from_permutation(order(*analysis.series, order_options));
+
+                RenderOptions render_options = jobs[job].render;
+                render_options.source_key = analysis_options[job_analyses[job]].source_key;
+                render_options.metrics = nullptr;
+                render_options.encoder.metrics = nullptr;
+                if (workers > 1)
+                {
+                    render_options.encoder.codec_options.emplace("threads", encoder_threads);
+                }
+                result.stats = render(jobs[job].input, jobs[job].output, edl, render_options);
+                result.runs = edl.size();
+                result.succeeded = true;
+            }
+            catch (const std::exception &e)
+            {
+                result.error = e.what();
+            }
+            result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            std::lock_guard<std::mutex> lock(completed_mutex);
+            if (options.metrics)
+            {
+                options.metrics->add_progress();
+            }
+            if (options.completed)
+            {
+                options.completed(job, result);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int worker = 1; worker < workers; worker++)
+    {
+        threads.emplace_back(work);
+    }
+    work();
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+
+    if (options.metrics)
+    {
+        options.metrics->end_phase();
+    }
+    return results;
+}
+
+}
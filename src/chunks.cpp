@@ -0,0 +1,544 @@
+#include "lumin/chunks.h"
+#include "lumin/decoder.h"
+#include "lumin/encoder.h"
+#include "lumin/exceptions.h"
+#include "lumin/read_ahead.h"
+#include "lumin/sidecar.h"
+#include "libav.h"
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace lumin
+{
+
+static std::string get_chunk_path(const std::string &directory, size_t chunk, const std::string &suffix)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "chunk-%06zu", chunk);
+    return directory + "/" + name + suffix;
+}
+
+/*------------------------------------------------------------------------
+ * Extension of `path`, with its dot, or "" if it has none.
+ *-----------------------------------------------------------------------*/
+static std::string get_extension(const std::string &path)
+{
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    {
+        return "";
+    }
+    return path.substr(dot);
+}
+
+/*------------------------------------------------------------------------
+ * `path` with a temporary suffix before its extension, which still
+ * chooses the container.
+ *-----------------------------------------------------------------------*/
+static std::string get_temp_path(const std::string &path)
+{
+    std::string extension = get_extension(path);
+    return path.substr(0, path.size() - extension.size()) + ".tmp." + std::to_string(getpid()) + extension;
+}
+
+static std::string read_file(const std::string &path)
+{
+    std::string text;
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        return text;
+    }
+    char buffer[4096];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        text.append(buffer, count);
+    }
+    fclose(file);
+    return text;
+}
+
+/*------------------------------------------------------------------------
+ * Write `text` to a temporary file and rename it into place, so a marker
+ * is never seen half-written.
+ *-----------------------------------------------------------------------*/
+static void write_file(const std::string &path, const std::string &text)
+{
+    std::string temp_path = path + ".tmp." + std::to_string(getpid());
+    FILE *file = fopen(temp_path.c_str(), "wb");
+    if (!file)
+    {
+        throw io_exception("Couldn't open " + temp_path + " for writing");
+    }
+    size_t written = fwrite(text.data(), 1, text.size(), file);
+    if (fclose(file) != 0 || written != text.size() || rename(temp_path.c_str(), path.c_str()) != 0)
+    {
+        unlink(temp_path.c_str());
+        throw io_exception("Couldn't write " + path);
+    }
+}
+
+/*------------------------------------------------------------------------
+ * Completion marker for a chunk: everything that determines its
+ * content. A chunk is only reused if its marker matches exactly.
+ *-----------------------------------------------------------------------*/
+static std::string get_marker(const SourceKey &key,
+                              const EditDecisionList &chunk_edl,
+                              size_t dest_start,
+                              const RenderOptions &options)
+{
+    uint64_t runs_hash = 14695981039346656037ull;
+    for (const EditRun &run : chunk_edl.get_runs())
+    {
+        for (uint32_t value : { run.source_start, run.length })
+        {
+            for (int byte = 0; byte < 4; byte++)
+            {
+                runs_hash = (runs_hash ^ ((value >> (byte * 8)) & 0xff)) * 1099511628211ull;
+            }
+        }
+    }
+
+    char buffer[256];
+    std::string marker = "lumin-chunk 1\nsource " + key.path + "\n";
+    snprintf(buffer, sizeof(buffer), "source_key %llu %lld %016llx\nframes %zu %zu %lld/%lld\nruns %zu %016llx\n",
+             (unsigned long long) key.size, (long long) key.mtime_ns, (unsigned long long) key.content_hash,
+             dest_start, chunk_edl.get_frame_count(), (long long) chunk_edl.get_frame_rate().num,
+             (long long) chunk_edl.get_frame_rate().den, chunk_edl.size(), (unsigned long long) runs_hash);
+    marker += buffer;
+    marker += "codec " + options.encoder.codec + " " + std::to_string(options.encoder.bit_rate);
+    for (const auto &option : options.encoder.codec_options)
+    {
+        marker += " " + option.first + "=" + option.second;
+    }
+    marker += options.stream_copy ? "\nstream_copy\n" : "\n";
+    return marker;
+}
+
+/*------------------------------------------------------------------------
+ * Join the chunks at `paths` into `output` by copying their packets,
+ * shifting each chunk's timestamps to its place in the output, and
+ * encode the reordered soundtrack alongside.
+ *-----------------------------------------------------------------------*/
+static void join_chunks(const std::string &input,
+                        const std::string &output,
+                        const std::vector<std::string> &paths,
+                        const EditDecisionList &edl,
+                        size_t chunk_frames,
+                        const RenderOptions &options)
+{
+    std::unique_ptr<AudioFile> source_audio;
+    std::unique_ptr<RemappedAudio> audio;
+    if (options.audio)
+    {
+        if (options.metrics)
+        {
+            options.metrics->begin_phase("audio");
+        }
+        source_audio = decode_audio(input, options.spill_directory);
+        if (source_audio)
+        {
+            audio = std::make_unique<RemappedAudio>(*source_audio, edl, options.crossfade);
+        }
+    }
+    if (options.metrics)
+    {
+        options.metrics->begin_phase("join", edl.get_frame_count());
+    }
+
+    EncoderOptions encoder_options = options.encoder;
+    encoder_options.metrics = options.metrics;
+    const std::string temp_path = get_temp_path(output);
+    const AVRational frame_duration = { (int) edl.get_frame_rate().den, (int) edl.get_frame_rate().num };
+    std::unique_ptr<VideoEncoder> muxer;
+    AVFormatContext *chunk_context = nullptr;
+    AVPacket *packet = av_packet_alloc();
+    AVRational time_base = { 0, 1 };
+    int codec_id = 0;
+    int64_t last_dts = INT64_MIN;
+
+    try
+    {
+        for (size_t chunk = 0; chunk < paths.size(); chunk++)
+        {
+            const std::string &path = paths[chunk];
+            int rv = avformat_open_input(&chunk_context, path.c_str(), nullptr, nullptr);
+            if (rv < 0)
+            {
+                throw io_exception("Couldn't open " + path + ": " + av_error_string(rv));
+            }
+            rv = avformat_find_stream_info(chunk_context, nullptr);
+            int stream_index = rv < 0 ? rv : av_find_best_stream(chunk_context, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+            if (stream_index < 0)
+            {
+                throw decode_exception("No video stream in " + path);
+            }
+            AVStream *stream = chunk_context->streams[stream_index];
+
+            /*------------------------------------------------------------------------
+             * Timestamps are carried in the first chunk's time base. Chunks
+             * from one encoder share it, so the rescale is normally a no-op.
+             *-----------------------------------------------------------------------*/
+            if (!muxer)
+            {
+                time_base = stream->time_base;
+                codec_id = stream->codecpar->codec_id;
+                muxer = std::make_unique<VideoEncoder>(temp_path, stream->codecpar, edl.get_frame_rate(),
+                                                       encoder_options, audio.get());
+            }
+            else if (stream->codecpar->codec_id != codec_id)
+            {
+                throw decode_exception("Chunk " + path + " wasn't encoded like the others");
+            }
+
+            const int64_t offset = av_rescale_q((int64_t) (chunk * chunk_frames), frame_duration, time_base);
+            const size_t expected = std::min(chunk_frames, edl.get_frame_count() - chunk * chunk_frames);
+            size_t copied = 0;
+            while ((rv = av_read_frame(chunk_context, packet)) >= 0)
+            {
+                if (packet->stream_index != stream_index)
+                {
+                    av_packet_unref(packet);
+                    continue;
+                }
+                av_packet_rescale_ts(packet, stream->time_base, time_base);
+                if (packet->pts != AV_NOPTS_VALUE)
+                {
+                    packet->pts += offset;
+                }
+                packet->dts = packet->dts == AV_NOPTS_VALUE ? packet->pts : packet->dts + offset;
+                if (packet->dts != AV_NOPTS_VALUE)
+                {
+                    if (packet->dts <= last_dts)
+                    {
+                        packet->dts = last_dts + 1;
+                    }
+                    last_dts = packet->dts;
+                }
+                if (options.metrics)
+                {
+                    options.metrics->add_bytes_read(packet->size);
+                    options.metrics->add_progress();
+                }
+                muxer->write_packet(packet, Rational(time_base.num, time_base.den));
+                copied++;
+            }
+            if (rv != AVERROR_EOF)
+            {
+                throw io_exception("Read failed: " + av_error_string(rv));
+            }
+            avformat_close_input(&chunk_context);
+            if (copied != expected)
+            {
+                throw decode_exception("Chunk " + path + " has " + std::to_string(copied) + " frames, expected " +
+                                       std::to_string(expected));
+            }
+        }
+        muxer->finish();
+        muxer.reset();
+    }
+    catch (...)
+    {
+        av_packet_free(&packet);
+        avformat_close_input(&chunk_context);
+        muxer.reset();
+        unlink(temp_path.c_str());
+        throw;
+    }
+    av_packet_free(&packet);
+
+    if (rename(temp_path.c_str(), output.c_str()) != 0)
+    {
+        std::string error = strerror(errno);
+        unlink(temp_path.c_str());
+        throw io_exception("Couldn't write " + output + ": " + error);
+    }
+}
+
+RenderStats render_chunked(const std::string &input,
+                           const std::string &output,
+                           const EditDecisionList &edl,
+                           const RenderOptions &options)
+{
+    if (options.chunk_shard_count == 0 || options.chunk_shard >= options.chunk_shard_count)
+    {
+        throw invalid_argument_exception("Chunk shard must be less than the shard count");
+    }
+    if (edl.get_frame_count() == 0)
+    {
+        throw invalid_argument_exception("Nothing to render");
+    }
+
+    /*------------------------------------------------------------------------
+     * With a fixed GOP size, chunks fall on the same GOP grid as a render
+     * in one piece would.
+     *-----------------------------------------------------------------------*/
+    size_t chunk_frames = std::max<size_t>(1, options.chunk_frames);
+    auto gop = options.encoder.codec_options.find("g");
+    if (gop != options.encoder.codec_options.end() && atol(gop->second.c_str()) > 0)
+    {
+        size_t gop_frames = (size_t) atol(gop->second.c_str());
+        chunk_frames = (chunk_frames + gop_frames - 1) / gop_frames * gop_frames;
+    }
+    const size_t frame_count = edl.get_frame_count();
+    const size_t chunk_count = (frame_count + chunk_frames - 1) / chunk_frames;
+
+    const std::string directory = options.chunk_directory.empty() ? output + ".chunks" : options.chunk_directory;
+    if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        throw io_exception("Couldn't create " + directory + ": " + strerror(errno));
+    }
+
+    SourceKey computed_key;
+    if (!options.source_key)
+    {
+        computed_key = SourceKey::from_file(input);
+    }
+    const SourceKey &key = options.source_key ? *options.source_key : computed_key;
+    const std::string extension = get_extension(output);
+    std::vector<std::string> paths(chunk_count);
+    std::vector<std::string> markers(chunk_count);
+    auto is_complete = [&](size_t chunk) {
+        return access(paths[chunk].c_str(), R_OK) == 0 &&
+               read_file(get_chunk_path(directory, chunk, ".done")) == markers[chunk];
+    };
+
+    RenderStats stats;
+    stats.chunks = chunk_count;
+    std::vector<size_t> pending;
+    size_t complete_frames = 0;
+    for (size_t chunk = 0; chunk < chunk_count; chunk++)
+    {
+        paths[chunk] = get_chunk_path(directory, chunk, extension);
+        markers[chunk] = get_marker(key, edl.slice(chunk * chunk_frames, (chunk + 1) * chunk_frames),
+                                    chunk * chunk_frames, options);
+        if (chunk % options.chunk_shard_count == options.chunk_shard)
+        {
+            if (is_complete(chunk))
+            {
+                complete_frames += std::min(chunk_frames, frame_count - chunk * chunk_frames);
+            }
+            else
+            {
+                pending.push_back(chunk);
+            }
+        }
+    }
+
+    /*------------------------------------------------------------------------
+     * Index the source once for every chunk, unless frames will come
+     * from a frame store.
+     *-----------------------------------------------------------------------*/
+    PacketIndex built_index;
+    const PacketIndex *index = options.packet_index;
+    if (!index && !pending.empty() && (options.frame_store_path.empty() || options.stream_copy))
+    {
+        if (options.metrics)
+        {
+            options.metrics->begin_phase("index");
+        }
+        built_index = load_packet_index(input, options.packet_index_path, &key);
+        index = &built_index;
+    }
+
+    if (options.metrics)
+    {
+        options.metrics->begin_phase("render", frame_count);
+        options.metrics->add_progress(complete_frames);
+    }
+
+    /*------------------------------------------------------------------------
+     * Chunks render without their soundtrack, which is encoded whole when
+     * they are joined, so there are no encoder delays at chunk boundaries.
+     *-----------------------------------------------------------------------*/
+    const int hardware_threads = std::max(1, (int) std::thread::hardware_concurrency());
+    int workers = options.chunk_workers > 0 ? options.chunk_workers : std::max(1, hardware_threads / 4);
+    workers = std::max(1, std::min(workers, (int) pending.size()));
+    const std::string encoder_threads = std::to_string(std::max(1, hardware_threads / workers));
+
+    /*------------------------------------------------------------------------
+     * Workers read the source through one read-ahead cache, so that each
+     * block is fetched once however many chunks need it.
+     *-----------------------------------------------------------------------*/
+    std::unique_ptr<ReadAheadFile> read_ahead;
+    if (options.read_ahead && !options.read_ahead_file && !pending.empty())
+    {
+        ReadAheadOptions read_ahead_options;
+        read_ahead_options.budget = options.read_ahead;
+        read_ahead = std::make_unique<ReadAheadFile>(input, read_ahead_options);
+    }
+
+    std::atomic<size_t> next(0);
+    std::mutex mutex;
+    std::exception_ptr error;
+    auto work = [&]() {
+        size_t item;
+        while ((item = next.fetch_add(1)) < pending.size())
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (error)
+                {
+                    return;
+                }
+            }
+
+            const size_t chunk = pending[item];
+            EditDecisionList chunk_edl = edl.slice(chunk * chunk_frames, (chunk + 1) * chunk_frames);
+            RenderOptions chunk_options = options;
+            chunk_options.chunk_frames = 0;
+            chunk_options.audio = false;
+            chunk_options.metrics = nullptr;
+            chunk_options.encoder.metrics = nullptr;
+            chunk_options.packet_index = index;
+            chunk_options.source_key = &key;
+            if (read_ahead)
+            {
+                chunk_options.read_ahead_file = read_ahead.get();
+            }
+            if (workers > 1)
+            {
+                chunk_options.encoder.codec_options.emplace("threads", encoder_threads);
+            }
+
+            const std::string temp_path = get_temp_path(paths[chunk]);
+            try
+            {
+                RenderStats chunk_stats = render(input, temp_path, chunk_edl, chunk_options);
+                if (rename(temp_path.c_str(), paths[chunk].c_str()) != 0)
+                {
+                    throw io_exception("Couldn't write " + paths[chunk] + ": " + strerror(errno));
+                }
+                write_file(get_chunk_path(directory, chunk, ".done"), markers[chunk]);
+
+                std::lock_guard<std::mutex> lock(mutex);
+                stats.chunks_rendered++;
+                stats.passes += chunk_stats.passes;
+                stats.seeks += chunk_stats.seeks;
+                stats.frames_decoded += chunk_stats.frames_decoded;
+                stats.frames_written += chunk_stats.frames_written;
+                stats.frame_store_used = stats.frame_store_used || chunk_stats.frame_store_used;
+                if (options.metrics)
+                {
+                    options.metrics->add_frames_written(chunk_stats.frames_written);
+                    options.metrics->add_frames_decoded(chunk_stats.frames_decoded);
+                    options.metrics->add_seeks(chunk_stats.seeks);
+                    options.metrics->add_progress(chunk_edl.get_frame_count());
+                }
+            }
+            catch (...)
+            {
+                unlink(temp_path.c_str());
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error)
+                {
+                    error = std::current_exception();
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int worker = 1; worker < workers; worker++)
+    {
+        threads.emplace_back(work);
+    }
+    work();
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    if (read_ahead)
+    {
+        stats.read_ahead = read_ahead->get_stats();
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+
+    /*------------------------------------------------------------------------
+     * Join once every chunk is complete, including other shards'.
+     *-----------------------------------------------------------------------*/
+    for (size_t chunk = 0; chunk < chunk_count; chunk++)
+    {
+        if (!is_complete(chunk))
+        {
+            if (options.metrics)
+            {
+                options.metrics->end_phase();
+            }
+            return stats;
+        }
+    }
+
+    /*------------------------------------------------------------------------
+     * Shards finishing together would each join into the same output and
+     * remove the others' chunks, so only the one that creates the join
+     * marker does. A failed join removes it so that a rerun can join; a
+     * join that was killed leaves it, to be removed by hand.
+     *-----------------------------------------------------------------------*/
+    const std::string join_marker = directory + "/join";
+    int fd = ::open(join_marker.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        if (errno != EEXIST)
+        {
+            throw io_exception("Couldn't create " + join_marker + ": " + strerror(errno));
+        }
+        stats.chunks_joined_elsewhere = true;
+        if (options.metrics)
+        {
+            options.metrics->end_phase();
+        }
+        return stats;
+    }
+    ::close(fd);
+    try
+    {
+        join_chunks(input, output, paths, edl, chunk_frames, options);
+    }
+    catch (...)
+    {
+        unlink(join_marker.c_str());
+        throw;
+    }
+    stats.chunks_joined = true;
+
+    for (size_t chunk = 0; chunk < chunk_count; chunk++)
+    {
+        unlink(paths[chunk].c_str());
+        unlink(get_chunk_path(directory, chunk, ".done").c_str());
+    }
+    unlink(join_marker.c_str());
+    rmdir(directory.c_str());
+    if (options.metrics)
+    {
+        options.metrics->end_phase();
+    }
+    return stats;
+}
+
+}
@@ -0,0 +1,103 @@
+#include "cuda_kernels.h"
+#include "lumin/exceptions.h"
+
+#include <cuda_runtime.h>
+
+#include <string>
+
+namespace lumin
+{
+
+static const int THREADS_PER_BLOCK = 256;
+
+/*------------------------------------------------------------------------
+ * One block per row (striding over rows if there are more rows than
+ * blocks). Each thread sums a strided subset of the row, the block
+ * reduces in shared memory, and one atomic add per block accumulates the
+ * plane total.
+ *-----------------------------------------------------------------------*/
+__global__ static void sum_plane_kernel(const uint8_t *data,
+                                        size_t stride,
+                                        size_t width,
+                                        size_t height,
+                                        unsigned long long *total)
+{
+    __shared__ unsigned long long partial[THREADS_PER_BLOCK];
+
+    unsigned long long sum = 0;
+    for (size_t y = blockIdx.x; y < height; y += gridDim.x)
+    {
+        const uint8_t *row = data + y * stride;
+        for (size_t x = threadIdx.x; x < width; x += blockDim.x)
+        {
+            sum += row[x];
+        }
+    }
+    partial[threadIdx.x] = sum;
+    __syncthreads();
+
+    for (int offset = blockDim.x / 2; offset > 0; offset /= 2)
+    {
+        if (threadIdx.x < offset)
+        {
+            partial[threadIdx.x] += partial[threadIdx.x + offset];
+        }
+        __syncthreads();
+    }
+    if (threadIdx.x == 0)
+    {
+        atomicAdd(total, partial[0]);
+    }
+}
+
+/*------------------------------------------------------------------------
+ * Per-thread stream and device-side accumulator, so that parallel
+ * analysis segments don't serialise on each other.
+ *-----------------------------------------------------------------------*/
+class DeviceAccumulator
+{
+public:
+    DeviceAccumulator()
+        : stream(nullptr), total(nullptr)
+    {
+        if (cudaStreamCreateWithFlags(&this->stream, cudaStreamNonBlocking) != cudaSuccess ||
+            cudaMalloc(&this->total, sizeof(unsigned long long)) != cudaSuccess)
+        {
+            throw decode_exception(std::string("Couldn't allocate CUDA accumulator: ") +
+                                   cudaGetErrorString(cudaGetLastError()));
+        }
+    }
+
+    ~DeviceAccumulator()
+    {
+        cudaFree(this->total);
+        cudaStreamDestroy(this->stream);
+    }
+
+    cudaStream_t stream;
+    unsigned long long *total;
+};
+
+uint64_t sum_device_plane_u8(const uint8_t *device_data, size_t stride, size_t width, size_t height)
+{
+    if (width == 0 || height == 0)
+    {
+        return 0;
+    }
+    thread_local DeviceAccumulator accumulator;
+
+    const unsigned int blocks = (unsigned int) (height < 1024 ? height : 1024);
+    unsigned long long total = 0;
+    cudaMemsetAsync(accumulator.total, 0, sizeof(total), accumulator.stream);
+    sum_plane_kernel<<<blocks, THREADS_PER_BLOCK, 0, accumulator.stream>>>(device_data, stride, width, height,
+                                                                           accumulator.total);
+    cudaMemcpyAsync(&total, accumulator.total, sizeof(total), cudaMemcpyDeviceToHost, accumulator.stream);
+    cudaError_t error = cudaStreamSynchronize(accumulator.stream);
+    if (error != cudaSuccess)
+    {
+        throw decode_exception(std::string("CUDA reduction failed: ") + cudaGetErrorString(error));
+    }
+    return total;
+}
+
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+/*------------------------------------------------------------------------
+ * Reduction kernels for image planes in GPU memory, built only with the
+ * CUDA backend (LUMIN_HAVE_CUDA).
+ *-----------------------------------------------------------------------*/
+
+#include <cstddef>
+#include <cstdint>
+
+namespace lumin
+{
+
+/*------------------------------------------------------------------------
+ * Sum of a `width` x `height` plane of 8-bit samples at `device_data`,
+ * a pointer in the primary CUDA context, with rows `stride` bytes
+ * apart. Only the 64-bit sum is copied back to the host. Safe to call
+ * from several threads at once.
+ *-----------------------------------------------------------------------*/
+uint64_t sum_device_plane_u8(const uint8_t *device_data, size_t stride, size_t width, size_t height);
+
+}
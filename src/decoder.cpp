@@ -0,0 +1,870 @@
+#include "lumin/decoder.h"
+#include "lumin/exceptions.h"
+#include "lumin/read_ahead.h"
+#include "lumin/sidecar.h"
+#include "libav.h"
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/dict.h>
+#include <libavutil/hwcontext.h>
+#include <libavutil/log.h>
+#include <libavutil/mem.h>
+#include <libavutil/pixdesc.h>
+#include <libswresample/swresample.h>
+#include <libswscale/swscale.h>
+}
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace lumin
+{
+
+const char *get_hardware_decode_name(HardwareDecode hardware)
+{
+    switch (hardware)
+    {
+        case HARDWARE_DECODE_AUTO:
+            return "auto";
+        case HARDWARE_DECODE_CUDA:
+            return "cuda";
+        case HARDWARE_DECODE_VAAPI:
+            return "vaapi";
+        case HARDWARE_DECODE_VIDEOTOOLBOX:
+            return "videotoolbox";
+        default:
+            return "none";
+    }
+}
+
+static AVHWDeviceType get_device_type(HardwareDecode hardware)
+{
+    switch (hardware)
+    {
+        case HARDWARE_DECODE_CUDA:
+            return AV_HWDEVICE_TYPE_CUDA;
+        case HARDWARE_DECODE_VAAPI:
+            return AV_HWDEVICE_TYPE_VAAPI;
+        case HARDWARE_DECODE_VIDEOTOOLBOX:
+            return AV_HWDEVICE_TYPE_VIDEOTOOLBOX;
+        default:
+            return AV_HWDEVICE_TYPE_NONE;
+    }
+}
+
+/*------------------------------------------------------------------------
+ * Surface format that `codec` decodes to with a device of `type`, or
+ * AV_PIX_FMT_NONE if it has no hardware decoder for the device.
+ *-----------------------------------------------------------------------*/
+static AVPixelFormat get_device_format(const AVCodec *codec, AVHWDeviceType type)
+{
+    for (int index = 0;; index++)
+    {
+        const AVCodecHWConfig *config = avcodec_get_hw_config(codec, index);
+        if (!config)
+        {
+            return AV_PIX_FMT_NONE;
+        }
+        if ((config->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX) && config->device_type == type)
+        {
+            return config->pix_fmt;
+        }
+    }
+}
+
+/*------------------------------------------------------------------------
+ * Choose the hardware surface format, which the context's opaque
+ * pointer points to, if the decoder offers it. Otherwise the device
+ * can't decode this stream, so clear the format and fall back to the
+ * first software format. This is called again whenever the stream's
+ * parameters change.
+ *-----------------------------------------------------------------------*/
+static AVPixelFormat get_hardware_format(AVCodecContext *context, const AVPixelFormat *formats)
+{
+    int *hardware_format = (int *) context->opaque;
+    for (const AVPixelFormat *format = formats; *format != AV_PIX_FMT_NONE; format++)
+    {
+        if (*format == *hardware_format)
+        {
+            return *format;
+        }
+    }
+    *hardware_format = AV_PIX_FMT_NONE;
+    for (const AVPixelFormat *format = formats; *format != AV_PIX_FMT_NONE; format++)
+    {
+        if (!(av_pix_fmt_desc_get(*format)->flags & AV_PIX_FMT_FLAG_HWACCEL))
+        {
+            return *format;
+        }
+    }
+    return AV_PIX_FMT_NONE;
+}
+
+/*------------------------------------------------------------------------
+ * Open a device for `hardware` and attach it to `context`, returning
+ * the surface format, or AV_PIX_FMT_NONE if `codec` can't be decoded
+ * with it.
+ *-----------------------------------------------------------------------*/
+static AVPixelFormat open_hardware_device(AVCodecContext *context, const AVCodec *codec, HardwareDecode hardware)
+{
+    AVHWDeviceType type = get_device_type(hardware);
+    AVPixelFormat format = get_device_format(codec, type);
+    if (format == AV_PIX_FMT_NONE)
+    {
+        return AV_PIX_FMT_NONE;
+    }
+
+    AVDictionary *device_options = nullptr;
+    if (type == AV_HWDEVICE_TYPE_CUDA)
+    {
+        av_dict_set(&device_options, "primary_ctx", "1", 0);
+    }
+    int rv = av_hwdevice_ctx_create(&context->hw_device_ctx, type, nullptr, device_options, 0);
+    av_dict_free(&device_options);
+    return rv < 0 ? AV_PIX_FMT_NONE : format;
+}
+
+/*------------------------------------------------------------------------
+ * Size of the buffer libavformat reads into from a read-ahead cache,
+ * which is served from the cache's blocks.
+ *-----------------------------------------------------------------------*/
+static const int READ_AHEAD_IO_BUFFER_SIZE = 64 << 10;
+
+/*------------------------------------------------------------------------
+ * A decoder's position in a shared ReadAheadFile.
+ *-----------------------------------------------------------------------*/
+class ReadAheadCursor
+{
+public:
+    ReadAheadFile *file;
+    int64_t position;
+};
+
+static int read_read_ahead(void *opaque, uint8_t *buffer, int size)
+{
+    ReadAheadCursor *cursor = (ReadAheadCursor *) opaque;
+    size_t count;
+    try
+    {
+        count = cursor->file->read(cursor->position, buffer, (size_t) size);
+    }
+    catch (const io_exception &)
+    {
+        return AVERROR(EIO);
+    }
+    if (count == 0)
+    {
+        return AVERROR_EOF;
+    }
+    cursor->position += (int64_t) count;
+    return (int) count;
+}
+
+static int64_t seek_read_ahead(void *opaque, int64_t offset, int whence)
+{
+    ReadAheadCursor *cursor = (ReadAheadCursor *) opaque;
+    if (whence & AVSEEK_SIZE)
+    {
+        return cursor->file->get_size();
+    }
+
+    int64_t position;
+    switch (whence & ~AVSEEK_FORCE)
+    {
+        case SEEK_SET:
+            position = offset;
+            break;
+        case SEEK_CUR:
+            position = cursor->position + offset;
+            break;
+        case SEEK_END:
+            position = cursor->file->get_size() + offset;
+            break;
+        default:
+            return AVERROR(EINVAL);
+    }
+    if (position < 0)
+    {
+        return AVERROR(EINVAL);
+    }
+    cursor->position = position;
+    return position;
+}
+
+VideoDecoder::VideoDecoder(const std::string &path, const DecoderOptions &options)
+    : format_context(nullptr), io_context(nullptr), codec_context(nullptr), packet(nullptr), frame(nullptr),
+      stream_index(-1), packet_pending(false), flushing(false), finished(false), metrics(options.metrics),
+      hardware(HARDWARE_DECODE_NONE), hardware_format(AV_PIX_FMT_NONE), download(options.download),
+      software_format(AV_PIX_FMT_NONE), convert_download(false), downloaded(nullptr), converted(nullptr),
+      sws_context(nullptr)
+{
+    if (options.read_ahead)
+    {
+        this->cursor = std::make_unique<ReadAheadCursor>();
+        this->cursor->file = options.read_ahead;
+        this->cursor->position = 0;
+        uint8_t *buffer = (uint8_t *) av_malloc(READ_AHEAD_IO_BUFFER_SIZE);
+        this->io_context = avio_alloc_context(buffer, READ_AHEAD_IO_BUFFER_SIZE, 0, this->cursor.get(),
+                                              read_read_ahead, nullptr, seek_read_ahead);
+        this->format_context = avformat_alloc_context();
+        if (!buffer || !this->io_context || !this->format_context)
+        {
+            if (!this->io_context)
+            {
+                av_free(buffer);
+            }
+            this->close_input();
+            throw decode_exception("Couldn't allocate I/O context for " + path);
+        }
+        this->format_context->pb = this->io_context;
+        this->format_context->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+
+    int rv = avformat_open_input(&this->format_context, path.c_str(), nullptr, nullptr);
+    if (rv < 0)
+    {
+        this->close_input();
+        throw io_exception("Couldn't open " + path + ": " + av_error_string(rv));
+    }
+
+    rv = avformat_find_stream_info(this->format_context, nullptr);
+    if (rv < 0)
+    {
+        this->close_input();
+        throw io_exception("Couldn't probe " + path + ": " + av_error_string(rv));
+    }
+
+    const AVCodec *codec = nullptr;
+    this->stream_index = av_find_best_stream(this->format_context, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+    if (this->stream_index < 0)
+    {
+        this->close_input();
+        throw decode_exception("No decodable video stream in " + path);
+    }
+
+    /*------------------------------------------------------------------------
+     * Discard packets from every other stream at the demuxer, so that
+     * audio is never read during analysis.
+     *-----------------------------------------------------------------------*/
+    for (unsigned int index = 0; index < this->format_context->nb_streams; index++)
+    {
+        if ((int) index != this->stream_index)
+        {
+            this->format_context->streams[index]->discard = AVDISCARD_ALL;
+        }
+    }
+
+    AVStream *stream = this->format_context->streams[this->stream_index];
+    this->codec_context = avcodec_alloc_context3(codec);
+    avcodec_parameters_to_context(this->codec_context, stream->codecpar);
+    this->codec_context->thread_count = options.threads;
+    if (options.proxy)
+    {
+        this->codec_context->lowres = codec->max_lowres;
+        this->codec_context->skip_loop_filter = AVDISCARD_ALL;
+        this->codec_context->flags2 |= AV_CODEC_FLAG2_FAST;
+    }
+    this->software_format = this->codec_context->pix_fmt;
+
+    /*------------------------------------------------------------------------
+     * Try each candidate decoder in turn, decoding in software if none
+     * opens.
+     *-----------------------------------------------------------------------*/
+    std::vector<HardwareDecode> candidates;
+    if (options.hardware == HARDWARE_DECODE_AUTO)
+    {
+#ifdef __APPLE__
+        candidates = { HARDWARE_DECODE_VIDEOTOOLBOX };
+#else
+        candidates = { HARDWARE_DECODE_CUDA, HARDWARE_DECODE_VAAPI };
+#endif
+    }
+    else if (options.hardware != HARDWARE_DECODE_NONE)
+    {
+        candidates = { options.hardware };
+    }
+    for (HardwareDecode candidate : candidates)
+    {
+        AVPixelFormat format = open_hardware_device(this->codec_context, codec, candidate);
+        if (format != AV_PIX_FMT_NONE)
+        {
+            this->hardware = candidate;
+            this->hardware_format = format;
+            this->codec_context->opaque = &this->hardware_format;
+            this->codec_context->get_format = get_hardware_format;
+            this->codec_context->extra_hw_frames = options.extra_hw_frames;
+            break;
+        }
+    }
+
+    rv = avcodec_open2(this->codec_context, codec, nullptr);
+    if (rv < 0)
+    {
+        avcodec_free_context(&this->codec_context);
+        this->close_input();
+        throw decode_exception("Couldn't open decoder for " + path + ": " + av_error_string(rv));
+    }
+
+    this->packet = av_packet_alloc();
+    this->frame = av_frame_alloc();
+    this->downloaded = av_frame_alloc();
+    this->converted = av_frame_alloc();
+}
+
+VideoDecoder::~VideoDecoder()
+{
+    sws_freeContext(this->sws_context);
+    av_frame_free(&this->converted);
+    av_frame_free(&this->downloaded);
+    av_frame_free(&this->frame);
+    av_packet_free(&this->packet);
+    avcodec_free_context(&this->codec_context);
+    this->close_input();
+}
+
+/*------------------------------------------------------------------------
+ * With custom I/O, libavformat leaves the I/O context, and the buffer it
+ * may have replaced, to be freed here.
+ *-----------------------------------------------------------------------*/
+void VideoDecoder::close_input()
+{
+    avformat_close_input(&this->format_context);
+    if (this->io_context)
+    {
+        av_freep(&this->io_context->buffer);
+        avio_context_free(&this->io_context);
+    }
+}
+
+/*------------------------------------------------------------------------
+ * Decoders that report a corrupt packet only when its frame is due (with
+ * frame threading, say) do so here; the frame is skipped, as a packet
+ * rejected by avcodec_send_packet() would be, and callers see a gap.
+ *-----------------------------------------------------------------------*/
+bool VideoDecoder::receive_frame()
+{
+    int rv = avcodec_receive_frame(this->codec_context, this->frame);
+    while (rv == AVERROR_INVALIDDATA)
+    {
+        if (this->metrics)
+        {
+            this->metrics->add_corrupt_packets();
+        }
+        rv = avcodec_receive_frame(this->codec_context, this->frame);
+    }
+    if (rv == 0)
+    {
+        if (this->metrics)
+        {
+            this->metrics->add_frames_decoded();
+        }
+        return true;
+    }
+    if (rv == AVERROR_EOF)
+    {
+        this->finished = true;
+        return false;
+    }
+    if (rv != AVERROR(EAGAIN))
+    {
+        throw decode_exception("Decode failed: " + av_error_string(rv));
+    }
+    return false;
+}
+
+AVFrame *VideoDecoder::read_frame()
+{
+    while (!this->finished)
+    {
+        if (this->receive_frame())
+        {
+            return this->download && this->frame->hw_frames_ctx ? this->download_frame() : this->frame;
+        }
+        if (this->finished)
+        {
+            break;
+        }
+
+        if (this->flushing)
+        {
+            /*------------------------------------------------------------------------
+             * Draining, and the decoder has asked for more input: this
+             * only happens if it has nothing left to give.
+             *-----------------------------------------------------------------------*/
+            this->finished = true;
+            break;
+        }
+
+        if (!this->packet_pending)
+        {
+            int rv = av_read_frame(this->format_context, this->packet);
+            if (rv == AVERROR_EOF)
+            {
+                this->flushing = true;
+                avcodec_send_packet(this->codec_context, nullptr);
+                continue;
+            }
+            if (rv < 0)
+            {
+                throw io_exception("Read failed: " + av_error_string(rv));
+            }
+            if (this->metrics)
+            {
+                this->metrics->add_bytes_read(this->packet->size);
+            }
+            if (this->packet->stream_index != this->stream_index)
+            {
+                av_packet_unref(this->packet);
+                continue;
+            }
+        }
+
+        /*------------------------------------------------------------------------
+         * With EAGAIN the decoder must give up a frame before it takes
+         * more input, so the packet is kept and sent again once that has
+         * been received. A corrupt packet is skipped, leaving a gap that
+         * callers fill (see analyse() and render()).
+         *-----------------------------------------------------------------------*/
+        int rv = avcodec_send_packet(this->codec_context, this->packet);
+        this->packet_pending = rv == AVERROR(EAGAIN);
+        if (this->packet_pending)
+        {
+            continue;
+        }
+        av_packet_unref(this->packet);
+        if (rv == AVERROR_INVALIDDATA)
+        {
+            if (this->metrics)
+            {
+                this->metrics->add_corrupt_packets();
+            }
+        }
+        else if (rv < 0)
+        {
+            throw decode_exception("Decode failed: " + av_error_string(rv));
+        }
+    }
+
+    return nullptr;
+}
+
+/*------------------------------------------------------------------------
+ * Most devices can download to the stream's own format (VAAPI, for
+ * instance, to planar YUV as well as NV12); the others download to
+ * their own format, which is then converted.
+ *-----------------------------------------------------------------------*/
+AVFrame *VideoDecoder::download_frame()
+{
+    av_frame_unref(this->downloaded);
+    int rv = AVERROR(EINVAL);
+    if (!this->convert_download)
+    {
+        this->downloaded->format = this->software_format;
+        rv = av_hwframe_transfer_data(this->downloaded, this->frame, 0);
+        if (rv < 0)
+        {
+            this->convert_download = true;
+            av_frame_unref(this->downloaded);
+        }
+    }
+    if (rv < 0)
+    {
+        rv = av_hwframe_transfer_data(this->downloaded, this->frame, 0);
+    }
+    if (rv < 0)
+    {
+        throw decode_exception("Couldn't download hardware frame: " + av_error_string(rv));
+    }
+    av_frame_copy_props(this->downloaded, this->frame);
+    if (this->downloaded->format == this->software_format)
+    {
+        return this->downloaded;
+    }
+
+    /*------------------------------------------------------------------------
+     * A new buffer for every frame, as callers may hold references to
+     * returned frames.
+     *-----------------------------------------------------------------------*/
+    av_frame_unref(this->converted);
+    this->converted->format = this->software_format;
+    this->converted->width = this->downloaded->width;
+    this->converted->height = this->downloaded->height;
+    rv = av_frame_get_buffer(this->converted, 0);
+    if (rv < 0)
+    {
+        throw decode_exception("Couldn't allocate frame: " + av_error_string(rv));
+    }
+    this->sws_context = sws_getCachedContext(this->sws_context,
+                                             this->downloaded->width, this->downloaded->height,
+                                             (AVPixelFormat) this->downloaded->format,
+                                             this->converted->width, this->converted->height,
+                                             (AVPixelFormat) this->software_format,
+                                             SWS_POINT, nullptr, nullptr, nullptr);
+    if (!this->sws_context)
+    {
+        throw decode_exception("Couldn't convert downloaded hardware frame");
+    }
+
+    /*------------------------------------------------------------------------
+     * Only the layout changes, not the levels, even between formats of
+     * different nominal range, such as NV12 and YUVJ420P.
+     *-----------------------------------------------------------------------*/
+    const int *coefficients = sws_getCoefficients(SWS_CS_DEFAULT);
+    int full_range = this->downloaded->color_range == AVCOL_RANGE_JPEG;
+    sws_setColorspaceDetails(this->sws_context, coefficients, full_range, coefficients, full_range, 0, 1 << 16,
+                             1 << 16);
+    sws_scale(this->sws_context, this->downloaded->data, this->downloaded->linesize, 0, this->downloaded->height,
+              this->converted->data, this->converted->linesize);
+    av_frame_copy_props(this->converted, this->downloaded);
+    return this->converted;
+}
+
+void VideoDecoder::seek(int64_t pts)
+{
+    int rv = av_seek_frame(this->format_context, this->stream_index, pts, AVSEEK_FLAG_BACKWARD);
+    if (rv < 0)
+    {
+        throw io_exception("Seek failed: " + av_error_string(rv));
+    }
+    avcodec_flush_buffers(this->codec_context);
+    if (this->metrics)
+    {
+        this->metrics->add_seeks();
+    }
+    av_packet_unref(this->packet);
+    this->packet_pending = false;
+    this->flushing = false;
+    this->finished = false;
+}
+
+int64_t VideoDecoder::get_timestamp(const AVFrame *frame) const
+{
+    return frame->best_effort_timestamp;
+}
+
+Rational VideoDecoder::get_time_base() const
+{
+    AVRational time_base = this->format_context->streams[this->stream_index]->time_base;
+    return Rational(time_base.num, time_base.den);
+}
+
+Rational VideoDecoder::get_frame_rate() const
+{
+    AVStream *stream = this->format_context->streams[this->stream_index];
+    AVRational rate = av_guess_frame_rate(this->format_context, stream, nullptr);
+    if (rate.num <= 0 || rate.den <= 0)
+    {
+        throw decode_exception("Stream has no usable frame rate");
+    }
+    return Rational(rate.num, rate.den);
+}
+
+double VideoDecoder::get_duration() const
+{
+    AVStream *stream = this->format_context->streams[this->stream_index];
+    if (stream->duration != AV_NOPTS_VALUE)
+    {
+        return stream->duration * av_q2d(stream->time_base);
+    }
+    if (this->format_context->duration != AV_NOPTS_VALUE)
+    {
+        return this->format_context->duration / (double) AV_TIME_BASE;
+    }
+    return 0.0;
+}
+
+int VideoDecoder::get_width() const
+{
+    return this->codec_context->width;
+}
+
+int VideoDecoder::get_height() const
+{
+    return this->codec_context->height;
+}
+
+int VideoDecoder::get_pixel_format() const
+{
+    if (this->download)
+    {
+        return this->software_format;
+    }
+    if (this->codec_context->hw_frames_ctx)
+    {
+        return ((AVHWFramesContext *) this->codec_context->hw_frames_ctx->data)->sw_format;
+    }
+    if (this->hardware_format != AV_PIX_FMT_NONE && this->codec_context->pix_fmt == this->hardware_format)
+    {
+        return this->codec_context->sw_pix_fmt;
+    }
+    return this->codec_context->pix_fmt;
+}
+
+HardwareDecode VideoDecoder::get_hardware() const
+{
+    return this->hardware_format == AV_PIX_FMT_NONE ? HARDWARE_DECODE_NONE : this->hardware;
+}
+
+void VideoDecoder::set_extra_hw_frames(int count)
+{
+    if (this->codec_context->hw_frames_ctx)
+    {
+        throw invalid_argument_exception("Hardware surfaces are already allocated");
+    }
+    this->codec_context->extra_hw_frames = count;
+}
+
+PacketIndex index_packets(const std::string &path)
+{
+    AVFormatContext *format_context = nullptr;
+    int rv = avformat_open_input(&format_context, path.c_str(), nullptr, nullptr);
+    if (rv < 0)
+    {
+        throw io_exception("Couldn't open " + path + ": " + av_error_string(rv));
+    }
+
+    rv = avformat_find_stream_info(format_context, nullptr);
+    int stream_index = rv < 0 ? rv : av_find_best_stream(format_context, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (stream_index < 0)
+    {
+        avformat_close_input(&format_context);
+        throw decode_exception("No video stream in " + path);
+    }
+
+    for (unsigned int index = 0; index < format_context->nb_streams; index++)
+    {
+        if ((int) index != stream_index)
+        {
+            format_context->streams[index]->discard = AVDISCARD_ALL;
+        }
+    }
+
+    AVStream *stream = format_context->streams[stream_index];
+    AVRational time_base = stream->time_base;
+    AVRational frame_rate = av_guess_frame_rate(format_context, stream, nullptr);
+
+    std::vector<PacketIndexEntry> entries;
+    AVPacket *packet = av_packet_alloc();
+    while ((rv = av_read_frame(format_context, packet)) >= 0)
+    {
+        if (packet->stream_index == stream_index)
+        {
+            entries.push_back({ packet->pts, packet->dts, packet->pos, packet->size,
+                                (packet->flags & AV_PKT_FLAG_KEY) != 0 });
+        }
+        av_packet_unref(packet);
+    }
+    av_packet_free(&packet);
+    avformat_close_input(&format_context);
+
+    if (rv != AVERROR_EOF)
+    {
+        throw io_exception("Read failed while indexing " + path + ": " + av_error_string(rv));
+    }
+
+    return PacketIndex(std::move(entries),
+                       Rational(time_base.num, time_base.den),
+                       Rational(frame_rate.num, frame_rate.den));
+}
+
+PacketIndex load_packet_index(const std::string &path, const std::string &cache_path, const SourceKey *source_key)
+{
+    if (cache_path.empty())
+    {
+        return index_packets(path);
+    }
+
+    const SourceKey key = source_key ? *source_key : SourceKey::from_file(path);
+    PacketIndex index;
+    if (PacketIndexFile::read(cache_path, key, index))
+    {
+        return index;
+    }
+
+    index = index_packets(path);
+    if (index.get_frame_count() > 0)
+    {
+        try
+        {
+            PacketIndexFile::write(cache_path, key, index);
+        }
+        catch (const io_exception &)
+        {
+            /*------------------------------------------------------------------------
+             * As with the luminance index, sources on read-only media are
+             * indexed every time.
+             *-----------------------------------------------------------------------*/
+        }
+    }
+    return index;
+}
+
+std::unique_ptr<AudioFile> decode_audio(const std::string &path, const std::string &directory)
+{
+    AVFormatContext *format_context = nullptr;
+    int rv = avformat_open_input(&format_context, path.c_str(), nullptr, nullptr);
+    if (rv < 0)
+    {
+        throw io_exception("Couldn't open " + path + ": " + av_error_string(rv));
+    }
+
+    rv = avformat_find_stream_info(format_context, nullptr);
+    const AVCodec *codec = nullptr;
+    int stream_index = rv < 0 ? rv : av_find_best_stream(format_context, AVMEDIA_TYPE_AUDIO, -1, -1, &codec, 0);
+    if (stream_index < 0)
+    {
+        avformat_close_input(&format_context);
+        return nullptr;
+    }
+
+    for (unsigned int index = 0; index < format_context->nb_streams; index++)
+    {
+        if ((int) index != stream_index)
+        {
+            format_context->streams[index]->discard = AVDISCARD_ALL;
+        }
+    }
+
+    AVCodecContext *codec_context = avcodec_alloc_context3(codec);
+    avcodec_parameters_to_context(codec_context, format_context->streams[stream_index]->codecpar);
+    rv = avcodec_open2(codec_context, codec, nullptr);
+    if (rv < 0)
+    {
+        avcodec_free_context(&codec_context);
+        avformat_close_input(&format_context);
+        throw decode_exception("Couldn't open audio decoder for " + path + ": " + av_error_string(rv));
+    }
+
+    const int sample_rate = codec_context->sample_rate;
+    const int channels = codec_context->ch_layout.nb_channels;
+    const AVRational stream_time_base = format_context->streams[stream_index]->time_base;
+    SwrContext *swr_context = nullptr;
+    rv = swr_alloc_set_opts2(&swr_context,
+                             &codec_context->ch_layout, AV_SAMPLE_FMT_FLT, sample_rate,
+                             &codec_context->ch_layout, codec_context->sample_fmt, sample_rate,
+                             0, nullptr);
+    if (rv < 0 || swr_init(swr_context) < 0)
+    {
+        swr_free(&swr_context);
+        avcodec_free_context(&codec_context);
+        avformat_close_input(&format_context);
+        throw decode_exception("Couldn't convert audio from " + path);
+    }
+
+    /*------------------------------------------------------------------------
+     * Decode in one sequential pass, converting each frame into a scratch
+     * buffer and appending it to the file.
+     *-----------------------------------------------------------------------*/
+    std::unique_ptr<AudioFile> audio;
+    std::vector<float> samples;
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    auto convert = [&](const AVFrame *input) {
+        int count = (int) swr_get_delay(swr_context, sample_rate) + (input ? input->nb_samples : 0);
+        if (count <= 0)
+        {
+            return;
+        }
+        samples.resize((size_t) count * channels);
+        uint8_t *output = (uint8_t *) samples.data();
+        int converted = swr_convert(swr_context, &output, count,
+                                    input ? (const uint8_t **) input->extended_data : nullptr,
+                                    input ? input->nb_samples : 0);
+        if (converted > 0)
+        {
+            audio->append(samples.data(), (size_t) converted);
+        }
+    };
+    /*------------------------------------------------------------------------
+     * A corrupt packet is skipped rather than failing the render. Its
+     * duration is filled with silence where known, so that the audio
+     * after it stays in sync with the video.
+     *-----------------------------------------------------------------------*/
+    size_t corrupt_packets = 0;
+    auto drain = [&]() {
+        while ((rv = avcodec_receive_frame(codec_context, frame)) == 0)
+        {
+            convert(frame);
+            av_frame_unref(frame);
+        }
+        if (rv == AVERROR_INVALIDDATA)
+        {
+            corrupt_packets++;
+        }
+        else if (rv != AVERROR(EAGAIN) && rv != AVERROR_EOF)
+        {
+            throw decode_exception("Audio decode failed: " + av_error_string(rv));
+        }
+    };
+    auto send = [&]() {
+        rv = avcodec_send_packet(codec_context, packet);
+        if (rv == AVERROR(EAGAIN))
+        {
+            drain();
+            rv = avcodec_send_packet(codec_context, packet);
+        }
+        if (rv == AVERROR_INVALIDDATA)
+        {
+            corrupt_packets++;
+            const int64_t silence = packet->duration > 0
+                                        ? av_rescale_q(packet->duration, stream_time_base, { 1, sample_rate })
+                                        : 0;
+            samples.assign((size_t) silence * channels, 0.0f);
+            audio->append(samples.data(), (size_t) silence);
+        }
+        else if (rv < 0)
+        {
+            throw decode_exception("Audio decode failed: " + av_error_string(rv));
+        }
+        drain();
+    };
+
+    try
+    {
+        audio = std::make_unique<AudioFile>(sample_rate, channels, directory);
+        while ((rv = av_read_frame(format_context, packet)) >= 0)
+        {
+            if (packet->stream_index == stream_index)
+            {
+                send();
+            }
+            av_packet_unref(packet);
+        }
+        if (rv != AVERROR_EOF)
+        {
+            throw io_exception("Read failed: " + av_error_string(rv));
+        }
+        avcodec_send_packet(codec_context, nullptr);
+        drain();
+        convert(nullptr);
+    }
+    catch (...)
+    {
+        av_frame_free(&frame);
+        av_packet_free(&packet);
+        swr_free(&swr_context);
+        avcodec_free_context(&codec_context);
+        avformat_close_input(&format_context);
+        throw;
+    }
+
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    swr_free(&swr_context);
+    avcodec_free_context(&codec_context);
+    avformat_close_input(&format_context);
+
+    if (corrupt_packets > 0)
+    {
+        av_log(nullptr, AV_LOG_WARNING, "Skipped %zu corrupt audio packets in %s\n", corrupt_packets, path.c_str());
+    }
+    return audio;
+}
+
+}
@@ -0,0 +1,121 @@
+#include "lumin/edl.h"
+#include "lumin/exceptions.h"
+
+#include <algorithm>
+
+namespace lumin
+{
+
+EditDecisionList::EditDecisionList()
+    : frame_count(0)
+{
+}
+
+EditDecisionList::EditDecisionList(Rational frame_rate, std::vector<EditRun> runs)
+    : frame_rate(frame_rate), runs(std::move(runs)), frame_count(0)
+{
+    for (const EditRun &run : this->runs)
+    {
+        if (run.dest_start != this->frame_count || run.length == 0)
+        {
+            throw invalid_argument_exception("EDL runs must be non-empty and contiguous in destination order");
+        }
+        this->frame_count += run.length;
+    }
+}
+
+EditDecisionList EditDecisionList::from_permutation(const Permutation &permutation)
+{
+    const std::vector<uint32_t> &source_frames = permutation.get_source_frames();
+    std::vector<EditRun> runs;
+
+    size_t dest_frame = 0;
+    while (dest_frame < source_frames.size())
+    {
+        size_t end = dest_frame + 1;
+        while (end < source_frames.size() && source_frames[end] == source_frames[end - 1] + 1)
+        {
+            end++;
+        }
+        runs.push_back({ source_frames[dest_frame], (uint32_t) (end - dest_frame), (uint32_t) dest_frame });
+        dest_frame = end;
+    }
+
+    return EditDecisionList(permutation.get_frame_rate(), std::move(runs));
+}
+
+Permutation EditDecisionList::to_permutation() const
+{
+    std::vector<uint32_t> source_frames(this->frame_count);
+    for (const EditRun &run : this->runs)
+    {
+        for (uint32_t offset = 0; offset < run.length; offset++)
+        {
+            source_frames[run.dest_start + offset] = run.source_start + offset;
+        }
+    }
+    return Permutation(this->frame_rate, std::move(source_frames));
+}
+
+Rational EditDecisionList::get_frame_rate() const
+{
+    return this->frame_rate;
+}
+
+size_t EditDecisionList::get_frame_count() const
+{
+    return this->frame_count;
+}
+
+size_t EditDecisionList::size() const
+{
+    return this->runs.size();
+}
+
+const std::vector<EditRun> &EditDecisionList::get_runs() const
+{
+    return this->runs;
+}
+
+size_t EditDecisionList::find_run(size_t dest_frame) const
+{
+    auto it = std::upper_bound(this->runs.begin(), this->runs.end(), dest_frame,
+                               [](size_t frame, const EditRun &run) { return frame < run.dest_start; });
+    return (it - this->runs.begin()) - 1;
+}
+
+size_t EditDecisionList::get_source_end() const
+{
+    size_t end = 0;
+    for (const EditRun &run : this->runs)
+    {
+        end = std::max<size_t>(end, run.get_source_end());
+    }
+    return end;
+}
+
+EditDecisionList EditDecisionList::slice(size_t dest_start, size_t dest_end) const
+{
+    dest_end = std::min(dest_end, this->frame_count);
+    if (dest_start >= dest_end)
+    {
+        throw invalid_argument_exception("EDL slice is empty");
+    }
+
+    std::vector<EditRun> runs;
+    for (size_t index = this->find_run(dest_start); index < this->runs.size(); index++)
+    {
+        const EditRun &run = this->runs[index];
+        if (run.dest_start >= dest_end)
+        {
+            break;
+        }
+        size_t start = std::max<size_t>(run.dest_start, dest_start);
+        size_t end = std::min<size_t>(run.get_dest_end(), dest_end);
+        runs.push_back({ run.source_start + (uint32_t) (start - run.dest_start), (uint32_t) (end - start),
+                         (uint32_t) (start - dest_start) });
+    }
+    return EditDecisionList(this->frame_rate, std::move(runs));
+}
+
+}
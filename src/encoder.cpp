@@ -0,0 +1,466 @@
+#include "lumin/encoder.h"
+#include "lumin/exceptions.h"
+#include "libav.h"
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/buffer.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/dict.h>
+#include <libavutil/frame.h>
+#include <libswscale/swscale.h>
+}
+
+#include <algorithm>
+
+namespace lumin
+{
+
+/*------------------------------------------------------------------------
+ * Use `format` if the codec accepts it, else the codec's first choice.
+ *-----------------------------------------------------------------------*/
+static AVPixelFormat choose_pixel_format(const AVCodec *codec, AVPixelFormat format)
+{
+    if (!codec->pix_fmts)
+    {
+        return format;
+    }
+    for (const AVPixelFormat *candidate = codec->pix_fmts; *candidate != AV_PIX_FMT_NONE; candidate++)
+    {
+        if (*candidate == format)
+        {
+            return format;
+        }
+    }
+    return codec->pix_fmts[0];
+}
+
+/*------------------------------------------------------------------------
+ * Float sample format accepted by the codec, preferring planar, as
+ * native AAC does.
+ *-----------------------------------------------------------------------*/
+static AVSampleFormat choose_sample_format(const AVCodec *codec)
+{
+    if (!codec->sample_fmts)
+    {
+        return AV_SAMPLE_FMT_FLTP;
+    }
+    AVSampleFormat chosen = AV_SAMPLE_FMT_NONE;
+    for (const AVSampleFormat *candidate = codec->sample_fmts; *candidate != AV_SAMPLE_FMT_NONE; candidate++)
+    {
+        if (*candidate == AV_SAMPLE_FMT_FLTP)
+        {
+            return AV_SAMPLE_FMT_FLTP;
+        }
+        if (*candidate == AV_SAMPLE_FMT_FLT)
+        {
+            chosen = AV_SAMPLE_FMT_FLT;
+        }
+    }
+    return chosen;
+}
+
+VideoEncoder::VideoEncoder(const std::string &path,
+                           int width,
+                           int height,
+                           int pixel_format,
+                           Rational frame_rate,
+                           const EncoderOptions &options,
+                           const AudioSource *audio,
+                           AVBufferRef *hw_frames_context)
+    : format_context(nullptr), codec_context(nullptr), stream(nullptr), packet(nullptr), converted(nullptr),
+      stamped(nullptr), sws_context(nullptr), input_format(pixel_format), frame_rate(frame_rate), next_pts(0),
+      finished(false), metrics(options.metrics), audio(audio && !audio->empty() ? audio : nullptr),
+      audio_codec_context(nullptr), audio_stream(nullptr), audio_frame(nullptr), audio_position(0)
+{
+    const AVCodec *codec = avcodec_find_encoder_by_name(options.codec.c_str());
+    if (!codec)
+    {
+        throw invalid_argument_exception("Unknown encoder: " + options.codec);
+    }
+
+    int rv = avformat_alloc_output_context2(&this->format_context, nullptr, nullptr, path.c_str());
+    if (rv < 0 || !this->format_context)
+    {
+        throw io_exception("Couldn't create output " + path + ": " + av_error_string(rv));
+    }
+
+    this->stream = avformat_new_stream(this->format_context, nullptr);
+    this->codec_context = avcodec_alloc_context3(codec);
+    this->codec_context->width = width;
+    this->codec_context->height = height;
+    this->codec_context->pix_fmt = choose_pixel_format(codec, (AVPixelFormat) pixel_format);
+    if (hw_frames_context)
+    {
+        if (this->codec_context->pix_fmt != (AVPixelFormat) pixel_format)
+        {
+            this->close();
+            throw invalid_argument_exception("Encoder " + options.codec + " doesn't accept these hardware frames");
+        }
+        this->codec_context->hw_frames_ctx = av_buffer_ref(hw_frames_context);
+    }
+    this->codec_context->framerate = { (int) frame_rate.num, (int) frame_rate.den };
+    this->codec_context->time_base = { (int) frame_rate.den, (int) frame_rate.num };
+    this->codec_context->bit_rate = options.bit_rate;
+    if (this->format_context->oformat->flags & AVFMT_GLOBALHEADER)
+    {
+        this->codec_context->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+
+    AVDictionary *codec_options = nullptr;
+    for (const auto &option : options.codec_options)
+    {
+        av_dict_set(&codec_options, option.first.c_str(), option.second.c_str(), 0);
+    }
+    rv = avcodec_open2(this->codec_context, codec, &codec_options);
+    av_dict_free(&codec_options);
+    if (rv < 0)
+    {
+        this->close();
+        throw invalid_argument_exception("Couldn't open encoder " + options.codec + ": " + av_error_string(rv));
+    }
+
+    avcodec_parameters_from_context(this->stream->codecpar, this->codec_context);
+    this->stream->time_base = this->codec_context->time_base;
+    this->stream->avg_frame_rate = this->codec_context->framerate;
+    this->open(path, options);
+
+    if (this->codec_context->pix_fmt != (AVPixelFormat) pixel_format)
+    {
+        this->converted = av_frame_alloc();
+        this->converted->format = this->codec_context->pix_fmt;
+        this->converted->width = width;
+        this->converted->height = height;
+        av_frame_get_buffer(this->converted, 0);
+    }
+}
+
+VideoEncoder::VideoEncoder(const std::string &path,
+                           const AVCodecParameters *parameters,
+                           Rational frame_rate,
+                           const EncoderOptions &options,
+                           const AudioSource *audio)
+    : format_context(nullptr), codec_context(nullptr), stream(nullptr), packet(nullptr), converted(nullptr),
+      stamped(nullptr), sws_context(nullptr), input_format(AV_PIX_FMT_NONE), frame_rate(frame_rate), next_pts(0),
+      finished(false), metrics(options.metrics), audio(audio && !audio->empty() ? audio : nullptr),
+      audio_codec_context(nullptr), audio_stream(nullptr), audio_frame(nullptr), audio_position(0)
+{
+    int rv = avformat_alloc_output_context2(&this->format_context, nullptr, nullptr, path.c_str());
+    if (rv < 0 || !this->format_context)
+    {
+        throw io_exception("Couldn't create output " + path + ": " + av_error_string(rv));
+    }
+
+    this->stream = avformat_new_stream(this->format_context, nullptr);
+    avcodec_parameters_copy(this->stream->codecpar, parameters);
+    this->stream->codecpar->codec_tag = 0;
+    this->stream->time_base = { (int) frame_rate.den, (int) frame_rate.num };
+    this->stream->avg_frame_rate = { (int) frame_rate.num, (int) frame_rate.den };
+    this->open(path, options);
+}
+
+/*------------------------------------------------------------------------
+ * Add the soundtrack stream, open `path` and write the header, once the
+ * video stream is set up. Closes the encoder on failure.
+ *-----------------------------------------------------------------------*/
+void VideoEncoder::open(const std::string &path, const EncoderOptions &options)
+{
+    if (this->audio)
+    {
+        try
+        {
+            this->open_audio(options);
+        }
+        catch (...)
+        {
+            this->close();
+            throw;
+        }
+    }
+
+    int rv;
+    if (!(this->format_context->oformat->flags & AVFMT_NOFILE))
+    {
+        rv = avio_open(&this->format_context->pb, path.c_str(), AVIO_FLAG_WRITE);
+        if (rv < 0)
+        {
+            this->close();
+            throw io_exception("Couldn't open " + path + " for writing: " + av_error_string(rv));
+        }
+    }
+
+    rv = avformat_write_header(this->format_context, nullptr);
+    if (rv < 0)
+    {
+        this->close();
+        throw io_exception("Couldn't write header to " + path + ": " + av_error_string(rv));
+    }
+
+    this->packet = av_packet_alloc();
+    this->stamped = av_frame_alloc();
+}
+
+void VideoEncoder::open_audio(const EncoderOptions &options)
+{
+    const AVCodec *codec = avcodec_find_encoder_by_name(options.audio_codec.c_str());
+    if (!codec)
+    {
+        throw invalid_argument_exception("Unknown audio encoder: " + options.audio_codec);
+    }
+    AVSampleFormat sample_format = choose_sample_format(codec);
+    if (sample_format == AV_SAMPLE_FMT_NONE)
+    {
+        throw invalid_argument_exception("Audio encoder doesn't accept float samples: " + options.audio_codec);
+    }
+
+    this->audio_stream = avformat_new_stream(this->format_context, nullptr);
+    this->audio_codec_context = avcodec_alloc_context3(codec);
+    this->audio_codec_context->sample_rate = this->audio->get_sample_rate();
+    this->audio_codec_context->sample_fmt = sample_format;
+    this->audio_codec_context->bit_rate = options.audio_bit_rate;
+    this->audio_codec_context->time_base = { 1, this->audio->get_sample_rate() };
+    av_channel_layout_default(&this->audio_codec_context->ch_layout, this->audio->get_channels());
+    if (this->format_context->oformat->flags & AVFMT_GLOBALHEADER)
+    {
+        this->audio_codec_context->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+
+    int rv = avcodec_open2(this->audio_codec_context, codec, nullptr);
+    if (rv < 0)
+    {
+        throw invalid_argument_exception("Couldn't open audio encoder " + options.audio_codec + ": " +
+                                         av_error_string(rv));
+    }
+    avcodec_parameters_from_context(this->audio_stream->codecpar, this->audio_codec_context);
+    this->audio_stream->time_base = this->audio_codec_context->time_base;
+
+    /*------------------------------------------------------------------------
+     * Encoders with a fixed frame size (AAC: 1024) must be given exactly
+     * that many samples per frame, except the last.
+     *-----------------------------------------------------------------------*/
+    this->audio_frame = av_frame_alloc();
+    this->audio_frame->format = sample_format;
+    this->audio_frame->sample_rate = this->audio_codec_context->sample_rate;
+    this->audio_frame->nb_samples = this->audio_codec_context->frame_size > 0 &&
+                                            !(codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE)
+                                        ? this->audio_codec_context->frame_size
+                                        : 4096;
+    av_channel_layout_copy(&this->audio_frame->ch_layout, &this->audio_codec_context->ch_layout);
+    rv = av_frame_get_buffer(this->audio_frame, 0);
+    if (rv < 0)
+    {
+        throw invalid_argument_exception("Couldn't allocate audio frame: " + av_error_string(rv));
+    }
+}
+
+VideoEncoder::~VideoEncoder()
+{
+    this->close();
+}
+
+void VideoEncoder::close()
+{
+    sws_freeContext(this->sws_context);
+    this->sws_context = nullptr;
+    av_frame_free(&this->converted);
+    av_frame_free(&this->stamped);
+    av_frame_free(&this->audio_frame);
+    av_packet_free(&this->packet);
+    avcodec_free_context(&this->codec_context);
+    avcodec_free_context(&this->audio_codec_context);
+    if (this->format_context)
+    {
+        if (this->format_context->pb && !(this->format_context->oformat->flags & AVFMT_NOFILE))
+        {
+            avio_closep(&this->format_context->pb);
+        }
+        avformat_free_context(this->format_context);
+        this->format_context = nullptr;
+    }
+}
+
+void VideoEncoder::write_frame(const AVFrame *frame)
+{
+    if (!this->codec_context)
+    {
+        throw invalid_argument_exception("Encoder was opened to copy packets, not encode frames");
+    }
+    const AVFrame *input = frame;
+    if (this->converted)
+    {
+        this->sws_context = sws_getCachedContext(this->sws_context,
+                                                 frame->width, frame->height, (AVPixelFormat) frame->format,
+                                                 this->codec_context->width, this->codec_context->height,
+                                                 this->codec_context->pix_fmt,
+                                                 SWS_BICUBIC, nullptr, nullptr, nullptr);
+        av_frame_make_writable(this->converted);
+        sws_scale(this->sws_context, frame->data, frame->linesize, 0, frame->height,
+                  this->converted->data, this->converted->linesize);
+        input = this->converted;
+    }
+
+    /*------------------------------------------------------------------------
+     * Stamp a new reference to the caller's buffers, leaving the caller's
+     * frame untouched. No image data is copied: the encoder reads the
+     * decoder's buffers directly.
+     *-----------------------------------------------------------------------*/
+    int rv = av_frame_ref(this->stamped, input);
+    if (rv < 0)
+    {
+        throw decode_exception("Couldn't reference frame for encoding: " + av_error_string(rv));
+    }
+    this->stamped->pts = this->next_pts++;
+    this->stamped->pict_type = AV_PICTURE_TYPE_NONE;
+    this->encode(this->codec_context, this->stream, this->stamped);
+    av_frame_unref(this->stamped);
+    if (this->metrics)
+    {
+        this->metrics->add_frames_written();
+    }
+
+    if (this->audio)
+    {
+        this->write_audio(this->audio->get_sample_position(this->next_pts, this->frame_rate));
+    }
+}
+
+void VideoEncoder::write_packet(AVPacket *packet, Rational time_base)
+{
+    if (this->codec_context)
+    {
+        throw invalid_argument_exception("Encoder was opened to encode frames, not copy packets");
+    }
+
+    av_packet_rescale_ts(packet, { (int) time_base.num, (int) time_base.den }, this->stream->time_base);
+    packet->stream_index = this->stream->index;
+    packet->pos = -1;
+    int size = packet->size;
+    int rv = av_interleaved_write_frame(this->format_context, packet);
+    if (rv < 0)
+    {
+        throw io_exception("Write failed: " + av_error_string(rv));
+    }
+    this->next_pts++;
+    if (this->metrics)
+    {
+        this->metrics->add_bytes_written(size);
+        this->metrics->add_frames_written();
+    }
+
+    if (this->audio)
+    {
+        this->write_audio(this->audio->get_sample_position(this->next_pts, this->frame_rate));
+    }
+}
+
+/*------------------------------------------------------------------------
+ * Encode soundtrack samples up to `sample_end`, keeping the audio level
+ * with the video so that the muxer can interleave without buffering.
+ *-----------------------------------------------------------------------*/
+void VideoEncoder::write_audio(size_t sample_end)
+{
+    const size_t channels = this->audio->get_channels();
+    const size_t frame_size = this->audio_frame->nb_samples;
+    sample_end = std::min(sample_end, this->audio->get_sample_count());
+
+    while (this->audio_position < sample_end)
+    {
+        size_t count = std::min(frame_size, this->audio->get_sample_count() - this->audio_position);
+        if (count < frame_size && sample_end < this->audio->get_sample_count())
+        {
+            return;
+        }
+
+        int rv = av_frame_make_writable(this->audio_frame);
+        if (rv < 0)
+        {
+            throw decode_exception("Couldn't write audio frame: " + av_error_string(rv));
+        }
+        if (this->audio_frame->format == AV_SAMPLE_FMT_FLTP)
+        {
+            this->audio_samples.resize(frame_size * channels);
+            const float *input = this->audio_samples.data();
+            this->audio->read(this->audio_position, count, this->audio_samples.data());
+            for (size_t channel = 0; channel < channels; channel++)
+            {
+                float *plane = (float *) this->audio_frame->extended_data[channel];
+                for (size_t sample = 0; sample < count; sample++)
+                {
+                    plane[sample] = input[sample * channels + channel];
+                }
+            }
+        }
+        else
+        {
+            this->audio->read(this->audio_position, count, (float *) this->audio_frame->data[0]);
+        }
+
+        int nb_samples = this->audio_frame->nb_samples;
+        this->audio_frame->nb_samples = (int) count;
+        this->audio_frame->pts = (int64_t) this->audio_position;
+        this->encode(this->audio_codec_context, this->audio_stream, this->audio_frame);
+        this->audio_frame->nb_samples = nb_samples;
+        this->audio_position += count;
+    }
+}
+
+void VideoEncoder::encode(AVCodecContext *context, AVStream *stream, const AVFrame *frame)
+{
+    int rv = avcodec_send_frame(context, frame);
+    if (rv < 0)
+    {
+        throw decode_exception("Encode failed: " + av_error_string(rv));
+    }
+
+    while ((rv = avcodec_receive_packet(context, this->packet)) == 0)
+    {
+        av_packet_rescale_ts(this->packet, context->time_base, stream->time_base);
+        this->packet->stream_index = stream->index;
+        if (this->metrics)
+        {
+            this->metrics->add_bytes_written(this->packet->size);
+        }
+        rv = av_interleaved_write_frame(this->format_context, this->packet);
+        if (rv < 0)
+        {
+            throw io_exception("Write failed: " + av_error_string(rv));
+        }
+    }
+    if (rv != AVERROR(EAGAIN) && rv != AVERROR_EOF)
+    {
+        throw decode_exception("Encode failed: " + av_error_string(rv));
+    }
+}
+
+void VideoEncoder::finish()
+{
+    if (this->finished)
+    {
+        return;
+    }
+    this->finished = true;
+    if (this->codec_context)
+    {
+        this->encode(this->codec_context, this->stream, nullptr);
+    }
+    if (this->audio)
+    {
+        this->write_audio(this->audio->get_sample_count());
+        this->encode(this->audio_codec_context, this->audio_stream, nullptr);
+    }
+
+    int rv = av_write_trailer(this->format_context);
+    if (rv < 0)
+    {
+        throw io_exception("Couldn't write trailer: " + av_error_string(rv));
+    }
+}
+
+int64_t VideoEncoder::get_frame_count() const
+{
+    return this->next_pts;
+}
+
+}
@@ -0,0 +1,104 @@
+#include "lumin/frame_cache.h"
+#include "lumin/exceptions.h"
+
+extern "C"
+{
+#include <libavutil/frame.h>
+}
+
+#include <algorithm>
+
+namespace lumin
+{
+
+FrameCache::FrameCache(size_t byte_budget, int width, int height, int pixel_format)
+    : pool(width, height, pixel_format,
+           std::max<size_t>(1, byte_budget / FramePool::get_frame_bytes(width, height, pixel_format)))
+{
+    this->entries.reserve(this->pool.get_capacity());
+}
+
+const AVFrame *FrameCache::get(uint32_t frame_index)
+{
+    auto it = this->entries.find(frame_index);
+    if (it == this->entries.end())
+    {
+        this->stats.misses++;
+        return nullptr;
+    }
+
+    this->stats.hits++;
+    this->recency.splice(this->recency.begin(), this->recency, it->second.position);
+    return it->second.frame;
+}
+
+const AVFrame *FrameCache::insert(uint32_t frame_index, const AVFrame *frame)
+{
+    auto existing = this->entries.find(frame_index);
+    if (existing != this->entries.end())
+    {
+        this->recency.splice(this->recency.begin(), this->recency, existing->second.position);
+        return existing->second.frame;
+    }
+
+    AVFrame *slot = this->pool.acquire();
+    if (!slot)
+    {
+        uint32_t victim = this->recency.back();
+        this->recency.pop_back();
+        auto it = this->entries.find(victim);
+        this->pool.release(it->second.frame);
+        this->entries.erase(it);
+        this->stats.evictions++;
+        slot = this->pool.acquire();
+    }
+
+    if (av_frame_copy(slot, frame) < 0)
+    {
+        this->pool.release(slot);
+        throw decode_exception("Decoded frame doesn't match cache format");
+    }
+    FrameCache::copy_props(slot, frame);
+
+    this->recency.push_front(frame_index);
+    this->entries[frame_index] = { slot, this->recency.begin() };
+    this->stats.insertions++;
+    return slot;
+}
+
+void FrameCache::copy_props(AVFrame *dst, const AVFrame *src)
+{
+    /*------------------------------------------------------------------------
+     * av_frame_copy_props() would also duplicate side data, which
+     * allocates; only the properties that affect encoding are needed.
+     *-----------------------------------------------------------------------*/
+    dst->pts = src->pts;
+    dst->best_effort_timestamp = src->best_effort_timestamp;
+    dst->sample_aspect_ratio = src->sample_aspect_ratio;
+    dst->color_range = src->color_range;
+    dst->color_primaries = src->color_primaries;
+    dst->color_trc = src->color_trc;
+    dst->colorspace = src->colorspace;
+}
+
+bool FrameCache::contains(uint32_t frame_index) const
+{
+    return this->entries.count(frame_index) > 0;
+}
+
+size_t FrameCache::get_capacity() const
+{
+    return this->pool.get_capacity();
+}
+
+size_t FrameCache::size() const
+{
+    return this->entries.size();
+}
+
+CacheStats FrameCache::get_stats() const
+{
+    return this->stats;
+}
+
+}
@@ -0,0 +1,552 @@
+#include "lumin/frame_metric.h"
+#include "lumin/exceptions.h"
+#include "lumin/kernels.h"
+#include "libav.h"
+
+extern "C"
+{
+#include <libavutil/frame.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+}
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <mutex>
+
+namespace lumin
+{
+
+/**------------------------------------------------------------------------
+ * A frame converted by swscale into a single reusable buffer, at its own
+ * size or scaled down by point sampling.
+ *-----------------------------------------------------------------------*/
+class ConvertedFrame
+{
+public:
+    ConvertedFrame(AVPixelFormat format, int bytes_per_pixel)
+        : format(format), bytes_per_pixel(bytes_per_pixel), sws_context(nullptr), width(0), height(0), linesize(0)
+    {
+    }
+
+    ~ConvertedFrame()
+    {
+        sws_freeContext(this->sws_context);
+    }
+
+    FramePlane convert(const AVFrame *frame, int width, int height)
+    {
+        if (width != this->width || height != this->height)
+        {
+            this->width = width;
+            this->height = height;
+            this->linesize = FFALIGN(this->width * this->bytes_per_pixel, 64);
+            this->buffer.resize((size_t) this->linesize * this->height);
+        }
+
+        int flags = width == frame->width && height == frame->height ? SWS_BICUBIC : SWS_POINT;
+        this->sws_context = sws_getCachedContext(this->sws_context,
+                                                 frame->width, frame->height, (AVPixelFormat) frame->format,
+                                                 this->width, this->height, this->format,
+                                                 flags, nullptr, nullptr, nullptr);
+        if (!this->sws_context)
+        {
+            throw decode_exception("Couldn't create colour converter for frame");
+        }
+
+        uint8_t *dst_data[4] = { this->buffer.data(), nullptr, nullptr, nullptr };
+        int dst_linesize[4] = { this->linesize, 0, 0, 0 };
+        sws_scale(this->sws_context, frame->data, frame->linesize, 0, frame->height, dst_data, dst_linesize);
+
+        FramePlane plane;
+        plane.data = this->buffer.data();
+        plane.stride = this->linesize;
+        plane.pixel_stride = this->bytes_per_pixel;
+        plane.width = (size_t) this->width;
+        plane.height = (size_t) this->height;
+        plane.bytes_per_pixel = this->bytes_per_pixel;
+        plane.full_range = false;
+        return plane;
+    }
+
+private:
+    AVPixelFormat format;
+    int bytes_per_pixel;
+    SwsContext *sws_context;
+    int width;
+    int height;
+    int linesize;
+    std::vector<uint8_t> buffer;
+};
+
+static bool is_jpeg_format(AVPixelFormat format)
+{
+    return format == AV_PIX_FMT_YUVJ420P || format == AV_PIX_FMT_YUVJ422P || format == AV_PIX_FMT_YUVJ444P;
+}
+
+bool FrameSampling::is_whole_frame() const
+{
+    return this->left == 0.0 && this->top == 0.0 && this->width == 1.0 && this->height == 1.0;
+}
+
+bool FrameSampling::is_default() const
+{
+    return this->is_whole_frame() && this->step == 1;
+}
+
+void FrameSampling::validate() const
+{
+    if (!(this->left >= 0.0 && this->top >= 0.0 && this->width > 0.0 && this->height > 0.0 &&
+          this->left + this->width <= 1.0 && this->top + this->height <= 1.0))
+    {
+        throw invalid_argument_exception("Region of interest must be a non-empty part of the frame");
+    }
+    if (this->step < 1)
+    {
+        throw invalid_argument_exception("Sampling step must be positive");
+    }
+}
+
+/*------------------------------------------------------------------------
+ * The pixel span [start, end) of the fraction [offset, offset + size) of
+ * `length` pixels, at least one pixel long.
+ *-----------------------------------------------------------------------*/
+static void get_span(double offset, double size, int length, size_t &start, size_t &end)
+{
+    start = (size_t) std::min<long>(std::lround(offset * length), length - 1);
+    end = (size_t) std::max<long>(std::lround((offset + size) * length), (long) start + 1);
+    end = std::min(end, (size_t) length);
+}
+
+static size_t get_sample_count(size_t length, int step)
+{
+    return (length + step - 1) / step;
+}
+
+MetricFrame::MetricFrame(const FrameSampling &sampling)
+    : sampling(sampling), frame(nullptr), cropped(nullptr), rgb_sums{ { 0, 0, 0 } }, has_luma(false), has_rgb(false),
+      has_rgb_sums(false)
+{
+    this->sampling.validate();
+}
+
+MetricFrame::~MetricFrame()
+{
+    av_frame_free(&this->cropped);
+}
+
+void MetricFrame::set_frame(const AVFrame *frame)
+{
+    this->frame = frame;
+    if (this->cropped)
+    {
+        av_frame_unref(this->cropped);
+    }
+    if (frame && !this->sampling.is_whole_frame())
+    {
+        /*------------------------------------------------------------------------
+         * Crop a new reference to the frame, which only moves its plane
+         * pointers, so that conversions only read the region.
+         *-----------------------------------------------------------------------*/
+        if (!this->cropped && !(this->cropped = av_frame_alloc()))
+        {
+            throw decode_exception("Couldn't allocate frame");
+        }
+        size_t left, right, top, bottom;
+        get_span(this->sampling.left, this->sampling.width, frame->width, left, right);
+        get_span(this->sampling.top, this->sampling.height, frame->height, top, bottom);
+        int rv = av_frame_ref(this->cropped, frame);
+        if (rv >= 0)
+        {
+            this->cropped->crop_left = left;
+            this->cropped->crop_right = (size_t) frame->width - right;
+            this->cropped->crop_top = top;
+            this->cropped->crop_bottom = (size_t) frame->height - bottom;
+            rv = av_frame_apply_cropping(this->cropped, AV_FRAME_CROP_UNALIGNED);
+        }
+        if (rv < 0)
+        {
+            throw decode_exception("Couldn't crop frame to region of interest: " + av_error_string(rv));
+        }
+        this->frame = this->cropped;
+    }
+    this->has_luma = false;
+    this->has_rgb = false;
+    this->has_rgb_sums = false;
+}
+
+const AVFrame *MetricFrame::get_frame() const
+{
+    return this->frame;
+}
+
+const FramePlane &MetricFrame::get_luma()
+{
+    if (this->has_luma)
+    {
+        return this->luma_plane;
+    }
+
+    const int step = this->sampling.step;
+    AVPixelFormat format = (AVPixelFormat) this->frame->format;
+    if (has_8bit_luma_plane(format))
+    {
+        this->luma_plane.data = this->frame->data[0];
+        this->luma_plane.stride = (ptrdiff_t) this->frame->linesize[0] * step;
+        this->luma_plane.pixel_stride = step;
+        this->luma_plane.width = get_sample_count((size_t) this->frame->width, step);
+        this->luma_plane.height = get_sample_count((size_t) this->frame->height, step);
+        this->luma_plane.bytes_per_pixel = 1;
+        this->luma_plane.full_range = this->frame->color_range == AVCOL_RANGE_JPEG || is_jpeg_format(format);
+    }
+    else
+    {
+        if (!this->gray)
+        {
+            this->gray = std::make_unique<ConvertedFrame>(AV_PIX_FMT_GRAY8, 1);
+        }
+        this->luma_plane = this->gray->convert(this->frame,
+                                               (int) get_sample_count((size_t) this->frame->width, step),
+                                               (int) get_sample_count((size_t) this->frame->height, step));
+    }
+    this->has_luma = true;
+    return this->luma_plane;
+}
+
+const FramePlane &MetricFrame::get_rgb()
+{
+    if (!this->has_rgb)
+    {
+        if (!this->rgb)
+        {
+            this->rgb = std::make_unique<ConvertedFrame>(AV_PIX_FMT_RGB24, 3);
+        }
+        const int step = this->sampling.step;
+        this->rgb_plane = this->rgb->convert(this->frame,
+                                             (int) get_sample_count((size_t) this->frame->width, step),
+                                             (int) get_sample_count((size_t) this->frame->height, step));
+        this->rgb_plane.full_range = true;
+        this->has_rgb = true;
+    }
+    return this->rgb_plane;
+}
+
+const std::array<uint64_t, 3> &MetricFrame::get_rgb_sums()
+{
+    if (!this->has_rgb_sums)
+    {
+        const FramePlane &plane = this->get_rgb();
+        uint64_t sums[3] = { 0, 0, 0 };
+        for (size_t y = 0; y < plane.height; y++)
+        {
+            const uint8_t *pixel = plane.data + y * plane.stride;
+            uint32_t row_sums[3] = { 0, 0, 0 };
+            for (size_t x = 0; x < plane.width; x++, pixel += plane.pixel_stride)
+            {
+                row_sums[0] += pixel[0];
+                row_sums[1] += pixel[1];
+                row_sums[2] += pixel[2];
+            }
+            sums[0] += row_sums[0];
+            sums[1] += row_sums[1];
+            sums[2] += row_sums[2];
+        }
+        this->rgb_sums = { { sums[0], sums[1], sums[2] } };
+        this->has_rgb_sums = true;
+    }
+    return this->rgb_sums;
+}
+
+double normalise_luma(double mean, bool full_range)
+{
+    if (full_range)
+    {
+        return mean / 255.0;
+    }
+
+    /*------------------------------------------------------------------------
+     * Limited-range luma: black is 16, white is 235.
+     *-----------------------------------------------------------------------*/
+    double value = (mean - 16.0) / 219.0;
+    return value < 0.0 ? 0.0 : (value > 1.0 ? 1.0 : value);
+}
+
+/*------------------------------------------------------------------------
+ * Sum of every byte of the sampled pixels of `plane`.
+ *-----------------------------------------------------------------------*/
+static uint64_t sum_samples(const FramePlane &plane)
+{
+    if (plane.pixel_stride == plane.bytes_per_pixel)
+    {
+        return sum_plane_u8(plane.data, plane.stride, plane.width * plane.bytes_per_pixel, plane.height);
+    }
+
+    uint64_t sum = 0;
+    for (size_t y = 0; y < plane.height; y++)
+    {
+        const uint8_t *pixel = plane.data + y * plane.stride;
+        uint32_t row_sum = 0;
+        for (size_t x = 0; x < plane.width; x++, pixel += plane.pixel_stride)
+        {
+            for (int byte = 0; byte < plane.bytes_per_pixel; byte++)
+            {
+                row_sum += pixel[byte];
+            }
+        }
+        sum += row_sum;
+    }
+    return sum;
+}
+
+/**------------------------------------------------------------------------
+ * Sums the Y plane in place for 8-bit YUV and greyscale formats.
+ *-----------------------------------------------------------------------*/
+class LumaMetric : public FrameMetric
+{
+public:
+    double compute(MetricFrame &frame) override
+    {
+        const FramePlane &luma = frame.get_luma();
+        uint64_t sum = sum_samples(luma);
+        return normalise_luma((double) sum / ((double) luma.width * luma.height), luma.full_range);
+    }
+};
+
+/**------------------------------------------------------------------------
+ * The mean over all channels of RGB24: bit-compatible with
+ * np.mean(frame) / 255.0 in reorder.py.
+ *-----------------------------------------------------------------------*/
+class RGBMeanMetric : public FrameMetric
+{
+public:
+    double compute(MetricFrame &frame) override
+    {
+        const FramePlane &rgb = frame.get_rgb();
+        uint64_t sum = sum_samples(rgb);
+        return (double) sum / ((double) rgb.width * rgb.bytes_per_pixel * rgb.height) / 255.0;
+    }
+};
+
+/**------------------------------------------------------------------------
+ * Rec.709 luma weights applied to the mean gamma-encoded R'G'B', which
+ * is the mean of the weighted values.
+ *-----------------------------------------------------------------------*/
+class Rec709Metric : public FrameMetric
+{
+public:
+    double compute(MetricFrame &frame) override
+    {
+        const std::array<uint64_t, 3> &sums = frame.get_rgb_sums();
+        const FramePlane &rgb = frame.get_rgb();
+        double weighted = 0.2126 * sums[0] + 0.7152 * sums[1] + 0.0722 * sums[2];
+        return weighted / ((double) rgb.width * rgb.height) / 255.0;
+    }
+};
+
+/**------------------------------------------------------------------------
+ * RMS contrast: the standard deviation of normalised luma, from a
+ * histogram of luma levels so that limited-range clamping is exact.
+ * Doubled, as the deviation of values in [0..1] is at most 0.5.
+ *-----------------------------------------------------------------------*/
+class ContrastMetric : public FrameMetric
+{
+public:
+    double compute(MetricFrame &frame) override
+    {
+        const FramePlane &luma = frame.get_luma();
+        uint64_t histogram[256] = { 0 };
+        for (size_t y = 0; y < luma.height; y++)
+        {
+            const uint8_t *pixel = luma.data + y * luma.stride;
+            for (size_t x = 0; x < luma.width; x++, pixel += luma.pixel_stride)
+            {
+                histogram[*pixel]++;
+            }
+        }
+
+        double count = (double) luma.width * luma.height;
+        double sum = 0.0;
+        double sum_squares = 0.0;
+        for (int level = 0; level < 256; level++)
+        {
+            double value = normalise_luma(level, luma.full_range);
+            sum += value * histogram[level];
+            sum_squares += value * value * histogram[level];
+        }
+        double mean = sum / count;
+        double variance = std::max(0.0, sum_squares / count - mean * mean);
+        return std::min(1.0, 2.0 * std::sqrt(variance));
+    }
+};
+
+/**------------------------------------------------------------------------
+ * Mean over pixels of HSV saturation, (max - min) / max.
+ *-----------------------------------------------------------------------*/
+class SaturationMetric : public FrameMetric
+{
+public:
+    double compute(MetricFrame &frame) override
+    {
+        const FramePlane &rgb = frame.get_rgb();
+        double total = 0.0;
+        for (size_t y = 0; y < rgb.height; y++)
+        {
+            const uint8_t *pixel = rgb.data + y * rgb.stride;
+            float row_total = 0.0f;
+            for (size_t x = 0; x < rgb.width; x++, pixel += rgb.pixel_stride)
+            {
+                int high = std::max(pixel[0], std::max(pixel[1], pixel[2]));
+                int low = std::min(pixel[0], std::min(pixel[1], pixel[2]));
+                if (high > 0)
+                {
+                    row_total += (float) (high - low) / high;
+                }
+            }
+            total += row_total;
+        }
+        return total / ((double) rgb.width * rgb.height);
+    }
+};
+
+/**------------------------------------------------------------------------
+ * Hue angle of the mean colour, projected onto the chromaticity plane
+ * (a = R - (G + B) / 2, b = sqrt(3) / 2 * (G - B)), so that each pixel
+ * counts in proportion to its chroma. Red is 0, green 1/3, blue 2/3.
+ *-----------------------------------------------------------------------*/
+class HueMetric : public FrameMetric
+{
+public:
+    double compute(MetricFrame &frame) override
+    {
+        const std::array<uint64_t, 3> &sums = frame.get_rgb_sums();
+        double a = (double) sums[0] - 0.5 * ((double) sums[1] + (double) sums[2]);
+        double b = 0.5 * std::sqrt(3.0) * ((double) sums[1] - (double) sums[2]);
+        const FramePlane &rgb = frame.get_rgb();
+        if (std::hypot(a, b) < 0.5 * rgb.width * rgb.height)
+        {
+            return 0.0;
+        }
+        double hue = std::atan2(b, a) / (2.0 * M_PI);
+        return hue < 0.0 ? hue + 1.0 : hue;
+    }
+};
+
+template <typename T>
+static FrameMetricFactory make_factory()
+{
+    return []() { return std::unique_ptr<FrameMetric>(new T()); };
+}
+
+/*------------------------------------------------------------------------
+ * The registry, made with the built-in metrics on first use.
+ *-----------------------------------------------------------------------*/
+class MetricRegistry
+{
+public:
+    static MetricRegistry &get()
+    {
+        static MetricRegistry registry;
+        return registry;
+    }
+
+    std::mutex mutex;
+    std::map<std::string, FrameMetricFactory> factories;
+
+private:
+    MetricRegistry()
+    {
+        this->factories["luma"] = make_factory<LumaMetric>();
+        this->factories["rgb"] = make_factory<RGBMeanMetric>();
+        this->factories["rec709"] = make_factory<Rec709Metric>();
+        this->factories["contrast"] = make_factory<ContrastMetric>();
+        this->factories["saturation"] = make_factory<SaturationMetric>();
+        this->factories["hue"] = make_factory<HueMetric>();
+    }
+};
+
+static bool is_valid_metric_name(const std::string &name)
+{
+    if (name.empty() || name.size() > 31)
+    {
+        return false;
+    }
+    return std::all_of(name.begin(), name.end(), [](char c) {
+        return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_';
+    });
+}
+
+void register_frame_metric(const std::string &name, FrameMetricFactory factory)
+{
+    if (!is_valid_metric_name(name) || !factory)
+    {
+        throw invalid_argument_exception("Invalid frame metric name: " + name);
+    }
+    MetricRegistry &registry = MetricRegistry::get();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    if (!registry.factories.emplace(name, std::move(factory)).second)
+    {
+        throw invalid_argument_exception("Frame metric already registered: " + name);
+    }
+}
+
+std::unique_ptr<FrameMetric> create_frame_metric(const std::string &name)
+{
+    FrameMetricFactory factory;
+    {
+        MetricRegistry &registry = MetricRegistry::get();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        auto found = registry.factories.find(name);
+        if (found == registry.factories.end())
+        {
+            throw invalid_argument_exception("Unknown frame metric: " + name);
+        }
+        factory = found->second;
+    }
+    return factory();
+}
+
+bool has_frame_metric(const std::string &name)
+{
+    MetricRegistry &registry = MetricRegistry::get();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    return registry.factories.count(name) > 0;
+}
+
+std::vector<std::string> get_frame_metric_names()
+{
+    MetricRegistry &registry = MetricRegistry::get();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    std::vector<std::string> names;
+    for (const auto &entry : registry.factories)
+    {
+        names.push_back(entry.first);
+    }
+    return names;
+}
+
+FrameMetricSet::FrameMetricSet(const std::vector<std::string> &names, const FrameSampling &sampling)
+    : frame(sampling)
+{
+    for (const std::string &name : names)
+    {
+        this->metrics.push_back(create_frame_metric(name));
+    }
+}
+
+size_t FrameMetricSet::size() const
+{
+    return this->metrics.size();
+}
+
+void FrameMetricSet::compute(const AVFrame *frame, double *values)
+{
+    this->frame.set_frame(frame);
+    for (size_t index = 0; index < this->metrics.size(); index++)
+    {
+        values[index] = this->metrics[index]->compute(this->frame);
+    }
+    this->frame.set_frame(nullptr);
+}
+
+}
@@ -0,0 +1,87 @@
+#include "lumin/frame_pool.h"
+#include "lumin/exceptions.h"
+
+extern "C"
+{
+#include <libavutil/frame.h>
+#include <libavutil/imgutils.h>
+}
+
+namespace lumin
+{
+
+static const int FRAME_ALIGNMENT = 64;
+
+FramePool::FramePool(int width, int height, int pixel_format, size_t capacity)
+{
+    this->frames.reserve(capacity);
+    for (size_t index = 0; index < capacity; index++)
+    {
+        AVFrame *frame = av_frame_alloc();
+        frame->format = pixel_format;
+        frame->width = width;
+        frame->height = height;
+        if (av_frame_get_buffer(frame, FRAME_ALIGNMENT) < 0)
+        {
+            av_frame_free(&frame);
+            for (AVFrame *&allocated : this->frames)
+            {
+                av_frame_free(&allocated);
+            }
+            throw decode_exception("Couldn't allocate frame pool");
+        }
+        this->frames.push_back(frame);
+    }
+    this->available = this->frames;
+}
+
+FramePool::~FramePool()
+{
+    for (AVFrame *&frame : this->frames)
+    {
+        av_frame_free(&frame);
+    }
+}
+
+AVFrame *FramePool::acquire()
+{
+    if (this->available.empty())
+    {
+        return nullptr;
+    }
+    AVFrame *frame = this->available.back();
+    this->available.pop_back();
+    if (av_frame_make_writable(frame) < 0)
+    {
+        this->available.push_back(frame);
+        throw decode_exception("Couldn't reclaim pooled frame");
+    }
+    return frame;
+}
+
+void FramePool::release(AVFrame *frame)
+{
+    this->available.push_back(frame);
+}
+
+size_t FramePool::get_capacity() const
+{
+    return this->frames.size();
+}
+
+size_t FramePool::get_available() const
+{
+    return this->available.size();
+}
+
+size_t FramePool::get_frame_bytes(int width, int height, int pixel_format)
+{
+    int bytes = av_image_get_buffer_size((AVPixelFormat) pixel_format, width, height, FRAME_ALIGNMENT);
+    if (bytes <= 0)
+    {
+        throw decode_exception("Unsupported pixel format");
+    }
+    return (size_t) bytes;
+}
+
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+/*------------------------------------------------------------------------
+ * A pipeline queue of frame references, owned by the queue while in it.
+ *-----------------------------------------------------------------------*/
+
+#include "lumin/exceptions.h"
+#include "lumin/pipeline.h"
+
+extern "C"
+{
+#include <libavutil/frame.h>
+}
+
+namespace lumin
+{
+
+/*------------------------------------------------------------------------
+ * Deep enough to absorb jitter between stages; each queued frame pins a
+ * decoder buffer, so not much deeper.
+ *-----------------------------------------------------------------------*/
+static const size_t FRAME_QUEUE_DEPTH = 8;
+
+class FrameQueue : public SpscQueue<AVFrame *>
+{
+public:
+    FrameQueue(size_t capacity = FRAME_QUEUE_DEPTH)
+        : SpscQueue<AVFrame *>(capacity)
+    {
+    }
+
+    ~FrameQueue()
+    {
+        AVFrame *frame;
+        while (this->try_pop(frame))
+        {
+            av_frame_free(&frame);
+        }
+    }
+
+    /*------------------------------------------------------------------------
+     * Queue a new reference to `frame`, blocking while the queue is full.
+     * Returns false if the queue has been closed.
+     *-----------------------------------------------------------------------*/
+    bool push_reference(const AVFrame *frame, Stage *producer)
+    {
+        AVFrame *reference = av_frame_clone(frame);
+        if (!reference)
+        {
+            throw decode_exception("Couldn't reference frame");
+        }
+        if (!this->push(reference, producer))
+        {
+            av_frame_free(&reference);
+            return false;
+        }
+        return true;
+    }
+};
+
+}
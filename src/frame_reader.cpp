@@ -0,0 +1,98 @@
+#include "lumin/frame_reader.h"
+
+extern "C"
+{
+#include <libavutil/frame.h>
+}
+
+#include <algorithm>
+
+namespace lumin
+{
+
+FrameReader::FrameReader(const std::string &path,
+                         const PacketIndex &index,
+                         size_t cache_budget,
+                         const DecoderOptions &decoder_options)
+    : decoder(path, decoder_options), index(index), position(0), seeks(0), decoded(0)
+{
+    this->cache = std::make_unique<FrameCache>(cache_budget,
+                                               this->decoder.get_width(),
+                                               this->decoder.get_height(),
+                                               this->decoder.get_pixel_format());
+}
+
+const AVFrame *FrameReader::read(uint32_t frame_index)
+{
+    if (const AVFrame *frame = this->cache->get(frame_index))
+    {
+        return frame;
+    }
+
+    /*------------------------------------------------------------------------
+     * Decode forward from the current position unless the target is
+     * behind it, or a keyframe between here and the target means a seek
+     * would skip work.
+     *-----------------------------------------------------------------------*/
+    const std::vector<size_t> &keyframes = this->index.get_keyframes();
+    auto it = std::upper_bound(keyframes.begin(), keyframes.end(), (size_t) frame_index);
+    size_t keyframe = it == keyframes.begin() ? 0 : *(it - 1);
+
+    if (this->position > frame_index || keyframe > this->position)
+    {
+        this->decoder.seek(this->index.get_frame_pts(frame_index));
+        this->position = keyframe;
+        this->seeks++;
+    }
+
+    while (AVFrame *frame = this->decoder.read_frame())
+    {
+        this->decoded++;
+        int64_t timestamp = this->decoder.get_timestamp(frame);
+        if (timestamp == AV_NOPTS_VALUE)
+        {
+            continue;
+        }
+
+        size_t decoded_index = this->index.get_frame_index(timestamp);
+        this->position = decoded_index + 1;
+        const AVFrame *cached = this->cache->insert((uint32_t) decoded_index, frame);
+        if (decoded_index == frame_index)
+        {
+            return cached;
+        }
+        if (decoded_index > frame_index)
+        {
+            break;
+        }
+    }
+
+    return nullptr;
+}
+
+CacheStats FrameReader::get_cache_stats() const
+{
+    return this->cache->get_stats();
+}
+
+size_t FrameReader::get_cache_capacity() const
+{
+    return this->cache->get_capacity();
+}
+
+size_t FrameReader::get_seek_count() const
+{
+    return this->seeks;
+}
+
+size_t FrameReader::get_decode_count() const
+{
+    return this->decoded;
+}
+
+VideoDecoder &FrameReader::get_decoder()
+{
+    return this->decoder;
+}
+
+}
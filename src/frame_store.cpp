@@ -0,0 +1,360 @@
+#include "lumin/frame_store.h"
+#include "lumin/exceptions.h"
+
+extern "C"
+{
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#include <libavutil/imgutils.h>
+}
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace lumin
+{
+
+static const char FRAME_STORE_MAGIC[8] = { 'L', 'U', 'M', 'I', 'N', 'R', 'A', 'W' };
+static const uint64_t FRAME_STORE_ALIGNMENT = 4096;
+static const int PLANE_ALIGNMENT = 64;
+
+static uint64_t align(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static std::string errno_string()
+{
+    return std::string(strerror(errno));
+}
+
+/*------------------------------------------------------------------------
+ * Slot layout for frames of a format and size: each plane's linesize
+ * rounded up to PLANE_ALIGNMENT, planes at aligned offsets, and the
+ * slot rounded up to a page. False if such frames can't be stored.
+ *-----------------------------------------------------------------------*/
+static bool get_layout(int pixel_format, int width, int height, int32_t linesize[4], uint64_t plane_offset[4],
+                       uint64_t &slot_bytes)
+{
+    int unaligned[4];
+    if (width <= 0 || height <= 0 || av_image_check_size((unsigned) width, (unsigned) height, 0, nullptr) < 0 ||
+        av_image_fill_linesizes(unaligned, (AVPixelFormat) pixel_format, width) < 0)
+    {
+        return false;
+    }
+    ptrdiff_t aligned[4];
+    for (int plane = 0; plane < 4; plane++)
+    {
+        linesize[plane] = (int32_t) align(unaligned[plane], PLANE_ALIGNMENT);
+        aligned[plane] = linesize[plane];
+    }
+    size_t plane_size[4];
+    if (av_image_fill_plane_sizes(plane_size, (AVPixelFormat) pixel_format, height, aligned) < 0)
+    {
+        return false;
+    }
+    uint64_t offset = 0;
+    for (int plane = 0; plane < 4; plane++)
+    {
+        plane_offset[plane] = offset;
+        offset = align(offset + plane_size[plane], PLANE_ALIGNMENT);
+    }
+    slot_bytes = align(offset, FRAME_STORE_ALIGNMENT);
+    return true;
+}
+
+/*------------------------------------------------------------------------
+ * True if `header`'s slot layout is the one get_layout() gives for its
+ * format and size, so that every plane read() hands out lies within
+ * its slot.
+ *-----------------------------------------------------------------------*/
+static bool has_valid_layout(const FrameStoreHeader *header)
+{
+    int32_t linesize[4];
+    uint64_t plane_offset[4];
+    uint64_t slot_bytes = 0;
+    if (!get_layout(header->pixel_format, header->width, header->height, linesize, plane_offset, slot_bytes) ||
+        slot_bytes != header->slot_bytes)
+    {
+        return false;
+    }
+    for (int plane = 0; plane < 4; plane++)
+    {
+        if (linesize[plane] != header->linesize[plane] || plane_offset[plane] != header->plane_offset[plane])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*------------------------------------------------------------------------
+ * Frames only borrow the mapping, which the store unmaps itself.
+ *-----------------------------------------------------------------------*/
+static void free_nothing(void *, uint8_t *)
+{
+}
+
+FrameStore::FrameStore(void *mapping, size_t mapping_size)
+    : mapping(mapping), mapping_size(mapping_size), header((const FrameStoreHeader *) mapping)
+{
+    this->frame = av_frame_alloc();
+    if (!this->frame)
+    {
+        munmap(this->mapping, this->mapping_size);
+        throw decode_exception("Couldn't allocate frame");
+    }
+}
+
+FrameStore::~FrameStore()
+{
+    av_frame_free(&this->frame);
+    munmap(this->mapping, this->mapping_size);
+}
+
+std::unique_ptr<FrameStore> FrameStore::open(const std::string &path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(FrameStoreHeader))
+    {
+        ::close(fd);
+        return nullptr;
+    }
+
+    size_t size = (size_t) info.st_size;
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    const FrameStoreHeader *header = (const FrameStoreHeader *) mapping;
+    bool valid = memcmp(header->magic, FRAME_STORE_MAGIC, sizeof(FRAME_STORE_MAGIC)) == 0 &&
+                 header->version == VERSION &&
+                 header->data_offset % FRAME_STORE_ALIGNMENT == 0 &&
+                 sizeof(FrameStoreHeader) + header->path_length <= header->data_offset &&
+                 header->data_offset <= size &&
+                 has_valid_layout(header) &&
+                 header->frame_count <= (size - header->data_offset) / header->slot_bytes &&
+                 header->present_offset == header->data_offset + header->frame_count * header->slot_bytes &&
+                 header->present_offset + header->frame_count <= size;
+    if (!valid)
+    {
+        munmap(mapping, size);
+        return nullptr;
+    }
+
+    /*------------------------------------------------------------------------
+     * Frame access is mostly sequential within a run, but jumps between
+     * runs; read-ahead is requested slot by slot in read().
+     *-----------------------------------------------------------------------*/
+    madvise(mapping, size, MADV_RANDOM);
+    return std::unique_ptr<FrameStore>(new FrameStore(mapping, size));
+}
+
+std::string FrameStore::get_default_path(const std::string &source_path)
+{
+    return source_path + ".lumraw";
+}
+
+bool FrameStore::matches(const SourceKey &key) const
+{
+    SourceKey stored;
+    stored.path = std::string((const char *) this->mapping + sizeof(FrameStoreHeader), this->header->path_length);
+    stored.size = this->header->source_size;
+    stored.mtime_ns = this->header->source_mtime_ns;
+    stored.content_hash = this->header->content_hash;
+    return stored == key;
+}
+
+const AVFrame *FrameStore::read(size_t frame_index)
+{
+    const uint8_t *base = (const uint8_t *) this->mapping;
+    if (frame_index >= this->header->frame_count || !base[this->header->present_offset + frame_index])
+    {
+        return nullptr;
+    }
+
+    uint8_t *slot = (uint8_t *) base + this->header->data_offset + frame_index * this->header->slot_bytes;
+    if (frame_index + 1 < this->header->frame_count)
+    {
+        madvise(slot + this->header->slot_bytes, this->header->slot_bytes, MADV_WILLNEED);
+    }
+
+    av_frame_unref(this->frame);
+    this->frame->buf[0] = av_buffer_create(slot, this->header->slot_bytes, free_nothing, nullptr,
+                                           AV_BUFFER_FLAG_READONLY);
+    if (!this->frame->buf[0])
+    {
+        throw decode_exception("Couldn't reference stored frame");
+    }
+    for (int plane = 0; plane < 4; plane++)
+    {
+        this->frame->data[plane] = this->header->linesize[plane] ? slot + this->header->plane_offset[plane] : nullptr;
+        this->frame->linesize[plane] = this->header->linesize[plane];
+    }
+    this->frame->format = this->header->pixel_format;
+    this->frame->width = this->header->width;
+    this->frame->height = this->header->height;
+    return this->frame;
+}
+
+uint32_t FrameStore::get_flags() const
+{
+    return this->header->flags;
+}
+
+size_t FrameStore::get_frame_count() const
+{
+    return (size_t) this->header->frame_count;
+}
+
+int FrameStore::get_width() const
+{
+    return this->header->width;
+}
+
+int FrameStore::get_height() const
+{
+    return this->header->height;
+}
+
+int FrameStore::get_pixel_format() const
+{
+    return this->header->pixel_format;
+}
+
+FrameStoreWriter::FrameStoreWriter(const std::string &path, const SourceKey &key)
+    : path(path), temp_path(path + ".tmp." + std::to_string(getpid())), key(key), finished(false), has_layout(false)
+{
+    memset(&this->header, 0, sizeof(this->header));
+    this->fd = ::open(this->temp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (this->fd < 0)
+    {
+        throw io_exception("Couldn't write " + this->temp_path + ": " + errno_string());
+    }
+}
+
+FrameStoreWriter::~FrameStoreWriter()
+{
+    if (!this->finished)
+    {
+        ::close(this->fd);
+        unlink(this->temp_path.c_str());
+    }
+}
+
+void FrameStoreWriter::set_layout(const AVFrame *frame)
+{
+    if (frame->hw_frames_ctx)
+    {
+        throw invalid_argument_exception("Hardware frames can't be stored");
+    }
+
+    FrameStoreHeader &header = this->header;
+    memcpy(header.magic, FRAME_STORE_MAGIC, sizeof(FRAME_STORE_MAGIC));
+    header.version = FrameStore::VERSION;
+    header.pixel_format = frame->format;
+    header.width = frame->width;
+    header.height = frame->height;
+    header.path_length = (uint32_t) this->key.path.size();
+    header.source_size = this->key.size;
+    header.source_mtime_ns = this->key.mtime_ns;
+    header.content_hash = this->key.content_hash;
+
+    if (!get_layout(frame->format, frame->width, frame->height, header.linesize, header.plane_offset,
+                    header.slot_bytes))
+    {
+        throw invalid_argument_exception("Frames of this pixel format can't be stored");
+    }
+    header.data_offset = align(sizeof(header) + this->key.path.size(), FRAME_STORE_ALIGNMENT);
+    this->has_layout = true;
+}
+
+void FrameStoreWriter::write(size_t frame_index, const AVFrame *frame)
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (!this->has_layout)
+        {
+            this->set_layout(frame);
+        }
+        if (frame->format != this->header.pixel_format || frame->width != this->header.width ||
+            frame->height != this->header.height || frame->hw_frames_ctx)
+        {
+            throw invalid_argument_exception("Frames of differing size or format can't be stored");
+        }
+    }
+
+    thread_local std::vector<uint8_t> buffer;
+    buffer.resize(this->header.slot_bytes);
+    uint8_t *data[4];
+    int linesize[4];
+    for (int plane = 0; plane < 4; plane++)
+    {
+        data[plane] = this->header.linesize[plane] ? buffer.data() + this->header.plane_offset[plane] : nullptr;
+        linesize[plane] = this->header.linesize[plane];
+    }
+    av_image_copy(data, linesize, (const uint8_t **) frame->data, frame->linesize,
+                  (AVPixelFormat) frame->format, frame->width, frame->height);
+
+    off_t offset = (off_t) (this->header.data_offset + frame_index * this->header.slot_bytes);
+    if (pwrite(this->fd, buffer.data(), buffer.size(), offset) != (ssize_t) buffer.size())
+    {
+        throw io_exception("Couldn't write " + this->temp_path + ": " + errno_string());
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->present.size() <= frame_index)
+    {
+        this->present.resize(frame_index + 1, 0);
+    }
+    this->present[frame_index] = 1;
+}
+
+void FrameStoreWriter::finish(size_t frame_count, uint32_t flags)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (!this->has_layout)
+    {
+        throw decode_exception("No frames to store in " + this->path);
+    }
+
+    this->present.resize(frame_count, 0);
+    this->header.frame_count = frame_count;
+    this->header.flags = flags;
+    this->header.present_offset = this->header.data_offset + frame_count * this->header.slot_bytes;
+
+    std::vector<uint8_t> preamble(sizeof(this->header) + this->key.path.size());
+    memcpy(preamble.data(), &this->header, sizeof(this->header));
+    memcpy(preamble.data() + sizeof(this->header), this->key.path.data(), this->key.path.size());
+
+    bool ok = pwrite(this->fd, preamble.data(), preamble.size(), 0) == (ssize_t) preamble.size() &&
+              pwrite(this->fd, this->present.data(), frame_count, (off_t) this->header.present_offset) ==
+                  (ssize_t) frame_count &&
+              ftruncate(this->fd, (off_t) (this->header.present_offset + frame_count)) == 0;
+    ok = ::close(this->fd) == 0 && ok;
+    this->finished = true;
+
+    if (!ok || rename(this->temp_path.c_str(), this->path.c_str()) != 0)
+    {
+        std::string error = errno_string();
+        unlink(this->temp_path.c_str());
+        throw io_exception("Couldn't write " + this->path + ": " + error);
+    }
+}
+
+}
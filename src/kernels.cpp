@@ -0,0 +1,205 @@
+#include "lumin/kernels.h"
+#include "lumin/exceptions.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace lumin
+{
+
+typedef uint64_t (*sum_u8_function)(const uint8_t *, size_t);
+
+static KernelType detect_kernel_type()
+{
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return KERNEL_AVX2;
+    }
+#elif defined(__aarch64__)
+    return KERNEL_NEON;
+#endif
+    return KERNEL_SCALAR;
+}
+
+static sum_u8_function get_sum_u8_function(KernelType type)
+{
+    switch (type)
+    {
+#if defined(__x86_64__)
+        case KERNEL_AVX2:
+            return sum_u8_avx2;
+#endif
+#if defined(__aarch64__)
+        case KERNEL_NEON:
+            return sum_u8_neon;
+#endif
+        case KERNEL_SCALAR:
+            return sum_u8_scalar;
+        default:
+            return nullptr;
+    }
+}
+
+static KernelType kernel_type = detect_kernel_type();
+static sum_u8_function sum_u8_impl = get_sum_u8_function(kernel_type);
+
+KernelType get_kernel_type()
+{
+    return kernel_type;
+}
+
+const char *get_kernel_name(KernelType type)
+{
+    switch (type)
+    {
+        case KERNEL_SCALAR:
+            return "scalar";
+        case KERNEL_AVX2:
+            return "avx2";
+        case KERNEL_NEON:
+            return "neon";
+    }
+    return "unknown";
+}
+
+void set_kernel_type(KernelType type)
+{
+    sum_u8_function function = get_sum_u8_function(type);
+    if (!function || (type != KERNEL_SCALAR && type != detect_kernel_type()))
+    {
+        throw invalid_argument_exception(std::string("Kernel not supported on this CPU: ") + get_kernel_name(type));
+    }
+    kernel_type = type;
+    sum_u8_impl = function;
+}
+
+uint64_t sum_u8(const uint8_t *data, size_t count)
+{
+    return sum_u8_impl(data, count);
+}
+
+uint64_t sum_plane_u8(const uint8_t *data, ptrdiff_t stride, size_t width, size_t height)
+{
+    /*------------------------------------------------------------------------
+     * Unpadded planes can be summed in a single run.
+     *-----------------------------------------------------------------------*/
+    if (stride == (ptrdiff_t) width)
+    {
+        return sum_u8_impl(data, width * height);
+    }
+
+    uint64_t sum = 0;
+    for (size_t y = 0; y < height; y++)
+    {
+        sum += sum_u8_impl(data + (ptrdiff_t) y * stride, width);
+    }
+    return sum;
+}
+
+uint64_t sum_u8_scalar(const uint8_t *data, size_t count)
+{
+    /*------------------------------------------------------------------------
+     * Accumulate in 32 bits over blocks short enough not to overflow,
+     * which lets the compiler auto-vectorise the inner loop.
+     *-----------------------------------------------------------------------*/
+    const size_t block_size = 1 << 23;
+    uint64_t sum = 0;
+    while (count > 0)
+    {
+        size_t block = count < block_size ? count : block_size;
+        uint32_t partial = 0;
+        for (size_t index = 0; index < block; index++)
+        {
+            partial += data[index];
+        }
+        sum += partial;
+        data += block;
+        count -= block;
+    }
+    return sum;
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2")))
+uint64_t sum_u8_avx2(const uint8_t *data, size_t count)
+{
+    /*------------------------------------------------------------------------
+     * _mm256_sad_epu8 against zero sums each group of 8 bytes into a
+     * 64-bit lane, so the accumulators cannot overflow.
+     *-----------------------------------------------------------------------*/
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    __m256i acc2 = _mm256_setzero_si256();
+    __m256i acc3 = _mm256_setzero_si256();
+
+    size_t index = 0;
+    for (; index + 128 <= count; index += 128)
+    {
+        const __m256i *p = (const __m256i *) (data + index);
+        acc0 = _mm256_add_epi64(acc0, _mm256_sad_epu8(_mm256_loadu_si256(p + 0), zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_sad_epu8(_mm256_loadu_si256(p + 1), zero));
+        acc2 = _mm256_add_epi64(acc2, _mm256_sad_epu8(_mm256_loadu_si256(p + 2), zero));
+        acc3 = _mm256_add_epi64(acc3, _mm256_sad_epu8(_mm256_loadu_si256(p + 3), zero));
+    }
+    for (; index + 32 <= count; index += 32)
+    {
+        acc0 = _mm256_add_epi64(acc0, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *) (data + index)), zero));
+    }
+
+    __m256i acc = _mm256_add_epi64(_mm256_add_epi64(acc0, acc1), _mm256_add_epi64(acc2, acc3));
+    __m128i half = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    uint64_t sum = (uint64_t) _mm_cvtsi128_si64(half) + (uint64_t) _mm_extract_epi64(half, 1);
+
+    for (; index < count; index++)
+    {
+        sum += data[index];
+    }
+    return sum;
+}
+
+#endif
+
+#if defined(__aarch64__)
+
+uint64_t sum_u8_neon(const uint8_t *data, size_t count)
+{
+    /*------------------------------------------------------------------------
+     * Widen pairwise u8 -> u16 -> u32. Each 64-byte step adds at most
+     * 4080 to a u32 lane, so widen to u64 every 2^16 steps.
+     *-----------------------------------------------------------------------*/
+    const size_t block_size = 64 << 16;
+    uint64_t sum = 0;
+    size_t index = 0;
+
+    while (index + 64 <= count)
+    {
+        size_t block_end = index + block_size < count ? index + block_size : count;
+        uint32x4_t acc = vdupq_n_u32(0);
+        for (; index + 64 <= block_end; index += 64)
+        {
+            uint16x8_t partial = vpaddlq_u8(vld1q_u8(data + index));
+            partial = vpadalq_u8(partial, vld1q_u8(data + index + 16));
+            partial = vpadalq_u8(partial, vld1q_u8(data + index + 32));
+            partial = vpadalq_u8(partial, vld1q_u8(data + index + 48));
+            acc = vpadalq_u16(acc, partial);
+        }
+        sum += vaddlvq_u32(acc);
+    }
+
+    for (; index < count; index++)
+    {
+        sum += data[index];
+    }
+    return sum;
+}
+
+#endif
+
+}
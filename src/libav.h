@@ -0,0 +1,44 @@
+#pragma once
+
+/*------------------------------------------------------------------------
+ * Helpers shared by the translation units that use libav directly.
+ *-----------------------------------------------------------------------*/
+
+extern "C"
+{
+#include <libavutil/error.h>
+#include <libavutil/pixdesc.h>
+}
+
+#include <string>
+
+namespace lumin
+{
+
+inline std::string av_error_string(int error)
+{
+    char buffer[AV_ERROR_MAX_STRING_SIZE] = { 0 };
+    av_strerror(error, buffer, sizeof(buffer));
+    return std::string(buffer);
+}
+
+/*------------------------------------------------------------------------
+ * True if plane 0 of `format` is a packed 8-bit luma plane that can be
+ * read in place.
+ *-----------------------------------------------------------------------*/
+inline bool has_8bit_luma_plane(AVPixelFormat format)
+{
+    const AVPixFmtDescriptor *descriptor = av_pix_fmt_desc_get(format);
+    if (!descriptor || descriptor->nb_components == 0)
+    {
+        return false;
+    }
+    if (descriptor->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL))
+    {
+        return false;
+    }
+    const AVComponentDescriptor &luma = descriptor->comp[0];
+    return luma.plane == 0 && luma.step == 1 && luma.offset == 0 && luma.shift == 0 && luma.depth == 8;
+}
+
+}
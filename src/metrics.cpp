@@ -0,0 +1,265 @@
+#include "lumin/metrics.h"
+
+#include <cstdarg>
+
+namespace lumin
+{
+
+/*------------------------------------------------------------------------
+ * Append printf-formatted text to `json`.
+ *-----------------------------------------------------------------------*/
+static void append(std::string &json, const char *format, ...)
+{
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    json += buffer;
+}
+
+static double get_seconds(std::chrono::steady_clock::duration duration)
+{
+    return std::chrono::duration<double>(duration).count();
+}
+
+Metrics::Metrics()
+    : start_time(Clock::now()),
+      phase_total(0),
+      phase_progress(0),
+      last_progress_ns(0),
+      frames_decoded(0),
+      frames_written(0),
+      seeks(0),
+      cache_hits(0),
+      cache_misses(0),
+      bytes_read(0),
+      bytes_written(0),
+      corrupt_packets(0)
+{
+}
+
+void Metrics::begin_phase(const std::string &name, uint64_t total)
+{
+    this->end_phase();
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->phase = name;
+    this->phase_start_time = Clock::now();
+    this->phase_total = total;
+    this->phase_progress = 0;
+    this->last_progress_ns = std::chrono::nanoseconds(this->phase_start_time - this->start_time).count();
+}
+
+void Metrics::end_phase()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->phase.empty())
+    {
+        return;
+    }
+    PhaseStats stats;
+    stats.name = this->phase;
+    stats.seconds = get_seconds(Clock::now() - this->phase_start_time);
+    stats.items = this->phase_progress;
+    this->phases.push_back(stats);
+    this->phase.clear();
+}
+
+void Metrics::set_phase_total(uint64_t total)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->phase_total = total;
+}
+
+void Metrics::add_progress(uint64_t count)
+{
+    this->phase_progress.fetch_add(count, std::memory_order_relaxed);
+    this->last_progress_ns.store(std::chrono::nanoseconds(Clock::now() - this->start_time).count(),
+                                 std::memory_order_relaxed);
+}
+
+void Metrics::add_frames_decoded(uint64_t count)
+{
+    this->frames_decoded.fetch_add(count, std::memory_order_relaxed);
+}
+
+void Metrics::add_frames_written(uint64_t count)
+{
+    this->frames_written.fetch_add(count, std::memory_order_relaxed);
+}
+
+void Metrics::add_seeks(uint64_t count)
+{
+    this->seeks.fetch_add(count, std::memory_order_relaxed);
+}
+
+void Metrics::add_cache_hits(uint64_t count)
+{
+    this->cache_hits.fetch_add(count, std::memory_order_relaxed);
+}
+
+void Metrics::add_cache_misses(uint64_t count)
+{
+    this->cache_misses.fetch_add(count, std::memory_order_relaxed);
+}
+
+void Metrics::add_bytes_read(uint64_t count)
+{
+    this->bytes_read.fetch_add(count, std::memory_order_relaxed);
+}
+
+void Metrics::add_bytes_written(uint64_t count)
+{
+    this->bytes_written.fetch_add(count, std::memory_order_relaxed);
+}
+
+void Metrics::add_corrupt_packets(uint64_t count)
+{
+    this->corrupt_packets.fetch_add(count, std::memory_order_relaxed);
+}
+
+void Metrics::add_queue(const std::string &name, std::function<size_t()> depth)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->queues[name] = depth;
+}
+
+void Metrics::remove_queue(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->queues.erase(name);
+}
+
+std::vector<PhaseStats> Metrics::get_phases() const
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->phases;
+}
+
+std::string Metrics::get_counters_json() const
+{
+    double elapsed = get_seconds(Clock::now() - this->start_time);
+    uint64_t decoded = this->frames_decoded.load(std::memory_order_relaxed);
+    std::string json;
+    append(json, "\"elapsed\": %.3f, \"frames_decoded\": %llu, \"decode_fps\": %.2f, ",
+           elapsed, (unsigned long long) decoded, elapsed > 0.0 ? decoded / elapsed : 0.0);
+    append(json, "\"frames_written\": %llu, \"seeks\": %llu, \"cache_hits\": %llu, \"cache_misses\": %llu, ",
+           (unsigned long long) this->frames_written.load(std::memory_order_relaxed),
+           (unsigned long long) this->seeks.load(std::memory_order_relaxed),
+           (unsigned long long) this->cache_hits.load(std::memory_order_relaxed),
+           (unsigned long long) this->cache_misses.load(std::memory_order_relaxed));
+    append(json, "\"bytes_read\": %llu, \"bytes_written\": %llu, \"corrupt_packets\": %llu",
+           (unsigned long long) this->bytes_read.load(std::memory_order_relaxed),
+           (unsigned long long) this->bytes_written.load(std::memory_order_relaxed),
+           (unsigned long long) this->corrupt_packets.load(std::memory_order_relaxed));
+    return json;
+}
+
+std::string Metrics::get_progress_json() const
+{
+    std::string json = "{\"type\": \"progress\", ";
+    json += this->get_counters_json();
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (!this->phase.empty())
+    {
+        Clock::time_point now = Clock::now();
+        double phase_elapsed = get_seconds(now - this->phase_start_time);
+        uint64_t done = this->phase_progress.load(std::memory_order_relaxed);
+        double rate = phase_elapsed > 0.0 ? done / phase_elapsed : 0.0;
+        double stalled = get_seconds(now - this->start_time)
+                       - this->last_progress_ns.load(std::memory_order_relaxed) * 1e-9;
+
+        append(json, ", \"phase\": \"%s\", \"phase_elapsed\": %.3f, \"done\": %llu, \"total\": %llu, "
+               "\"rate\": %.2f, \"stalled\": %.3f, \"eta\": ",
+               this->phase.c_str(), phase_elapsed, (unsigned long long) done,
+               (unsigned long long) this->phase_total, rate, stalled);
+        if (this->phase_total > 0 && rate > 0.0 && done <= this->phase_total)
+        {
+            append(json, "%.1f", (this->phase_total - done) / rate);
+        }
+        else
+        {
+            json += "null";
+        }
+    }
+
+    json += ", \"queues\": {";
+    bool first = true;
+    for (const auto &queue : this->queues)
+    {
+        append(json, "%s\"%s\": %zu", first ? "" : ", ", queue.first.c_str(), queue.second());
+        first = false;
+    }
+    json += "}}";
+    return json;
+}
+
+std::string Metrics::get_summary_json() const
+{
+    std::string json = "{\"type\": \"summary\", ";
+    json += this->get_counters_json();
+    json += ", \"phases\": [";
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (size_t index = 0; index < this->phases.size(); index++)
+    {
+        const PhaseStats &phase = this->phases[index];
+        append(json, "%s{\"name\": \"%s\", \"seconds\": %.3f, \"items\": %llu, \"rate\": %.2f}",
+               index ? ", " : "", phase.name.c_str(), phase.seconds, (unsigned long long) phase.items,
+               phase.get_rate());
+    }
+    json += "]}";
+    return json;
+}
+
+ProgressReporter::ProgressReporter(const Metrics &metrics, FILE *output, double interval)
+    : metrics(metrics), output(output), stopping(false), finished(false)
+{
+    if (interval <= 0.0)
+    {
+        return;
+    }
+    auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(interval));
+    this->thread = std::thread([this, period]() {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        while (!this->condition.wait_for(lock, period, [this]() { return this->stopping; }))
+        {
+            fprintf(this->output, "%s\n", this->metrics.get_progress_json().c_str());
+            fflush(this->output);
+        }
+    });
+}
+
+ProgressReporter::~ProgressReporter()
+{
+    this->finish();
+}
+
+void ProgressReporter::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->condition.notify_all();
+    if (this->thread.joinable())
+    {
+        this->thread.join();
+    }
+}
+
+void ProgressReporter::finish()
+{
+    if (this->finished)
+    {
+        return;
+    }
+    this->finished = true;
+    this->stop();
+    fprintf(this->output, "%s\n", this->metrics.get_summary_json().c_str());
+    fflush(this->output);
+}
+
+}
@@ -0,0 +1,244 @@
+#include "lumin/packet_index.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace lumin
+{
+
+/*------------------------------------------------------------------------
+ * Matches AV_NOPTS_VALUE, without pulling libavutil into the core.
+ *-----------------------------------------------------------------------*/
+static const int64_t NO_TIMESTAMP = INT64_MIN;
+
+PacketTable::~PacketTable()
+{
+}
+
+/*------------------------------------------------------------------------
+ * Packets held in memory, as built by a scan.
+ *-----------------------------------------------------------------------*/
+class EntryTable : public PacketTable
+{
+public:
+    explicit EntryTable(std::vector<PacketIndexEntry> entries)
+        : entries(std::move(entries))
+    {
+    }
+
+    size_t size() const override
+    {
+        return this->entries.size();
+    }
+
+    PacketIndexEntry get(size_t position) const override
+    {
+        return this->entries[position];
+    }
+
+private:
+    std::vector<PacketIndexEntry> entries;
+};
+
+static size_t find_pts(const std::vector<int64_t> &presentation_pts, int64_t pts)
+{
+    return std::lower_bound(presentation_pts.begin(), presentation_pts.end(), pts) - presentation_pts.begin();
+}
+
+PacketIndex::PacketIndex()
+    : tables(std::make_shared<Tables>())
+{
+}
+
+PacketIndex::PacketIndex(std::vector<PacketIndexEntry> entries, Rational time_base, Rational frame_rate)
+    : PacketIndex(std::make_shared<EntryTable>(std::move(entries)), time_base, frame_rate)
+{
+}
+
+PacketIndex::PacketIndex(std::shared_ptr<const PacketTable> packets, Rational time_base, Rational frame_rate)
+    : packets(std::move(packets)), tables(std::make_shared<Tables>()), time_base(time_base), frame_rate(frame_rate)
+{
+}
+
+const PacketIndex::Tables &PacketIndex::get_tables() const
+{
+    std::call_once(this->tables->built, [this]() { this->build_tables(); });
+    return *this->tables;
+}
+
+void PacketIndex::build_tables() const
+{
+    Tables &tables = *this->tables;
+    if (!this->packets)
+    {
+        return;
+    }
+
+    const size_t count = this->packets->size();
+    std::vector<std::pair<int64_t, size_t>> order;
+    order.reserve(count);
+    for (size_t position = 0; position < count; position++)
+    {
+        const int64_t pts = this->packets->get(position).pts;
+        if (pts == NO_TIMESTAMP)
+        {
+            return;
+        }
+        order.emplace_back(pts, position);
+    }
+
+    /*------------------------------------------------------------------------
+     * Packets with the same timestamp are taken in decode order, so that
+     * every packet still has a frame of its own.
+     *-----------------------------------------------------------------------*/
+    std::sort(order.begin(), order.end());
+    tables.timestamps = true;
+    tables.unique_timestamps = true;
+    tables.presentation_pts.resize(count);
+    tables.presentation_entries.resize(count);
+    for (size_t frame = 0; frame < count; frame++)
+    {
+        tables.presentation_pts[frame] = order[frame].first;
+        tables.presentation_entries[frame] = order[frame].second;
+        if (frame > 0 && order[frame].first == order[frame - 1].first)
+        {
+            tables.unique_timestamps = false;
+        }
+        if (this->packets->get(order[frame].second).keyframe)
+        {
+            tables.keyframes.push_back(frame);
+        }
+    }
+}
+
+size_t PacketIndex::get_frame_count() const
+{
+    return this->packets ? this->packets->size() : 0;
+}
+
+Rational PacketIndex::get_time_base() const
+{
+    return this->time_base;
+}
+
+Rational PacketIndex::get_frame_rate() const
+{
+    return this->frame_rate;
+}
+
+bool PacketIndex::has_timestamps() const
+{
+    return this->get_tables().timestamps;
+}
+
+bool PacketIndex::has_unique_timestamps() const
+{
+    return this->get_tables().unique_timestamps;
+}
+
+int64_t PacketIndex::get_frame_pts(size_t index) const
+{
+    return this->get_tables().presentation_pts.at(index);
+}
+
+size_t PacketIndex::get_frame_index(int64_t pts) const
+{
+    return find_pts(this->get_tables().presentation_pts, pts);
+}
+
+const std::vector<size_t> &PacketIndex::get_keyframes() const
+{
+    return this->get_tables().keyframes;
+}
+
+std::vector<FrameRange> PacketIndex::split(size_t segment_count, size_t frame_count) const
+{
+    frame_count = std::min(frame_count, this->get_frame_count());
+    if (frame_count == 0)
+    {
+        return {};
+    }
+    const Tables &tables = this->get_tables();
+    if (segment_count <= 1 || !tables.timestamps || tables.keyframes.empty())
+    {
+        return { { 0, frame_count } };
+    }
+
+    /*------------------------------------------------------------------------
+     * Take the first keyframe at or after each ideal split point.
+     * Segments collapse when keyframes are further apart than the ideal
+     * segment length.
+     *-----------------------------------------------------------------------*/
+    std::vector<FrameRange> segments;
+    size_t start = 0;
+    for (size_t segment = 1; segment < segment_count; segment++)
+    {
+        size_t target = frame_count * segment / segment_count;
+        auto it = std::lower_bound(tables.keyframes.begin(), tables.keyframes.end(), std::max(target, start + 1));
+        if (it == tables.keyframes.end() || *it >= frame_count)
+        {
+            break;
+        }
+        segments.push_back({ start, *it });
+        start = *it;
+    }
+    segments.push_back({ start, frame_count });
+
+    return segments;
+}
+
+PacketIndexEntry PacketIndex::get_entry(size_t position) const
+{
+    return this->packets->get(position);
+}
+
+ByteRange PacketIndex::get_byte_range(size_t start, size_t end) const
+{
+    const Tables &tables = this->get_tables();
+    end = std::min(end, this->get_frame_count());
+    if (start >= end || !tables.timestamps)
+    {
+        return { 0, 0 };
+    }
+
+    auto keyframe = std::upper_bound(tables.keyframes.begin(), tables.keyframes.end(), start);
+    const size_t first_frame = keyframe == tables.keyframes.begin() ? 0 : *(keyframe - 1);
+    const size_t first = tables.presentation_entries[first_frame];
+
+    /*------------------------------------------------------------------------
+     * With reordering, a frame of the range may be decoded after frames
+     * past its end, but never after the next keyframe past it.
+     *-----------------------------------------------------------------------*/
+    size_t last = first;
+    for (size_t position = first; position < this->get_frame_count(); position++)
+    {
+        const PacketIndexEntry entry = this->packets->get(position);
+        size_t frame = find_pts(tables.presentation_pts, entry.pts);
+        if (frame < end)
+        {
+            last = position;
+        }
+        else if (entry.keyframe)
+        {
+            break;
+        }
+    }
+
+    ByteRange range = { INT64_MAX, 0 };
+    for (size_t position = first; position <= last; position++)
+    {
+        const PacketIndexEntry entry = this->packets->get(position);
+        if (entry.pos >= 0)
+        {
+            range.start = std::min(range.start, entry.pos);
+            range.end = std::max(range.end, entry.pos + entry.size);
+        }
+    }
+    if (range.start >= range.end)
+    {
+        return { 0, 0 };
+    }
+    return range;
+}
+
+}
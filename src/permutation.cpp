@@ -0,0 +1,209 @@
+#include "lumin/permutation.h"
+#include "lumin/exceptions.h"
+#include "lumin/sort.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace lumin
+{
+
+bool OrderOptions::constrains_runs() const
+{
+    return this->min_run_length > 1 || this->run_tolerance > 0 || this->shot_threshold > 0.0;
+}
+
+OrderKey::OrderKey(const OrderOptions &options)
+    : reverse(options.reverse)
+{
+    if (options.decimal_places < 0 || options.decimal_places > 12)
+    {
+        throw invalid_argument_exception("Decimal places must be between 0 and 12");
+    }
+
+    /*------------------------------------------------------------------------
+     * 0 places means no rounding, as in reorder.py, which is
+     * approximated with 12 places.
+     *-----------------------------------------------------------------------*/
+    const int places = options.decimal_places == 0 ? 12 : options.decimal_places;
+    this->scale = std::pow(10.0, places);
+}
+
+Permutation::Permutation()
+{
+}
+
+Permutation::Permutation(Rational frame_rate, std::vector<uint32_t> source_frames)
+    : frame_rate(frame_rate), source_frames(std::move(source_frames))
+{
+    if (!frame_rate.is_valid())
+    {
+        throw invalid_argument_exception("Frame rate must be positive");
+    }
+    if (this->source_frames.size() > UINT32_MAX)
+    {
+        throw invalid_argument_exception("Too many frames for a 32-bit permutation");
+    }
+}
+
+size_t Permutation::size() const
+{
+    return this->source_frames.size();
+}
+
+Rational Permutation::get_frame_rate() const
+{
+    return this->frame_rate;
+}
+
+size_t Permutation::get_frame_index(double t) const
+{
+    if (this->source_frames.empty() || !(t > 0.0))
+    {
+        return 0;
+    }
+
+    /*------------------------------------------------------------------------
+     * frame = floor(t * num / den). Quantising t to microseconds loses up
+     * to half a tick, so allow one tick of slack: timestamps of frame
+     * starts, i / fps, then always land in frame i.
+     *-----------------------------------------------------------------------*/
+    const int64_t ticks_per_second = 1000000;
+    int64_t ticks = std::llround(t * ticks_per_second);
+    int64_t frame = (ticks * this->frame_rate.num + this->frame_rate.num) / (this->frame_rate.den * ticks_per_second);
+
+    return std::min((size_t) frame, this->source_frames.size() - 1);
+}
+
+double Permutation::remap(double t) const
+{
+    if (this->source_frames.empty())
+    {
+        return t;
+    }
+    size_t dest_frame = this->get_frame_index(t);
+    int64_t shift = (int64_t) this->source_frames[dest_frame] - (int64_t) dest_frame;
+    return t + (double) (shift * this->frame_rate.den) / this->frame_rate.num;
+}
+
+const std::vector<uint32_t> &Permutation::get_source_frames() const
+{
+    return this->source_frames;
+}
+
+std::vector<uint32_t> Permutation::get_inverse() const
+{
+    std::vector<uint32_t> inverse(this->source_frames.size());
+    for (size_t dest_frame = 0; dest_frame < this->source_frames.size(); dest_frame++)
+    {
+        inverse[this->source_frames[dest_frame]] = (uint32_t) dest_frame;
+    }
+    return inverse;
+}
+
+/*------------------------------------------------------------------------
+ * First source frame of each run that `options` keeps together.
+ *-----------------------------------------------------------------------*/
+static std::vector<uint32_t> split_runs(const std::vector<double> &values,
+                                        const OrderOptions &options,
+                                        const OrderKey &get_key)
+{
+    std::vector<uint32_t> starts;
+    int64_t first_key = 0;
+    for (size_t frame = 0; frame < values.size(); frame++)
+    {
+        int64_t key = get_key(values[frame]);
+        if (!starts.empty())
+        {
+            bool cut = options.shot_threshold > 0.0 &&
+                       std::fabs(values[frame] - values[frame - 1]) >= options.shot_threshold;
+            bool joins = frame - starts.back() < options.min_run_length ||
+                         std::llabs(key - first_key) <= options.run_tolerance;
+            if (joins && !cut)
+            {
+                continue;
+            }
+        }
+        starts.push_back((uint32_t) frame);
+        first_key = key;
+    }
+    return starts;
+}
+
+/*------------------------------------------------------------------------
+ * Sort the runs by the key of their mean brightness, and lay out their
+ * frames in that order.
+ *-----------------------------------------------------------------------*/
+static std::vector<uint32_t> order_runs(const std::vector<double> &values,
+                                        const OrderOptions &options,
+                                        const OrderKey &get_key)
+{
+    std::vector<uint32_t> starts = split_runs(values, options, get_key);
+    auto get_end = [&](size_t run) { return run + 1 < starts.size() ? (size_t) starts[run + 1] : values.size(); };
+
+    KeySorter sorter(options.memory_budget, options.spill_directory);
+    for (size_t run = 0; run < starts.size(); run++)
+    {
+        double sum = 0.0;
+        for (size_t frame = starts[run]; frame < get_end(run); frame++)
+        {
+            sum += values[frame];
+        }
+        sorter.add(encode_sort_key(get_key(sum / (double) (get_end(run) - starts[run]))), (uint32_t) run);
+    }
+
+    std::vector<uint32_t> source_frames;
+    source_frames.reserve(values.size());
+    for (uint32_t run : sorter.finish())
+    {
+        for (size_t frame = starts[run]; frame < get_end(run); frame++)
+        {
+            source_frames.push_back((uint32_t) frame);
+        }
+    }
+    return source_frames;
+}
+
+Permutation order(const LuminanceSeries &series, const OrderOptions &options)
+{
+    const OrderKey get_key(options);
+    const std::vector<double> &values = series.get_values();
+    if (values.size() > UINT32_MAX)
+    {
+        throw invalid_argument_exception("Too many frames for a 32-bit permutation");
+    }
+    if (options.run_tolerance < 0 || options.shot_threshold < 0.0)
+    {
+        throw invalid_argument_exception("Run tolerance and shot threshold can't be negative");
+    }
+
+    if (options.metrics)
+    {
+        options.metrics->begin_phase("order", values.size());
+    }
+    std::vector<uint32_t> source_frames;
+    if (options.constrains_runs())
+    {
+        source_frames = order_runs(values, options, get_key);
+    }
+    else
+    {
+        KeySorter sorter(options.memory_budget, options.spill_directory);
+        for (size_t index = 0; index < values.size(); index++)
+        {
+            sorter.add(encode_sort_key(get_key(values[index])), (uint32_t) index);
+        }
+        source_frames = sorter.finish();
+    }
+
+    Permutation permutation(series.get_frame_rate(), std::move(source_frames));
+    if (options.metrics)
+    {
+        options.metrics->add_progress(values.size());
+        options.metrics->end_phase();
+    }
+    return permutation;
+}
+
+}
@@ -0,0 +1,96 @@
+#include "lumin/pipeline.h"
+
+namespace lumin
+{
+
+double StageStats::get_utilisation() const
+{
+    if (this->wall_seconds <= 0.0)
+    {
+        return 0.0;
+    }
+    double busy = this->wall_seconds - this->input_wait_seconds - this->output_wait_seconds;
+    return busy < 0.0 ? 0.0 : busy / this->wall_seconds;
+}
+
+Stage::Stage(const std::string &name)
+    : name(name), input_wait_ns(0), output_wait_ns(0), items(0)
+{
+}
+
+void Stage::start()
+{
+    this->start_time = this->stop_time = std::chrono::steady_clock::now();
+}
+
+void Stage::stop()
+{
+    this->stop_time = std::chrono::steady_clock::now();
+}
+
+void Stage::add_items(uint64_t count)
+{
+    this->items.fetch_add(count, std::memory_order_relaxed);
+}
+
+void Stage::add_input_wait(std::chrono::nanoseconds duration)
+{
+    this->input_wait_ns.fetch_add(duration.count(), std::memory_order_relaxed);
+}
+
+void Stage::add_output_wait(std::chrono::nanoseconds duration)
+{
+    this->output_wait_ns.fetch_add(duration.count(), std::memory_order_relaxed);
+}
+
+StageStats Stage::get_stats() const
+{
+    StageStats stats;
+    stats.name = this->name;
+    stats.wall_seconds = std::chrono::duration<double>(this->stop_time - this->start_time).count();
+    stats.input_wait_seconds = this->input_wait_ns.load(std::memory_order_relaxed) * 1e-9;
+    stats.output_wait_seconds = this->output_wait_ns.load(std::memory_order_relaxed) * 1e-9;
+    stats.items = this->items.load(std::memory_order_relaxed);
+    return stats;
+}
+
+StageThread::StageThread(Stage &stage, std::function<void()> body, std::function<void()> finally)
+{
+    this->thread = std::thread([this, &stage, body, finally]() {
+        stage.start();
+        try
+        {
+            body();
+        }
+        catch (...)
+        {
+            this->error = std::current_exception();
+        }
+        finally();
+        stage.stop();
+    });
+}
+
+StageThread::~StageThread()
+{
+    if (this->thread.joinable())
+    {
+        this->thread.join();
+    }
+}
+
+void StageThread::join()
+{
+    if (this->thread.joinable())
+    {
+        this->thread.join();
+    }
+    if (this->error)
+    {
+        std::exception_ptr error = this->error;
+        this->error = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+}
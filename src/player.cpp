@@ -0,0 +1,590 @@
+#include "lumin/player.h"
+#include "lumin/decoder.h"
+#include "lumin/exceptions.h"
+#include "lumin/frame_reader.h"
+#include "lumin/frame_store.h"
+#include "lumin/sidecar.h"
+#include "frame_queue.h"
+
+extern "C"
+{
+#include <libavutil/frame.h>
+#include <libswscale/swscale.h>
+}
+
+#include <SDL.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <thread>
+
+namespace lumin
+{
+
+FrameTimeHistogram::FrameTimeHistogram()
+    : buckets(BUCKET_COUNT, 0), count(0), total(0.0), max(0.0)
+{
+}
+
+void FrameTimeHistogram::add(double seconds)
+{
+    size_t bucket = seconds > 0.0 ? (size_t) (seconds / BUCKET_SECONDS) : 0;
+    this->buckets[std::min(bucket, BUCKET_COUNT - 1)]++;
+    this->count++;
+    this->total += seconds;
+    this->max = std::max(this->max, seconds);
+}
+
+uint64_t FrameTimeHistogram::get_count() const
+{
+    return this->count;
+}
+
+double FrameTimeHistogram::get_mean() const
+{
+    return this->count ? this->total / this->count : 0.0;
+}
+
+double FrameTimeHistogram::get_max() const
+{
+    return this->max;
+}
+
+double FrameTimeHistogram::get_percentile(double fraction) const
+{
+    if (!this->count)
+    {
+        return 0.0;
+    }
+    uint64_t target = std::max((uint64_t) 1, (uint64_t) std::ceil(fraction * this->count));
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket + 1 < BUCKET_COUNT; bucket++)
+    {
+        seen += this->buckets[bucket];
+        if (seen >= target)
+        {
+            return std::min(this->max, (bucket + 1) * BUCKET_SECONDS);
+        }
+    }
+    return this->max;
+}
+
+uint64_t FrameTimeHistogram::get_count_over(double seconds) const
+{
+    uint64_t over = 0;
+    for (size_t bucket = (size_t) std::ceil(seconds / BUCKET_SECONDS); bucket < BUCKET_COUNT; bucket++)
+    {
+        over += this->buckets[bucket];
+    }
+    return over;
+}
+
+const std::vector<uint64_t> &FrameTimeHistogram::get_buckets() const
+{
+    return this->buckets;
+}
+
+/*------------------------------------------------------------------------
+ * Texture format that frames of `pixel_format` can be uploaded to
+ * unconverted, or SDL_PIXELFORMAT_UNKNOWN if they must be converted to
+ * YUV420P first.
+ *-----------------------------------------------------------------------*/
+static uint32_t get_texture_format(int pixel_format)
+{
+    switch (pixel_format)
+    {
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+        return SDL_PIXELFORMAT_IYUV;
+    case AV_PIX_FMT_NV12:
+        return SDL_PIXELFORMAT_NV12;
+    default:
+        return SDL_PIXELFORMAT_UNKNOWN;
+    }
+}
+
+/**------------------------------------------------------------------------
+ * A window showing one texture at a time, letterboxed. Frames are
+ * uploaded to the texture that isn't on screen, so an upload never waits
+ * for the GPU to finish drawing the frame before.
+ *-----------------------------------------------------------------------*/
+class Display
+{
+public:
+    Display(int width, int height, uint32_t texture_format, bool fullscreen)
+        : texture_format(texture_format), window(nullptr), renderer(nullptr), textures{ nullptr, nullptr },
+          front(0), vsync(false), refresh_rate(0)
+    {
+        if (SDL_InitSubSystem(SDL_INIT_VIDEO) != 0)
+        {
+            throw io_exception("Couldn't initialise SDL: " + std::string(SDL_GetError()));
+        }
+
+        /*------------------------------------------------------------------------
+         * Shrink the window to fit the screen, keeping the aspect ratio.
+         *-----------------------------------------------------------------------*/
+        int window_width = width;
+        int window_height = height;
+        SDL_Rect bounds;
+        if (SDL_GetDisplayUsableBounds(0, &bounds) == 0 && (width > bounds.w || height > bounds.h))
+        {
+            double scale = std::min((double) bounds.w / width, (double) bounds.h / height);
+            window_width = std::max(1, (int) (width * scale));
+            window_height = std::max(1, (int) (height * scale));
+        }
+
+        this->window = SDL_CreateWindow("lumin-order", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+                                        window_width, window_height,
+                                        SDL_WINDOW_RESIZABLE | (fullscreen ? SDL_WINDOW_FULLSCREEN_DESKTOP : 0));
+        if (!this->window)
+        {
+            this->fail("Couldn't open window");
+        }
+        this->renderer = SDL_CreateRenderer(this->window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+        if (!this->renderer)
+        {
+            this->fail("Couldn't create renderer");
+        }
+
+        SDL_RendererInfo info;
+        this->vsync = SDL_GetRendererInfo(this->renderer, &info) == 0 && (info.flags & SDL_RENDERER_PRESENTVSYNC);
+        SDL_DisplayMode mode;
+        if (SDL_GetCurrentDisplayMode(std::max(0, SDL_GetWindowDisplayIndex(this->window)), &mode) == 0)
+        {
+            this->refresh_rate = mode.refresh_rate;
+        }
+
+        SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
+        SDL_SetYUVConversionMode(SDL_YUV_CONVERSION_AUTOMATIC);
+        SDL_RenderSetLogicalSize(this->renderer, width, height);
+        SDL_SetRenderDrawColor(this->renderer, 0, 0, 0, 255);
+        for (SDL_Texture *&texture : this->textures)
+        {
+            texture = SDL_CreateTexture(this->renderer, texture_format, SDL_TEXTUREACCESS_STREAMING, width, height);
+            if (!texture)
+            {
+                this->fail("Couldn't create texture");
+            }
+        }
+        if (fullscreen)
+        {
+            SDL_ShowCursor(SDL_DISABLE);
+        }
+    }
+
+    ~Display()
+    {
+        this->close();
+    }
+
+    Display(const Display &) = delete;
+    Display &operator=(const Display &) = delete;
+
+    /**------------------------------------------------------------------------
+     * Upload `frame` to the back texture, and make it the one presented.
+     *-----------------------------------------------------------------------*/
+    void upload(const AVFrame *frame)
+    {
+        SDL_Texture *texture = this->textures[1 - this->front];
+        int rv;
+        if (this->texture_format == SDL_PIXELFORMAT_NV12)
+        {
+            rv = SDL_UpdateNVTexture(texture, nullptr, frame->data[0], frame->linesize[0],
+                                     frame->data[1], frame->linesize[1]);
+        }
+        else
+        {
+            rv = SDL_UpdateYUVTexture(texture, nullptr, frame->data[0], frame->linesize[0],
+                                      frame->data[1], frame->linesize[1], frame->data[2], frame->linesize[2]);
+        }
+        if (rv != 0)
+        {
+            throw decode_exception("Couldn't upload frame: " + std::string(SDL_GetError()));
+        }
+        this->front = 1 - this->front;
+    }
+
+    /**------------------------------------------------------------------------
+     * Draw the front texture, blocking until the next vsync if the
+     * renderer supports it.
+     *-----------------------------------------------------------------------*/
+    void present()
+    {
+        SDL_RenderClear(this->renderer);
+        SDL_RenderCopy(this->renderer, this->textures[this->front], nullptr, nullptr);
+        SDL_RenderPresent(this->renderer);
+    }
+
+    /**------------------------------------------------------------------------
+     * Handle pending window events. Returns false once the window has
+     * been closed or Escape or Q pressed.
+     *-----------------------------------------------------------------------*/
+    bool poll()
+    {
+        SDL_Event event;
+        while (SDL_PollEvent(&event))
+        {
+            if (event.type == SDL_QUIT)
+            {
+                return false;
+            }
+            if (event.type == SDL_KEYDOWN &&
+                (event.key.keysym.sym == SDLK_ESCAPE || event.key.keysym.sym == SDLK_q))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool has_vsync() const
+    {
+        return this->vsync;
+    }
+
+    int get_refresh_rate() const
+    {
+        return this->refresh_rate;
+    }
+
+private:
+    [[noreturn]] void fail(const std::string &message)
+    {
+        std::string error = SDL_GetError();
+        this->close();
+        throw io_exception(message + ": " + error);
+    }
+
+    void close()
+    {
+        for (SDL_Texture *&texture : this->textures)
+        {
+            if (texture)
+            {
+                SDL_DestroyTexture(texture);
+                texture = nullptr;
+            }
+        }
+        if (this->renderer)
+        {
+            SDL_DestroyRenderer(this->renderer);
+            this->renderer = nullptr;
+        }
+        if (this->window)
+        {
+            SDL_DestroyWindow(this->window);
+            this->window = nullptr;
+        }
+        SDL_QuitSubSystem(SDL_INIT_VIDEO);
+    }
+
+    uint32_t texture_format;
+    SDL_Window *window;
+    SDL_Renderer *renderer;
+    SDL_Texture *textures[2];
+    int front;
+    bool vsync;
+    int refresh_rate;
+};
+
+/*------------------------------------------------------------------------
+ * The frame store at options.frame_store_path, if it can stand in for
+ * decoding `input` to play `edl`.
+ *-----------------------------------------------------------------------*/
+static std::unique_ptr<FrameStore> open_frame_store(const EditDecisionList &edl,
+                                                    const SourceKey *key,
+                                                    const PlaybackOptions &options)
+{
+    if (options.frame_store_path.empty())
+    {
+        return nullptr;
+    }
+    std::unique_ptr<FrameStore> store = FrameStore::open(options.frame_store_path);
+    if (!store || !store->matches(*key) || store->get_frame_count() < edl.get_source_end())
+    {
+        return nullptr;
+    }
+    return store;
+}
+
+PlaybackStats play(const std::string &input, const EditDecisionList &edl, const PlaybackOptions &options)
+{
+    using Clock = std::chrono::steady_clock;
+
+    const Rational frame_rate = edl.get_frame_rate();
+    if (!frame_rate.is_valid() || edl.get_frame_count() == 0)
+    {
+        throw invalid_argument_exception("Nothing to play");
+    }
+
+    /*------------------------------------------------------------------------
+     * Identify the source once, for both the frame store and the packet
+     * index file.
+     *-----------------------------------------------------------------------*/
+    SourceKey computed_key;
+    const SourceKey *key = options.source_key;
+    if (!key && (!options.frame_store_path.empty() || !options.packet_index_path.empty()))
+    {
+        computed_key = SourceKey::from_file(input);
+        key = &computed_key;
+    }
+
+    PlaybackStats stats;
+    std::unique_ptr<FrameStore> store = open_frame_store(edl, key, options);
+    PacketIndex index;
+    std::unique_ptr<FrameReader> reader;
+    if (store)
+    {
+        stats.frame_store_used = true;
+    }
+    else
+    {
+        if (options.metrics)
+        {
+            options.metrics->begin_phase("index");
+        }
+        index = load_packet_index(input, options.packet_index_path, key);
+        if (!index.has_timestamps())
+        {
+            throw decode_exception("Source has no timestamps, so can't be played out of order: " + input);
+        }
+        if (edl.get_source_end() > index.get_frame_count())
+        {
+            throw invalid_argument_exception("EDL is longer than the source");
+        }
+        DecoderOptions decoder_options;
+        decoder_options.hardware = options.hardware;
+        decoder_options.download = true;
+        decoder_options.metrics = options.metrics;
+        reader = std::make_unique<FrameReader>(input, index, options.cache_budget, decoder_options);
+    }
+
+    const int width = store ? store->get_width() : reader->get_decoder().get_width();
+    const int height = store ? store->get_height() : reader->get_decoder().get_height();
+    const int pixel_format = store ? store->get_pixel_format() : reader->get_decoder().get_pixel_format();
+    uint32_t texture_format = get_texture_format(pixel_format);
+    const bool convert = texture_format == SDL_PIXELFORMAT_UNKNOWN;
+    if (convert)
+    {
+        texture_format = SDL_PIXELFORMAT_IYUV;
+    }
+
+    /*------------------------------------------------------------------------
+     * Read upcoming frames in destination order on their own thread, as
+     * far ahead as the queue allows. A frame that failed to decode is
+     * replaced by the last good one. Formats SDL can't show are converted
+     * here, off the display thread.
+     *-----------------------------------------------------------------------*/
+    FrameQueue frames(std::max((size_t) 2, options.prefetch_frames));
+    QueueGauge frames_gauge(options.metrics, "display", [&frames]() { return frames.size(); });
+    Stage read_stage("read");
+    auto read = [&](uint32_t frame_index) -> const AVFrame * {
+        return store ? store->read(frame_index) : reader->read(frame_index);
+    };
+    auto read_frames = [&]() {
+        SwsContext *sws_context = nullptr;
+        AVFrame *converted = nullptr;
+        try
+        {
+            int64_t last = -1;
+            do
+            {
+                size_t pushed = 0;
+                for (const EditRun &run : edl.get_runs())
+                {
+                    for (uint32_t source_frame = run.source_start; source_frame < run.get_source_end(); source_frame++)
+                    {
+                        const AVFrame *frame = read(source_frame);
+                        if (frame)
+                        {
+                            last = source_frame;
+                        }
+                        else if (last >= 0)
+                        {
+                            frame = read((uint32_t) last);
+                        }
+                        if (!frame)
+                        {
+                            continue;
+                        }
+
+                        if (convert)
+                        {
+                            if (!converted)
+                            {
+                                converted = av_frame_alloc();
+                                converted->format = AV_PIX_FMT_YUV420P;
+                                converted->width = width;
+                                converted->height = height;
+                                if (av_frame_get_buffer(converted, 0) < 0)
+                                {
+                                    throw decode_exception("Couldn't allocate frame");
+                                }
+                            }
+                            sws_context = sws_getCachedContext(sws_context, frame->width, frame->height,
+                                                               (AVPixelFormat) frame->format,
+                                                               width, height, AV_PIX_FMT_YUV420P,
+                                                               SWS_BILINEAR, nullptr, nullptr, nullptr);
+                            if (!sws_context || av_frame_make_writable(converted) < 0)
+                            {
+                                throw decode_exception("Couldn't convert frame for display");
+                            }
+                            sws_scale(sws_context, frame->data, frame->linesize, 0, frame->height,
+                                      converted->data, converted->linesize);
+                            frame = converted;
+                        }
+                        if (!frames.push_reference(frame, &read_stage))
+                        {
+                            av_frame_free(&converted);
+                            sws_freeContext(sws_context);
+                            return;
+                        }
+                        read_stage.add_items(1);
+                        pushed++;
+                    }
+                }
+                if (!pushed)
+                {
+                    throw decode_exception("No frames could be decoded");
+                }
+            } while (options.loop);
+        }
+        catch (...)
+        {
+            av_frame_free(&converted);
+            sws_freeContext(sws_context);
+            throw;
+        }
+        av_frame_free(&converted);
+        sws_freeContext(sws_context);
+    };
+    StageThread read_thread(read_stage, read_frames, [&frames]() { frames.close(); });
+
+    Stage display_stage("display");
+    try
+    {
+        Display display(width, height, texture_format, options.fullscreen);
+        stats.refresh_rate = display.get_refresh_rate();
+        if (options.metrics)
+        {
+            options.metrics->begin_phase("play", options.loop || options.duration > 0.0 ? 0 : edl.get_frame_count());
+        }
+
+        /*------------------------------------------------------------------------
+         * Destination frame n is due `n * period` after the first was shown,
+         * and is uploaded at the last vsync before then (within half a
+         * refresh), so that cadence between the source and display rates
+         * stays even. After a late frame, the timeline restarts from it
+         * rather than rushing the frames behind it.
+         *-----------------------------------------------------------------------*/
+        const Clock::duration period = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>((double) frame_rate.den / frame_rate.num));
+        const Clock::duration half_refresh = stats.refresh_rate > 0
+            ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(0.5 / stats.refresh_rate))
+            : period / 2;
+
+        display_stage.start();
+        AVFrame *frame = nullptr;
+        if (!frames.pop(frame, &display_stage))
+        {
+            display_stage.stop();
+            read_thread.join();
+            throw decode_exception("No frames could be decoded");
+        }
+        display.upload(frame);
+        av_frame_free(&frame);
+        display.present();
+
+        Clock::time_point start = Clock::now();
+        Clock::time_point base = start;
+        Clock::time_point last_present = start;
+        int64_t frame_number = 1;
+        bool late = false;
+        stats.frames_shown = 1;
+        display_stage.add_items(1);
+        if (options.metrics)
+        {
+            options.metrics->add_progress();
+        }
+
+        while (display.poll())
+        {
+            Clock::time_point now = Clock::now();
+            if (options.duration > 0.0 && std::chrono::duration<double>(now - start).count() >= options.duration)
+            {
+                break;
+            }
+
+            Clock::time_point due = base + period * frame_number;
+            bool shown = false;
+            if (now + half_refresh >= due)
+            {
+                if (frames.try_pop(frame) || (frames.is_closed() && frames.try_pop(frame)))
+                {
+                    display.upload(frame);
+                    av_frame_free(&frame);
+                    shown = true;
+                }
+                else if (frames.is_closed())
+                {
+                    break;
+                }
+                else if (!late)
+                {
+                    late = true;
+                    stats.frames_late++;
+                }
+            }
+            if (!display.has_vsync())
+            {
+                std::this_thread::sleep_until(shown ? due : now + half_refresh);
+            }
+            display.present();
+
+            if (shown)
+            {
+                now = Clock::now();
+                stats.frame_times.add(std::chrono::duration<double>(now - last_present).count());
+                last_present = now;
+                if (late)
+                {
+                    base = now - period * frame_number;
+                    late = false;
+                }
+                frame_number++;
+                stats.frames_shown++;
+                display_stage.add_items(1);
+                if (options.metrics)
+                {
+                    options.metrics->add_progress();
+                }
+            }
+        }
+        display_stage.stop();
+    }
+    catch (...)
+    {
+        frames.close();
+        throw;
+    }
+
+    frames.close();
+    read_thread.join();
+    if (options.metrics)
+    {
+        options.metrics->end_phase();
+    }
+
+    stats.loops = stats.frames_shown / edl.get_frame_count();
+    if (reader)
+    {
+        stats.seeks = reader->get_seek_count();
+        stats.frames_decoded = reader->get_decode_count();
+    }
+    stats.stages = { read_stage.get_stats(), display_stage.get_stats() };
+    return stats;
+}
+
+}
@@ -0,0 +1,341 @@
+#include "lumin/read_ahead.h"
+#include "lumin/exceptions.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+namespace lumin
+{
+
+/*------------------------------------------------------------------------
+ * Buffers of evicted blocks kept for reuse, so that steady-state reading
+ * does no allocation.
+ *-----------------------------------------------------------------------*/
+static const size_t MAX_SPARE_BUFFERS = 8;
+
+ReadAheadFile::ReadAheadFile(const std::string &path, const ReadAheadOptions &options)
+    : path(path), options(options), fd(-1), size(0), block_count(0), capacity(0), prefetched_count(0),
+      stopping(false)
+{
+    if (options.block_size == 0 || options.threads <= 0)
+    {
+        throw invalid_argument_exception("Read-ahead needs a block size and at least one thread");
+    }
+
+    this->fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (this->fd < 0)
+    {
+        throw io_exception("Couldn't open " + path + ": " + strerror(errno));
+    }
+    struct stat info;
+    if (fstat(this->fd, &info) != 0)
+    {
+        std::string error = strerror(errno);
+        ::close(this->fd);
+        throw io_exception("Couldn't stat " + path + ": " + error);
+    }
+    this->size = (int64_t) info.st_size;
+    this->block_count = (this->size + (int64_t) options.block_size - 1) / (int64_t) options.block_size;
+
+    /*------------------------------------------------------------------------
+     * Always room for the block being read and those read ahead of it.
+     *-----------------------------------------------------------------------*/
+    this->capacity = std::max(options.budget / options.block_size, options.sequential_blocks + 2);
+
+    for (int thread = 0; thread < options.threads; thread++)
+    {
+        this->workers.emplace_back(&ReadAheadFile::run_worker, this);
+    }
+}
+
+ReadAheadFile::~ReadAheadFile()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->queue_changed.notify_all();
+    for (std::thread &worker : this->workers)
+    {
+        worker.join();
+    }
+    ::close(this->fd);
+}
+
+const std::string &ReadAheadFile::get_path() const
+{
+    return this->path;
+}
+
+int64_t ReadAheadFile::get_size() const
+{
+    return this->size;
+}
+
+size_t ReadAheadFile::read(int64_t offset, uint8_t *buffer, size_t size)
+{
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->stats.reads++;
+
+    bool waited = false;
+    auto wait_start = std::chrono::steady_clock::now();
+    size_t copied = 0;
+    while (copied < size && offset < this->size)
+    {
+        const int64_t index = offset / (int64_t) this->options.block_size;
+        auto it = this->blocks.find(index);
+        if (it == this->blocks.end() || it->second.state == BLOCK_QUEUED)
+        {
+            /*------------------------------------------------------------------------
+             * Read a block that no worker has started on here, rather than
+             * waiting behind the queue.
+             *-----------------------------------------------------------------------*/
+            if (it == this->blocks.end())
+            {
+                this->evict();
+                it = this->blocks.emplace(index, Block()).first;
+            }
+            if (it->second.prefetched)
+            {
+                it->second.prefetched = false;
+                this->prefetched_count--;
+            }
+            it->second.state = BLOCK_READING;
+            waited = true;
+            this->read_block(index, lock);
+            continue;
+        }
+        if (it->second.state == BLOCK_READING)
+        {
+            waited = true;
+            this->block_changed.wait(lock);
+            continue;
+        }
+
+        Block &block = it->second;
+        if (block.state == BLOCK_FAILED)
+        {
+            int error = block.error;
+            this->lru.erase(block.lru_position);
+            this->blocks.erase(it);
+            throw io_exception("Couldn't read " + this->path + ": " + strerror(error));
+        }
+        if (block.prefetched)
+        {
+            block.prefetched = false;
+            this->prefetched_count--;
+        }
+        this->lru.splice(this->lru.end(), this->lru, block.lru_position);
+
+        const size_t block_offset = (size_t) (offset - index * (int64_t) this->options.block_size);
+        if (block_offset >= block.data.size())
+        {
+            break;
+        }
+        const size_t count = std::min(size - copied, block.data.size() - block_offset);
+        memcpy(buffer + copied, block.data.data() + block_offset, count);
+        copied += count;
+        offset += (int64_t) count;
+
+        /*------------------------------------------------------------------------
+         * Queue the following blocks ahead of any prefetched ranges,
+         * nearest first.
+         *-----------------------------------------------------------------------*/
+        for (size_t ahead = this->options.sequential_blocks; ahead > 0; ahead--)
+        {
+            this->enqueue(index + (int64_t) ahead, true, false);
+        }
+    }
+
+    if (waited)
+    {
+        this->stats.waits++;
+        this->stats.wait_seconds +=
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - wait_start).count();
+    }
+    return copied;
+}
+
+bool ReadAheadFile::prefetch(int64_t start, int64_t end)
+{
+    start = std::max<int64_t>(start, 0);
+    end = std::min(end, this->size);
+    if (start >= end)
+    {
+        return true;
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    const int64_t block_size = (int64_t) this->options.block_size;
+    for (int64_t index = start / block_size; index <= (end - 1) / block_size; index++)
+    {
+        if (!this->enqueue(index, false, true))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+ReadAheadStats ReadAheadFile::get_stats() const
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->stats;
+}
+
+bool ReadAheadFile::enqueue(int64_t index, bool urgent, bool prefetched)
+{
+    if (index < 0 || index >= this->block_count)
+    {
+        return true;
+    }
+
+    auto it = this->blocks.find(index);
+    if (it != this->blocks.end())
+    {
+        if (urgent && it->second.state == BLOCK_QUEUED)
+        {
+            auto position = std::find(this->queue.begin(), this->queue.end(), index);
+            if (position != this->queue.end())
+            {
+                this->queue.erase(position);
+            }
+            this->queue.push_front(index);
+        }
+        return true;
+    }
+
+    if (prefetched && this->prefetched_count >= this->capacity / 2)
+    {
+        return false;
+    }
+    this->evict();
+    if (this->blocks.size() >= this->capacity)
+    {
+        return false;
+    }
+
+    Block &block = this->blocks[index];
+    block.prefetched = prefetched;
+    if (prefetched)
+    {
+        this->prefetched_count++;
+    }
+    if (urgent)
+    {
+        this->queue.push_front(index);
+    }
+    else
+    {
+        this->queue.push_back(index);
+    }
+    this->queue_changed.notify_one();
+    return true;
+}
+
+void ReadAheadFile::evict()
+{
+    while (this->blocks.size() >= this->capacity && !this->lru.empty())
+    {
+        auto it = this->blocks.find(this->lru.front());
+        this->lru.pop_front();
+        if (it->second.prefetched)
+        {
+            this->prefetched_count--;
+        }
+        if (this->spare_buffers.size() < MAX_SPARE_BUFFERS)
+        {
+            this->spare_buffers.push_back(std::move(it->second.data));
+        }
+        this->blocks.erase(it);
+        this->stats.evictions++;
+    }
+}
+
+void ReadAheadFile::read_block(int64_t index, std::unique_lock<std::mutex> &lock)
+{
+    std::vector<uint8_t> data;
+    if (!this->spare_buffers.empty())
+    {
+        data = std::move(this->spare_buffers.back());
+        this->spare_buffers.pop_back();
+    }
+    const int64_t start = index * (int64_t) this->options.block_size;
+    data.resize((size_t) std::min<int64_t>((int64_t) this->options.block_size, this->size - start));
+
+    /*------------------------------------------------------------------------
+     * Blocks being read are never evicted, so `block` stays valid while
+     * the lock is released.
+     *-----------------------------------------------------------------------*/
+    Block &block = this->blocks.at(index);
+    lock.unlock();
+
+    size_t filled = 0;
+    int error = 0;
+    while (filled < data.size())
+    {
+        ssize_t count = pread(this->fd, data.data() + filled, data.size() - filled, (off_t) (start + filled));
+        if (count < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            error = errno;
+            break;
+        }
+        if (count == 0)
+        {
+            break;
+        }
+        filled += (size_t) count;
+    }
+    data.resize(filled);
+
+    lock.lock();
+    if (error)
+    {
+        block.state = BLOCK_FAILED;
+        block.error = error;
+    }
+    else
+    {
+        block.state = BLOCK_READY;
+        block.data = std::move(data);
+        this->stats.blocks_read++;
+        this->stats.bytes_read += filled;
+    }
+    block.lru_position = this->lru.insert(this->lru.end(), index);
+    this->block_changed.notify_all();
+}
+
+void ReadAheadFile::run_worker()
+{
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true)
+    {
+        this->queue_changed.wait(lock, [this] { return this->stopping || !this->queue.empty(); });
+        if (this->stopping)
+        {
+            return;
+        }
+        int64_t index = this->queue.front();
+        this->queue.pop_front();
+
+        auto it = this->blocks.find(index);
+        if (it == this->blocks.end() || it->second.state != BLOCK_QUEUED)
+        {
+            continue;
+        }
+        it->second.state = BLOCK_READING;
+        this->read_block(index, lock);
+    }
+}
+
+}
@@ -0,0 +1,336 @@
+#include "lumin/remux.h"
+#include "lumin/exceptions.h"
+#include "libav.h"
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/mathematics.h>
+}
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace lumin
+{
+
+/*------------------------------------------------------------------------
+ * Decode-order position of the packet of each presentation-order frame.
+ *-----------------------------------------------------------------------*/
+static std::vector<size_t> get_decode_positions(const PacketIndex &index)
+{
+    std::vector<size_t> positions(index.get_frame_count());
+    for (size_t position = 0; position < positions.size(); position++)
+    {
+        positions[index.get_frame_index(index.get_entry(position).pts)] = position;
+    }
+    return positions;
+}
+
+/*------------------------------------------------------------------------
+ * Offset to add to the timestamps of each run. It takes the run's first
+ * frame to its destination position, and if the run's first decode
+ * timestamp would then not follow the previous run's last, moves it on
+ * just far enough; B-frame streams can need this at run boundaries.
+ * Returns false, setting `reason`, if that would take the run onto the
+ * next destination frame, or if its decode timestamps don't increase.
+ *-----------------------------------------------------------------------*/
+static bool get_run_offsets(const PacketIndex &index,
+                            const EditDecisionList &edl,
+                            const std::vector<size_t> &positions,
+                            std::vector<int64_t> &offsets,
+                            std::string &reason)
+{
+    offsets.clear();
+    if (edl.get_source_end() > positions.size())
+    {
+        reason = "EDL is longer than the source";
+        return false;
+    }
+    if (edl.get_runs().empty())
+    {
+        return true;
+    }
+
+    const AVRational time_base = { (int) index.get_time_base().num, (int) index.get_time_base().den };
+    const AVRational frame_duration = { (int) edl.get_frame_rate().den, (int) edl.get_frame_rate().num };
+    const int64_t frame_ticks = av_rescale_q(1, frame_duration, time_base);
+    const int64_t start_pts = index.get_frame_pts(0);
+    auto get_dts = [&index](size_t position) {
+        const PacketIndexEntry entry = index.get_entry(position);
+        return entry.dts == AV_NOPTS_VALUE ? entry.pts : entry.dts;
+    };
+
+    int64_t last_dts = INT64_MIN;
+    std::vector<size_t> run_positions;
+    for (const EditRun &run : edl.get_runs())
+    {
+        run_positions.assign(positions.begin() + run.source_start, positions.begin() + run.get_source_end());
+        std::sort(run_positions.begin(), run_positions.end());
+
+        int64_t offset = start_pts + av_rescale_q(run.dest_start, frame_duration, time_base) -
+                         index.get_frame_pts(run.source_start);
+        const int64_t first_dts = get_dts(run_positions.front()) + offset;
+        if (last_dts != INT64_MIN && first_dts <= last_dts)
+        {
+            const int64_t shift = last_dts + 1 - first_dts;
+            if (shift >= frame_ticks)
+            {
+                reason = "decode timestamps of run at source frame " + std::to_string(run.source_start) +
+                         " can't follow the previous run's";
+                return false;
+            }
+            offset += shift;
+        }
+        for (size_t position : run_positions)
+        {
+            const int64_t dts = get_dts(position) + offset;
+            if (dts <= last_dts)
+            {
+                reason = "decode timestamps of run at source frame " + std::to_string(run.source_start) +
+                         " don't increase";
+                return false;
+            }
+            last_dts = dts;
+        }
+        offsets.push_back(offset);
+    }
+    return true;
+}
+
+bool can_remux(const PacketIndex &index, const EditDecisionList &edl, std::string *reason)
+{
+    auto fail = [reason](const std::string &message) {
+        if (reason)
+        {
+            *reason = message;
+        }
+        return false;
+    };
+
+    if (!index.has_timestamps())
+    {
+        return fail("source has no timestamps");
+    }
+    if (!index.has_unique_timestamps())
+    {
+        return fail("source has duplicate timestamps");
+    }
+
+    const std::vector<size_t> &keyframes = index.get_keyframes();
+    std::vector<size_t> positions = get_decode_positions(index);
+    std::vector<int64_t> offsets;
+    std::string offset_reason;
+    if (!get_run_offsets(index, edl, positions, offsets, offset_reason))
+    {
+        return fail(offset_reason);
+    }
+    if (keyframes.size() == index.get_frame_count())
+    {
+        return true;
+    }
+
+    const size_t frame_count = index.get_frame_count();
+    auto is_keyframe = [&keyframes](size_t frame) {
+        return std::binary_search(keyframes.begin(), keyframes.end(), frame);
+    };
+
+    for (const EditRun &run : edl.get_runs())
+    {
+        size_t end = run.get_source_end();
+        if (!is_keyframe(run.source_start) || (end < frame_count && !is_keyframe(end)))
+        {
+            return fail("run at source frame " + std::to_string(run.source_start) +
+                        " doesn't start and end on keyframes");
+        }
+
+        /*------------------------------------------------------------------------
+         * The packets between the two keyframes in decode order must be
+         * exactly the run's frames.
+         *-----------------------------------------------------------------------*/
+        size_t first = positions[run.source_start];
+        size_t last = end < frame_count ? positions[end] : frame_count;
+        if (last < first || last - first != run.length)
+        {
+            return fail("GOP at source frame " + std::to_string(run.source_start) + " is not closed");
+        }
+        for (size_t position = first; position < last; position++)
+        {
+            size_t frame = index.get_frame_index(index.get_entry(position).pts);
+            if (frame < run.source_start || frame >= end)
+            {
+                return fail("GOP at source frame " + std::to_string(run.source_start) + " is not closed");
+            }
+        }
+    }
+
+    return true;
+}
+
+RemuxStats remux(const std::string &input,
+                 const std::string &output,
+                 const PacketIndex &index,
+                 const EditDecisionList &edl,
+                 Metrics *metrics)
+{
+    std::string reason;
+    if (!can_remux(index, edl, &reason))
+    {
+        throw invalid_argument_exception("Can't stream copy: " + reason);
+    }
+
+    AVFormatContext *input_context = nullptr;
+    int rv = avformat_open_input(&input_context, input.c_str(), nullptr, nullptr);
+    if (rv < 0)
+    {
+        throw io_exception("Couldn't open " + input + ": " + av_error_string(rv));
+    }
+    rv = avformat_find_stream_info(input_context, nullptr);
+    int stream_index = rv < 0 ? rv : av_find_best_stream(input_context, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (stream_index < 0)
+    {
+        avformat_close_input(&input_context);
+        throw decode_exception("No video stream in " + input);
+    }
+    for (unsigned int stream = 0; stream < input_context->nb_streams; stream++)
+    {
+        if ((int) stream != stream_index)
+        {
+            input_context->streams[stream]->discard = AVDISCARD_ALL;
+        }
+    }
+    AVStream *input_stream = input_context->streams[stream_index];
+
+    AVFormatContext *output_context = nullptr;
+    rv = avformat_alloc_output_context2(&output_context, nullptr, nullptr, output.c_str());
+    if (rv < 0 || !output_context)
+    {
+        avformat_close_input(&input_context);
+        throw io_exception("Couldn't create output " + output + ": " + av_error_string(rv));
+    }
+
+    auto cleanup = [&]() {
+        if (output_context->pb && !(output_context->oformat->flags & AVFMT_NOFILE))
+        {
+            avio_closep(&output_context->pb);
+        }
+        avformat_free_context(output_context);
+        avformat_close_input(&input_context);
+    };
+
+    AVStream *output_stream = avformat_new_stream(output_context, nullptr);
+    avcodec_parameters_copy(output_stream->codecpar, input_stream->codecpar);
+    output_stream->codecpar->codec_tag = 0;
+    output_stream->time_base = input_stream->time_base;
+    output_stream->avg_frame_rate = { (int) edl.get_frame_rate().num, (int) edl.get_frame_rate().den };
+
+    if (!(output_context->oformat->flags & AVFMT_NOFILE))
+    {
+        rv = avio_open(&output_context->pb, output.c_str(), AVIO_FLAG_WRITE);
+        if (rv < 0)
+        {
+            cleanup();
+            throw io_exception("Couldn't open " + output + " for writing: " + av_error_string(rv));
+        }
+    }
+    rv = avformat_write_header(output_context, nullptr);
+    if (rv < 0)
+    {
+        cleanup();
+        throw io_exception("Couldn't write header to " + output + ": " + av_error_string(rv));
+    }
+
+    /*------------------------------------------------------------------------
+     * Each run is shifted by a constant offset (see get_run_offsets()), so
+     * timing within each GOP is preserved.
+     *-----------------------------------------------------------------------*/
+    const AVRational time_base = input_stream->time_base;
+    std::vector<int64_t> offsets;
+    get_run_offsets(index, edl, get_decode_positions(index), offsets, reason);
+
+    RemuxStats stats;
+    AVPacket *packet = av_packet_alloc();
+
+    try
+    {
+        for (size_t run_index = 0; run_index < edl.get_runs().size(); run_index++)
+        {
+            const EditRun &run = edl.get_runs()[run_index];
+            rv = av_seek_frame(input_context, stream_index, index.get_frame_pts(run.source_start),
+                               AVSEEK_FLAG_BACKWARD);
+            if (rv < 0)
+            {
+                throw io_exception("Seek failed: " + av_error_string(rv));
+            }
+            stats.seeks++;
+            if (metrics)
+            {
+                metrics->add_seeks();
+            }
+
+            const int64_t offset = offsets[run_index];
+            size_t copied = 0;
+
+            while (copied < run.length && (rv = av_read_frame(input_context, packet)) >= 0)
+            {
+                if (packet->stream_index != stream_index || packet->pts == AV_NOPTS_VALUE)
+                {
+                    av_packet_unref(packet);
+                    continue;
+                }
+                size_t frame = index.get_frame_index(packet->pts);
+                if (frame < run.source_start || frame >= run.get_source_end())
+                {
+                    av_packet_unref(packet);
+                    continue;
+                }
+
+                packet->dts = (packet->dts == AV_NOPTS_VALUE ? packet->pts : packet->dts) + offset;
+                packet->pts += offset;
+
+                packet->stream_index = output_stream->index;
+                packet->pos = -1;
+                av_packet_rescale_ts(packet, time_base, output_stream->time_base);
+                int size = packet->size;
+                rv = av_interleaved_write_frame(output_context, packet);
+                if (rv < 0)
+                {
+                    throw io_exception("Write failed: " + av_error_string(rv));
+                }
+                copied++;
+                stats.packets_written++;
+                if (metrics)
+                {
+                    metrics->add_bytes_read(size);
+                    metrics->add_bytes_written(size);
+                    metrics->add_progress();
+                }
+            }
+            if (rv < 0 && rv != AVERROR_EOF)
+            {
+                throw io_exception("Read failed: " + av_error_string(rv));
+            }
+            stats.runs++;
+        }
+
+        rv = av_write_trailer(output_context);
+        if (rv < 0)
+        {
+            throw io_exception("Couldn't write trailer: " + av_error_string(rv));
+        }
+    }
+    catch (...)
+    {
+        av_packet_free(&packet);
+        cleanup();
+        throw;
+    }
+
+    av_packet_free(&packet);
+    cleanup();
+    return stats;
+}
+
+}
@@ -0,0 +1,866 @@
+#include "lumin/renderer.h"
+#include "lumin/chunks.h"
+#include "lumin/decoder.h"
+#include "lumin/exceptions.h"
+#include "lumin/frame_pool.h"
+#include "lumin/frame_reader.h"
+#include "lumin/frame_store.h"
+#include "lumin/remux.h"
+#include "lumin/scheduler.h"
+#include "frame_queue.h"
+#include "libav.h"
+
+extern "C"
+{
+#include <libavutil/frame.h>
+#include <libavutil/imgutils.h>
+}
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace lumin
+{
+
+/**------------------------------------------------------------------------
+ * Holds the decoded frames of a render pass, indexed by slot (the
+ * destination frame relative to the start of the pass).
+ *-----------------------------------------------------------------------*/
+class FrameHolder
+{
+public:
+    virtual ~FrameHolder() {}
+
+    /**------------------------------------------------------------------------
+     * Discard held frames and prepare `count` empty slots.
+     *-----------------------------------------------------------------------*/
+    virtual void reset(size_t count) = 0;
+
+    virtual void store(size_t slot, const AVFrame *frame) = 0;
+
+    /**------------------------------------------------------------------------
+     * The frame in `slot`, or nullptr if none was stored. Valid until the
+     * next call to load() or reset().
+     *-----------------------------------------------------------------------*/
+    virtual const AVFrame *load(size_t slot) = 0;
+};
+
+/**------------------------------------------------------------------------
+ * Holds references to the decoder's own frame buffers, which are later
+ * handed unchanged to the encoder: no image data is copied between
+ * decode and encode. Frame shells are reused across passes.
+ *-----------------------------------------------------------------------*/
+class ReferenceFrameHolder : public FrameHolder
+{
+public:
+    ~ReferenceFrameHolder()
+    {
+        for (AVFrame *&frame : this->frames)
+        {
+            av_frame_free(&frame);
+        }
+    }
+
+    void reset(size_t count) override
+    {
+        for (size_t slot = 0; slot < this->frames.size(); slot++)
+        {
+            av_frame_unref(this->frames[slot]);
+        }
+        while (this->frames.size() < count)
+        {
+            this->frames.push_back(av_frame_alloc());
+        }
+        this->present.assign(count, false);
+    }
+
+    void store(size_t slot, const AVFrame *frame) override
+    {
+        av_frame_unref(this->frames[slot]);
+        if (av_frame_ref(this->frames[slot], frame) < 0)
+        {
+            throw decode_exception("Couldn't reference decoded frame");
+        }
+        this->present[slot] = true;
+    }
+
+    const AVFrame *load(size_t slot) override
+    {
+        return this->present[slot] ? this->frames[slot] : nullptr;
+    }
+
+private:
+    std::vector<AVFrame *> frames;
+    std::vector<bool> present;
+};
+
+/**------------------------------------------------------------------------
+ * Copies frames into pooled buffers, so that decoder buffers are
+ * released immediately and nothing is allocated per frame.
+ *-----------------------------------------------------------------------*/
+class MemoryFrameHolder : public FrameHolder
+{
+public:
+    MemoryFrameHolder(int width, int height, int pixel_format, size_t capacity)
+        : pool(width, height, pixel_format, capacity)
+    {
+    }
+
+    ~MemoryFrameHolder()
+    {
+        this->reset(0);
+    }
+
+    void reset(size_t count) override
+    {
+        for (AVFrame *frame : this->frames)
+        {
+            if (frame)
+            {
+                this->pool.release(frame);
+            }
+        }
+        this->frames.assign(count, nullptr);
+    }
+
+    void store(size_t slot, const AVFrame *frame) override
+    {
+        AVFrame *copy = this->frames[slot] ? this->frames[slot] : this->pool.acquire();
+        if (!copy || av_frame_copy(copy, frame) < 0)
+        {
+            if (copy)
+            {
+                this->pool.release(copy);
+            }
+            this->frames[slot] = nullptr;
+            throw decode_exception("Couldn't copy decoded frame");
+        }
+        FrameCache::copy_props(copy, frame);
+        this->frames[slot] = copy;
+    }
+
+    const AVFrame *load(size_t slot) override
+    {
+        return this->frames[slot];
+    }
+
+private:
+    FramePool pool;
+    std::vector<AVFrame *> frames;
+};
+
+/**------------------------------------------------------------------------
+ * Writes frames as raw images to an unlinked temporary file, one
+ * fixed-size slot per frame.
+ *-----------------------------------------------------------------------*/
+class SpillFrameHolder : public FrameHolder
+{
+public:
+    SpillFrameHolder(const std::string &directory, int width, int height, int pixel_format)
+        : width(width), height(height), pixel_format(pixel_format), frame(av_frame_alloc())
+    {
+        this->frame_bytes = av_image_get_buffer_size((AVPixelFormat) pixel_format, width, height, 1);
+        if (this->frame_bytes <= 0)
+        {
+            throw decode_exception("Can't spill frames in this pixel format");
+        }
+        this->buffer.resize(this->frame_bytes);
+
+        std::string path_template = directory + "/lumin-spill-XXXXXX";
+        std::vector<char> path(path_template.begin(), path_template.end());
+        path.push_back('\0');
+        this->fd = mkstemp(path.data());
+        if (this->fd < 0)
+        {
+            throw io_exception("Couldn't create spill file in " + directory + ": " + strerror(errno));
+        }
+        unlink(path.data());
+    }
+
+    ~SpillFrameHolder()
+    {
+        close(this->fd);
+        av_frame_free(&this->frame);
+    }
+
+    void reset(size_t count) override
+    {
+        this->present.assign(count, false);
+    }
+
+    void store(size_t slot, const AVFrame *frame) override
+    {
+        av_image_copy_to_buffer(this->buffer.data(), this->frame_bytes, frame->data, frame->linesize,
+                                (AVPixelFormat) this->pixel_format, this->width, this->height, 1);
+        off_t offset = (off_t) slot * this->frame_bytes;
+        if (pwrite(this->fd, this->buffer.data(), this->frame_bytes, offset) != this->frame_bytes)
+        {
+            throw io_exception(std::string("Couldn't write spill file: ") + strerror(errno));
+        }
+        this->present[slot] = true;
+    }
+
+    const AVFrame *load(size_t slot) override
+    {
+        if (!this->present[slot])
+        {
+            return nullptr;
+        }
+        off_t offset = (off_t) slot * this->frame_bytes;
+        if (pread(this->fd, this->buffer.data(), this->frame_bytes, offset) != this->frame_bytes)
+        {
+            throw io_exception(std::string("Couldn't read spill file: ") + strerror(errno));
+        }
+        this->frame->format = this->pixel_format;
+        this->frame->width = this->width;
+        this->frame->height = this->height;
+        av_image_fill_arrays(this->frame->data, this->frame->linesize, this->buffer.data(),
+                             (AVPixelFormat) this->pixel_format, this->width, this->height, 1);
+        return this->frame;
+    }
+
+private:
+    int width;
+    int height;
+    int pixel_format;
+    int frame_bytes;
+    int fd;
+    AVFrame *frame;
+    std::vector<uint8_t> buffer;
+    std::vector<bool> present;
+};
+
+/**------------------------------------------------------------------------
+ * Encodes frames on its own thread, fed through a bounded queue, so that
+ * encoding overlaps decoding. Frames are queued by reference.
+ *-----------------------------------------------------------------------*/
+class EncodeStage
+{
+public:
+    using Opener = std::function<std::unique_ptr<VideoEncoder>(const AVFrame *frame)>;
+
+    /**------------------------------------------------------------------------
+     * @param open Opens the encoder. Called with nullptr up front, or if
+     *             `lazy`, with the first frame, for hardware frames whose
+     *             frames context is only known then.
+     *-----------------------------------------------------------------------*/
+    EncodeStage(Opener open, bool lazy, Metrics *metrics)
+        : open(open),
+          metrics(metrics),
+          frames_gauge(metrics, "encode", [this]() { return this->frames.size(); }),
+          stage("encode"),
+          cancelled(false)
+    {
+        if (!lazy)
+        {
+            this->encoder = this->open(nullptr);
+        }
+        this->thread = std::make_unique<StageThread>(
+            this->stage, [this]() { this->run(); }, [this]() { this->frames.close(); });
+    }
+
+    ~EncodeStage()
+    {
+        this->cancel();
+    }
+
+    /**------------------------------------------------------------------------
+     * Queue `frame` as the next output frame. Returns false if the encode
+     * thread has failed, in which case finish() rethrows its exception.
+     *-----------------------------------------------------------------------*/
+    bool write(const AVFrame *frame, Stage *producer)
+    {
+        return this->frames.push_reference(frame, producer);
+    }
+
+    /**------------------------------------------------------------------------
+     * Wait for queued frames to be encoded, and finish the output.
+     *-----------------------------------------------------------------------*/
+    void finish()
+    {
+        this->frames.close();
+        this->thread->join();
+        if (!this->encoder)
+        {
+            throw decode_exception("No frames could be decoded");
+        }
+    }
+
+    void cancel()
+    {
+        this->cancelled = true;
+        this->frames.close();
+    }
+
+    StageStats get_stats() const
+    {
+        return this->stage.get_stats();
+    }
+
+private:
+    void run()
+    {
+        AVFrame *frame;
+        while (this->frames.pop(frame, &this->stage))
+        {
+            try
+            {
+                if (!this->cancelled)
+                {
+                    if (!this->encoder)
+                    {
+                        this->encoder = this->open(frame);
+                    }
+                    this->encoder->write_frame(frame);
+                    this->stage.add_items(1);
+                    if (this->metrics)
+                    {
+                        this->metrics->add_progress();
+                    }
+                }
+            }
+            catch (...)
+            {
+                av_frame_free(&frame);
+                throw;
+            }
+            av_frame_free(&frame);
+        }
+        if (!this->cancelled && this->encoder)
+        {
+            this->encoder->finish();
+        }
+    }
+
+    Opener open;
+    Metrics *metrics;
+    std::unique_ptr<VideoEncoder> encoder;
+    FrameQueue frames;
+    QueueGauge frames_gauge;
+    Stage stage;
+    std::atomic<bool> cancelled;
+
+    /*------------------------------------------------------------------------
+     * Last, so that the thread is joined before anything it uses is
+     * destroyed.
+     *-----------------------------------------------------------------------*/
+    std::unique_ptr<StageThread> thread;
+};
+
+/*------------------------------------------------------------------------
+ * Keeps a read-ahead cache fetching the packets of the frame ranges to be
+ * decoded next, in order, as far ahead as its budget allows. Ranges that
+ * didn't fit are asked for again as decoding moves on.
+ *-----------------------------------------------------------------------*/
+class RangePrefetcher
+{
+public:
+    RangePrefetcher(ReadAheadFile *file, const PacketIndex &index, std::vector<FrameRange> ranges)
+        : file(file), index(index), ranges(std::move(ranges)), next(0)
+    {
+    }
+
+    /**------------------------------------------------------------------------
+     * Range `position` is about to be decoded.
+     *-----------------------------------------------------------------------*/
+    void advance(size_t position)
+    {
+        if (!this->file)
+        {
+            return;
+        }
+        this->next = std::max(this->next, position);
+        while (this->next < this->ranges.size())
+        {
+            const FrameRange &range = this->ranges[this->next];
+            ByteRange bytes = this->index.get_byte_range(range.start, range.end);
+            if (!this->file->prefetch(bytes.start, bytes.end))
+            {
+                break;
+            }
+            this->next++;
+        }
+    }
+
+private:
+    ReadAheadFile *file;
+    const PacketIndex &index;
+    std::vector<FrameRange> ranges;
+    size_t next;
+};
+
+/*------------------------------------------------------------------------
+ * Request frames in destination order, relying on the cache to avoid
+ * decoding each GOP more than once.
+ *-----------------------------------------------------------------------*/
+static RenderStats render_cached(const std::string &input,
+                                 const std::string &output,
+                                 const EditDecisionList &edl,
+                                 const PacketIndex &index,
+                                 const AudioSource *audio,
+                                 ReadAheadFile *read_ahead,
+                                 const RenderOptions &options)
+{
+    DecoderOptions decoder_options;
+    decoder_options.hardware = options.hardware;
+    decoder_options.download = true;
+    decoder_options.read_ahead = read_ahead;
+    decoder_options.metrics = options.metrics;
+    FrameReader reader(input, index, options.cache_budget, decoder_options);
+    VideoDecoder &decoder = reader.get_decoder();
+    EncodeStage encode(
+        [&](const AVFrame *) {
+            return std::make_unique<VideoEncoder>(output, decoder.get_width(), decoder.get_height(),
+                                                  decoder.get_pixel_format(), edl.get_frame_rate(),
+                                                  options.encoder, audio);
+        },
+        false, options.metrics);
+
+    std::vector<FrameRange> run_ranges;
+    for (const EditRun &run : edl.get_runs())
+    {
+        run_ranges.push_back({ run.source_start, run.get_source_end() });
+    }
+    RangePrefetcher prefetcher(read_ahead, index, std::move(run_ranges));
+
+    RenderStats stats;
+    stats.passes = 1;
+    Stage decode_stage("decode");
+    decode_stage.start();
+
+    /*------------------------------------------------------------------------
+     * A frame that failed to decode is replaced by the last good one,
+     * which is normally still cached.
+     *-----------------------------------------------------------------------*/
+    int64_t last = -1;
+    CacheStats reported;
+    for (size_t run_index = 0; run_index < edl.get_runs().size(); run_index++)
+    {
+        const EditRun &run = edl.get_runs()[run_index];
+        prefetcher.advance(run_index);
+        for (uint32_t source_frame = run.source_start; source_frame < run.get_source_end(); source_frame++)
+        {
+            const AVFrame *frame = reader.read(source_frame);
+            if (frame)
+            {
+                last = source_frame;
+            }
+            else if (last >= 0)
+            {
+                frame = reader.read((uint32_t) last);
+            }
+            if (options.metrics)
+            {
+                CacheStats cache = reader.get_cache_stats();
+                options.metrics->add_cache_hits(cache.hits - reported.hits);
+                options.metrics->add_cache_misses(cache.misses - reported.misses);
+                reported = cache;
+            }
+
+            if (frame)
+            {
+                if (!encode.write(frame, &decode_stage))
+                {
+                    encode.finish();
+                }
+                decode_stage.add_items(1);
+                stats.frames_written++;
+            }
+        }
+    }
+    decode_stage.stop();
+    encode.finish();
+
+    stats.stages = { decode_stage.get_stats(), encode.get_stats() };
+    stats.seeks = reader.get_seek_count();
+    stats.frames_decoded = reader.get_decode_count();
+    stats.cache = reader.get_cache_stats();
+    return stats;
+}
+
+/*------------------------------------------------------------------------
+ * Read frames by index from a raw frame store, in destination order.
+ *-----------------------------------------------------------------------*/
+static RenderStats render_stored(FrameStore &store,
+                                 const std::string &output,
+                                 const EditDecisionList &edl,
+                                 const AudioSource *audio,
+                                 const RenderOptions &options)
+{
+    EncodeStage encode(
+        [&](const AVFrame *) {
+            return std::make_unique<VideoEncoder>(output, store.get_width(), store.get_height(),
+                                                  store.get_pixel_format(), edl.get_frame_rate(),
+                                                  options.encoder, audio);
+        },
+        false, options.metrics);
+
+    RenderStats stats;
+    stats.passes = 1;
+    stats.frame_store_used = true;
+    Stage read_stage("read");
+    read_stage.start();
+
+    /*------------------------------------------------------------------------
+     * A frame that failed to decode during analysis is replaced by the
+     * last good one.
+     *-----------------------------------------------------------------------*/
+    int64_t last = -1;
+    for (const EditRun &run : edl.get_runs())
+    {
+        for (uint32_t source_frame = run.source_start; source_frame < run.get_source_end(); source_frame++)
+        {
+            const AVFrame *frame = store.read(source_frame);
+            if (frame)
+            {
+                last = source_frame;
+            }
+            else if (last >= 0)
+            {
+                frame = store.read((size_t) last);
+            }
+
+            if (frame)
+            {
+                if (!encode.write(frame, &read_stage))
+                {
+                    encode.finish();
+                }
+                read_stage.add_items(1);
+                stats.frames_written++;
+            }
+        }
+    }
+    read_stage.stop();
+    encode.finish();
+
+    stats.stages = { read_stage.get_stats(), encode.get_stats() };
+    return stats;
+}
+
+/*------------------------------------------------------------------------
+ * The frame store at options.frame_store_path, if it can stand in for
+ * decoding `input` to render `edl`.
+ *-----------------------------------------------------------------------*/
+static std::unique_ptr<FrameStore> open_frame_store(const EditDecisionList &edl,
+                                                    const SourceKey *key,
+                                                    const RenderOptions &options)
+{
+    if (options.frame_store_path.empty() || options.cuda)
+    {
+        return nullptr;
+    }
+    std::unique_ptr<FrameStore> store = FrameStore::open(options.frame_store_path);
+    if (!store || !store->matches(*key) || store->get_frame_count() < edl.get_source_end())
+    {
+        return nullptr;
+    }
+    return store;
+}
+
+static RenderStats render_source(const std::string &input,
+                                 const std::string &output,
+                                 const EditDecisionList &edl,
+                                 const RenderOptions &options)
+{
+    /*------------------------------------------------------------------------
+     * Identify the source once, for both the frame store and the packet
+     * index file. With a frame store, the packet index is only needed to
+     * stream copy.
+     *-----------------------------------------------------------------------*/
+    SourceKey computed_key;
+    const SourceKey *key = options.source_key;
+    if (!key && (!options.frame_store_path.empty() || (!options.packet_index && !options.packet_index_path.empty())))
+    {
+        computed_key = SourceKey::from_file(input);
+        key = &computed_key;
+    }
+    std::unique_ptr<FrameStore> store = open_frame_store(edl, key, options);
+    PacketIndex built_index;
+    if (!options.packet_index && (!store || options.stream_copy))
+    {
+        if (options.metrics)
+        {
+            options.metrics->begin_phase("index");
+        }
+        built_index = load_packet_index(input, options.packet_index_path, key);
+    }
+    const PacketIndex &index = options.packet_index ? *options.packet_index : built_index;
+    if (!store)
+    {
+        if (!index.has_timestamps())
+        {
+            throw decode_exception("Source has no timestamps, so can't be rendered out of order: " + input);
+        }
+        if (edl.get_source_end() > index.get_frame_count())
+        {
+            throw invalid_argument_exception("EDL is longer than the source");
+        }
+    }
+    if (options.stream_copy && index.has_timestamps() && edl.get_source_end() <= index.get_frame_count() &&
+        can_remux(index, edl))
+    {
+        if (options.metrics)
+        {
+            options.metrics->begin_phase("render", edl.get_frame_count());
+        }
+        RemuxStats remux_stats = remux(input, output, index, edl, options.metrics);
+        RenderStats stats;
+        stats.passes = 1;
+        stats.seeks = remux_stats.seeks;
+        stats.frames_written = remux_stats.packets_written;
+        stats.stream_copied = true;
+        return stats;
+    }
+
+    /*------------------------------------------------------------------------
+     * The soundtrack is decoded to a temporary file before any video is
+     * decoded, and reordered run by run as the encoder reads it.
+     *-----------------------------------------------------------------------*/
+    std::unique_ptr<AudioFile> source_audio;
+    std::unique_ptr<RemappedAudio> audio;
+    if (options.audio)
+    {
+        if (options.metrics)
+        {
+            options.metrics->begin_phase("audio");
+        }
+        source_audio = decode_audio(input, options.spill_directory);
+        if (source_audio)
+        {
+            audio = std::make_unique<RemappedAudio>(*source_audio, edl, options.crossfade);
+        }
+    }
+
+    if (options.metrics)
+    {
+        options.metrics->begin_phase("render", edl.get_frame_count());
+    }
+    if (store)
+    {
+        return render_stored(*store, output, edl, audio.get(), options);
+    }
+    if (options.mode == RENDER_CACHED && options.cuda)
+    {
+        throw invalid_argument_exception("CUDA rendering needs a render schedule, not a frame cache");
+    }
+
+    std::unique_ptr<ReadAheadFile> owned_read_ahead;
+    ReadAheadFile *read_ahead = options.read_ahead_file;
+    if (!read_ahead && options.read_ahead)
+    {
+        ReadAheadOptions read_ahead_options;
+        read_ahead_options.budget = options.read_ahead;
+        owned_read_ahead = std::make_unique<ReadAheadFile>(input, read_ahead_options);
+        read_ahead = owned_read_ahead.get();
+    }
+    if (options.mode == RENDER_CACHED)
+    {
+        RenderStats stats = render_cached(input, output, edl, index, audio.get(), read_ahead, options);
+        if (owned_read_ahead)
+        {
+            stats.read_ahead = owned_read_ahead->get_stats();
+        }
+        return stats;
+    }
+
+    DecoderOptions decoder_options;
+    decoder_options.hardware = options.cuda ? HARDWARE_DECODE_CUDA : options.hardware;
+    decoder_options.download = !options.cuda;
+    decoder_options.read_ahead = read_ahead;
+    decoder_options.metrics = options.metrics;
+    std::unique_ptr<VideoDecoder> decoder = std::make_unique<VideoDecoder>(input, decoder_options);
+    const int width = decoder->get_width();
+    const int height = decoder->get_height();
+    const int pixel_format = decoder->get_pixel_format();
+
+    const size_t frame_bytes = FramePool::get_frame_bytes(width, height, pixel_format);
+    const size_t frame_count = edl.get_frame_count();
+    size_t frames_per_pass = std::max<size_t>(1, options.memory_budget / frame_bytes);
+    std::unique_ptr<FrameHolder> holder;
+    if (options.cuda)
+    {
+        /*------------------------------------------------------------------------
+         * Decoded frames stay on the GPU, held by reference, so the
+         * decoder needs a surface for every frame of a pass.
+         *-----------------------------------------------------------------------*/
+        decoder->set_extra_hw_frames((int) std::min(frames_per_pass, frame_count));
+        holder = std::make_unique<ReferenceFrameHolder>();
+    }
+    else if (frames_per_pass < frame_count && !options.spill_directory.empty())
+    {
+        holder = std::make_unique<SpillFrameHolder>(options.spill_directory, width, height, pixel_format);
+        frames_per_pass = frame_count;
+    }
+    else if (options.zero_copy)
+    {
+        holder = std::make_unique<ReferenceFrameHolder>();
+    }
+    else
+    {
+        holder = std::make_unique<MemoryFrameHolder>(width, height, pixel_format,
+                                                     std::min(frames_per_pass, frame_count));
+    }
+
+    RenderSchedule schedule = schedule_render(edl, index.get_keyframes(), std::max<size_t>(1, frames_per_pass));
+
+    /*------------------------------------------------------------------------
+     * Destination frame of each source frame shown. The EDL may show only
+     * some of the source frames, as a chunk of a larger render does.
+     *-----------------------------------------------------------------------*/
+    std::vector<uint32_t> dest_frames(edl.get_source_end());
+    for (const EditRun &run : edl.get_runs())
+    {
+        for (uint32_t offset = 0; offset < run.length; offset++)
+        {
+            dest_frames[run.source_start + offset] = run.dest_start + offset;
+        }
+    }
+
+    /*------------------------------------------------------------------------
+     * Hardware frames can only be encoded once their frames context
+     * exists, so in CUDA mode the encoder is opened at the first frame.
+     *-----------------------------------------------------------------------*/
+    EncodeStage encode(
+        [&](const AVFrame *frame) {
+            return std::make_unique<VideoEncoder>(output, width, height, frame ? frame->format : pixel_format,
+                                                  edl.get_frame_rate(), options.encoder, audio.get(),
+                                                  frame ? frame->hw_frames_ctx : nullptr);
+        },
+        options.cuda, options.metrics);
+
+    /*------------------------------------------------------------------------
+     * Spans of every pass in decode order, to fetch ahead of the decoder.
+     *-----------------------------------------------------------------------*/
+    std::vector<FrameRange> span_ranges;
+    for (const RenderPass &pass : schedule.passes)
+    {
+        for (const DecodeSpan &span : pass.spans)
+        {
+            span_ranges.push_back({ span.start, span.end });
+        }
+    }
+    RangePrefetcher prefetcher(read_ahead, index, std::move(span_ranges));
+
+    RenderStats stats;
+    stats.passes = schedule.passes.size();
+    Stage decode_stage("decode");
+    decode_stage.start();
+
+    /*------------------------------------------------------------------------
+     * A frame that failed to decode is replaced by the previous one, to
+     * keep the output timeline intact. The last good frame of each pass
+     * is kept by reference, as the holder drops it for the next pass.
+     *-----------------------------------------------------------------------*/
+    GapFiller gaps;
+    ReferenceFrameHolder carried;
+    carried.reset(1);
+    const AVFrame *last = nullptr;
+
+    size_t span_index = 0;
+    for (const RenderPass &pass : schedule.passes)
+    {
+        holder->reset(pass.dest_range.size());
+
+        for (const DecodeSpan &span : pass.spans)
+        {
+            prefetcher.advance(span_index++);
+            if (span.seek)
+            {
+                decoder->seek(index.get_frame_pts(span.start));
+                stats.seeks++;
+            }
+
+            size_t next = span.start;
+            while (next < span.end)
+            {
+                AVFrame *frame = decoder->read_frame();
+                if (!frame)
+                {
+                    break;
+                }
+                stats.frames_decoded++;
+
+                int64_t timestamp = decoder->get_timestamp(frame);
+                if (timestamp == AV_NOPTS_VALUE)
+                {
+                    continue;
+                }
+                size_t source_frame = index.get_frame_index(timestamp);
+                if (source_frame < span.start)
+                {
+                    continue;
+                }
+                if (source_frame >= span.end)
+                {
+                    break;
+                }
+
+                holder->store(dest_frames[source_frame] - pass.dest_range.start, frame);
+                next = source_frame + 1;
+            }
+        }
+
+        for (size_t slot = 0; slot < pass.dest_range.size(); slot++)
+        {
+            const AVFrame *frame = holder->load(slot);
+            const size_t count = gaps.next(frame != nullptr);
+            if (frame)
+            {
+                last = frame;
+            }
+            for (size_t copy = 0; copy < count; copy++)
+            {
+                if (!encode.write(last, &decode_stage))
+                {
+                    encode.finish();
+                }
+                decode_stage.add_items(1);
+                stats.frames_written++;
+            }
+        }
+        if (last && last != carried.load(0))
+        {
+            carried.store(0, last);
+            last = carried.load(0);
+        }
+    }
+    decode_stage.stop();
+    encode.finish();
+
+    stats.stages = { decode_stage.get_stats(), encode.get_stats() };
+    if (owned_read_ahead)
+    {
+        stats.read_ahead = owned_read_ahead->get_stats();
+    }
+    return stats;
+}
+
+RenderStats render(const std::string &input,
+                   const std::string &output,
+                   const EditDecisionList &edl,
+                   const RenderOptions &options)
+{
+    if (options.chunk_frames)
+    {
+        return render_chunked(input, output, edl, options);
+    }
+    if (!options.metrics)
+    {
+        return render_source(input, output, edl, options);
+    }
+    RenderOptions metered = options;
+    metered.encoder.metrics = options.metrics;
+    RenderStats stats = render_source(input, output, edl, metered);
+    options.metrics->end_phase();
+    return stats;
+}
+
+}
@@ -0,0 +1,166 @@
+#include "lumin/reorder.h"
+#include "lumin/exceptions.h"
+
+#include <algorithm>
+
+namespace lumin
+{
+
+size_t ReorderResult::get_changed_frame_count() const
+{
+    size_t count = 0;
+    for (const FrameRange &range : this->changed_ranges)
+    {
+        count += range.size();
+    }
+    return count;
+}
+
+/*------------------------------------------------------------------------
+ * A maximal span of the previous permutation with equal previous keys.
+ *-----------------------------------------------------------------------*/
+class Bucket
+{
+public:
+    size_t start;
+    size_t end;
+};
+
+/*------------------------------------------------------------------------
+ * Frames of `previous`, an order of `values` by `previous_options`,
+ * reordered by `options`. Neither options constrain runs.
+ *-----------------------------------------------------------------------*/
+static std::vector<uint32_t> reorder_buckets(const std::vector<double> &values,
+                                             const Permutation &previous,
+                                             const OrderOptions &previous_options,
+                                             const OrderOptions &options)
+{
+    const std::vector<uint32_t> &source_frames = previous.get_source_frames();
+    const OrderKey get_previous_key(previous_options);
+    const OrderKey get_key(options);
+
+    std::vector<Bucket> buckets;
+    for (size_t dest_frame = 0; dest_frame < source_frames.size(); dest_frame++)
+    {
+        int64_t key = get_previous_key(values[source_frames[dest_frame]]);
+        if (dest_frame > 0)
+        {
+            int64_t last_key = get_previous_key(values[source_frames[dest_frame - 1]]);
+            if (key < last_key || (key == last_key && source_frames[dest_frame] < source_frames[dest_frame - 1]))
+            {
+                throw invalid_argument_exception("Permutation is not ordered by the previous options");
+            }
+            if (key == last_key)
+            {
+                buckets.back().end++;
+                continue;
+            }
+        }
+        buckets.push_back({ dest_frame, dest_frame + 1 });
+    }
+
+    if (options.reverse != previous_options.reverse)
+    {
+        std::reverse(buckets.begin(), buckets.end());
+    }
+
+    /*------------------------------------------------------------------------
+     * Frames are in order if sorted by new key, then by source frame.
+     *-----------------------------------------------------------------------*/
+    auto precedes = [&values, &get_key](uint32_t a, uint32_t b) {
+        int64_t key_a = get_key(values[a]);
+        int64_t key_b = get_key(values[b]);
+        return key_a != key_b ? key_a < key_b : a < b;
+    };
+
+    std::vector<uint32_t> result;
+    result.reserve(source_frames.size());
+    for (const Bucket &bucket : buckets)
+    {
+        size_t start = result.size();
+        result.insert(result.end(), source_frames.begin() + bucket.start, source_frames.begin() + bucket.end);
+        if (!std::is_sorted(result.begin() + start, result.end(), precedes))
+        {
+            std::sort(result.begin() + start, result.end(), precedes);
+        }
+
+        /*------------------------------------------------------------------------
+         * If the bucket's first frame belongs before the end of what has
+         * been placed so far, merge it back into just the overlap.
+         *-----------------------------------------------------------------------*/
+        if (start > 0 && precedes(result[start], result[start - 1]))
+        {
+            auto first = std::upper_bound(result.begin(), result.begin() + start, result[start], precedes);
+            std::inplace_merge(first, result.begin() + start, result.end(), precedes);
+        }
+    }
+
+    return result;
+}
+
+ReorderResult reorder(const LuminanceSeries &series,
+                      const Permutation &previous,
+                      const OrderOptions &previous_options,
+                      const OrderOptions &options)
+{
+    const std::vector<double> &values = series.get_values();
+    if (previous.size() != values.size())
+    {
+        throw invalid_argument_exception("Permutation and series differ in length");
+    }
+
+    /*------------------------------------------------------------------------
+     * Constrained orders place runs rather than frames, so their buckets
+     * aren't spans of equal frame keys: order from scratch, and only
+     * compare the runs.
+     *-----------------------------------------------------------------------*/
+    ReorderResult reordered;
+    if (previous_options.constrains_runs() || options.constrains_runs())
+    {
+        reordered.permutation = order(series, options);
+    }
+    else
+    {
+        reordered.permutation = Permutation(previous.get_frame_rate(),
+                                            reorder_buckets(values, previous, previous_options, options));
+    }
+    reordered.edl = EditDecisionList::from_permutation(reordered.permutation);
+
+    /*------------------------------------------------------------------------
+     * A run is unchanged if the previous EDL has a run with the same
+     * source frames at the same destination. Runs of both EDLs are in
+     * destination order, so walk them together.
+     *-----------------------------------------------------------------------*/
+    const std::vector<EditRun> previous_runs = EditDecisionList::from_permutation(previous).get_runs();
+    size_t previous_index = 0;
+    const std::vector<EditRun> &runs = reordered.edl.get_runs();
+    for (size_t index = 0; index < runs.size(); index++)
+    {
+        const EditRun &run = runs[index];
+        while (previous_index < previous_runs.size() && previous_runs[previous_index].dest_start < run.dest_start)
+        {
+            previous_index++;
+        }
+        if (previous_index < previous_runs.size() &&
+            previous_runs[previous_index].dest_start == run.dest_start &&
+            previous_runs[previous_index].source_start == run.source_start &&
+            previous_runs[previous_index].length == run.length)
+        {
+            continue;
+        }
+
+        reordered.changed_runs.push_back(index);
+        if (!reordered.changed_ranges.empty() && reordered.changed_ranges.back().end == run.dest_start)
+        {
+            reordered.changed_ranges.back().end = run.get_dest_end();
+        }
+        else
+        {
+            reordered.changed_ranges.push_back({ run.dest_start, run.get_dest_end() });
+        }
+    }
+
+    return reordered;
+}
+
+}
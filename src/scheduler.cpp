@@ -0,0 +1,134 @@
+#include "lumin/scheduler.h"
+#include "lumin/exceptions.h"
+
+#include <algorithm>
+
+namespace lumin
+{
+
+size_t RenderSchedule::get_seek_count() const
+{
+    size_t count = 0;
+    for (const RenderPass &pass : this->passes)
+    {
+        for (const DecodeSpan &span : pass.spans)
+        {
+            count += span.seek ? 1 : 0;
+        }
+    }
+    return count;
+}
+
+size_t RenderSchedule::get_decode_count() const
+{
+    size_t count = 0;
+    for (const std::vector<size_t> &costs : this->decode_costs)
+    {
+        for (size_t cost : costs)
+        {
+            count += cost;
+        }
+    }
+    return count;
+}
+
+/*------------------------------------------------------------------------
+ * Last keyframe at or before `frame`, or 0 if there is none.
+ *-----------------------------------------------------------------------*/
+static size_t get_keyframe_before(const std::vector<size_t> &keyframes, size_t frame)
+{
+    auto it = std::upper_bound(keyframes.begin(), keyframes.end(), frame);
+    return it == keyframes.begin() ? 0 : *(it - 1);
+}
+
+RenderSchedule schedule_render(const EditDecisionList &edl,
+                               const std::vector<size_t> &keyframes,
+                               size_t frames_per_pass)
+{
+    if (frames_per_pass == 0)
+    {
+        throw invalid_argument_exception("Render pass must hold at least one frame");
+    }
+
+    RenderSchedule schedule;
+    const std::vector<EditRun> &runs = edl.get_runs();
+    const size_t frame_count = edl.get_frame_count();
+
+    /*------------------------------------------------------------------------
+     * The decoder starts positioned at frame 0. Each pass starts with a
+     * seek unless its first span happens to begin at the current position.
+     *-----------------------------------------------------------------------*/
+    size_t position = 0;
+    size_t run_index = 0;
+
+    for (size_t dest_start = 0; dest_start < frame_count; dest_start += frames_per_pass)
+    {
+        size_t dest_end = std::min(frame_count, dest_start + frames_per_pass);
+        RenderPass pass;
+        pass.dest_range = { dest_start, dest_end };
+
+        /*------------------------------------------------------------------------
+         * Clip the runs overlapping this window to its bounds.
+         *-----------------------------------------------------------------------*/
+        std::vector<DecodeSpan> spans;
+        for (; run_index < runs.size() && runs[run_index].dest_start < dest_end; run_index++)
+        {
+            const EditRun &run = runs[run_index];
+            size_t start = std::max<size_t>(run.dest_start, dest_start);
+            size_t end = std::min<size_t>(run.get_dest_end(), dest_end);
+            uint32_t source_start = run.source_start + (uint32_t) (start - run.dest_start);
+            spans.push_back({ source_start, source_start + (uint32_t) (end - start), false });
+
+            if (run.get_dest_end() > dest_end)
+            {
+                break;
+            }
+        }
+
+        std::sort(spans.begin(), spans.end(),
+                  [](const DecodeSpan &a, const DecodeSpan &b) { return a.start < b.start; });
+
+        std::vector<size_t> costs;
+        for (const DecodeSpan &span : spans)
+        {
+            if (!pass.spans.empty() && pass.spans.back().end == span.start)
+            {
+                pass.spans.back().end = span.end;
+                costs.back() += span.end - span.start;
+                position = span.end;
+                continue;
+            }
+
+            size_t keyframe = get_keyframe_before(keyframes, span.start);
+            bool seek = position > span.start || keyframe > position;
+            costs.push_back(span.end - (seek ? keyframe : position));
+            pass.spans.push_back({ span.start, span.end, seek });
+            position = span.end;
+        }
+
+        schedule.passes.push_back(std::move(pass));
+        schedule.decode_costs.push_back(std::move(costs));
+    }
+
+    return schedule;
+}
+
+GapFiller::GapFiller()
+    : started(false), missing(0)
+{
+}
+
+size_t GapFiller::next(bool present)
+{
+    if (!this->started && !present)
+    {
+        this->missing++;
+        return 0;
+    }
+    this->started = true;
+    const size_t count = this->missing + 1;
+    this->missing = 0;
+    return count;
+}
+
+}
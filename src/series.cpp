@@ -0,0 +1,61 @@
+#include "lumin/series.h"
+#include "lumin/exceptions.h"
+
+namespace lumin
+{
+
+LuminanceSeries::LuminanceSeries()
+{
+}
+
+LuminanceSeries::LuminanceSeries(Rational frame_rate, std::vector<double> values)
+    : frame_rate(frame_rate), values(std::move(values))
+{
+    if (!frame_rate.is_valid())
+    {
+        throw invalid_argument_exception("Frame rate must be positive");
+    }
+}
+
+Rational LuminanceSeries::get_frame_rate() const
+{
+    return this->frame_rate;
+}
+
+size_t LuminanceSeries::size() const
+{
+    return this->values.size();
+}
+
+double LuminanceSeries::get_offset(size_t index) const
+{
+    return (double) ((int64_t) index * this->frame_rate.den) / this->frame_rate.num;
+}
+
+double LuminanceSeries::get_value(size_t index) const
+{
+    return this->values.at(index);
+}
+
+std::vector<std::pair<double, double>> LuminanceSeries::get_pairs() const
+{
+    std::vector<std::pair<double, double>> pairs;
+    pairs.reserve(this->values.size());
+    for (size_t index = 0; index < this->values.size(); index++)
+    {
+        pairs.emplace_back(this->get_offset(index), this->values[index]);
+    }
+    return pairs;
+}
+
+void LuminanceSeries::append(double value)
+{
+    this->values.push_back(value);
+}
+
+const std::vector<double> &LuminanceSeries::get_values() const
+{
+    return this->values;
+}
+
+}
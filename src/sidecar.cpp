@@ -0,0 +1,442 @@
+#include "lumin/sidecar.h"
+#include "lumin/exceptions.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace lumin
+{
+
+static const char SIDECAR_MAGIC[8] = { 'L', 'U', 'M', 'I', 'N', 'I', 'D', 'X' };
+static const char PACKET_INDEX_MAGIC[8] = { 'L', 'U', 'M', 'I', 'N', 'P', 'K', 'T' };
+static const uint64_t SIDECAR_ALIGNMENT = 4096;
+static const size_t HASH_BLOCK_SIZE = 1 << 20;
+
+/*------------------------------------------------------------------------
+ * 64-bit FNV-1a.
+ *-----------------------------------------------------------------------*/
+static uint64_t fnv1a(const uint8_t *data, size_t size, uint64_t hash)
+{
+    for (size_t index = 0; index < size; index++)
+    {
+        hash ^= data[index];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static std::string errno_string()
+{
+    return std::string(strerror(errno));
+}
+
+/*------------------------------------------------------------------------
+ * Write `blocks` to a temporary path and rename it into place, so that
+ * readers never see a partial file.
+ *-----------------------------------------------------------------------*/
+static void write_file_atomically(const std::string &path, const std::vector<std::pair<const void *, size_t>> &blocks)
+{
+    std::string temp_path = path + ".tmp." + std::to_string(getpid());
+    FILE *file = fopen(temp_path.c_str(), "wb");
+    if (!file)
+    {
+        throw io_exception("Couldn't write " + temp_path + ": " + errno_string());
+    }
+
+    bool ok = true;
+    for (const std::pair<const void *, size_t> &block : blocks)
+    {
+        ok = ok && fwrite(block.first, 1, block.second, file) == block.second;
+    }
+    ok = (fclose(file) == 0) && ok;
+
+    if (!ok || rename(temp_path.c_str(), path.c_str()) != 0)
+    {
+        std::string error = errno_string();
+        unlink(temp_path.c_str());
+        throw io_exception("Couldn't write " + path + ": " + error);
+    }
+}
+
+/*------------------------------------------------------------------------
+ * Map the whole of the file at `path` read-only, if it is at least
+ * `min_size` bytes. Returns nullptr otherwise.
+ *-----------------------------------------------------------------------*/
+static void *map_file(const std::string &path, size_t min_size, size_t &size)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t) info.st_size < min_size)
+    {
+        ::close(fd);
+        return nullptr;
+    }
+
+    size = (size_t) info.st_size;
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    return mapping == MAP_FAILED ? nullptr : mapping;
+}
+
+SourceKey SourceKey::from_file(const std::string &path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw io_exception("Couldn't open " + path + ": " + errno_string());
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        ::close(fd);
+        throw io_exception("Couldn't stat " + path + ": " + errno_string());
+    }
+
+    SourceKey key;
+    char resolved[PATH_MAX];
+    key.path = realpath(path.c_str(), resolved) ? std::string(resolved) : path;
+    key.size = (uint64_t) info.st_size;
+    key.mtime_ns = (int64_t) info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+
+    /*------------------------------------------------------------------------
+     * Hash the size plus a block from the start, middle and end.
+     *-----------------------------------------------------------------------*/
+    uint64_t hash = fnv1a((const uint8_t *) &key.size, sizeof(key.size), 0xcbf29ce484222325ULL);
+    std::vector<uint8_t> block(HASH_BLOCK_SIZE);
+    uint64_t offsets[3] = { 0, key.size / 2, key.size > HASH_BLOCK_SIZE ? key.size - HASH_BLOCK_SIZE : 0 };
+    for (uint64_t offset : offsets)
+    {
+        ssize_t bytes = pread(fd, block.data(), block.size(), (off_t) offset);
+        if (bytes < 0)
+        {
+            ::close(fd);
+            throw io_exception("Couldn't read " + path + ": " + errno_string());
+        }
+        hash = fnv1a(block.data(), (size_t) bytes, hash);
+    }
+    ::close(fd);
+
+    key.content_hash = hash;
+    return key;
+}
+
+bool SourceKey::operator==(const SourceKey &other) const
+{
+    return this->path == other.path && this->size == other.size && this->mtime_ns == other.mtime_ns &&
+           this->content_hash == other.content_hash;
+}
+
+bool SourceKey::operator!=(const SourceKey &other) const
+{
+    return !(*this == other);
+}
+
+LuminanceIndex::LuminanceIndex(void *mapping, size_t mapping_size)
+    : mapping(mapping), mapping_size(mapping_size), header((const SidecarHeader *) mapping)
+{
+}
+
+LuminanceIndex::~LuminanceIndex()
+{
+    munmap(this->mapping, this->mapping_size);
+}
+
+std::unique_ptr<LuminanceIndex> LuminanceIndex::open(const std::string &path)
+{
+    size_t size = 0;
+    void *mapping = map_file(path, sizeof(SidecarHeader), size);
+    if (!mapping)
+    {
+        return nullptr;
+    }
+
+    /*------------------------------------------------------------------------
+     * Sizes are checked by division, so that no header can overflow the
+     * bounds into passing; with 32-bit counts, the products can't.
+     *-----------------------------------------------------------------------*/
+    const SidecarHeader *header = (const SidecarHeader *) mapping;
+    bool valid = memcmp(header->magic, SIDECAR_MAGIC, sizeof(SIDECAR_MAGIC)) == 0 &&
+                 header->version == VERSION &&
+                 Rational(header->frame_rate_num, header->frame_rate_den).is_valid() &&
+                 header->data_offset % SIDECAR_ALIGNMENT == 0 &&
+                 header->column_count > 0 &&
+                 sizeof(SidecarHeader) + header->path_length +
+                         (uint64_t) header->column_count * COLUMN_NAME_SIZE <= header->data_offset &&
+                 header->data_offset <= size &&
+                 header->frame_count <= (size - header->data_offset) / (header->column_count * sizeof(double));
+    if (!valid)
+    {
+        munmap(mapping, size);
+        return nullptr;
+    }
+
+    return std::unique_ptr<LuminanceIndex>(new LuminanceIndex(mapping, size));
+}
+
+void LuminanceIndex::write(const std::string &path,
+                           const SourceKey &key,
+                           const std::vector<std::string> &names,
+                           const std::vector<LuminanceSeries> &columns,
+                           uint32_t flags)
+{
+    if (columns.empty() || names.size() != columns.size())
+    {
+        throw invalid_argument_exception("Index needs one name per column");
+    }
+    for (size_t column = 0; column < columns.size(); column++)
+    {
+        if (names[column].empty() || names[column].size() >= COLUMN_NAME_SIZE)
+        {
+            throw invalid_argument_exception("Invalid index column name: " + names[column]);
+        }
+        if (columns[column].size() != columns[0].size() ||
+            columns[column].get_frame_rate() != columns[0].get_frame_rate())
+        {
+            throw invalid_argument_exception("Index columns differ in length or frame rate");
+        }
+    }
+
+    SidecarHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SIDECAR_MAGIC, sizeof(SIDECAR_MAGIC));
+    header.version = VERSION;
+    header.flags = flags;
+    header.frame_count = columns[0].size();
+    header.frame_rate_num = columns[0].get_frame_rate().num;
+    header.frame_rate_den = columns[0].get_frame_rate().den;
+    header.column_count = (uint32_t) columns.size();
+    header.path_length = (uint32_t) key.path.size();
+    header.source_size = key.size;
+    header.source_mtime_ns = key.mtime_ns;
+    header.content_hash = key.content_hash;
+
+    uint64_t prefix = sizeof(header) + key.path.size() + columns.size() * COLUMN_NAME_SIZE;
+    header.data_offset = (prefix + SIDECAR_ALIGNMENT - 1) / SIDECAR_ALIGNMENT * SIDECAR_ALIGNMENT;
+
+    std::vector<uint8_t> preamble(header.data_offset, 0);
+    memcpy(preamble.data(), &header, sizeof(header));
+    memcpy(preamble.data() + sizeof(header), key.path.data(), key.path.size());
+    for (size_t column = 0; column < names.size(); column++)
+    {
+        memcpy(preamble.data() + sizeof(header) + key.path.size() + column * COLUMN_NAME_SIZE,
+               names[column].data(), names[column].size());
+    }
+
+    std::vector<std::pair<const void *, size_t>> blocks = { { preamble.data(), preamble.size() } };
+    for (const LuminanceSeries &series : columns)
+    {
+        const std::vector<double> &values = series.get_values();
+        blocks.push_back({ values.data(), values.size() * sizeof(double) });
+    }
+    write_file_atomically(path, blocks);
+}
+
+std::string LuminanceIndex::get_default_path(const std::string &source_path)
+{
+    return source_path + ".lumin";
+}
+
+bool LuminanceIndex::matches(const SourceKey &key) const
+{
+    return this->get_source_key() == key;
+}
+
+SourceKey LuminanceIndex::get_source_key() const
+{
+    SourceKey key;
+    key.path = std::string((const char *) this->mapping + sizeof(SidecarHeader), this->header->path_length);
+    key.size = this->header->source_size;
+    key.mtime_ns = this->header->source_mtime_ns;
+    key.content_hash = this->header->content_hash;
+    return key;
+}
+
+uint32_t LuminanceIndex::get_flags() const
+{
+    return this->header->flags;
+}
+
+Rational LuminanceIndex::get_frame_rate() const
+{
+    return Rational(this->header->frame_rate_num, this->header->frame_rate_den);
+}
+
+size_t LuminanceIndex::get_frame_count() const
+{
+    return (size_t) this->header->frame_count;
+}
+
+size_t LuminanceIndex::get_column_count() const
+{
+    return this->header->column_count;
+}
+
+std::string LuminanceIndex::get_column_name(size_t column) const
+{
+    const char *name = (const char *) this->mapping + sizeof(SidecarHeader) + this->header->path_length +
+                       column * COLUMN_NAME_SIZE;
+    return std::string(name, strnlen(name, COLUMN_NAME_SIZE));
+}
+
+int LuminanceIndex::find_column(const std::string &name) const
+{
+    for (size_t column = 0; column < this->get_column_count(); column++)
+    {
+        if (this->get_column_name(column) == name)
+        {
+            return (int) column;
+        }
+    }
+    return -1;
+}
+
+const double *LuminanceIndex::get_values(size_t column) const
+{
+    return (const double *) ((const uint8_t *) this->mapping + this->header->data_offset) +
+           column * this->header->frame_count;
+}
+
+LuminanceSeries LuminanceIndex::to_series(size_t column, size_t frame_count) const
+{
+    if (frame_count > this->get_frame_count())
+    {
+        frame_count = this->get_frame_count();
+    }
+    const double *values = this->get_values(column);
+    return LuminanceSeries(this->get_frame_rate(), std::vector<double>(values, values + frame_count));
+}
+
+/*------------------------------------------------------------------------
+ * The records of a packet index file, read in place from its mapping,
+ * which is held until the last index sharing it is gone.
+ *-----------------------------------------------------------------------*/
+class MappedPacketTable : public PacketTable
+{
+public:
+    MappedPacketTable(void *mapping, size_t mapping_size, const PacketIndexRecord *records, size_t count)
+        : mapping(mapping), mapping_size(mapping_size), records(records), count(count)
+    {
+    }
+
+    ~MappedPacketTable()
+    {
+        munmap(this->mapping, this->mapping_size);
+    }
+
+    size_t size() const override
+    {
+        return this->count;
+    }
+
+    PacketIndexEntry get(size_t position) const override
+    {
+        const PacketIndexRecord &record = this->records[position];
+        return { record.pts, record.dts, record.pos, record.size,
+                 (record.flags & PacketIndexFile::RECORD_KEYFRAME) != 0 };
+    }
+
+private:
+    void *mapping;
+    size_t mapping_size;
+    const PacketIndexRecord *records;
+    size_t count;
+};
+
+bool PacketIndexFile::read(const std::string &path, const SourceKey &key, PacketIndex &index)
+{
+    size_t size = 0;
+    void *mapping = map_file(path, sizeof(PacketIndexHeader), size);
+    if (!mapping)
+    {
+        return false;
+    }
+
+    const PacketIndexHeader *header = (const PacketIndexHeader *) mapping;
+    bool valid = memcmp(header->magic, PACKET_INDEX_MAGIC, sizeof(PACKET_INDEX_MAGIC)) == 0 &&
+                 header->version == VERSION &&
+                 header->data_offset % SIDECAR_ALIGNMENT == 0 &&
+                 sizeof(PacketIndexHeader) + header->path_length <= header->data_offset &&
+                 header->data_offset <= size &&
+                 header->entry_count <= (size - header->data_offset) / sizeof(PacketIndexRecord);
+    if (valid)
+    {
+        SourceKey stored;
+        stored.path = std::string((const char *) mapping + sizeof(PacketIndexHeader), header->path_length);
+        stored.size = header->source_size;
+        stored.mtime_ns = header->source_mtime_ns;
+        stored.content_hash = header->content_hash;
+        valid = stored == key;
+    }
+    if (!valid)
+    {
+        munmap(mapping, size);
+        return false;
+    }
+
+    const PacketIndexRecord *records =
+        (const PacketIndexRecord *) ((const uint8_t *) mapping + header->data_offset);
+    Rational time_base(header->time_base_num, header->time_base_den);
+    Rational frame_rate(header->frame_rate_num, header->frame_rate_den);
+    index = PacketIndex(std::make_shared<MappedPacketTable>(mapping, size, records, header->entry_count),
+                        time_base, frame_rate);
+    return true;
+}
+
+void PacketIndexFile::write(const std::string &path, const SourceKey &key, const PacketIndex &index)
+{
+    const size_t entry_count = index.get_frame_count();
+
+    PacketIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PACKET_INDEX_MAGIC, sizeof(PACKET_INDEX_MAGIC));
+    header.version = VERSION;
+    header.entry_count = entry_count;
+    header.time_base_num = index.get_time_base().num;
+    header.time_base_den = index.get_time_base().den;
+    header.frame_rate_num = index.get_frame_rate().num;
+    header.frame_rate_den = index.get_frame_rate().den;
+    header.path_length = (uint32_t) key.path.size();
+    header.source_size = key.size;
+    header.source_mtime_ns = key.mtime_ns;
+    header.content_hash = key.content_hash;
+
+    uint64_t prefix = sizeof(header) + key.path.size();
+    header.data_offset = (prefix + SIDECAR_ALIGNMENT - 1) / SIDECAR_ALIGNMENT * SIDECAR_ALIGNMENT;
+
+    std::vector<uint8_t> preamble(header.data_offset, 0);
+    memcpy(preamble.data(), &header, sizeof(header));
+    memcpy(preamble.data() + sizeof(header), key.path.data(), key.path.size());
+
+    std::vector<PacketIndexRecord> records(entry_count);
+    for (size_t position = 0; position < entry_count; position++)
+    {
+        const PacketIndexEntry entry = index.get_entry(position);
+        records[position] = { entry.pts, entry.dts, entry.pos, entry.size, entry.keyframe ? RECORD_KEYFRAME : 0 };
+    }
+
+    write_file_atomically(path, { { preamble.data(), preamble.size() },
+                                  { records.data(), records.size() * sizeof(PacketIndexRecord) } });
+}
+
+std::string PacketIndexFile::get_default_path(const std::string &index_path)
+{
+    return index_path + ".packets";
+}
+
+}
@@ -0,0 +1,264 @@
+#include "lumin/sort.h"
+#include "lumin/exceptions.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <queue>
+
+namespace lumin
+{
+
+void radix_sort(std::vector<uint64_t> &keys, std::vector<uint32_t> &frames)
+{
+    const size_t count = keys.size();
+    if (count < 2)
+    {
+        return;
+    }
+
+    /*------------------------------------------------------------------------
+     * One histogram per byte, gathered in a single pass.
+     *-----------------------------------------------------------------------*/
+    std::vector<size_t> histograms(8 * 256, 0);
+    for (size_t index = 0; index < count; index++)
+    {
+        uint64_t key = keys[index];
+        for (int byte = 0; byte < 8; byte++)
+        {
+            histograms[byte * 256 + ((key >> (byte * 8)) & 0xFF)]++;
+        }
+    }
+
+    std::vector<uint64_t> scratch_keys(count);
+    std::vector<uint32_t> scratch_frames(count);
+    for (int byte = 0; byte < 8; byte++)
+    {
+        size_t *histogram = histograms.data() + byte * 256;
+        const int shift = byte * 8;
+        if (histogram[(keys[0] >> shift) & 0xFF] == count)
+        {
+            continue;
+        }
+
+        size_t offset = 0;
+        for (int digit = 0; digit < 256; digit++)
+        {
+            size_t digit_count = histogram[digit];
+            histogram[digit] = offset;
+            offset += digit_count;
+        }
+        for (size_t index = 0; index < count; index++)
+        {
+            size_t position = histogram[(keys[index] >> shift) & 0xFF]++;
+            scratch_keys[position] = keys[index];
+            scratch_frames[position] = frames[index];
+        }
+        keys.swap(scratch_keys);
+        frames.swap(scratch_frames);
+    }
+}
+
+KeySorter::KeySorter(size_t memory_budget, const std::string &spill_directory)
+    : capacity(memory_budget ? std::max<size_t>(1, memory_budget / RECORD_BYTES) : 0),
+      spill_directory(spill_directory), count(0)
+{
+    if (this->spill_directory.empty())
+    {
+        const char *tmpdir = getenv("TMPDIR");
+        this->spill_directory = tmpdir && *tmpdir ? tmpdir : "/tmp";
+    }
+}
+
+KeySorter::~KeySorter()
+{
+    for (int fd : this->spill_fds)
+    {
+        close(fd);
+    }
+}
+
+void KeySorter::add(uint64_t key, uint32_t frame)
+{
+    if (this->capacity && this->keys.size() >= this->capacity)
+    {
+        this->spill();
+    }
+    this->keys.push_back(key);
+    this->frames.push_back(frame);
+    this->count++;
+}
+
+size_t KeySorter::get_spill_count() const
+{
+    return this->spill_fds.size();
+}
+
+/*------------------------------------------------------------------------
+ * Records are spilled as key/frame pairs, padded to 16 bytes.
+ *-----------------------------------------------------------------------*/
+struct SpilledRecord
+{
+    uint64_t key;
+    uint64_t frame;
+};
+
+void KeySorter::spill()
+{
+    radix_sort(this->keys, this->frames);
+
+    std::string path_template = this->spill_directory + "/lumin-sort-XXXXXX";
+    std::vector<char> path(path_template.begin(), path_template.end());
+    path.push_back('\0');
+    int fd = mkstemp(path.data());
+    if (fd < 0)
+    {
+        throw io_exception("Couldn't create sort spill file in " + this->spill_directory + ": " + strerror(errno));
+    }
+    unlink(path.data());
+    this->spill_fds.push_back(fd);
+    this->spill_sizes.push_back(this->keys.size());
+
+    std::vector<SpilledRecord> block;
+    block.reserve(4096);
+    for (size_t index = 0; index < this->keys.size(); index += block.capacity())
+    {
+        block.clear();
+        for (size_t offset = index; offset < this->keys.size() && block.size() < block.capacity(); offset++)
+        {
+            block.push_back({ this->keys[offset], this->frames[offset] });
+        }
+        size_t bytes = block.size() * sizeof(SpilledRecord);
+        if (write(fd, block.data(), bytes) != (ssize_t) bytes)
+        {
+            throw io_exception(std::string("Couldn't write sort spill file: ") + strerror(errno));
+        }
+    }
+
+    this->keys.clear();
+    this->frames.clear();
+}
+
+/*------------------------------------------------------------------------
+ * Sequential reader over one spilled run.
+ *-----------------------------------------------------------------------*/
+class SpillReader
+{
+public:
+    SpillReader(int fd, size_t size, size_t block_size)
+        : fd(fd), size(size), read_count(0), position(0)
+    {
+        this->block.reserve(block_size);
+    }
+
+    bool next(SpilledRecord &record)
+    {
+        if (this->position == this->block.size())
+        {
+            size_t remaining = this->size - this->read_count;
+            if (remaining == 0)
+            {
+                return false;
+            }
+            this->block.resize(std::min(remaining, this->block.capacity()));
+            size_t bytes = this->block.size() * sizeof(SpilledRecord);
+            off_t offset = (off_t) (this->read_count * sizeof(SpilledRecord));
+            if (pread(this->fd, this->block.data(), bytes, offset) != (ssize_t) bytes)
+            {
+                throw io_exception(std::string("Couldn't read sort spill file: ") + strerror(errno));
+            }
+            this->read_count += this->block.size();
+            this->position = 0;
+        }
+        record = this->block[this->position++];
+        return true;
+    }
+
+private:
+    int fd;
+    size_t size;
+    size_t read_count;
+    size_t position;
+    std::vector<SpilledRecord> block;
+};
+
+std::vector<uint32_t> KeySorter::finish()
+{
+    if (this->spill_fds.empty())
+    {
+        radix_sort(this->keys, this->frames);
+        std::vector<uint32_t> frames;
+        frames.swap(this->frames);
+        this->keys.clear();
+        this->count = 0;
+        return frames;
+    }
+
+    if (!this->keys.empty())
+    {
+        this->spill();
+    }
+    std::vector<uint64_t>().swap(this->keys);
+    std::vector<uint32_t>().swap(this->frames);
+
+    /*------------------------------------------------------------------------
+     * k-way merge, sharing the budget between the runs' read buffers.
+     * Ties are broken by frame, which within a key is source order.
+     *-----------------------------------------------------------------------*/
+    const size_t runs = this->spill_fds.size();
+    size_t block_size = std::max<size_t>(256, this->capacity * RECORD_BYTES / sizeof(SpilledRecord) / runs);
+    std::vector<SpillReader> readers;
+    readers.reserve(runs);
+    for (size_t run = 0; run < runs; run++)
+    {
+        readers.emplace_back(this->spill_fds[run], this->spill_sizes[run], block_size);
+    }
+
+    struct Head
+    {
+        SpilledRecord record;
+        size_t run;
+        bool operator>(const Head &other) const
+        {
+            return record.key != other.record.key ? record.key > other.record.key
+                                                  : record.frame > other.record.frame;
+        }
+    };
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+    for (size_t run = 0; run < runs; run++)
+    {
+        Head head;
+        head.run = run;
+        if (readers[run].next(head.record))
+        {
+            heads.push(head);
+        }
+    }
+
+    std::vector<uint32_t> frames;
+    frames.reserve(this->count);
+    while (!heads.empty())
+    {
+        Head head = heads.top();
+        heads.pop();
+        frames.push_back((uint32_t) head.record.frame);
+        if (readers[head.run].next(head.record))
+        {
+            heads.push(head);
+        }
+    }
+
+    for (int fd : this->spill_fds)
+    {
+        close(fd);
+    }
+    this->spill_fds.clear();
+    this->spill_sizes.clear();
+    this->count = 0;
+    return frames;
+}
+
+}
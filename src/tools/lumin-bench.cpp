@@ -0,0 +1,348 @@
+/*------------------------------------------------------------------------
+ * lumin-bench: throughput benchmark for the native engine.
+ *
+ * Usage:
+ *   lumin-bench [-d clip_directory] [-n frames] [-j threads] [-l] [case...]
+ *
+ *   -d clip_directory      Where reference clips are generated, and reused
+ *                          on later runs (default: $TMPDIR/lumin-bench)
+ *   -n frames              Override the frame count of every case
+ *   -j threads             Analysis threads (default: one per hardware
+ *                          thread)
+ *   -l                     List the cases and exit
+ *
+ * Each case is a synthetic reference clip, generated with the engine's
+ * own encoder, at a given resolution, codec, GOP structure and frame
+ * rate. Its brightness changes smoothly with a few slow oscillations, so
+ * that ordering it gives long runs broken by many cuts, as real footage
+ * does.
+ *
+ * Every phase of each case (analyse, order, render, render-cached and
+ * remux) is timed on its own, and printed to stdout as one JSON object
+ * per line:
+ *
+ *   {"case": "hd-h264-2997", "phase": "analyse", "width": 1920, ...,
+ *    "seconds": 1.92, "fps": 312.4, "peak_rss_kb": 81220, "seeks": 0}
+ *
+ * peak_rss_kb is the peak resident set during that phase alone, where
+ * the kernel allows resetting it (Linux), or otherwise the peak of the
+ * process so far. seeks is the number of seeks the renderer made.
+ *-----------------------------------------------------------------------*/
+
+#include "lumin/lumin.h"
+
+extern "C"
+{
+#include <libavutil/frame.h>
+}
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/*------------------------------------------------------------------------
+ * A reference clip. gop is the keyframe interval, with 1 meaning
+ * intra-only.
+ *-----------------------------------------------------------------------*/
+struct BenchCase
+{
+    const char *name;
+    int width;
+    int height;
+    const char *codec;
+    const char *extension;
+    int gop;
+    int b_frames;
+    lumin::Rational frame_rate;
+    int frames;
+};
+
+static const std::vector<BenchCase> CASES = {
+    { "sd-mpeg2-gop12", 720, 576, "mpeg2video", "mpg", 12, 2, { 25, 1 }, 1500 },
+    { "hd-h264-2997", 1920, 1080, "libx264", "mp4", 250, 3, { 30000, 1001 }, 900 },
+    { "hd-h264-intra", 1920, 1080, "libx264", "mp4", 1, 0, { 24, 1 }, 600 },
+    { "hd-mjpeg", 1280, 720, "mjpeg", "avi", 1, 0, { 50, 1 }, 1000 },
+    { "hd-prores", 1920, 1080, "prores_ks", "mov", 1, 0, { 25, 1 }, 500 },
+    { "uhd-h264-gop60", 3840, 2160, "libx264", "mp4", 60, 3, { 60, 1 }, 300 },
+};
+
+static void usage()
+{
+    fprintf(stderr, "Usage: lumin-bench [-d clip_directory] [-n frames] [-j threads] [-l] [case...]\n");
+    exit(2);
+}
+
+static double now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*------------------------------------------------------------------------
+ * Peak resident set, in kB. reset_peak_rss() restarts the measurement
+ * where the kernel supports it, so that each phase is measured alone.
+ *-----------------------------------------------------------------------*/
+static bool reset_peak_rss()
+{
+    FILE *fd = fopen("/proc/self/clear_refs", "w");
+    if (!fd)
+    {
+        return false;
+    }
+    bool reset = fputs("5", fd) >= 0;
+    return fclose(fd) == 0 && reset;
+}
+
+static long get_peak_rss()
+{
+    FILE *fd = fopen("/proc/self/status", "r");
+    if (fd)
+    {
+        char line[256];
+        long peak = -1;
+        while (fgets(line, sizeof(line), fd))
+        {
+            if (strncmp(line, "VmHWM:", 6) == 0)
+            {
+                peak = atol(line + 6);
+                break;
+            }
+        }
+        fclose(fd);
+        if (peak >= 0)
+        {
+            return peak;
+        }
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+/*------------------------------------------------------------------------
+ * Write the reference clip for `bench` to `path`. Each frame is a
+ * diagonal gradient that drifts over time, so that the encoder has real
+ * motion to code, offset by a brightness that follows the sum of three
+ * slow sines.
+ *-----------------------------------------------------------------------*/
+static void generate_clip(const BenchCase &bench, int frames, const std::string &path)
+{
+    lumin::EncoderOptions options;
+    options.codec = bench.codec;
+    options.codec_options = { { "g", std::to_string(bench.gop) }, { "bf", std::to_string(bench.b_frames) } };
+    if (options.codec == "libx264")
+    {
+        options.codec_options["preset"] = "veryfast";
+        options.codec_options["crf"] = "20";
+    }
+    else
+    {
+        options.bit_rate = (int64_t) bench.width * bench.height * 4;
+    }
+    lumin::VideoEncoder encoder(path, bench.width, bench.height, AV_PIX_FMT_YUV420P, bench.frame_rate, options);
+
+    AVFrame *frame = av_frame_alloc();
+    if (frame)
+    {
+        frame->format = AV_PIX_FMT_YUV420P;
+        frame->width = bench.width;
+        frame->height = bench.height;
+    }
+    if (!frame || av_frame_get_buffer(frame, 0) < 0)
+    {
+        av_frame_free(&frame);
+        throw lumin::decode_exception("Couldn't allocate frame");
+    }
+
+    for (int index = 0; index < frames; index++)
+    {
+        if (av_frame_make_writable(frame) < 0)
+        {
+            av_frame_free(&frame);
+            throw lumin::decode_exception("Couldn't allocate frame");
+        }
+        double phase = (double) index / frames;
+        double level = 0.5 + 0.2 * sin(phase * 2 * M_PI * 3) + 0.15 * sin(phase * 2 * M_PI * 7)
+                     + 0.05 * sin(phase * 2 * M_PI * 23);
+        int offset = (int) (level * 219) - 110;
+        for (int y = 0; y < bench.height; y++)
+        {
+            uint8_t *row = frame->data[0] + (size_t) y * frame->linesize[0];
+            for (int x = 0; x < bench.width; x++)
+            {
+                int value = 16 + ((x + y + index * 4) & 0xff) * 219 / 255 + offset;
+                row[x] = (uint8_t) (value < 16 ? 16 : value > 235 ? 235 : value);
+            }
+        }
+        for (int plane = 1; plane < 3; plane++)
+        {
+            for (int y = 0; y < bench.height / 2; y++)
+            {
+                memset(frame->data[plane] + (size_t) y * frame->linesize[plane], 128, bench.width / 2);
+            }
+        }
+        encoder.write_frame(frame);
+    }
+    av_frame_free(&frame);
+    encoder.finish();
+}
+
+static void print_result(const BenchCase &bench,
+                         int frames,
+                         const char *phase,
+                         double seconds,
+                         long peak_rss,
+                         size_t seeks)
+{
+    printf("{\"case\": \"%s\", \"phase\": \"%s\", \"width\": %d, \"height\": %d, \"codec\": \"%s\", "
+           "\"gop\": %d, \"b_frames\": %d, \"frame_rate\": \"%lld/%lld\", \"frames\": %d, "
+           "\"seconds\": %.4f, \"fps\": %.2f, \"peak_rss_kb\": %ld, \"seeks\": %zu}\n",
+           bench.name, phase, bench.width, bench.height, bench.codec,
+           bench.gop, bench.b_frames, (long long) bench.frame_rate.num, (long long) bench.frame_rate.den, frames,
+           seconds, seconds > 0 ? frames / seconds : 0.0, peak_rss, seeks);
+    fflush(stdout);
+}
+
+/*------------------------------------------------------------------------
+ * Time each phase on `bench`'s clip. The input is analysed without a
+ * luminance index, so that every run decodes.
+ *-----------------------------------------------------------------------*/
+static void run_case(const BenchCase &bench, int frames, int threads, const std::string &directory)
+{
+    std::string input = directory + "/" + bench.name + "-" + std::to_string(frames) + "." + bench.extension;
+    struct stat info;
+    if (stat(input.c_str(), &info) != 0)
+    {
+        fprintf(stderr, "Generating %s (%d frames) ...\n", input.c_str(), frames);
+        generate_clip(bench, frames, input);
+    }
+
+    fprintf(stderr, "Running %s ...\n", bench.name);
+    lumin::AnalysisOptions analysis_options;
+    analysis_options.threads = threads;
+
+    reset_peak_rss();
+    double start = now();
+    lumin::LuminanceSeries series = lumin::analyse(input, analysis_options);
+    print_result(bench, series.size(), "analyse", now() - start, get_peak_rss(), 0);
+
+    reset_peak_rss();
+    start = now();
+    lumin::Permutation permutation = lumin::order(series, lumin::OrderOptions());
+    lumin::EditDecisionList edl = lumin::EditDecisionList::from_permutation(permutation);
+    print_result(bench, permutation.size(), "order", now() - start, get_peak_rss(), 0);
+
+    std::string output = directory + "/" + bench.name + ".out." + bench.extension;
+    struct Render
+    {
+        const char *phase;
+        lumin::RenderMode mode;
+        bool stream_copy;
+    };
+    for (const Render &render : { Render { "render", lumin::RENDER_SCHEDULED, false },
+                                  Render { "render-cached", lumin::RENDER_CACHED, false },
+                                  Render { "remux", lumin::RENDER_SCHEDULED, true } })
+    {
+        lumin::RenderOptions render_options;
+        render_options.mode = render.mode;
+        render_options.stream_copy = render.stream_copy;
+        render_options.encoder.codec = bench.codec;
+        if (render.stream_copy && !lumin::can_remux(lumin::index_packets(input), edl))
+        {
+            continue;
+        }
+
+        reset_peak_rss();
+        start = now();
+        lumin::RenderStats stats = lumin::render(input, output, edl, render_options);
+        print_result(bench, stats.frames_written, render.phase, now() - start, get_peak_rss(), stats.seeks);
+    }
+    remove(output.c_str());
+}
+
+int main(int argc, char **argv)
+{
+    const char *tmp = getenv("TMPDIR");
+    std::string directory = std::string(tmp && *tmp ? tmp : "/tmp") + "/lumin-bench";
+    int frames = 0;
+    int threads = 0;
+    std::vector<std::string> names;
+
+    for (int index = 1; index < argc; index++)
+    {
+        std::string arg = argv[index];
+        if (arg == "-d" && index + 1 < argc)
+        {
+            directory = argv[++index];
+        }
+        else if (arg == "-n" && index + 1 < argc)
+        {
+            frames = atoi(argv[++index]);
+        }
+        else if (arg == "-j" && index + 1 < argc)
+        {
+            threads = atoi(argv[++index]);
+        }
+        else if (arg == "-l")
+        {
+            for (const BenchCase &bench : CASES)
+            {
+                printf("%s\n", bench.name);
+            }
+            return 0;
+        }
+        else if (arg[0] == '-')
+        {
+            usage();
+        }
+        else
+        {
+            names.push_back(arg);
+        }
+    }
+
+    try
+    {
+        if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST)
+        {
+            throw lumin::io_exception("Couldn't create " + directory + ": " + strerror(errno));
+        }
+        for (const std::string &name : names)
+        {
+            bool found = false;
+            for (const BenchCase &bench : CASES)
+            {
+                found |= name == bench.name;
+            }
+            if (!found)
+            {
+                throw lumin::invalid_argument_exception("Unknown case: " + name);
+            }
+        }
+        for (const BenchCase &bench : CASES)
+        {
+            bool selected = names.empty();
+            for (const std::string &name : names)
+            {
+                selected |= name == bench.name;
+            }
+            if (selected)
+            {
+                run_case(bench, frames ? frames : bench.frames, threads, directory);
+            }
+        }
+    }
+    catch (const std::exception &e)
+    {
+        fprintf(stderr, "lumin-bench: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
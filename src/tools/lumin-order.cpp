@@ -0,0 +1,1115 @@
+/*------------------------------------------------------------------------
+ * lumin-order: native engine for reorder.py.
+ *
+ * Usage:
+ *   lumin-order [-p seconds] command ...
+ *
+ *   lumin-order analyse [analysis options] input_file
+ *   lumin-order index [analysis options] input_file
+ *   lumin-order order [analysis options] [order options] input_file
+ *   lumin-order edl [analysis options] [order options] input_file
+ *   lumin-order render [analysis options] [order options]
+ *                      [render options] -o output_file input_file
+ *   lumin-order play [analysis options] [order options]
+ *                    [play options] input_file
+ *   lumin-order batch [-w workers] job_file
+ *
+ * Order options:
+ *   -r decimal_places      Luminosity precision, or 0 to disable rounding
+ *                          (default: 2)
+ *   -R                     Reverse order
+ *   -B sort_mb             Memory for sort records, beyond which sorted
+ *                          runs are spilled to $TMPDIR (default: no limit)
+ *   -L frames              Keep runs of at least this many consecutive
+ *                          source frames together (default: 1)
+ *   -T buckets             Also keep a frame with the run before it if its
+ *                          rounded value is within this many steps of
+ *                          the run's first frame (default: 0)
+ *   -E threshold           Never keep frames together across a shot cut:
+ *                          a change in value between consecutive frames
+ *                          of at least this much (default: no detection)
+ *   -o permutation_file    Write the permutation as raw native uint32s
+ *
+ * Render options:
+ *   -M memory_mb           Memory budget for decoded frames (default: 2048)
+ *   -S spill_directory     Spill decoded frames to a temporary file here
+ *                          rather than making several passes, and keep
+ *                          the decoded soundtrack here (default: $TMPDIR)
+ *   -P                     Copy decoded frames into a preallocated pool,
+ *                          rather than holding the decoder's buffers
+ *   -C cache_mb            Render in destination order through an LRU
+ *                          frame cache of this size, instead of by schedule
+ *   -c codec               Encoder (default: libx264)
+ *   -A                     Don't render the soundtrack
+ *   -x crossfade_ms        Crossfade between audio runs (default: 0)
+ *   -G                     Decode with NVDEC and encode GPU surfaces
+ *                          directly (default codec: h264_nvenc)
+ *   -s                     Copy compressed packets without re-encoding, if
+ *                          every run is made of whole closed GOPs (always
+ *                          true for intra-only codecs such as ProRes).
+ *                          The output has no soundtrack
+ *   -K chunk_frames        Render in chunks of this many frames, encoded
+ *                          in parallel and joined at the end; rerunning
+ *                          an interrupted render resumes it
+ *   -D chunk_directory     Where to keep chunks (default: output.chunks)
+ *   -W workers             Chunks to encode at once (default: a quarter
+ *                          of the hardware threads)
+ *   -N shard/count         Encode only every count-th chunk, starting
+ *                          from chunk `shard`, to split a render between
+ *                          machines sharing the chunk directory. The
+ *                          first shard to find every chunk complete
+ *                          joins them, creating chunk_directory/join
+ *                          while it does; the others exit successfully.
+ *                          Remove a join marker left by a killed join
+ *                          to join on the next run
+ *   -I read_ahead_mb       Read the source in large blocks through a
+ *                          read-ahead cache of this size, fetching the
+ *                          next runs' packets while the current run
+ *                          decodes (for network mounts; default: off)
+ *
+ * Play options:
+ *   -C cache_mb            Frame cache size (default: 512)
+ *   -b frames              Frames to read ahead (default: 32)
+ *   -f                     Fullscreen
+ *   -1                     Play once, rather than looping
+ *   -t seconds             Stop after this long
+ *
+ * Analysis options:
+ *   -l duration_seconds    Duration to crop to
+ *   -m metric              Frame metric to order by: luma, rgb, rec709,
+ *                          contrast, saturation or hue (default: luma)
+ *   -a metric,...          Further metrics to compute in the same decode
+ *                          and keep in the luminance index, so that
+ *                          ordering by them later needs no decode
+ *   -Z left,top,w,h        Only analyse this region of each frame, as
+ *                          fractions of its width and height
+ *   -d step                Only analyse every step-th pixel of every
+ *                          step-th row (1 in step² pixels), and report
+ *                          an estimate of the error this introduces,
+ *                          from 1 frame in 64 measured in full
+ *   -k scalar|avx2|neon    Force a reduction kernel
+ *   -j threads             Segments decoded in parallel (default: one
+ *                          per hardware thread)
+ *   -i index_file          Luminance index path (default: input.lumin).
+ *                          The packet index is cached alongside it, as
+ *                          index_file.packets
+ *   -n                     Don't read or write the luminance or packet
+ *                          index
+ *   -H decoder             Hardware decoder for analysis, render and
+ *                          play: auto, cuda, vaapi, videotoolbox or none
+ *                          (default: auto)
+ *   -g                     Same as -H cuda; luma is reduced on the GPU
+ *                          if built with CUDA
+ *   -q                     Quick proxy analysis at reduced resolution,
+ *                          refining frames near rounding boundaries
+ *   -Q decimal_places      Precision to refine proxy values at (default:
+ *                          the order precision, -r; none for analyse)
+ *   -F                     Keep every decoded frame, uncompressed, in a
+ *                          raw frame store at input.lumraw, which render
+ *                          then reads instead of decoding
+ *
+ * analyse prints one "offset_seconds value" line per frame, with the
+ * metric unrounded in [0..1]. -m rgb takes the mean over RGB24 channels,
+ * matching reorder.py's moviepy analysis bit-for-bit; -m luma reads the
+ * Y plane directly.
+ *
+ * index makes sure the luminance index for the whole of input_file is
+ * up to date and holds the -m and -a metrics, and prints its path.
+ *
+ * order prints the permutation: for each destination frame, one line
+ * giving the source frame index to show there.
+ *
+ * edl prints the permutation collapsed into runs of consecutive source
+ * frames, one "source_start length dest_start" line per run.
+ *
+ * -L, -T and -E trade strict brightness order for fewer, longer runs,
+ * each of which costs a render a seek. The runs they keep together are
+ * ordered by their mean value.
+ *
+ * render writes the reordered video stream of input_file to output_file.
+ *
+ * play shows the reordered video stream in a window, at the source frame
+ * rate, until it is closed or Escape or Q is pressed, then prints a
+ * histogram of frame times. Only available if built with SDL2.
+ *
+ * batch runs every render in job_file, one per line, each given as the
+ * arguments of a render command; blank lines and lines starting with #
+ * are skipped, and arguments may be double-quoted. Each distinct input is
+ * analysed once and shared by every job that orders it, and renders run
+ * on `workers` threads at once (default: a quarter of the hardware
+ * threads). A line is printed to stderr as each job finishes; the exit
+ * status is 1 if any job failed.
+ *
+ * Every command decodes with the first hardware decoder that can decode
+ * the input, and in software otherwise. Analysis then decodes the input
+ * in one piece, rather than in segments on -j threads, unless -j is
+ * given. -G renders with NVDEC whatever -H says.
+ *
+ * With -Z or -d, the luminance index is neither read nor written. With
+ * -d, one frame in 64 is also analysed from every pixel of the region,
+ * and the largest and mean differences are printed to stderr, with how
+ * many of those frames would change bucket at the order precision (-r,
+ * or -Q for analyse). index accepts neither.
+ *
+ * With -p, every command writes a JSON progress line to stderr every
+ * `seconds`: the current phase, items done and expected, rate, ETA,
+ * seconds since the last progress, frames decoded and written, seeks,
+ * cache hits and misses, bytes read and written, and queue depths. A
+ * summary line with the wall time of each phase follows at the end.
+ *-----------------------------------------------------------------------*/
+
+#include "lumin/lumin.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/*------------------------------------------------------------------------
+ * Progress counters for the command, if -p was given.
+ *-----------------------------------------------------------------------*/
+static lumin::Metrics *metrics = nullptr;
+
+/*------------------------------------------------------------------------
+ * Error of a subsampled analysis, if -d was given.
+ *-----------------------------------------------------------------------*/
+static lumin::SamplingError sampling_error;
+
+/*------------------------------------------------------------------------
+ * Where arguments are being parsed from, if not the command line.
+ *-----------------------------------------------------------------------*/
+static std::string parse_context;
+
+static void usage()
+{
+    if (!parse_context.empty())
+    {
+        fprintf(stderr, "%s: invalid job\n", parse_context.c_str());
+        exit(2);
+    }
+    fprintf(stderr,
+            "Usage: lumin-order [-p seconds] command ...\n"
+            "\n"
+            "       lumin-order analyse [analysis options] input_file\n"
+            "       lumin-order index [analysis options] input_file\n"
+            "       lumin-order order [analysis options] [order options] input_file\n"
+            "       lumin-order edl [analysis options] [order options] input_file\n"
+            "       lumin-order render [analysis options] [order options] [render options] -o output_file input_file\n"
+            "       lumin-order play [analysis options] [order options] [play options] input_file\n"
+            "       lumin-order batch [-w workers] job_file\n"
+            "\n"
+            "Order options: [-r decimal_places] [-R] [-B sort_mb] [-L frames] [-T buckets] [-E threshold]\n"
+            "               [-o permutation_file]\n"
+            "Render options: [-M memory_mb] [-S spill_directory] [-P] [-C cache_mb] [-c codec]\n"
+            "                [-A] [-x crossfade_ms] [-G] [-s] [-K chunk_frames] [-D chunk_directory]\n"
+            "                [-W workers] [-N shard/count] [-I read_ahead_mb]\n"
+            "Play options: [-C cache_mb] [-b frames] [-f] [-1] [-t seconds]\n"
+            "Analysis options: [-l duration_seconds] [-m metric] [-a metric,...] [-k scalar|avx2|neon]\n"
+            "                  [-j threads] [-i index_file] [-n] [-H decoder] [-g] [-q] [-Q decimal_places]\n"
+            "                  [-F] [-Z left,top,width,height] [-d step]\n");
+    exit(2);
+}
+
+/*------------------------------------------------------------------------
+ * Split a comma-separated list, skipping empty items.
+ *-----------------------------------------------------------------------*/
+static std::vector<std::string> split_list(const std::string &list)
+{
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (start <= list.size())
+    {
+        size_t end = std::min(list.find(',', start), list.size());
+        if (end > start)
+        {
+            items.push_back(list.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return items;
+}
+
+static lumin::HardwareDecode parse_hardware_decode(const std::string &name)
+{
+    const lumin::HardwareDecode decoders[] = { lumin::HARDWARE_DECODE_NONE, lumin::HARDWARE_DECODE_AUTO,
+                                               lumin::HARDWARE_DECODE_CUDA, lumin::HARDWARE_DECODE_VAAPI,
+                                               lumin::HARDWARE_DECODE_VIDEOTOOLBOX };
+    for (lumin::HardwareDecode decoder : decoders)
+    {
+        if (name == lumin::get_hardware_decode_name(decoder))
+        {
+            return decoder;
+        }
+    }
+    usage();
+    return lumin::HARDWARE_DECODE_NONE;
+}
+
+/*------------------------------------------------------------------------
+ * Parse the options shared by every command that analyses its input.
+ * Returns the input path.
+ *-----------------------------------------------------------------------*/
+static std::string parse_analysis_args(const std::vector<std::string> &args, lumin::AnalysisOptions &options)
+{
+    std::string input;
+    bool use_index = true;
+    bool use_frame_store = false;
+    options.hardware = lumin::HARDWARE_DECODE_AUTO;
+    options.metrics = metrics;
+
+    for (size_t index = 0; index < args.size(); index++)
+    {
+        const std::string &arg = args[index];
+        if (arg == "-l" && index + 1 < args.size())
+        {
+            options.duration = atof(args[++index].c_str());
+        }
+        else if (arg == "-m" && index + 1 < args.size())
+        {
+            options.metric = args[++index];
+            if (!lumin::has_frame_metric(options.metric))
+            {
+                usage();
+            }
+        }
+        else if (arg == "-a" && index + 1 < args.size())
+        {
+            options.extra_metrics = split_list(args[++index]);
+            for (const std::string &name : options.extra_metrics)
+            {
+                if (!lumin::has_frame_metric(name))
+                {
+                    usage();
+                }
+            }
+        }
+        else if (arg == "-Z" && index + 1 < args.size())
+        {
+            lumin::FrameSampling &sampling = options.sampling;
+            if (sscanf(args[++index].c_str(), "%lf,%lf,%lf,%lf", &sampling.left, &sampling.top, &sampling.width,
+                       &sampling.height) != 4)
+            {
+                usage();
+            }
+        }
+        else if (arg == "-d" && index + 1 < args.size())
+        {
+            options.sampling.step = atoi(args[++index].c_str());
+        }
+        else if (arg == "-j" && index + 1 < args.size())
+        {
+            options.threads = atoi(args[++index].c_str());
+        }
+        else if (arg == "-k" && index + 1 < args.size())
+        {
+            const std::string &kernel = args[++index];
+            if (kernel == "scalar")
+            {
+                lumin::set_kernel_type(lumin::KERNEL_SCALAR);
+            }
+            else if (kernel == "avx2")
+            {
+                lumin::set_kernel_type(lumin::KERNEL_AVX2);
+            }
+            else if (kernel == "neon")
+            {
+                lumin::set_kernel_type(lumin::KERNEL_NEON);
+            }
+            else
+            {
+                usage();
+            }
+        }
+        else if (arg == "-i" && index + 1 < args.size())
+        {
+            options.index_path = args[++index];
+        }
+        else if (arg == "-n")
+        {
+            use_index = false;
+        }
+        else if (arg == "-H" && index + 1 < args.size())
+        {
+            options.hardware = parse_hardware_decode(args[++index]);
+        }
+        else if (arg == "-g")
+        {
+            options.hardware = lumin::HARDWARE_DECODE_CUDA;
+        }
+        else if (arg == "-q")
+        {
+            options.proxy = true;
+        }
+        else if (arg == "-Q" && index + 1 < args.size())
+        {
+            options.refine_decimal_places = atoi(args[++index].c_str());
+        }
+        else if (arg == "-F")
+        {
+            use_frame_store = true;
+        }
+        else if (!arg.empty() && arg[0] == '-')
+        {
+            usage();
+        }
+        else if (input.empty())
+        {
+            input = arg;
+        }
+        else
+        {
+            usage();
+        }
+    }
+
+    if (input.empty())
+    {
+        usage();
+    }
+
+    if (use_frame_store)
+    {
+        options.frame_store_path = lumin::FrameStore::get_default_path(input);
+    }
+
+    options.sampling.validate();
+    if (options.sampling.step > 1 && parse_context.empty())
+    {
+        options.sampling_error = &sampling_error;
+    }
+
+    if (!use_index)
+    {
+        options.index_path.clear();
+    }
+    else if (options.index_path.empty())
+    {
+        options.index_path = lumin::LuminanceIndex::get_default_path(input);
+    }
+    if (!options.index_path.empty())
+    {
+        options.packet_index_path = lumin::PacketIndexFile::get_default_path(options.index_path);
+    }
+
+    return input;
+}
+
+/*------------------------------------------------------------------------
+ * Report the estimated error of a subsampled analysis, with how many
+ * checked frames it would move to another bucket at `decimal_places`.
+ *-----------------------------------------------------------------------*/
+static void print_sampling_error(const lumin::AnalysisOptions &options, int decimal_places)
+{
+    if (!options.sampling_error || options.sampling_error->get_frames_checked() == 0)
+    {
+        return;
+    }
+    lumin::OrderOptions order_options;
+    order_options.decimal_places = decimal_places;
+    const lumin::SamplingError &error = *options.sampling_error;
+    fprintf(stderr,
+            "Sampled 1 in %d pixels: estimated from %zu frames checked against every pixel (not a bound), "
+            "error max %.6f, mean %.6f; %zu of them change bucket at %d decimal places\n",
+            options.sampling.step * options.sampling.step, error.get_frames_checked(),
+            error.get_observed_max_error(), error.get_observed_mean_error(), error.get_bucket_changes(order_options),
+            decimal_places);
+}
+
+static int run_analyse(const std::vector<std::string> &args)
+{
+    lumin::AnalysisOptions options;
+    std::string input = parse_analysis_args(args, options);
+
+    lumin::LuminanceSeries series = lumin::analyse(input, options);
+    print_sampling_error(options, options.refine_decimal_places > 0 ? options.refine_decimal_places : 2);
+    for (size_t index = 0; index < series.size(); index++)
+    {
+        printf("%.17g %.17g\n", series.get_offset(index), series.get_value(index));
+    }
+
+    return 0;
+}
+
+static int run_index(const std::vector<std::string> &args)
+{
+    lumin::AnalysisOptions options;
+    std::string input = parse_analysis_args(args, options);
+    if (options.index_path.empty() || options.duration > 0.0 || options.proxy || !options.sampling.is_default())
+    {
+        usage();
+    }
+
+    const lumin::SourceKey key = lumin::SourceKey::from_file(input);
+    options.source_key = &key;
+    lumin::analyse(input, options);
+
+    /*------------------------------------------------------------------------
+     * analyse() does not fail if the index can't be written, so check.
+     *-----------------------------------------------------------------------*/
+    std::unique_ptr<lumin::LuminanceIndex> index = lumin::LuminanceIndex::open(options.index_path);
+    bool written = index && index->matches(key) &&
+                   index->find_column(options.metric) >= 0 &&
+                   std::all_of(options.extra_metrics.begin(), options.extra_metrics.end(),
+                               [&](const std::string &name) { return index->find_column(name) >= 0; });
+    if (!written)
+    {
+        throw lumin::io_exception("Couldn't write luminance index " + options.index_path);
+    }
+
+    printf("%s\n", options.index_path.c_str());
+    return 0;
+}
+
+/*------------------------------------------------------------------------
+ * Parse order options out of `args`, returning the remaining arguments.
+ *-----------------------------------------------------------------------*/
+static std::vector<std::string> parse_order_args(const std::vector<std::string> &args, lumin::OrderOptions &options)
+{
+    std::vector<std::string> remaining;
+    options.metrics = metrics;
+    for (size_t index = 0; index < args.size(); index++)
+    {
+        const std::string &arg = args[index];
+        if (arg == "-r" && index + 1 < args.size())
+        {
+            options.decimal_places = atoi(args[++index].c_str());
+        }
+        else if (arg == "-R")
+        {
+            options.reverse = true;
+        }
+        else if (arg == "-B" && index + 1 < args.size())
+        {
+            options.memory_budget = (size_t) atol(args[++index].c_str()) << 20;
+        }
+        else if (arg == "-L" && index + 1 < args.size())
+        {
+            options.min_run_length = (size_t) std::max(1L, atol(args[++index].c_str()));
+        }
+        else if (arg == "-T" && index + 1 < args.size())
+        {
+            options.run_tolerance = atoi(args[++index].c_str());
+        }
+        else if (arg == "-E" && index + 1 < args.size())
+        {
+            options.shot_threshold = atof(args[++index].c_str());
+        }
+        else
+        {
+            remaining.push_back(arg);
+        }
+    }
+    return remaining;
+}
+
+/*------------------------------------------------------------------------
+ * Analyse and order, refining proxy analysis at the order precision.
+ *-----------------------------------------------------------------------*/
+static void set_refine_precision(lumin::AnalysisOptions &options, const lumin::OrderOptions &order_options)
+{
+    if (options.proxy && options.refine_decimal_places == 0)
+    {
+        options.refine_decimal_places = order_options.decimal_places == 0 ? 12 : order_options.decimal_places;
+    }
+}
+
+static lumin::Permutation analyse_and_order(const std::string &input,
+                                            lumin::AnalysisOptions options,
+                                            const lumin::OrderOptions &order_options,
+                                            std::vector<lumin::StageStats> *stages = nullptr)
+{
+    set_refine_precision(options, order_options);
+    lumin::LuminanceSeries series = lumin::analyse(input, options, stages);
+    print_sampling_error(options, order_options.decimal_places);
+    return lumin::order(series, order_options);
+}
+
+/*------------------------------------------------------------------------
+ * Report how busy each pipeline stage was. The stage closest to 100%
+ * is the bottleneck; the others spent the rest waiting on it.
+ *-----------------------------------------------------------------------*/
+static void print_stages(const std::vector<lumin::StageStats> &stages)
+{
+    for (const lumin::StageStats &stage : stages)
+    {
+        fprintf(stderr, "  %-12s %5.1f%% busy, %8.3fs waiting for input, %8.3fs waiting for output (%llu items)\n",
+                stage.name.c_str(), stage.get_utilisation() * 100.0,
+                stage.input_wait_seconds, stage.output_wait_seconds,
+                (unsigned long long) stage.items);
+    }
+}
+
+/*------------------------------------------------------------------------
+ * Report how often the decoder had to wait for the source's read-ahead.
+ *-----------------------------------------------------------------------*/
+static void print_read_ahead(const lumin::ReadAheadStats &stats)
+{
+    if (!stats.reads)
+    {
+        return;
+    }
+    fprintf(stderr, "Read-ahead: %llu of %llu reads waited (%.3fs), %.1f MiB in %llu blocks, %llu evictions\n",
+            (unsigned long long) stats.waits, (unsigned long long) stats.reads, stats.wait_seconds,
+            stats.bytes_read / 1048576.0, (unsigned long long) stats.blocks_read,
+            (unsigned long long) stats.evictions);
+}
+
+static void write_permutation(const lumin::Permutation &permutation, const std::string &path)
+{
+    const std::vector<uint32_t> &source_frames = permutation.get_source_frames();
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file)
+    {
+        throw lumin::io_exception("Couldn't open " + path + " for writing");
+    }
+    size_t written = fwrite(source_frames.data(), sizeof(uint32_t), source_frames.size(), file);
+    if (fclose(file) != 0 || written != source_frames.size())
+    {
+        throw lumin::io_exception("Couldn't write " + path);
+    }
+}
+
+static int run_order(const std::vector<std::string> &args)
+{
+    lumin::OrderOptions order_options;
+    std::vector<std::string> remaining = parse_order_args(args, order_options);
+
+    std::string output;
+    for (size_t index = 0; index + 1 < remaining.size(); index++)
+    {
+        if (remaining[index] == "-o")
+        {
+            output = remaining[index + 1];
+            remaining.erase(remaining.begin() + index, remaining.begin() + index + 2);
+            break;
+        }
+    }
+
+    lumin::AnalysisOptions options;
+    std::string input = parse_analysis_args(remaining, options);
+
+    lumin::Permutation permutation = analyse_and_order(input, options, order_options);
+    if (!output.empty())
+    {
+        write_permutation(permutation, output);
+    }
+    else
+    {
+        for (uint32_t source_frame : permutation.get_source_frames())
+        {
+            printf("%u\n", source_frame);
+        }
+    }
+
+    return 0;
+}
+
+static int run_edl(const std::vector<std::string> &args)
+{
+    lumin::OrderOptions order_options;
+    lumin::AnalysisOptions options;
+    std::string input = parse_analysis_args(parse_order_args(args, order_options), options);
+
+    lumin::Permutation permutation = analyse_and_order(input, options, order_options);
+    lumin::EditDecisionList edl = lumin::EditDecisionList::from_permutation(permutation);
+    for (const lumin::EditRun &run : edl.get_runs())
+    {
+        printf("%u %u %u\n", run.source_start, run.length, run.dest_start);
+    }
+
+    return 0;
+}
+
+/*------------------------------------------------------------------------
+ * Parse render options out of `args`, returning the remaining arguments.
+ *-----------------------------------------------------------------------*/
+static std::vector<std::string> parse_render_args(const std::vector<std::string> &args,
+                                                  lumin::RenderOptions &options,
+                                                  std::string &output)
+{
+    std::vector<std::string> remaining;
+    bool codec_given = false;
+    options.metrics = metrics;
+    for (size_t index = 0; index < args.size(); index++)
+    {
+        const std::string &arg = args[index];
+        if (arg == "-o" && index + 1 < args.size())
+        {
+            output = args[++index];
+        }
+        else if (arg == "-M" && index + 1 < args.size())
+        {
+            options.memory_budget = (size_t) atol(args[++index].c_str()) << 20;
+        }
+        else if (arg == "-S" && index + 1 < args.size())
+        {
+            options.spill_directory = args[++index];
+        }
+        else if (arg == "-P")
+        {
+            options.zero_copy = false;
+        }
+        else if (arg == "-C" && index + 1 < args.size())
+        {
+            options.mode = lumin::RENDER_CACHED;
+            options.cache_budget = (size_t) atol(args[++index].c_str()) << 20;
+        }
+        else if (arg == "-c" && index + 1 < args.size())
+        {
+            options.encoder.codec = args[++index];
+            codec_given = true;
+        }
+        else if (arg == "-A")
+        {
+            options.audio = false;
+        }
+        else if (arg == "-x" && index + 1 < args.size())
+        {
+            options.crossfade = atof(args[++index].c_str()) / 1000.0;
+        }
+        else if (arg == "-G")
+        {
+            options.cuda = true;
+        }
+        else if (arg == "-s")
+        {
+            options.stream_copy = true;
+        }
+        else if (arg == "-K" && index + 1 < args.size())
+        {
+            options.chunk_frames = (size_t) atol(args[++index].c_str());
+        }
+        else if (arg == "-D" && index + 1 < args.size())
+        {
+            options.chunk_directory = args[++index];
+        }
+        else if (arg == "-W" && index + 1 < args.size())
+        {
+            options.chunk_workers = atoi(args[++index].c_str());
+        }
+        else if (arg == "-I" && index + 1 < args.size())
+        {
+            options.read_ahead = (size_t) atol(args[++index].c_str()) << 20;
+        }
+        else if (arg == "-N" && index + 1 < args.size())
+        {
+            unsigned long shard, count;
+            if (sscanf(args[++index].c_str(), "%lu/%lu", &shard, &count) != 2 || shard >= count)
+            {
+                usage();
+            }
+            options.chunk_shard = shard;
+            options.chunk_shard_count = count;
+        }
+        else
+        {
+            remaining.push_back(arg);
+        }
+    }
+    if (options.cuda && !codec_given)
+    {
+        options.encoder.codec = "h264_nvenc";
+    }
+    return remaining;
+}
+
+static int run_render(const std::vector<std::string> &args)
+{
+    lumin::RenderOptions render_options;
+    lumin::OrderOptions order_options;
+    lumin::AnalysisOptions options;
+    std::string output;
+    std::string input = parse_analysis_args(parse_order_args(parse_render_args(args, render_options, output),
+                                                             order_options),
+                                            options);
+    if (output.empty())
+    {
+        usage();
+    }
+    render_options.frame_store_path = options.frame_store_path;
+    render_options.hardware = options.hardware;
+    render_options.packet_index_path = options.packet_index_path;
+
+    /*------------------------------------------------------------------------
+     * Identify the source once for analysis and render alike.
+     *-----------------------------------------------------------------------*/
+    const lumin::SourceKey key = lumin::SourceKey::from_file(input);
+    options.source_key = &key;
+    render_options.source_key = &key;
+
+    std::vector<lumin::StageStats> analysis_stages;
+    lumin::Permutation permutation = analyse_and_order(input, options, order_options, &analysis_stages);
+    lumin::EditDecisionList edl = lumin::EditDecisionList::from_permutation(permutation);
+    lumin::RenderStats stats = lumin::render(input, output, edl, render_options);
+
+    if (stats.stream_copied)
+    {
+        fprintf(stderr, "Stream copied %zu packets from %zu runs: %zu seeks\n",
+                stats.frames_written, edl.size(), stats.seeks);
+        return 0;
+    }
+    if (stats.chunks)
+    {
+        fprintf(stderr, "Rendered %zu of %zu chunks (%zu frames): %zu passes, %zu seeks, %zu frames decoded\n",
+                stats.chunks_rendered, stats.chunks, stats.frames_written, stats.passes, stats.seeks,
+                stats.frames_decoded);
+        if (stats.chunks_joined)
+        {
+            fprintf(stderr, "Joined %zu chunks into %s\n", stats.chunks, output.c_str());
+        }
+        else if (stats.chunks_joined_elsewhere)
+        {
+            fprintf(stderr, "Another shard is joining the chunks into %s\n", output.c_str());
+        }
+        else
+        {
+            fprintf(stderr, "Other shards' chunks are incomplete, so not joining yet\n");
+        }
+        print_read_ahead(stats.read_ahead);
+        return 0;
+    }
+    if (render_options.stream_copy)
+    {
+        fprintf(stderr, "Runs don't fall on closed GOP boundaries, so re-encoding\n");
+    }
+    if (stats.frame_store_used)
+    {
+        fprintf(stderr, "Rendered %zu frames from %zu runs, read from the raw frame store\n",
+                stats.frames_written, edl.size());
+    }
+    else
+    {
+        fprintf(stderr, "Rendered %zu frames from %zu runs: %zu passes, %zu seeks, %zu frames decoded\n",
+                stats.frames_written, edl.size(), stats.passes, stats.seeks, stats.frames_decoded);
+    }
+    if (render_options.mode == lumin::RENDER_CACHED && !stats.frame_store_used)
+    {
+        fprintf(stderr, "Frame cache: %.1f%% hit rate (%llu hits, %llu misses, %llu evictions)\n",
+                stats.cache.get_hit_rate() * 100.0,
+                (unsigned long long) stats.cache.hits,
+                (unsigned long long) stats.cache.misses,
+                (unsigned long long) stats.cache.evictions);
+    }
+    print_read_ahead(stats.read_ahead);
+    if (!analysis_stages.empty())
+    {
+        fprintf(stderr, "Analysis stages:\n");
+        print_stages(analysis_stages);
+    }
+    fprintf(stderr, "Render stages:\n");
+    print_stages(stats.stages);
+    return 0;
+}
+
+#ifdef LUMIN_HAVE_SDL
+/*------------------------------------------------------------------------
+ * Parse play options out of `args`, returning the remaining arguments.
+ *-----------------------------------------------------------------------*/
+static std::vector<std::string> parse_play_args(const std::vector<std::string> &args,
+                                                lumin::PlaybackOptions &options)
+{
+    std::vector<std::string> remaining;
+    options.metrics = metrics;
+    for (size_t index = 0; index < args.size(); index++)
+    {
+        const std::string &arg = args[index];
+        if (arg == "-C" && index + 1 < args.size())
+        {
+            options.cache_budget = (size_t) atol(args[++index].c_str()) << 20;
+        }
+        else if (arg == "-b" && index + 1 < args.size())
+        {
+            options.prefetch_frames = (size_t) atol(args[++index].c_str());
+        }
+        else if (arg == "-f")
+        {
+            options.fullscreen = true;
+        }
+        else if (arg == "-1")
+        {
+            options.loop = false;
+        }
+        else if (arg == "-t" && index + 1 < args.size())
+        {
+            options.duration = atof(args[++index].c_str());
+        }
+        else
+        {
+            remaining.push_back(arg);
+        }
+    }
+    return remaining;
+}
+
+/*------------------------------------------------------------------------
+ * Print frame times in 1 ms bins, with a bar scaled to the fullest bin.
+ *-----------------------------------------------------------------------*/
+static void print_frame_times(const lumin::FrameTimeHistogram &histogram, double period)
+{
+    fprintf(stderr, "Frame times: mean %.2f ms, p50 %.2f ms, p99 %.2f ms, p99.9 %.2f ms, max %.2f ms\n",
+            histogram.get_mean() * 1e3, histogram.get_percentile(0.5) * 1e3, histogram.get_percentile(0.99) * 1e3,
+            histogram.get_percentile(0.999) * 1e3, histogram.get_max() * 1e3);
+    fprintf(stderr, "  %llu of %llu over 1.5 frame periods (%.2f ms)\n",
+            (unsigned long long) histogram.get_count_over(period * 1.5),
+            (unsigned long long) histogram.get_count(), period * 1.5e3);
+
+    const std::vector<uint64_t> &buckets = histogram.get_buckets();
+    const size_t per_bin = (size_t) (0.001 / lumin::FrameTimeHistogram::BUCKET_SECONDS + 0.5);
+    std::vector<uint64_t> bins((buckets.size() + per_bin - 1) / per_bin, 0);
+    for (size_t bucket = 0; bucket < buckets.size(); bucket++)
+    {
+        bins[bucket / per_bin] += buckets[bucket];
+    }
+    uint64_t fullest = 1;
+    for (uint64_t bin : bins)
+    {
+        fullest = std::max(fullest, bin);
+    }
+    for (size_t bin = 0; bin < bins.size(); bin++)
+    {
+        if (bins[bin])
+        {
+            std::string label = std::to_string(bin) + (bin + 1 == bins.size() ? "+" : "-" + std::to_string(bin + 1));
+            fprintf(stderr, "  %8s ms %8llu %s\n", label.c_str(), (unsigned long long) bins[bin],
+                    std::string((size_t) (bins[bin] * 50 / fullest), '#').c_str());
+        }
+    }
+}
+#endif
+
+static int run_play(const std::vector<std::string> &args)
+{
+#ifdef LUMIN_HAVE_SDL
+    lumin::PlaybackOptions play_options;
+    lumin::OrderOptions order_options;
+    lumin::AnalysisOptions options;
+    std::string input = parse_analysis_args(parse_order_args(parse_play_args(args, play_options), order_options),
+                                            options);
+    play_options.frame_store_path = options.frame_store_path;
+    play_options.hardware = options.hardware;
+    play_options.packet_index_path = options.packet_index_path;
+
+    const lumin::SourceKey key = lumin::SourceKey::from_file(input);
+    options.source_key = &key;
+    play_options.source_key = &key;
+
+    lumin::EditDecisionList edl = lumin::EditDecisionList::from_permutation(
+        analyse_and_order(input, options, order_options));
+    lumin::PlaybackStats stats = lumin::play(input, edl, play_options);
+
+    fprintf(stderr, "Played %zu frames (%zu loops) at %d Hz: %zu late", stats.frames_shown, stats.loops,
+            stats.refresh_rate, stats.frames_late);
+    if (stats.frame_store_used)
+    {
+        fprintf(stderr, ", read from the raw frame store\n");
+    }
+    else
+    {
+        fprintf(stderr, ", %zu seeks, %zu frames decoded\n", stats.seeks, stats.frames_decoded);
+    }
+    print_frame_times(stats.frame_times, 1.0 / edl.get_frame_rate().to_double());
+    fprintf(stderr, "Playback stages:\n");
+    print_stages(stats.stages);
+    return 0;
+#else
+    (void) args;
+    throw lumin::invalid_argument_exception("Built without SDL2, so can't play");
+#endif
+}
+
+/*------------------------------------------------------------------------
+ * Split a job file line into arguments at whitespace, keeping
+ * double-quoted arguments whole.
+ *-----------------------------------------------------------------------*/
+static std::vector<std::string> split_job_line(const std::string &line)
+{
+    std::vector<std::string> args;
+    std::string arg;
+    bool quoted = false;
+    bool pending = false;
+    for (char c : line)
+    {
+        if (c == '"')
+        {
+            quoted = !quoted;
+            pending = true;
+        }
+        else if (!quoted && isspace((unsigned char) c))
+        {
+            if (pending)
+            {
+                args.push_back(arg);
+                arg.clear();
+                pending = false;
+            }
+        }
+        else
+        {
+            arg += c;
+            pending = true;
+        }
+    }
+    if (quoted)
+    {
+        usage();
+    }
+    if (pending)
+    {
+        args.push_back(arg);
+    }
+    return args;
+}
+
+static int run_batch(const std::vector<std::string> &args)
+{
+    lumin::BatchOptions batch_options;
+    std::string job_path;
+    for (size_t index = 0; index < args.size(); index++)
+    {
+        if (args[index] == "-w" && index + 1 < args.size())
+        {
+            batch_options.workers = atoi(args[++index].c_str());
+        }
+        else if (job_path.empty() && !args[index].empty() && args[index][0] != '-')
+        {
+            job_path = args[index];
+        }
+        else
+        {
+            usage();
+        }
+    }
+    if (job_path.empty())
+    {
+        usage();
+    }
+
+    FILE *file = fopen(job_path.c_str(), "r");
+    if (!file)
+    {
+        throw lumin::io_exception("Couldn't open " + job_path);
+    }
+    std::vector<lumin::BatchJob> jobs;
+    char buffer[4096];
+    for (int line_number = 1; fgets(buffer, sizeof(buffer), file); line_number++)
+    {
+        parse_context = job_path + ":" + std::to_string(line_number);
+        std::vector<std::string> job_args = split_job_line(buffer);
+        if (job_args.empty() || job_args[0][0] == '#')
+        {
+            continue;
+        }
+
+        lumin::BatchJob job;
+        job.input = parse_analysis_args(parse_order_args(parse_render_args(job_args, job.render, job.output),
+                                                         job.order),
+                                        job.analysis);
+        if (job.output.empty())
+        {
+            usage();
+        }
+        set_refine_precision(job.analysis, job.order);
+        job.render.frame_store_path = job.analysis.frame_store_path;
+        job.render.hardware = job.analysis.hardware;
+        job.render.packet_index_path = job.analysis.packet_index_path;
+        jobs.push_back(job);
+    }
+    fclose(file);
+    parse_context.clear();
+
+    size_t completed = 0;
+    size_t failed = 0;
+    batch_options.metrics = metrics;
+    batch_options.completed = [&](size_t job, const lumin::BatchResult &result) {
+        completed++;
+        if (result.succeeded)
+        {
+            fprintf(stderr, "[%zu/%zu] %s: %zu frames from %zu runs in %.1fs\n",
+                    completed, jobs.size(), jobs[job].output.c_str(), result.stats.frames_written,
+                    result.runs, result.seconds);
+        }
+        else
+        {
+            failed++;
+            fprintf(stderr, "[%zu/%zu] %s: failed: %s\n",
+                    completed, jobs.size(), jobs[job].output.c_str(), result.error.c_str());
+        }
+    };
+    lumin::render_batch(jobs, batch_options);
+
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        usage();
+    }
+
+    int first = 1;
+    double progress_interval = 0.0;
+    if (strcmp(argv[first], "-p") == 0)
+    {
+        if (argc < 4)
+        {
+            usage();
+        }
+        progress_interval = atof(argv[first + 1]);
+        first += 2;
+    }
+
+    std::string command = argv[first];
+    std::vector<std::string> args(argv + first + 1, argv + argc);
+
+    lumin::Metrics command_metrics;
+    std::unique_ptr<lumin::ProgressReporter> reporter;
+    if (progress_interval > 0.0)
+    {
+        metrics = &command_metrics;
+        reporter = std::make_unique<lumin::ProgressReporter>(command_metrics, stderr, progress_interval);
+    }
+
+    try
+    {
+        if (command == "analyse")
+        {
+            return run_analyse(args);
+        }
+        else if (command == "index")
+        {
+            return run_index(args);
+        }
+        else if (command == "order")
+        {
+            return run_order(args);
+        }
+        else if (command == "edl")
+        {
+            return run_edl(args);
+        }
+        else if (command == "render")
+        {
+            return run_render(args);
+        }
+        else if (command == "play")
+        {
+            return run_play(args);
+        }
+        else if (command == "batch")
+        {
+            return run_batch(args);
+        }
+        usage();
+    }
+    catch (const std::exception &e)
+    {
+        fprintf(stderr, "lumin-order: %s\n", e.what());
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+/**------------------------------------------------------------------------
+ * @file check.h
+ * Minimal assertions for the unit tests, which are plain executables
+ * run by CTest: a failed check reports itself and exits non-zero.
+ *-----------------------------------------------------------------------*/
+
+#include <cstdio>
+#include <cstdlib>
+
+#define CHECK(condition)                                                                   \
+    do                                                                                     \
+    {                                                                                      \
+        if (!(condition))                                                                  \
+        {                                                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            exit(1);                                                                       \
+        }                                                                                  \
+    } while (0)
@@ -0,0 +1,152 @@
+/*------------------------------------------------------------------------
+ * RemappedAudio must produce the same soundtrack, read in blocks of any
+ * size, as copying each run's audio into one buffer, and an AudioFile
+ * must read back exactly what was appended to it.
+ *-----------------------------------------------------------------------*/
+
+#include "check.h"
+
+#include "lumin/audio.h"
+#include "lumin/edl.h"
+#include "lumin/permutation.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace lumin;
+
+/*------------------------------------------------------------------------
+ * The whole-buffer remap, run by run.
+ *-----------------------------------------------------------------------*/
+static std::vector<float> remap_whole(const AudioBuffer &source, const EditDecisionList &edl, double crossfade)
+{
+    const Rational frame_rate = edl.get_frame_rate();
+    const size_t channels = source.get_channels();
+    const size_t source_count = source.get_sample_count();
+    const size_t dest_count = source.get_sample_position(edl.get_frame_count(), frame_rate);
+    const size_t fade_count = (size_t) std::lround(crossfade * source.get_sample_rate());
+    const float *input = source.get_samples().data();
+    std::vector<float> samples(dest_count * channels, 0.0f);
+
+    size_t previous_end = 0;
+    bool first = true;
+    for (const EditRun &run : edl.get_runs())
+    {
+        size_t source_start = source.get_sample_position(run.source_start, frame_rate);
+        size_t dest_start = source.get_sample_position(run.dest_start, frame_rate);
+        size_t dest_end = std::min(source.get_sample_position(run.get_dest_end(), frame_rate), dest_count);
+        size_t length = dest_end - dest_start;
+        size_t available = source_start < source_count ? std::min(length, source_count - source_start) : 0;
+        std::copy(input + source_start * channels, input + (source_start + available) * channels,
+                  samples.begin() + dest_start * channels);
+        if (!first && fade_count > 0 && source_start != previous_end && previous_end < source_count)
+        {
+            size_t fade = std::min({ fade_count, length, source_count - previous_end });
+            for (size_t sample = 0; sample < fade; sample++)
+            {
+                float gain = (float) (sample + 1) / (float) (fade + 1);
+                for (size_t channel = 0; channel < channels; channel++)
+                {
+                    float &head = samples[(dest_start + sample) * channels + channel];
+                    head = head * gain + input[(previous_end + sample) * channels + channel] * (1.0f - gain);
+                }
+            }
+        }
+        previous_end = source_start + length;
+        first = false;
+    }
+    return samples;
+}
+
+/*------------------------------------------------------------------------
+ * Frames shuffled in blocks, so that runs of several lengths appear.
+ *-----------------------------------------------------------------------*/
+static EditDecisionList make_edl(std::mt19937 &random, Rational frame_rate)
+{
+    std::uniform_int_distribution<uint32_t> frame_count(1, 300);
+    std::uniform_int_distribution<uint32_t> block_length(1, 12);
+    std::vector<std::vector<uint32_t>> blocks;
+    const uint32_t count = frame_count(random);
+    for (uint32_t frame = 0; frame < count;)
+    {
+        std::vector<uint32_t> block;
+        for (uint32_t length = block_length(random); length > 0 && frame < count; length--)
+        {
+            block.push_back(frame++);
+        }
+        blocks.push_back(block);
+    }
+    std::shuffle(blocks.begin(), blocks.end(), random);
+    std::vector<uint32_t> frames;
+    for (const std::vector<uint32_t> &block : blocks)
+    {
+        frames.insert(frames.end(), block.begin(), block.end());
+    }
+    return EditDecisionList::from_permutation(Permutation(frame_rate, std::move(frames)));
+}
+
+int main()
+{
+    std::mt19937 random(20171001);
+    std::uniform_real_distribution<float> level(-1.0f, 1.0f);
+    std::uniform_int_distribution<size_t> block(1, 3000);
+    std::uniform_real_distribution<double> coverage(0.5, 1.2);
+    const Rational frame_rate(30000, 1001);
+    size_t cases = 0;
+
+    for (int trial = 0; trial < 40; trial++)
+    {
+        EditDecisionList edl = make_edl(random, frame_rate);
+        const int sample_rate = trial % 2 ? 44100 : 48000;
+        const int channels = 1 + trial % 3;
+
+        /*------------------------------------------------------------------------
+         * Sometimes shorter than the video, as when a soundtrack ends early.
+         *-----------------------------------------------------------------------*/
+        AudioBuffer probe(sample_rate, channels);
+        size_t sample_count = (size_t) (probe.get_sample_position(edl.get_frame_count(), frame_rate) *
+                                        coverage(random));
+        std::vector<float> samples(sample_count * channels);
+        for (float &sample : samples)
+        {
+            sample = level(random);
+        }
+        AudioBuffer buffer(sample_rate, channels, samples);
+
+        AudioFile file(sample_rate, channels);
+        for (size_t position = 0; position < sample_count;)
+        {
+            size_t count = std::min(block(random), sample_count - position);
+            file.append(samples.data() + position * channels, count);
+            position += count;
+        }
+        CHECK(file.get_sample_count() == sample_count);
+        std::vector<float> read_back(samples.size());
+        file.read(0, sample_count, read_back.data());
+        CHECK(read_back == samples);
+
+        for (double crossfade : { 0.0, 0.005, 0.05, 2.0 })
+        {
+            const std::vector<float> expected = remap_whole(buffer, edl, crossfade);
+            CHECK(remap_audio(buffer, edl, crossfade).get_samples() == expected);
+
+            RemappedAudio remapped(file, edl, crossfade);
+            CHECK(remapped.get_sample_count() * channels == expected.size());
+            std::vector<float> output(expected.size());
+            for (size_t position = 0; position < remapped.get_sample_count();)
+            {
+                size_t count = std::min(block(random), remapped.get_sample_count() - position);
+                remapped.read(position, count, output.data() + position * channels);
+                position += count;
+            }
+            CHECK(output == expected);
+            cases++;
+        }
+    }
+
+    printf("%zu remapped soundtracks match\n", cases);
+    return 0;
+}
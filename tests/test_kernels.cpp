@@ -0,0 +1,96 @@
+/*------------------------------------------------------------------------
+ * The vector reduction kernels must sum exactly as the scalar one does,
+ * at every length and alignment, including the tails shorter than a
+ * vector and inputs long enough to overflow narrow accumulators.
+ *-----------------------------------------------------------------------*/
+
+#include "check.h"
+
+#include "lumin/kernels.h"
+
+#include <random>
+#include <vector>
+
+using namespace lumin;
+
+typedef uint64_t (*sum_function)(const uint8_t *, size_t);
+
+static void check_kernel(sum_function sum, const std::vector<uint8_t> &data)
+{
+    for (size_t offset = 0; offset < 64; offset++)
+    {
+        for (size_t count = 0; count <= 300; count++)
+        {
+            CHECK(sum(data.data() + offset, count) == sum_u8_scalar(data.data() + offset, count));
+        }
+        for (size_t count : { 1023, 4097, 65537, 100003 })
+        {
+            CHECK(sum(data.data() + offset, count) == sum_u8_scalar(data.data() + offset, count));
+        }
+    }
+}
+
+/*------------------------------------------------------------------------
+ * Sum of whole rows, as sum_plane_u8() must compute without reading the
+ * padding between them.
+ *-----------------------------------------------------------------------*/
+static uint64_t sum_rows(const uint8_t *data, ptrdiff_t stride, size_t width, size_t height)
+{
+    uint64_t total = 0;
+    for (size_t row = 0; row < height; row++)
+    {
+        total += sum_u8_scalar(data + row * stride, width);
+    }
+    return total;
+}
+
+int main()
+{
+    std::mt19937 random(2);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::vector<uint8_t> noise((2 << 20) + 64);
+    for (uint8_t &value : noise)
+    {
+        value = (uint8_t) byte(random);
+    }
+    std::vector<uint8_t> white(noise.size(), 255);
+
+    CHECK(sum_u8_scalar(white.data(), 2 << 20) == 255ULL * (2 << 20));
+
+    std::vector<KernelType> kernels = { KERNEL_SCALAR };
+#if defined(__x86_64__)
+    if (get_kernel_type() == KERNEL_AVX2)
+    {
+        check_kernel(sum_u8_avx2, noise);
+        check_kernel(sum_u8_avx2, white);
+        CHECK(sum_u8_avx2(white.data() + 1, 2 << 20) == 255ULL * (2 << 20));
+        kernels.push_back(KERNEL_AVX2);
+    }
+#endif
+#if defined(__aarch64__)
+    check_kernel(sum_u8_neon, noise);
+    check_kernel(sum_u8_neon, white);
+    CHECK(sum_u8_neon(white.data() + 1, 2 << 20) == 255ULL * (2 << 20));
+    kernels.push_back(KERNEL_NEON);
+#endif
+
+    const KernelType detected = get_kernel_type();
+    for (KernelType kernel : kernels)
+    {
+        set_kernel_type(kernel);
+        for (size_t width : { 1, 31, 33, 640, 1001 })
+        {
+            for (ptrdiff_t padding : { 0, 1, 17, 64 })
+            {
+                const ptrdiff_t stride = (ptrdiff_t) width + padding;
+                const size_t height = 37;
+                CHECK(sum_plane_u8(noise.data() + 3, stride, width, height) ==
+                      sum_rows(noise.data() + 3, stride, width, height));
+            }
+        }
+    }
+    set_kernel_type(detected);
+
+    printf("%zu kernels match the scalar sum\n", kernels.size());
+    return 0;
+}
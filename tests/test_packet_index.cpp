@@ -0,0 +1,178 @@
+/*------------------------------------------------------------------------
+ * A packet index read from its file must answer every query as the
+ * index it was written from does, with its tables built on first use
+ * from any thread, and must keep working once the file is gone. Repeated
+ * timestamps must still give every packet a frame of its own.
+ *-----------------------------------------------------------------------*/
+
+#include "check.h"
+
+#include "lumin/packet_index.h"
+#include "lumin/sidecar.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace lumin;
+
+/*------------------------------------------------------------------------
+ * GOPs opening on a keyframe, with B-frames decoded after the frame
+ * they precede, as H.264 with reordering has.
+ *-----------------------------------------------------------------------*/
+static std::vector<PacketIndexEntry> make_entries(std::mt19937 &random, size_t frame_count)
+{
+    std::uniform_int_distribution<int32_t> size(100, 50000);
+    std::uniform_int_distribution<size_t> gop(1, 40);
+    std::vector<PacketIndexEntry> entries;
+    int64_t pos = 4096;
+    auto add = [&](size_t frame, bool keyframe) {
+        int32_t bytes = size(random);
+        entries.push_back({ (int64_t) frame * 1001, (int64_t) entries.size() * 1001 - 2002, pos, bytes, keyframe });
+        pos += bytes + 188;
+    };
+
+    for (size_t start = 0; start < frame_count;)
+    {
+        const size_t end = std::min(frame_count, start + gop(random));
+        add(start, true);
+        for (size_t frame = start + 1; frame < end; frame += 3)
+        {
+            const size_t last = std::min(end, frame + 3) - 1;
+            add(last, false);
+            for (size_t b = frame; b < last; b++)
+            {
+                add(b, false);
+            }
+        }
+        start = end;
+    }
+    return entries;
+}
+
+static void check_same(const PacketIndex &index, const PacketIndex &expected, std::mt19937 &random)
+{
+    CHECK(index.get_frame_count() == expected.get_frame_count());
+    CHECK(index.has_timestamps() == expected.has_timestamps());
+    CHECK(index.has_unique_timestamps() == expected.has_unique_timestamps());
+    CHECK(index.get_keyframes() == expected.get_keyframes());
+    CHECK(index.get_time_base() == expected.get_time_base());
+    CHECK(index.get_frame_rate() == expected.get_frame_rate());
+    for (size_t position = 0; position < index.get_frame_count(); position++)
+    {
+        const PacketIndexEntry entry = index.get_entry(position);
+        const PacketIndexEntry other = expected.get_entry(position);
+        CHECK(entry.pts == other.pts && entry.dts == other.dts && entry.pos == other.pos &&
+              entry.size == other.size && entry.keyframe == other.keyframe);
+        CHECK(index.get_frame_pts(position) == expected.get_frame_pts(position));
+        CHECK(index.get_frame_index(index.get_frame_pts(position)) == position);
+    }
+
+    std::uniform_int_distribution<size_t> frame(0, index.get_frame_count());
+    for (int trial = 0; trial < 200; trial++)
+    {
+        size_t start = frame(random);
+        size_t end = frame(random);
+        ByteRange range = index.get_byte_range(start, end);
+        ByteRange other = expected.get_byte_range(start, end);
+        CHECK(range.start == other.start && range.end == other.end);
+    }
+    for (size_t segments : { 1, 2, 7 })
+    {
+        std::vector<FrameRange> split = index.split(segments, index.get_frame_count());
+        std::vector<FrameRange> other = expected.split(segments, index.get_frame_count());
+        CHECK(split.size() == other.size());
+        for (size_t segment = 0; segment < split.size(); segment++)
+        {
+            CHECK(split[segment].start == other[segment].start && split[segment].end == other[segment].end);
+        }
+    }
+}
+
+/*------------------------------------------------------------------------
+ * A broken mux repeating a keyframe's timestamp on the frame after it.
+ *-----------------------------------------------------------------------*/
+static void check_duplicates()
+{
+    std::vector<PacketIndexEntry> entries = {
+        { 0, 0, 0, 10, true }, { 0, 1, 10, 10, false }, { 2, 2, 20, 10, false },
+        { 3, 3, 30, 10, true }, { 3, 4, 40, 10, true }, { 5, 5, 50, 10, false },
+    };
+    PacketIndex index(entries, Rational(1, 30), Rational(30, 1));
+    CHECK(index.has_timestamps() && !index.has_unique_timestamps());
+    CHECK(index.get_keyframes() == std::vector<size_t>({ 0, 3, 4 }));
+    const std::vector<int64_t> pts = { 0, 0, 2, 3, 3, 5 };
+    for (size_t frame = 0; frame < pts.size(); frame++)
+    {
+        CHECK(index.get_frame_pts(frame) == pts[frame]);
+    }
+
+    entries[1].pts = 1;
+    entries[4].pts = 4;
+    CHECK(PacketIndex(entries, Rational(1, 30), Rational(30, 1)).has_unique_timestamps());
+}
+
+int main()
+{
+    check_duplicates();
+
+    char directory_template[] = "/tmp/lumin-test-packets-XXXXXX";
+    CHECK(mkdtemp(directory_template));
+    const std::string directory = directory_template;
+    const std::string source_path = directory + "/source.mp4";
+    const std::string index_path = directory + "/source.mp4.lumidx.packets";
+
+    FILE *source = fopen(source_path.c_str(), "wb");
+    CHECK(source);
+    std::vector<char> bytes(100000, 'x');
+    CHECK(fwrite(bytes.data(), 1, bytes.size(), source) == bytes.size());
+    fclose(source);
+    const SourceKey key = SourceKey::from_file(source_path);
+    SourceKey other_key = key;
+    other_key.content_hash++;
+
+    std::mt19937 random(20171001);
+    for (size_t frame_count : { 0, 1, 2, 5, 100, 5000 })
+    {
+        PacketIndex expected(make_entries(random, frame_count), Rational(1, 30000), Rational(30000, 1001));
+        PacketIndexFile::write(index_path, key, expected);
+
+        PacketIndex index;
+        CHECK(!PacketIndexFile::read(index_path, other_key, index));
+        CHECK(index.get_frame_count() == 0 && !index.has_timestamps());
+        CHECK(PacketIndexFile::read(index_path, key, index));
+
+        /*------------------------------------------------------------------------
+         * The mapping outlives the file, and the first queries race.
+         *-----------------------------------------------------------------------*/
+        CHECK(unlink(index_path.c_str()) == 0);
+        std::vector<std::thread> threads;
+        std::vector<size_t> keyframe_counts(4);
+        for (size_t thread = 0; thread < keyframe_counts.size(); thread++)
+        {
+            threads.emplace_back([&, thread]() { keyframe_counts[thread] = index.get_keyframes().size(); });
+        }
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+        for (size_t count : keyframe_counts)
+        {
+            CHECK(count == expected.get_keyframes().size());
+        }
+
+        PacketIndex copy = index;
+        index = PacketIndex();
+        check_same(copy, expected, random);
+    }
+
+    unlink(source_path.c_str());
+    CHECK(rmdir(directory.c_str()) == 0);
+    printf("packet index files match the index they were written from\n");
+    return 0;
+}
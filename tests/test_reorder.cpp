@@ -0,0 +1,133 @@
+/*------------------------------------------------------------------------
+ * reorder() must give exactly the permutation order() would, from any
+ * previous ordering of the same series, and report as changed every run
+ * that isn't in the previous EDL.
+ *-----------------------------------------------------------------------*/
+
+#include "check.h"
+
+#include "lumin/edl.h"
+#include "lumin/permutation.h"
+#include "lumin/reorder.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace lumin;
+
+/*------------------------------------------------------------------------
+ * A series with long stretches of similar brightness, as real footage
+ * has, so that buckets hold runs of consecutive frames and ties are
+ * common at every precision.
+ *-----------------------------------------------------------------------*/
+static LuminanceSeries make_series(std::mt19937 &random)
+{
+    std::uniform_int_distribution<size_t> length(0, 400);
+    std::uniform_real_distribution<double> level(0.0, 1.0);
+    std::uniform_real_distribution<double> noise(-0.004, 0.004);
+    std::uniform_int_distribution<int> cut(0, 19);
+
+    std::vector<double> values(length(random));
+    double base = level(random);
+    for (double &value : values)
+    {
+        if (cut(random) == 0)
+        {
+            base = level(random);
+        }
+        value = std::min(1.0, std::max(0.0, base + noise(random)));
+    }
+    return LuminanceSeries(Rational(30000, 1001), std::move(values));
+}
+
+/*------------------------------------------------------------------------
+ * Every combination of precision and direction, each unconstrained and
+ * with each kind of run constraint.
+ *-----------------------------------------------------------------------*/
+static std::vector<OrderOptions> make_options()
+{
+    std::vector<OrderOptions> all;
+    for (int decimal_places = 0; decimal_places <= 4; decimal_places++)
+    {
+        for (bool reverse : { false, true })
+        {
+            for (int constraint = 0; constraint < 4; constraint++)
+            {
+                OrderOptions options;
+                options.decimal_places = decimal_places;
+                options.reverse = reverse;
+                if (constraint == 1)
+                {
+                    options.min_run_length = 5;
+                }
+                else if (constraint == 2)
+                {
+                    options.run_tolerance = 2;
+                }
+                else if (constraint == 3)
+                {
+                    options.min_run_length = 3;
+                    options.shot_threshold = 0.1;
+                }
+                all.push_back(options);
+            }
+        }
+    }
+    return all;
+}
+
+static bool same_run(const EditRun &a, const EditRun &b)
+{
+    return a.source_start == b.source_start && a.length == b.length && a.dest_start == b.dest_start;
+}
+
+int main()
+{
+    std::mt19937 random(20171001);
+    const std::vector<OrderOptions> all_options = make_options();
+    size_t cases = 0;
+
+    for (int trial = 0; trial < 20; trial++)
+    {
+        LuminanceSeries series = make_series(random);
+        for (const OrderOptions &previous_options : all_options)
+        {
+            Permutation previous = order(series, previous_options);
+            const std::vector<EditRun> previous_runs = EditDecisionList::from_permutation(previous).get_runs();
+
+            for (const OrderOptions &options : all_options)
+            {
+                ReorderResult result = reorder(series, previous, previous_options, options);
+                Permutation expected = order(series, options);
+                CHECK(result.permutation.get_source_frames() == expected.get_source_frames());
+                CHECK(result.edl.get_frame_count() == series.size());
+
+                /*------------------------------------------------------------------------
+                 * A run left out of changed_runs must be in the previous EDL.
+                 *-----------------------------------------------------------------------*/
+                const std::vector<EditRun> &runs = result.edl.get_runs();
+                size_t changed = 0;
+                for (size_t index = 0; index < runs.size(); index++)
+                {
+                    if (changed < result.changed_runs.size() && result.changed_runs[changed] == index)
+                    {
+                        changed++;
+                        continue;
+                    }
+                    bool found = false;
+                    for (const EditRun &run : previous_runs)
+                    {
+                        found = found || same_run(run, runs[index]);
+                    }
+                    CHECK(found);
+                }
+                CHECK(changed == result.changed_runs.size());
+                cases++;
+            }
+        }
+    }
+
+    printf("%zu reorders match order()\n", cases);
+    return 0;
+}
@@ -0,0 +1,202 @@
+/*------------------------------------------------------------------------
+ * Every render schedule must decode each source frame the EDL shows
+ * exactly once, in the pass that emits it, and only decode forward
+ * without seeking from where the decoder can actually reach. Frames that
+ * fail to decode must still leave an output of the EDL's full length.
+ *-----------------------------------------------------------------------*/
+
+#include "check.h"
+
+#include "lumin/edl.h"
+#include "lumin/permutation.h"
+#include "lumin/scheduler.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace lumin;
+
+static void check_schedule(const EditDecisionList &edl, const std::vector<size_t> &keyframes, size_t frames_per_pass)
+{
+    RenderSchedule schedule = schedule_render(edl, keyframes, frames_per_pass);
+    CHECK(schedule.decode_costs.size() == schedule.passes.size());
+
+    std::vector<uint32_t> source_of_dest(edl.get_frame_count());
+    std::vector<int> shown(edl.get_source_end(), 0);
+    for (const EditRun &run : edl.get_runs())
+    {
+        for (uint32_t offset = 0; offset < run.length; offset++)
+        {
+            source_of_dest[run.dest_start + offset] = run.source_start + offset;
+            shown[run.source_start + offset]++;
+        }
+    }
+
+    std::vector<int> decoded(edl.get_source_end(), 0);
+    size_t dest_start = 0;
+    size_t position = 0;
+    for (size_t pass_index = 0; pass_index < schedule.passes.size(); pass_index++)
+    {
+        const RenderPass &pass = schedule.passes[pass_index];
+        CHECK(pass.dest_range.start == dest_start);
+        CHECK(pass.dest_range.size() > 0 && pass.dest_range.size() <= frames_per_pass);
+        CHECK(schedule.decode_costs[pass_index].size() == pass.spans.size());
+        dest_start = pass.dest_range.end;
+
+        /*------------------------------------------------------------------------
+         * The pass's spans hold exactly the sources of its destinations.
+         *-----------------------------------------------------------------------*/
+        std::vector<uint32_t> needed;
+        for (size_t dest = pass.dest_range.start; dest < pass.dest_range.end; dest++)
+        {
+            needed.push_back(source_of_dest[dest]);
+        }
+        std::sort(needed.begin(), needed.end());
+
+        std::vector<uint32_t> spanned;
+        for (size_t span_index = 0; span_index < pass.spans.size(); span_index++)
+        {
+            const DecodeSpan &span = pass.spans[span_index];
+            CHECK(span.start < span.end);
+            CHECK(span_index == 0 || pass.spans[span_index - 1].end < span.start);
+
+            auto keyframe = std::upper_bound(keyframes.begin(), keyframes.end(), span.start);
+            size_t keyframe_before = keyframe == keyframes.begin() ? 0 : *(keyframe - 1);
+            CHECK(span.seek || (position <= span.start && keyframe_before <= position));
+            position = span.end;
+
+            for (uint32_t frame = span.start; frame < span.end; frame++)
+            {
+                spanned.push_back(frame);
+                decoded[frame]++;
+            }
+        }
+        CHECK(spanned == needed);
+    }
+    CHECK(dest_start == edl.get_frame_count());
+    CHECK(decoded == shown);
+    for (int count : shown)
+    {
+        CHECK(count <= 1);
+    }
+}
+
+/*------------------------------------------------------------------------
+ * Emit the destination frames of passes of `frames_per_pass` as the
+ * renderer does, where `decoded[dest]` says whether that frame decoded,
+ * and return the destination frame written in place of each.
+ *-----------------------------------------------------------------------*/
+static std::vector<size_t> fill_gaps(const std::vector<bool> &decoded, size_t frames_per_pass)
+{
+    GapFiller gaps;
+    std::vector<size_t> written;
+    size_t last = 0;
+    for (size_t pass_start = 0; pass_start < decoded.size(); pass_start += frames_per_pass)
+    {
+        const size_t pass_end = std::min(decoded.size(), pass_start + frames_per_pass);
+        for (size_t dest = pass_start; dest < pass_end; dest++)
+        {
+            const size_t count = gaps.next(decoded[dest]);
+            if (decoded[dest])
+            {
+                last = dest;
+            }
+            written.insert(written.end(), count, last);
+        }
+    }
+    return written;
+}
+
+static void check_gaps()
+{
+    /*------------------------------------------------------------------------
+     * The first frame of the second and third passes is missing, as are
+     * the first two frames of the output.
+     *-----------------------------------------------------------------------*/
+    std::vector<bool> decoded(12, true);
+    decoded[0] = decoded[1] = false;
+    decoded[4] = decoded[8] = decoded[9] = false;
+    const std::vector<size_t> expected = { 2, 2, 2, 3, 3, 5, 6, 7, 7, 7, 10, 11 };
+    CHECK(fill_gaps(decoded, 4) == expected);
+
+    std::mt19937 random(11);
+    for (int trial = 0; trial < 200; trial++)
+    {
+        std::vector<bool> present(1 + random() % 100);
+        for (size_t dest = 0; dest < present.size(); dest++)
+        {
+            present[dest] = random() % 4 != 0;
+        }
+        const bool any = std::find(present.begin(), present.end(), true) != present.end();
+        for (size_t frames_per_pass : { (size_t) 1, (size_t) 3, present.size() })
+        {
+            std::vector<size_t> written = fill_gaps(present, frames_per_pass);
+            CHECK(written.size() == (any ? present.size() : 0));
+            for (size_t dest = 0; dest < written.size(); dest++)
+            {
+                CHECK(present[written[dest]]);
+                CHECK(written[dest] == dest || !present[dest]);
+            }
+        }
+    }
+}
+
+int main()
+{
+    check_gaps();
+
+    std::mt19937 random(7);
+    size_t schedules = 0;
+
+    for (int trial = 0; trial < 40; trial++)
+    {
+        std::uniform_int_distribution<size_t> length(0, 600);
+        const size_t frame_count = length(random);
+
+        /*------------------------------------------------------------------------
+         * Orders with few long runs and with many short ones.
+         *-----------------------------------------------------------------------*/
+        std::uniform_real_distribution<double> level(0.0, 1.0);
+        std::vector<double> values(frame_count);
+        double base = level(random);
+        for (double &value : values)
+        {
+            if (random() % (trial % 2 ? 3 : 40) == 0)
+            {
+                base = level(random);
+            }
+            value = base;
+        }
+        OrderOptions options;
+        options.decimal_places = 1 + trial % 3;
+        options.reverse = trial % 4 == 0;
+        Permutation permutation = order(LuminanceSeries(Rational(24, 1), values), options);
+        EditDecisionList edl = EditDecisionList::from_permutation(permutation);
+
+        std::vector<size_t> keyframes;
+        const size_t gop = 1 + random() % 30;
+        for (size_t frame = 0; frame < frame_count; frame += gop)
+        {
+            keyframes.push_back(frame);
+        }
+
+        std::vector<EditDecisionList> edls = { edl };
+        if (frame_count > 10)
+        {
+            edls.push_back(edl.slice(frame_count / 3, frame_count * 2 / 3));
+        }
+        for (const EditDecisionList &scheduled : edls)
+        {
+            for (size_t frames_per_pass : { (size_t) 1, (size_t) 2, (size_t) 7, (size_t) 64, frame_count + 1 })
+            {
+                check_schedule(scheduled, keyframes, std::max<size_t>(1, frames_per_pass));
+                check_schedule(scheduled, {}, std::max<size_t>(1, frames_per_pass));
+                schedules += 2;
+            }
+        }
+    }
+
+    printf("%zu schedules cover their EDLs\n", schedules);
+    return 0;
+}
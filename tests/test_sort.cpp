@@ -0,0 +1,111 @@
+/*------------------------------------------------------------------------
+ * KeySorter must give the same stable order whether or not it spills
+ * sorted runs to disk: ties keep their source order across runs, which
+ * is what keeps each brightness bucket in source order.
+ *-----------------------------------------------------------------------*/
+
+#include "check.h"
+
+#include "lumin/permutation.h"
+#include "lumin/sort.h"
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace lumin;
+
+static bool is_empty_directory(const std::string &path)
+{
+    DIR *directory = opendir(path.c_str());
+    CHECK(directory);
+    size_t entries = 0;
+    while (struct dirent *entry = readdir(directory))
+    {
+        std::string name = entry->d_name;
+        entries += name != "." && name != "..";
+    }
+    closedir(directory);
+    return entries == 0;
+}
+
+int main()
+{
+    char path_template[] = "/tmp/lumin-test-sort-XXXXXX";
+    CHECK(mkdtemp(path_template));
+    const std::string spill_directory = path_template;
+
+    std::mt19937 random(12);
+    for (size_t count : { 0, 1, 63, 64, 65, 1000, 20000 })
+    {
+        /*------------------------------------------------------------------------
+         * Few distinct keys, so that every spilled run holds many ties.
+         *-----------------------------------------------------------------------*/
+        std::uniform_int_distribution<int64_t> key(-50, 50);
+        std::vector<uint64_t> keys(count);
+        for (uint64_t &value : keys)
+        {
+            value = encode_sort_key(key(random));
+        }
+
+        KeySorter in_memory;
+        KeySorter spilling(1024, spill_directory);
+        for (size_t frame = 0; frame < count; frame++)
+        {
+            in_memory.add(keys[frame], (uint32_t) frame);
+            spilling.add(keys[frame], (uint32_t) frame);
+        }
+        CHECK(in_memory.get_spill_count() == 0);
+        CHECK(count <= 1024 / KeySorter::RECORD_BYTES || spilling.get_spill_count() > 0);
+        std::vector<uint32_t> expected = in_memory.finish();
+        CHECK(spilling.finish() == expected);
+
+        std::vector<uint32_t> reference(count);
+        for (size_t frame = 0; frame < count; frame++)
+        {
+            reference[frame] = (uint32_t) frame;
+        }
+        std::stable_sort(reference.begin(), reference.end(),
+                         [&](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+        CHECK(expected == reference);
+    }
+
+    /*------------------------------------------------------------------------
+     * order() with a memory budget goes through the same spill path.
+     *-----------------------------------------------------------------------*/
+    std::uniform_real_distribution<double> level(0.0, 1.0);
+    std::vector<double> values(5000);
+    for (double &value : values)
+    {
+        value = level(random);
+    }
+    LuminanceSeries series(Rational(25, 1), values);
+    for (int decimal_places = 0; decimal_places <= 3; decimal_places++)
+    {
+        for (bool reverse : { false, true })
+        {
+            OrderOptions options;
+            options.decimal_places = decimal_places;
+            options.reverse = reverse;
+            Permutation expected = order(series, options);
+
+            options.memory_budget = 1024;
+            options.spill_directory = spill_directory;
+            CHECK(order(series, options).get_source_frames() == expected.get_source_frames());
+
+            options.min_run_length = 4;
+            Permutation constrained = order(series, options);
+            options.memory_budget = 0;
+            CHECK(constrained.get_source_frames() == order(series, options).get_source_frames());
+        }
+    }
+
+    CHECK(is_empty_directory(spill_directory));
+    rmdir(spill_directory.c_str());
+    return 0;
+}